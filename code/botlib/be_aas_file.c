@@ -281,6 +281,31 @@ void AAS_FileInfo(void)
 } //end of the function AAS_FileInfo
 #endif //AASFILEDEBUG
 //===========================================================================
+// the AAS file being loaded when it could be mapped, the lumps are
+// copied straight out of it instead of being read through the file
+//===========================================================================
+static const unsigned char *aasfiledata;
+static int aasfilelength;
+//===========================================================================
+// close the AAS file being loaded
+//
+// Parameter:				-
+// Returns:					-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_CloseAASFile(fileHandle_t fp)
+{
+	if (aasfiledata)
+	{
+		botimport.FS_UnmapFile(aasfiledata);
+		aasfiledata = NULL;
+	} //end if
+	else
+	{
+		botimport.FS_FCloseFile(fp);
+	} //end else
+} //end of the function AAS_CloseAASFile
+//===========================================================================
 // allocate memory and read a lump of a AAS file
 //
 // Parameter:				-
@@ -296,6 +321,20 @@ char *AAS_LoadAASLump(fileHandle_t fp, int offset, int length, int *lastoffset,
 		//just alloc a dummy
 		return (char *) GetClearedHunkMemory(size+1);
 	} //end if
+	//copy the data out of the mapped file
+	if (aasfiledata)
+	{
+		if (offset < 0 || length < 0 || offset > aasfilelength - length)
+		{
+			AAS_Error("aas lump out of the file\n");
+			AAS_DumpAASData();
+			AAS_CloseAASFile(fp);
+			return NULL;
+		} //end if
+		buf = (char *) GetClearedHunkMemory(length+1);
+		Com_Memcpy(buf, aasfiledata + offset, length);
+		return buf;
+	} //end if
 	//seek to the data
 	if (offset != *lastoffset)
 	{
@@ -304,7 +343,7 @@ char *AAS_LoadAASLump(fileHandle_t fp, int offset, int length, int *lastoffset,
 		{
 			AAS_Error("can't seek to aas lump\n");
 			AAS_DumpAASData();
-			botimport.FS_FCloseFile(fp);
+			AAS_CloseAASFile(fp);
 			return NULL;
 		} //end if
 	} //end if
@@ -349,22 +388,35 @@ int AAS_LoadAASFile(char *filename)
 	botimport.Print(PRT_MESSAGE, "trying to load %s\n", filename);
 	//dump current loaded aas file
 	AAS_DumpAASData();
-	//open the file
-	botimport.FS_FOpenFile( filename, &fp, FS_READ );
-	if (!fp)
+	//open the file, mapped when possible
+	fp = 0;
+	aasfilelength = botimport.FS_MapFile( filename, (const void **) &aasfiledata );
+	if (!aasfiledata)
+	{
+		botimport.FS_FOpenFile( filename, &fp, FS_READ );
+	} //end if
+	if (!aasfiledata && !fp)
 	{
 		AAS_Error("can't open %s\n", filename);
 		return BLERR_CANNOTOPENAASFILE;
 	} //end if
 	//read the header
-	botimport.FS_Read(&header, sizeof(aas_header_t), fp );
+	if (aasfiledata)
+	{
+		Com_Memset(&header, 0, sizeof(aas_header_t));
+		Com_Memcpy(&header, aasfiledata, aasfilelength < sizeof(aas_header_t) ? aasfilelength : sizeof(aas_header_t));
+	} //end if
+	else
+	{
+		botimport.FS_Read(&header, sizeof(aas_header_t), fp );
+	} //end else
 	lastoffset = sizeof(aas_header_t);
 	//check header identification
 	header.ident = LittleLong(header.ident);
 	if (header.ident != AASID)
 	{
 		AAS_Error("%s is not an AAS file\n", filename);
-		botimport.FS_FCloseFile(fp);
+		AAS_CloseAASFile(fp);
 		return BLERR_WRONGAASFILEID;
 	} //end if
 	//check the version
@@ -373,7 +425,7 @@ int AAS_LoadAASFile(char *filename)
 	if (header.version != AASVERSION_OLD && header.version != AASVERSION)
 	{
 		AAS_Error("aas file %s is version %i, not %i\n", filename, header.version, AASVERSION);
-		botimport.FS_FCloseFile(fp);
+		AAS_CloseAASFile(fp);
 		return BLERR_WRONGAASFILEVERSION;
 	} //end if
 	//
@@ -386,7 +438,7 @@ int AAS_LoadAASFile(char *filename)
 	if (LittleLong(header.bspchecksum) != aasworld.bspchecksum)
 	{
 		AAS_Error("aas file %s is out of date\n", filename);
-		botimport.FS_FCloseFile(fp);
+		AAS_CloseAASFile(fp);
 		return BLERR_WRONGAASFILEVERSION;
 	} //end if
 	//load the lumps:
@@ -479,7 +531,7 @@ int AAS_LoadAASFile(char *filename)
 	//aas file is loaded
 	aasworld.loaded = qtrue;
 	//close the file
-	botimport.FS_FCloseFile(fp);
+	AAS_CloseAASFile(fp);
 	//
 #ifdef AASFILEDEBUG
 	AAS_FileInfo();
@@ -195,6 +195,8 @@ typedef struct botlib_import_s
 	int			(*FS_Write)( const void *buffer, int len, fileHandle_t f );
 	void		(*FS_FCloseFile)( fileHandle_t f );
 	int			(*FS_Seek)( fileHandle_t f, long offset, int origin );
+	int			(*FS_MapFile)( const char *qpath, const void **buffer );
+	void		(*FS_UnmapFile)( const void *buffer );
 	//debug visualisation stuff
 	int			(*DebugLineCreate)(void);
 	void		(*DebugLineDelete)(int line);
@@ -96,6 +96,17 @@ typedef struct {
 	entityShared_t	r;				// shared by both the server system and game
 } sharedEntity_t;
 
+// one trace of a G_TRACEBATCH
+typedef struct {
+	vec3_t		start;
+	vec3_t		mins, maxs;			// can't be left out
+	vec3_t		end;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+	trace_t		results;			// filled in by the server
+} gameTrace_t;
+
 
 
 //===============================================================
@@ -229,6 +240,10 @@ typedef enum {
 	// 1.32
 	G_FS_SEEK,
 
+	G_TRACEBATCH,	// ( gameTrace_t *traces, int count );
+	// the same results as a G_TRACE or G_TRACECAPSULE for each of the traces,
+	// cheaper for a lot of traces in the same place
+
 	BOTLIB_SETUP = 200,				// ( void );
 	BOTLIB_SHUTDOWN,				// ( void );
 	BOTLIB_LIBVAR_SET,
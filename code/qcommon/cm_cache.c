@@ -0,0 +1,486 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cm_cache.c -- the built clip map saved to and loaded from the homepath
+
+#include "cm_local.h"
+#include "cm_patch.h"
+
+/*
+=============================================================================
+
+A cache file is a header and one block holding every array of the clip
+map, patch collision included, exactly as it sits in memory once loaded,
+except that pointers are stored as indexes into the arrays they point at.
+Loading reads the block onto the hunk in one go and turns the indexes back
+into pointers, so none of the lumps are parsed and no patch collision is
+generated.
+
+The files are native byte order and pointer size, and are only used for
+the bsp with the same checksum and length by a build with the same
+structure layout.
+
+=============================================================================
+*/
+
+#define	CMCACHE_IDENT		(('C'<<24)+('M'<<16)+('C'<<8)+'Q')
+#define	CMCACHE_VERSION		2
+
+// these must be the same as in cm_load.c
+#define	BOX_BRUSHES		1
+#define	BOX_SIDES		6
+#define	BOX_LEAFS		2
+#define	BOX_PLANES		12
+
+typedef enum {
+	CMS_SHADERS,
+	CMS_PLANES,
+	CMS_BRUSHSIDES,
+	CMS_BRUSHES,
+	CMS_NODES,
+	CMS_LEAFS,
+	CMS_LEAFBRUSHES,
+	CMS_LEAFSURFACES,
+	CMS_MODELS,
+	CMS_VISIBILITY,
+	CMS_ENTITIES,
+	CMS_AREAS,
+	CMS_AREAPORTALS,
+	CMS_SURFACES,
+	CMS_PATCHES,
+	CMS_PATCHCOLLIDES,
+	CMS_PATCHPLANES,
+	CMS_FACETS,
+
+	CMS_NUM_SECTIONS
+} cmCacheSection_t;
+
+typedef struct {
+	int			ofs;			// from the start of the block
+	int			count;			// elements
+} cmCacheLump_t;
+
+typedef struct {
+	int			ident;
+	int			version;
+	int			layout[5];		// pointer and structure sizes of the writer
+
+	int			bspChecksum;
+	int			bspLength;
+
+	int			blockSize;
+	int			blockChecksum;
+
+	int			numShaders;
+	int			numBrushSides;
+	int			numPlanes;
+	int			numNodes;
+	int			numLeafs;
+	int			numLeafBrushes;
+	int			numLeafSurfaces;
+	int			numSubModels;
+	int			numBrushes;
+	int			numClusters;
+	int			clusterBytes;
+	int			vised;
+	int			numEntityChars;
+	int			numAreas;
+	int			numSurfaces;
+
+	cmCacheLump_t	sections[CMS_NUM_SECTIONS];
+} cmCacheHeader_t;
+
+static const int	cmCacheElementSize[CMS_NUM_SECTIONS] = {
+	sizeof( dshader_t ),
+	sizeof( cplane_t ),
+	sizeof( cbrushside_t ),
+	sizeof( cbrush_t ),
+	sizeof( cNode_t ),
+	sizeof( cLeaf_t ),
+	sizeof( int ),
+	sizeof( int ),
+	sizeof( cmodel_t ),
+	1,
+	1,
+	sizeof( cArea_t ),
+	sizeof( int ),
+	sizeof( cPatch_t * ),
+	sizeof( cPatch_t ),
+	sizeof( patchCollide_t ),
+	sizeof( patchPlane_t ),
+	sizeof( facet_t )
+};
+
+// stored pointers are an index, or index + 1 where they can be NULL
+#define	CM_PTR_TO_INDEX( ptr, base )	( (void *)( (intptr_t)( (ptr) - (base) ) ) )
+#define	CM_INDEX_TO_PTR( ptr, base )	( (base) + (intptr_t)(ptr) )
+
+/*
+=================
+CM_CacheLayout
+=================
+*/
+static void CM_CacheLayout( int *layout ) {
+	layout[0] = sizeof( void * );
+	layout[1] = sizeof( cbrush_t );
+	layout[2] = sizeof( cmodel_t );
+	layout[3] = sizeof( patchCollide_t );
+	layout[4] = sizeof( facet_t );
+}
+
+/*
+=================
+CM_CachePath
+=================
+*/
+static void CM_CachePath( const char *name, char *path, int size ) {
+	char	base[MAX_QPATH];
+
+	// not va, name can be in a va buffer
+	COM_StripExtension( COM_SkipPath( (char *)name ), base, sizeof( base ) );
+	Com_sprintf( path, size, "cmcache/%s.cm", base );
+}
+
+/*
+=================
+CM_CacheLayoutSections
+
+Fills in the section offsets from their counts, returns the block size
+=================
+*/
+static int CM_CacheLayoutSections( cmCacheHeader_t *header ) {
+	int		i, ofs;
+
+	ofs = 0;
+	for ( i = 0 ; i < CMS_NUM_SECTIONS ; i++ ) {
+		header->sections[i].ofs = ofs;
+		ofs += ( header->sections[i].count * cmCacheElementSize[i] + 15 ) & ~15;
+	}
+	return ofs;
+}
+
+/*
+=================
+CM_WriteCache
+
+Saves the clip map that was just built from the bsp
+=================
+*/
+void CM_WriteCache( const char *name, int bspChecksum, int bspLength ) {
+	cmCacheHeader_t	header;
+	byte			*block;
+	cbrushside_t	*side;
+	cbrush_t		*brush;
+	cNode_t			*node;
+	cmodel_t		*model;
+	cPatch_t		**surface, *patch;
+	patchCollide_t	*pc;
+	int				*leafbrushes, *leafsurfaces;
+	int				numPatches, numPatchPlanes, numFacets;
+	int				numLeafBrushes, numLeafSurfaces, visibilityBytes;
+	int				i, patchNum, planeNum, facetNum;
+	fileHandle_t	f;
+	char			path[MAX_QPATH];
+
+	// the submodel leafs index past the end of the leaf lists, they get
+	// their own indexes appended to them
+	numLeafBrushes = cm.numLeafBrushes + BOX_BRUSHES;
+	numLeafSurfaces = cm.numLeafSurfaces;
+	for ( i = 1 ; i < cm.numSubModels ; i++ ) {
+		numLeafBrushes += cm.cmodels[i].leaf.numLeafBrushes;
+		numLeafSurfaces += cm.cmodels[i].leaf.numLeafSurfaces;
+	}
+
+	numPatches = numPatchPlanes = numFacets = 0;
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		if ( cm.surfaces[i] ) {
+			numPatches++;
+			numPatchPlanes += cm.surfaces[i]->pc->numPlanes;
+			numFacets += cm.surfaces[i]->pc->numFacets;
+		}
+	}
+
+	visibilityBytes = cm.vised ? cm.numClusters * cm.clusterBytes : cm.clusterBytes;
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	header.ident = CMCACHE_IDENT;
+	header.version = CMCACHE_VERSION;
+	CM_CacheLayout( header.layout );
+	header.bspChecksum = bspChecksum;
+	header.bspLength = bspLength;
+
+	header.numShaders = cm.numShaders;
+	header.numBrushSides = cm.numBrushSides;
+	header.numPlanes = cm.numPlanes;
+	header.numNodes = cm.numNodes;
+	header.numLeafs = cm.numLeafs;
+	header.numLeafBrushes = cm.numLeafBrushes;
+	header.numLeafSurfaces = cm.numLeafSurfaces;
+	header.numSubModels = cm.numSubModels;
+	header.numBrushes = cm.numBrushes;
+	header.numClusters = cm.numClusters;
+	header.clusterBytes = cm.clusterBytes;
+	header.vised = cm.vised;
+	header.numEntityChars = cm.numEntityChars;
+	header.numAreas = cm.numAreas;
+	header.numSurfaces = cm.numSurfaces;
+
+	header.sections[CMS_SHADERS].count = cm.numShaders;
+	header.sections[CMS_PLANES].count = cm.numPlanes + BOX_PLANES;
+	header.sections[CMS_BRUSHSIDES].count = cm.numBrushSides + BOX_SIDES;
+	header.sections[CMS_BRUSHES].count = cm.numBrushes + BOX_BRUSHES;
+	header.sections[CMS_NODES].count = cm.numNodes;
+	header.sections[CMS_LEAFS].count = cm.numLeafs + BOX_LEAFS;
+	header.sections[CMS_LEAFBRUSHES].count = numLeafBrushes;
+	header.sections[CMS_LEAFSURFACES].count = numLeafSurfaces;
+	header.sections[CMS_MODELS].count = cm.numSubModels;
+	header.sections[CMS_VISIBILITY].count = visibilityBytes;
+	header.sections[CMS_ENTITIES].count = cm.numEntityChars;
+	header.sections[CMS_AREAS].count = cm.numAreas;
+	header.sections[CMS_AREAPORTALS].count = cm.numAreas * cm.numAreas;
+	header.sections[CMS_SURFACES].count = cm.numSurfaces;
+	header.sections[CMS_PATCHES].count = numPatches;
+	header.sections[CMS_PATCHCOLLIDES].count = numPatches;
+	header.sections[CMS_PATCHPLANES].count = numPatchPlanes;
+	header.sections[CMS_FACETS].count = numFacets;
+
+	header.blockSize = CM_CacheLayoutSections( &header );
+	block = Hunk_AllocateTempMemory( header.blockSize );
+	Com_Memset( block, 0, header.blockSize );
+
+#define	CM_SECTION( s )		( (void *)( block + header.sections[s].ofs ) )
+
+	Com_Memcpy( CM_SECTION( CMS_SHADERS ), cm.shaders, cm.numShaders * sizeof( *cm.shaders ) );
+	Com_Memcpy( CM_SECTION( CMS_PLANES ), cm.planes, cm.numPlanes * sizeof( *cm.planes ) );
+
+	side = CM_SECTION( CMS_BRUSHSIDES );
+	for ( i = 0 ; i < cm.numBrushSides ; i++, side++ ) {
+		*side = cm.brushsides[i];
+		side->plane = CM_PTR_TO_INDEX( cm.brushsides[i].plane, cm.planes );
+	}
+
+	brush = CM_SECTION( CMS_BRUSHES );
+	for ( i = 0 ; i < cm.numBrushes ; i++, brush++ ) {
+		*brush = cm.brushes[i];
+		brush->sides = CM_PTR_TO_INDEX( cm.brushes[i].sides, cm.brushsides );
+		brush->checkcount = 0;
+	}
+
+	node = CM_SECTION( CMS_NODES );
+	for ( i = 0 ; i < cm.numNodes ; i++, node++ ) {
+		*node = cm.nodes[i];
+		node->plane = CM_PTR_TO_INDEX( cm.nodes[i].plane, cm.planes );
+	}
+
+	Com_Memcpy( CM_SECTION( CMS_LEAFS ), cm.leafs, cm.numLeafs * sizeof( *cm.leafs ) );
+
+	leafbrushes = CM_SECTION( CMS_LEAFBRUSHES );
+	leafsurfaces = CM_SECTION( CMS_LEAFSURFACES );
+	Com_Memcpy( leafbrushes, cm.leafbrushes, cm.numLeafBrushes * sizeof( int ) );
+	Com_Memcpy( leafsurfaces, cm.leafsurfaces, cm.numLeafSurfaces * sizeof( int ) );
+	numLeafBrushes = cm.numLeafBrushes + BOX_BRUSHES;
+	numLeafSurfaces = cm.numLeafSurfaces;
+
+	model = CM_SECTION( CMS_MODELS );
+	for ( i = 0 ; i < cm.numSubModels ; i++, model++ ) {
+		*model = cm.cmodels[i];
+		if ( i == 0 ) {
+			continue;
+		}
+		Com_Memcpy( leafbrushes + numLeafBrushes, cm.leafbrushes + model->leaf.firstLeafBrush,
+			model->leaf.numLeafBrushes * sizeof( int ) );
+		model->leaf.firstLeafBrush = numLeafBrushes;
+		numLeafBrushes += model->leaf.numLeafBrushes;
+
+		Com_Memcpy( leafsurfaces + numLeafSurfaces, cm.leafsurfaces + model->leaf.firstLeafSurface,
+			model->leaf.numLeafSurfaces * sizeof( int ) );
+		model->leaf.firstLeafSurface = numLeafSurfaces;
+		numLeafSurfaces += model->leaf.numLeafSurfaces;
+	}
+
+	Com_Memcpy( CM_SECTION( CMS_VISIBILITY ), cm.visibility, visibilityBytes );
+	Com_Memcpy( CM_SECTION( CMS_ENTITIES ), cm.entityString, cm.numEntityChars );
+
+	// areas and portals are zero until CM_FloodAreaConnections
+
+	surface = CM_SECTION( CMS_SURFACES );
+	patch = CM_SECTION( CMS_PATCHES );
+	pc = CM_SECTION( CMS_PATCHCOLLIDES );
+	patchNum = planeNum = facetNum = 0;
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		if ( !cm.surfaces[i] ) {
+			continue;
+		}
+		surface[i] = CM_PTR_TO_INDEX( patch + patchNum + 1, patch );
+
+		patch[patchNum] = *cm.surfaces[i];
+		patch[patchNum].checkcount = 0;
+		patch[patchNum].pc = CM_PTR_TO_INDEX( pc + patchNum, pc );
+
+		pc[patchNum] = *cm.surfaces[i]->pc;
+		pc[patchNum].planes = CM_PTR_TO_INDEX( (patchPlane_t *)CM_SECTION( CMS_PATCHPLANES ) + planeNum,
+			(patchPlane_t *)CM_SECTION( CMS_PATCHPLANES ) );
+		pc[patchNum].facets = CM_PTR_TO_INDEX( (facet_t *)CM_SECTION( CMS_FACETS ) + facetNum,
+			(facet_t *)CM_SECTION( CMS_FACETS ) );
+		Com_Memcpy( (patchPlane_t *)CM_SECTION( CMS_PATCHPLANES ) + planeNum, cm.surfaces[i]->pc->planes,
+			pc[patchNum].numPlanes * sizeof( patchPlane_t ) );
+		Com_Memcpy( (facet_t *)CM_SECTION( CMS_FACETS ) + facetNum, cm.surfaces[i]->pc->facets,
+			pc[patchNum].numFacets * sizeof( facet_t ) );
+
+		planeNum += pc[patchNum].numPlanes;
+		facetNum += pc[patchNum].numFacets;
+		patchNum++;
+	}
+
+#undef CM_SECTION
+
+	header.blockChecksum = Com_BlockChecksum( block, header.blockSize );
+
+	CM_CachePath( name, path, sizeof( path ) );
+	f = FS_SV_FOpenFileWrite( path );
+	if ( !f ) {
+		Com_Printf( "CM_WriteCache: couldn't write %s\n", path );
+		Hunk_FreeTempMemory( block );
+		return;
+	}
+	FS_Write( &header, sizeof( header ), f );
+	FS_Write( block, header.blockSize, f );
+	FS_FCloseFile( f );
+
+	Hunk_FreeTempMemory( block );
+}
+
+/*
+=================
+CM_LoadCache
+
+Builds cm from the cache file of the bsp, qfalse if there isn't a good one
+=================
+*/
+qboolean CM_LoadCache( const char *name, int bspChecksum, int bspLength ) {
+	cmCacheHeader_t	header;
+	cmCacheHeader_t	check;
+	fileHandle_t	f;
+	int				len, i, layout[5];
+	byte			*block;
+	patchCollide_t	*pc;
+	patchPlane_t	*patchPlanes;
+	facet_t			*facets;
+	cPatch_t		*patches;
+	char			path[MAX_QPATH];
+
+	CM_CachePath( name, path, sizeof( path ) );
+	len = FS_SV_FOpenFileRead( path, &f );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	CM_CacheLayout( layout );
+	if ( len < sizeof( header ) || FS_Read( &header, sizeof( header ), f ) != sizeof( header )
+		|| header.ident != CMCACHE_IDENT || header.version != CMCACHE_VERSION
+		|| memcmp( header.layout, layout, sizeof( layout ) )
+		|| header.bspChecksum != bspChecksum || header.bspLength != bspLength
+		|| header.blockSize != len - sizeof( header ) ) {
+		FS_FCloseFile( f );
+		return qfalse;
+	}
+
+	// the sections have to be where this build would put them
+	check = header;
+	if ( CM_CacheLayoutSections( &check ) != header.blockSize
+		|| memcmp( check.sections, header.sections, sizeof( header.sections ) ) ) {
+		FS_FCloseFile( f );
+		return qfalse;
+	}
+
+	// a bad block still costs the hunk memory until the next map
+	block = Hunk_Alloc( header.blockSize, h_high );
+	if ( FS_Read( block, header.blockSize, f ) != header.blockSize
+		|| Com_BlockChecksum( block, header.blockSize ) != header.blockChecksum ) {
+		Com_Printf( "CM_LoadCache: %s is damaged\n", path );
+		FS_FCloseFile( f );
+		return qfalse;
+	}
+	FS_FCloseFile( f );
+
+#define	CM_SECTION( s )		( (void *)( block + header.sections[s].ofs ) )
+
+	cm.numShaders = header.numShaders;
+	cm.numBrushSides = header.numBrushSides;
+	cm.numPlanes = header.numPlanes;
+	cm.numNodes = header.numNodes;
+	cm.numLeafs = header.numLeafs;
+	cm.numLeafBrushes = header.numLeafBrushes;
+	cm.numLeafSurfaces = header.numLeafSurfaces;
+	cm.numSubModels = header.numSubModels;
+	cm.numBrushes = header.numBrushes;
+	cm.numClusters = header.numClusters;
+	cm.clusterBytes = header.clusterBytes;
+	cm.vised = header.vised;
+	cm.numEntityChars = header.numEntityChars;
+	cm.numAreas = header.numAreas;
+	cm.numSurfaces = header.numSurfaces;
+
+	cm.shaders = CM_SECTION( CMS_SHADERS );
+	cm.planes = CM_SECTION( CMS_PLANES );
+	cm.brushsides = CM_SECTION( CMS_BRUSHSIDES );
+	cm.brushes = CM_SECTION( CMS_BRUSHES );
+	cm.nodes = CM_SECTION( CMS_NODES );
+	cm.leafs = CM_SECTION( CMS_LEAFS );
+	cm.leafbrushes = CM_SECTION( CMS_LEAFBRUSHES );
+	cm.leafsurfaces = CM_SECTION( CMS_LEAFSURFACES );
+	cm.cmodels = CM_SECTION( CMS_MODELS );
+	cm.visibility = CM_SECTION( CMS_VISIBILITY );
+	cm.entityString = CM_SECTION( CMS_ENTITIES );
+	cm.areas = CM_SECTION( CMS_AREAS );
+	cm.areaPortals = CM_SECTION( CMS_AREAPORTALS );
+	cm.surfaces = CM_SECTION( CMS_SURFACES );
+
+	patches = CM_SECTION( CMS_PATCHES );
+	pc = CM_SECTION( CMS_PATCHCOLLIDES );
+	patchPlanes = CM_SECTION( CMS_PATCHPLANES );
+	facets = CM_SECTION( CMS_FACETS );
+
+#undef CM_SECTION
+
+	// pointer fixups
+	for ( i = 0 ; i < cm.numBrushSides ; i++ ) {
+		cm.brushsides[i].plane = CM_INDEX_TO_PTR( cm.brushsides[i].plane, cm.planes );
+	}
+	for ( i = 0 ; i < cm.numBrushes ; i++ ) {
+		cm.brushes[i].sides = CM_INDEX_TO_PTR( cm.brushes[i].sides, cm.brushsides );
+	}
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		cm.nodes[i].plane = CM_INDEX_TO_PTR( cm.nodes[i].plane, cm.planes );
+	}
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		if ( cm.surfaces[i] ) {
+			cm.surfaces[i] = patches + (intptr_t)cm.surfaces[i] - 1;
+		}
+	}
+	for ( i = 0 ; i < header.sections[CMS_PATCHES].count ; i++ ) {
+		patches[i].pc = CM_INDEX_TO_PTR( patches[i].pc, pc );
+		pc[i].planes = CM_INDEX_TO_PTR( pc[i].planes, patchPlanes );
+		pc[i].facets = CM_INDEX_TO_PTR( pc[i].facets, facets );
+	}
+
+	return qtrue;
+}
@@ -62,6 +62,7 @@ byte		*cmod_base;
 cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
+cvar_t		*cm_cache;
 #endif
 
 cmodel_t	box_model;
@@ -572,6 +573,10 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	dheader_t		header;
 	int				length;
 	static unsigned	last_checksum;
+#ifndef BSPC
+	int				start;
+	qboolean		cached;
+#endif
 
 	if ( !name || !name[0] ) {
 		Com_Error( ERR_DROP, "CM_LoadMap: NULL name" );
@@ -581,6 +586,7 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	cm_noAreas = Cvar_Get ("cm_noAreas", "0", CVAR_CHEAT);
 	cm_noCurves = Cvar_Get ("cm_noCurves", "0", CVAR_CHEAT);
 	cm_playerCurveClip = Cvar_Get ("cm_playerCurveClip", "1", CVAR_ARCHIVE|CVAR_CHEAT );
+	cm_cache = Cvar_Get ("cm_cache", "1", CVAR_ARCHIVE );
 #endif
 	Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
 
@@ -606,7 +612,8 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	// load the file
 	//
 #ifndef BSPC
-	length = FS_ReadFile( name, (void **)&buf );
+	start = Sys_Milliseconds();
+	length = FS_MapFile( name, (const void **)&buf );
 #else
 	length = LoadQuakeFile((quakefile_t *) name, (void **)&buf);
 #endif
@@ -630,22 +637,40 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 
 	cmod_base = (byte *)buf;
 
-	// load into heap
-	CMod_LoadShaders( &header.lumps[LUMP_SHADERS] );
-	CMod_LoadLeafs (&header.lumps[LUMP_LEAFS]);
-	CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES]);
-	CMod_LoadLeafSurfaces (&header.lumps[LUMP_LEAFSURFACES]);
-	CMod_LoadPlanes (&header.lumps[LUMP_PLANES]);
-	CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES]);
-	CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES]);
-	CMod_LoadSubmodels (&header.lumps[LUMP_MODELS]);
-	CMod_LoadNodes (&header.lumps[LUMP_NODES]);
-	CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
-	CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY] );
-	CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS] );
+#ifndef BSPC
+	cached = cm_cache->integer && CM_LoadCache( name, last_checksum, length );
+	if ( !cached )
+#endif
+	{
+		// load into heap
+		CMod_LoadShaders( &header.lumps[LUMP_SHADERS] );
+		CMod_LoadLeafs (&header.lumps[LUMP_LEAFS]);
+		CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES]);
+		CMod_LoadLeafSurfaces (&header.lumps[LUMP_LEAFSURFACES]);
+		CMod_LoadPlanes (&header.lumps[LUMP_PLANES]);
+		CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES]);
+		CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES]);
+		CMod_LoadSubmodels (&header.lumps[LUMP_MODELS]);
+		CMod_LoadNodes (&header.lumps[LUMP_NODES]);
+		CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
+		CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY] );
+		CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS] );
+	}
 
 	// we are NOT freeing the file, because it is cached for the ref
+#ifndef BSPC
+	FS_UnmapFile (buf);
+#else
 	FS_FreeFile (buf);
+#endif
+
+#ifndef BSPC
+	if ( cm_cache->integer && !cached ) {
+		CM_WriteCache( name, last_checksum, length );
+	}
+	Com_Printf( "CM_LoadMap: %s in %i msec%s\n", name, Sys_Milliseconds() - start,
+		cached ? " from the cache" : "" );
+#endif
 
 	CM_InitBoxHull ();
 
@@ -1155,8 +1155,10 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mi
 
 	c_traces++;				// for statistics, may be zeroed
 
-	// fill in a default trace
-	Com_Memset( &tw, 0, sizeof(tw) );
+	// fill in a default trace, everything else in tw is set below
+	Com_Memset( &tw.trace, 0, sizeof(tw.trace) );
+	tw.isPoint = qfalse;
+	VectorClear( tw.extents );
 	tw.trace.fraction = 1;	// assume it goes the entire distance until shown otherwise
 	VectorCopy(origin, tw.modelOrigin);
 
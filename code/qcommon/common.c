@@ -40,10 +40,12 @@ int demo_protocols[] =
 #define MIN_COMHUNKMEGS		256
 #define DEF_COMHUNKMEGS		256
 #define DEF_COMZONEMEGS		24
+#define DEF_COMSLABMEGS		8
 #define XSTRING(x)				STRING(x)
 #define STRING(x)					#x
 #define DEF_COMHUNKMEGS_S	XSTRING(DEF_COMHUNKMEGS)
 #define DEF_COMZONEMEGS_S	XSTRING(DEF_COMZONEMEGS)
+#define DEF_COMSLABMEGS_S	XSTRING(DEF_COMSLABMEGS)
 
 int		com_argc;
 char	*com_argv[MAX_NUM_ARGVS+1];
@@ -82,6 +84,7 @@ cvar_t	*com_cameraMode;
 cvar_t	*com_ansiColor;
 cvar_t	*com_unfocused;
 cvar_t	*com_minimized;
+cvar_t	*net_recvBatch;		// 0 = one packet per event, else max datagrams per receive call
 
 // com_speeds times
 int		time_game;
@@ -755,6 +758,306 @@ memzone_t	*smallzone;
 
 void Z_CheckHeap( void );
 
+/*
+==============================================================================
+
+						SLAB ALLOCATION
+
+Allocations of up to SLAB_MAX_SIZE bytes are taken from size classes before
+the zones are tried.  The slab arena is cut into SLAB_PAGE_SIZE pages, and a
+class takes a new page when its free list runs dry and keeps it, so freed
+slots only ever go back to allocations of the same size and nothing can
+fragment.  When the arena is used up the allocations fall back to the zones.
+
+Each class keeps its free slots in a lock free stack.  The head holds the
+arena offset of the first free slot, plus one, in the low 32 bits and a pop
+count in the high 32, so a slot that is popped and pushed again between a
+read and the compare and swap can't corrupt the list.  Any thread can
+allocate: the zones behind the slabs, for bigger allocations and a full
+arena, are guarded by a spin lock.
+
+ZONE_DEBUG builds keep everything in the zones for their labels.
+==============================================================================
+*/
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define	Z_AtomicAdd( p, v )			_InterlockedExchangeAdd( (volatile long *)(p), (v) )
+#define	Z_AtomicCAS( p, o, n )		( _InterlockedCompareExchange( (volatile long *)(p), (n), (o) ) == (long)(o) )
+#define	Z_AtomicCAS64( p, o, n )	( _InterlockedCompareExchange64( (volatile __int64 *)(p), (n), (o) ) == (__int64)(o) )
+#define	Z_AtomicRelease( p )		_InterlockedExchange( (volatile long *)(p), 0 )
+#else
+#define	Z_AtomicAdd( p, v )			__sync_fetch_and_add( (p), (v) )
+#define	Z_AtomicCAS( p, o, n )		__sync_bool_compare_and_swap( (p), (o), (n) )
+#define	Z_AtomicCAS64( p, o, n )	__sync_bool_compare_and_swap( (p), (o), (n) )
+#define	Z_AtomicRelease( p )		__sync_lock_release( p )
+#endif
+
+#define	SLABID			0x5ab1d
+#define	SLAB_PAGE_SIZE	0x10000
+#define	SLAB_MAX_SIZE	512
+
+typedef struct {
+	unsigned short	size;			// as asked for
+	byte			tag;
+	byte			sizeClass;
+	int				id;				// SLABID while allocated, 0 when free
+} slabslot_t;
+
+typedef struct {
+	int				size;			// of a slot, including the slabslot_t
+	volatile unsigned long long	freeList;
+
+	volatile int	pages;
+	volatile int	used;
+	volatile int	peak;
+	volatile int	bytes;			// asked for by the used slots
+	volatile unsigned int	allocs;
+	volatile unsigned int	fallbacks;	// went to a zone because the arena was full
+} slabclass_t;
+
+static const int	slabSizes[] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+
+#define	NUM_SLAB_CLASSES	( sizeof( slabSizes ) / sizeof( slabSizes[0] ) )
+
+static slabclass_t	slabClasses[NUM_SLAB_CLASSES];
+static byte			slabClassForSize[SLAB_MAX_SIZE / 16 + 1];	// by ( size + 15 ) / 16
+
+static byte			*slabArena;
+static int			slabArenaSize;
+static int			slabArenaPages;
+static volatile int	slabPagesUsed;		// can run past slabArenaPages by a thread or two
+static byte			*slabPageClasses;	// sizeClass + 1 for every page handed out
+
+/*
+========================
+Z_InitSlabs
+========================
+*/
+static void Z_InitSlabs( int megs ) {
+	int		i, sizeClass;
+
+	sizeClass = 0;
+	for ( i = 0 ; i <= SLAB_MAX_SIZE / 16 ; i++ ) {
+		while ( slabSizes[sizeClass] < i * 16 ) {
+			sizeClass++;
+		}
+		slabClassForSize[i] = sizeClass;
+	}
+	for ( i = 0 ; i < NUM_SLAB_CLASSES ; i++ ) {
+		slabClasses[i].size = slabSizes[i] + sizeof( slabslot_t );
+	}
+
+	if ( megs <= 0 ) {
+		return;
+	}
+
+	slabArenaSize = megs * 1024 * 1024;
+	slabArenaPages = slabArenaSize / SLAB_PAGE_SIZE;
+	slabArena = calloc( slabArenaSize, 1 );
+	slabPageClasses = calloc( slabArenaPages, 1 );
+	if ( !slabArena || !slabPageClasses ) {
+		Com_Error( ERR_FATAL, "Slab data failed to allocate %i megs", megs );
+	}
+}
+
+/*
+========================
+Z_SlabPop
+========================
+*/
+static slabslot_t *Z_SlabPop( slabclass_t *sc ) {
+	unsigned long long	head, next;
+	unsigned int		ref;
+
+	while ( 1 ) {
+		head = sc->freeList;
+		ref = (unsigned int)head;
+		if ( !ref ) {
+			return NULL;
+		}
+		if ( ref > (unsigned int)slabArenaSize ) {
+			continue;		// torn read on a 32 bit cpu, read it again
+		}
+		next = *(unsigned int *)( slabArena + ref - 1 + sizeof( slabslot_t ) );
+		next |= ( ( head >> 32 ) + 1 ) << 32;
+		if ( Z_AtomicCAS64( &sc->freeList, head, next ) ) {
+			return (slabslot_t *)( slabArena + ref - 1 );
+		}
+	}
+}
+
+/*
+========================
+Z_SlabPush
+
+Pushes the slots from first to last, already linked to each other
+========================
+*/
+static void Z_SlabPush( slabclass_t *sc, slabslot_t *first, slabslot_t *last ) {
+	unsigned long long	head, next;
+
+	do {
+		head = sc->freeList;
+		*(unsigned int *)( last + 1 ) = (unsigned int)head;
+		next = ( head & 0xffffffff00000000ULL ) | (unsigned int)( (byte *)first - slabArena + 1 );
+	} while ( !Z_AtomicCAS64( &sc->freeList, head, next ) );
+}
+
+/*
+========================
+Z_SlabGrow
+
+Gives the class another page, qfalse if the arena is used up
+========================
+*/
+static qboolean Z_SlabGrow( int sizeClass ) {
+	slabclass_t	*sc;
+	slabslot_t	*slot;
+	byte		*page;
+	int			i, count, pageNum;
+
+	// checked first so a full arena doesn't count up forever
+	if ( slabPagesUsed >= slabArenaPages ) {
+		return qfalse;
+	}
+	pageNum = Z_AtomicAdd( &slabPagesUsed, 1 );
+	if ( pageNum >= slabArenaPages ) {
+		return qfalse;
+	}
+
+	sc = &slabClasses[sizeClass];
+	page = slabArena + pageNum * SLAB_PAGE_SIZE;
+	count = SLAB_PAGE_SIZE / sc->size;
+	for ( i = 0 ; i < count - 1 ; i++ ) {
+		slot = (slabslot_t *)( page + i * sc->size );
+		*(unsigned int *)( slot + 1 ) = page + ( i + 1 ) * sc->size - slabArena + 1;
+	}
+	slabPageClasses[pageNum] = sizeClass + 1;
+	Z_AtomicAdd( &sc->pages, 1 );
+
+	Z_SlabPush( sc, (slabslot_t *)page, (slabslot_t *)( page + ( count - 1 ) * sc->size ) );
+	return qtrue;
+}
+
+/*
+========================
+Z_SlabMalloc
+
+NULL if it has to come from a zone
+========================
+*/
+static void *Z_SlabMalloc( int size, int tag ) {
+	slabclass_t	*sc;
+	slabslot_t	*slot;
+	int			sizeClass, used;
+
+	sizeClass = slabClassForSize[ ( size + 15 ) >> 4 ];
+	sc = &slabClasses[sizeClass];
+
+	while ( !( slot = Z_SlabPop( sc ) ) ) {
+		if ( !Z_SlabGrow( sizeClass ) ) {
+			Z_AtomicAdd( &sc->fallbacks, 1 );
+			return NULL;
+		}
+	}
+
+	slot->size = size;
+	slot->tag = tag;
+	slot->sizeClass = sizeClass;
+	slot->id = SLABID;
+
+	used = Z_AtomicAdd( &sc->used, 1 ) + 1;
+	if ( used > sc->peak ) {
+		sc->peak = used;		// a race can only lose a peak by one
+	}
+	Z_AtomicAdd( &sc->bytes, size );
+	Z_AtomicAdd( &sc->allocs, 1 );
+
+	return slot + 1;
+}
+
+/*
+========================
+Z_SlabFree
+========================
+*/
+static void Z_SlabFree( void *ptr ) {
+	slabclass_t	*sc;
+	slabslot_t	*slot;
+
+	slot = (slabslot_t *)ptr - 1;
+	if ( slot->id != SLABID ) {
+		Com_Error( ERR_FATAL, "Z_Free: freed a free or damaged slab slot" );
+	}
+	if ( slot->sizeClass + 1 != slabPageClasses[ ( (byte *)slot - slabArena ) / SLAB_PAGE_SIZE ] ) {
+		Com_Error( ERR_FATAL, "Z_Free: slab slot in a page of another size" );
+	}
+
+	sc = &slabClasses[slot->sizeClass];
+	Z_AtomicAdd( &sc->used, -1 );
+	Z_AtomicAdd( &sc->bytes, -slot->size );
+
+	// set the slot to something that should cause problems
+	// if it is referenced...
+	Com_Memset( ptr, 0xaa, sc->size - sizeof( *slot ) );
+	slot->id = 0;
+
+	Z_SlabPush( sc, slot, slot );
+}
+
+/*
+========================
+Z_IsSlab
+========================
+*/
+static ID_INLINE qboolean Z_IsSlab( const void *ptr ) {
+	return (const byte *)ptr > slabArena && (const byte *)ptr < slabArena + slabArenaSize;
+}
+
+/*
+========================
+Z_FreeSlabTags
+========================
+*/
+static void Z_FreeSlabTags( int tag ) {
+	slabslot_t	*slot;
+	byte		*page;
+	int			i, pages, size;
+
+	pages = slabPagesUsed < slabArenaPages ? slabPagesUsed : slabArenaPages;
+	for ( i = 0 ; i < pages ; i++ ) {
+		if ( !slabPageClasses[i] ) {
+			continue;
+		}
+		size = slabClasses[ slabPageClasses[i] - 1 ].size;
+		for ( page = slabArena + i * SLAB_PAGE_SIZE ; page + size <= slabArena + ( i + 1 ) * SLAB_PAGE_SIZE ; page += size ) {
+			slot = (slabslot_t *)page;
+			if ( slot->id == SLABID && slot->tag == tag ) {
+				Z_SlabFree( slot + 1 );
+			}
+		}
+	}
+}
+
+static volatile int	zoneLock;
+
+/*
+========================
+Z_LockZones
+
+The zones are only held for a list walk, so waiters just spin
+========================
+*/
+static ID_INLINE void Z_LockZones( void ) {
+	while ( !Z_AtomicCAS( &zoneLock, 0, 1 ) ) {
+	}
+}
+
+static ID_INLINE void Z_UnlockZones( void ) {
+	Z_AtomicRelease( &zoneLock );
+}
+
 /*
 ========================
 Z_ClearZone
@@ -800,22 +1103,22 @@ int Z_AvailableMemory( void ) {
 
 /*
 ========================
-Z_Free
+Z_FreeBlock
+
+The zones must be locked, and are unlocked again before an error
 ========================
 */
-void Z_Free( void *ptr ) {
+static void Z_FreeBlock( void *ptr ) {
 	memblock_t	*block, *other;
 	memzone_t *zone;
-	
-	if (!ptr) {
-		Com_Error( ERR_DROP, "Z_Free: NULL pointer" );
-	}
 
 	block = (memblock_t *) ( (byte *)ptr - sizeof(memblock_t));
 	if (block->id != ZONEID) {
+		Z_UnlockZones();
 		Com_Error( ERR_FATAL, "Z_Free: freed a pointer without ZONEID" );
 	}
 	if (block->tag == 0) {
+		Z_UnlockZones();
 		Com_Error( ERR_FATAL, "Z_Free: freed a freed pointer" );
 	}
 	// if static memory
@@ -825,6 +1128,7 @@ void Z_Free( void *ptr ) {
 
 	// check the memory trash tester
 	if ( *(int *)((byte *)block + block->size - 4 ) != ZONEID ) {
+		Z_UnlockZones();
 		Com_Error( ERR_FATAL, "Z_Free: memory block wrote past end" );
 	}
 
@@ -868,6 +1172,26 @@ void Z_Free( void *ptr ) {
 	}
 }
 
+/*
+========================
+Z_Free
+========================
+*/
+void Z_Free( void *ptr ) {
+	if (!ptr) {
+		Com_Error( ERR_DROP, "Z_Free: NULL pointer" );
+	}
+
+	if ( Z_IsSlab( ptr ) ) {
+		Z_SlabFree( ptr );
+		return;
+	}
+
+	Z_LockZones();
+	Z_FreeBlock( ptr );
+	Z_UnlockZones();
+}
+
 
 /*
 ================
@@ -884,18 +1208,22 @@ void Z_FreeTags( int tag ) {
 	else {
 		zone = mainzone;
 	}
+	Z_FreeSlabTags( tag );
+
 	count = 0;
+	Z_LockZones();
 	// use the rover as our pointer, because
-	// Z_Free automatically adjusts it
+	// Z_FreeBlock automatically adjusts it
 	zone->rover = zone->blocklist.next;
 	do {
 		if ( zone->rover->tag == tag ) {
 			count++;
-			Z_Free( (void *)(zone->rover + 1) );
+			Z_FreeBlock( (void *)(zone->rover + 1) );
 			continue;
 		}
 		zone->rover = zone->rover->next;
 	} while ( zone->rover != &zone->blocklist );
+	Z_UnlockZones();
 }
 
 
@@ -917,6 +1245,17 @@ void *Z_TagMalloc( int size, int tag ) {
 		Com_Error( ERR_FATAL, "Z_TagMalloc: tried to use a 0 tag" );
 	}
 
+#ifndef ZONE_DEBUG
+	if ( slabArena && size >= 0 && size <= SLAB_MAX_SIZE ) {
+		void	*buf;
+
+		buf = Z_SlabMalloc( size, tag );
+		if ( buf ) {
+			return buf;
+		}
+	}
+#endif
+
 	if ( tag == TAG_SMALL ) {
 		zone = smallzone;
 	}
@@ -933,11 +1272,13 @@ void *Z_TagMalloc( int size, int tag ) {
 	size += 4;					// space for memory trash tester
 	size = PAD(size, sizeof(intptr_t));		// align to 32/64 bit boundary
 	
+	Z_LockZones();
 	base = rover = zone->rover;
 	start = base->prev;
 	
 	do {
 		if (rover == start)	{
+			Z_UnlockZones();
 #ifdef ZONE_DEBUG
 			Z_LogHeap();
 #endif
@@ -986,6 +1327,7 @@ void *Z_TagMalloc( int size, int tag ) {
 
 	// marker for memory trash testing
 	*(int *)((byte *)base + base->size - 4) = ZONEID;
+	Z_UnlockZones();
 
 	return (void *) ((byte *)base + sizeof(memblock_t));
 }
@@ -1226,6 +1568,34 @@ static	int		s_zoneTotal;
 static	int		s_smallZoneTotal;
 
 
+/*
+=================
+Z_ZoneFragmentation
+
+How broken up the free space of a zone is, 0% when it's one block
+=================
+*/
+static void Z_ZoneFragmentation( memzone_t *zone, const char *name ) {
+	memblock_t	*block;
+	int			freeBytes, freeBlocks, largest;
+
+	freeBytes = 0;
+	freeBlocks = 0;
+	largest = 0;
+	for ( block = zone->blocklist.next ; block != &zone->blocklist ; block = block->next ) {
+		if ( !block->tag ) {
+			freeBytes += block->size;
+			freeBlocks++;
+			if ( block->size > largest ) {
+				largest = block->size;
+			}
+		}
+	}
+
+	Com_Printf( "%8i bytes free in the %s zone in %i blocks, the largest %i, %.1f%% fragmented\n",
+		freeBytes, name, freeBlocks, largest, freeBytes ? 100.0f * ( freeBytes - largest ) / freeBytes : 0.0f );
+}
+
 /*
 =================
 Com_Meminfo_f
@@ -1233,10 +1603,12 @@ Com_Meminfo_f
 */
 void Com_Meminfo_f( void ) {
 	memblock_t	*block;
+	slabclass_t	*sc;
 	int			zoneBytes, zoneBlocks;
 	int			smallZoneBytes, smallZoneBlocks;
 	int			botlibBytes, rendererBytes;
 	int			unused;
+	int			i, slots, slabBytes, slabUsedBytes, slabPages;
 
 	zoneBytes = 0;
 	botlibBytes = 0;
@@ -1316,6 +1688,31 @@ void Com_Meminfo_f( void ) {
 	Com_Printf( "        %8i bytes in dynamic renderer\n", rendererBytes );
 	Com_Printf( "        %8i bytes in dynamic other\n", zoneBytes - ( botlibBytes + rendererBytes ) );
 	Com_Printf( "        %8i bytes in small Zone memory\n", smallZoneBytes );
+	Com_Printf( "\n" );
+
+	if ( !slabArena ) {
+		Com_Printf( "slabs are off\n" );
+	} else {
+		slabPages = slabPagesUsed < slabArenaPages ? slabPagesUsed : slabArenaPages;
+		Com_Printf( "%8i of %i slab pages of %i bytes in use\n", slabPages, slabArenaPages, SLAB_PAGE_SIZE );
+		Com_Printf( "    size pages    slots     used     peak    allocs fallbacks  waste\n" );
+		slabBytes = 0;
+		slabUsedBytes = 0;
+		for ( i = 0, sc = slabClasses ; i < NUM_SLAB_CLASSES ; i++, sc++ ) {
+			slots = sc->pages * ( SLAB_PAGE_SIZE / sc->size );
+			slabBytes += sc->used * sc->size;
+			slabUsedBytes += sc->bytes;
+			// what the used slots hold beyond what was asked for
+			Com_Printf( "    %4i %5i %8i %8i %8i %9u %9u %5.1f%%\n", slabSizes[i], sc->pages,
+				slots, sc->used, sc->peak, sc->allocs, sc->fallbacks,
+				sc->used ? 100.0f * ( sc->used * sc->size - sc->bytes ) / ( sc->used * sc->size ) : 0.0f );
+		}
+		Com_Printf( "%8i bytes in slab slots holding %i bytes\n", slabBytes, slabUsedBytes );
+	}
+	Com_Printf( "\n" );
+
+	Z_ZoneFragmentation( mainzone, "main" );
+	Z_ZoneFragmentation( smallzone, "small" );
 }
 
 /*
@@ -1405,6 +1802,10 @@ void Com_InitZoneMemory( void ) {
 	}
 	Z_ClearZone( mainzone, s_zoneTotal );
 
+	// small allocations go to the slabs first, 0 keeps them in the zones
+	cv = Cvar_Get( "com_slabMegs", DEF_COMSLABMEGS_S, CVAR_LATCH | CVAR_ARCHIVE );
+	Z_InitSlabs( cv->integer );
+
 }
 
 /*
@@ -1937,6 +2338,10 @@ static int         eventHead = 0;
 static int         eventTail = 0;
 static byte        sys_packetReceived[ MAX_MSGLEN ];
 
+// slab ring for batched receives, packets are handed to the server
+// straight out of these slots instead of going through the event queue
+static byte        sys_packetRing[ NET_MAX_RECV_BATCH ][ MAX_MSGLEN ];
+
 /*
 ================
 Com_QueueEvent
@@ -1978,6 +2383,29 @@ void Com_QueueEvent( int time, sysEventType_t type, int value, int value2, int p
 	ev->evPtr = ptr;
 }
 
+/*
+================
+Com_PacketBatchSize
+
+Returns the number of datagrams to pull per receive call, or 0 if
+packets should go through the event queue one at a time.  Journaling
+needs every packet to be an event, so it always uses the old path.
+================
+*/
+static int Com_PacketBatchSize( void )
+{
+	if ( !net_recvBatch || net_recvBatch->integer <= 0 ) {
+		return 0;
+	}
+	if ( com_journal && com_journal->integer ) {
+		return 0;
+	}
+	if ( net_recvBatch->integer > NET_MAX_RECV_BATCH ) {
+		return NET_MAX_RECV_BATCH;
+	}
+	return net_recvBatch->integer;
+}
+
 /*
 ================
 Com_GetSystemEvent
@@ -2011,9 +2439,9 @@ sysEvent_t Com_GetSystemEvent( void )
 		Com_QueueEvent( 0, SE_CONSOLE, 0, 0, len, b );
 	}
 
-	// check for network packets
+	// check for network packets, unless Com_EventLoop drains them in batches
 	MSG_Init( &netmsg, sys_packetReceived, sizeof( sys_packetReceived ) );
-	if ( Sys_GetPacket ( &adr, &netmsg ) )
+	if ( !Com_PacketBatchSize() && Sys_GetPacket ( &adr, &netmsg ) )
 	{
 		netadr_t  *buf;
 		int       len;
@@ -2169,6 +2597,61 @@ void Com_RunAndTimeServerPacket( netadr_t *evFrom, msg_t *buf ) {
 	}
 }
 
+/*
+=================
+Com_DispatchPacket
+=================
+*/
+static void Com_DispatchPacket( netadr_t *evFrom, msg_t *buf ) {
+	// this cvar allows simulation of connections that
+	// drop a lot of packets.  Note that loopback connections
+	// don't go through here at all.
+	if ( com_dropsim->value > 0 ) {
+		static int seed;
+
+		if ( Q_random( &seed ) < com_dropsim->value ) {
+			return;		// drop this packet
+		}
+	}
+
+	if ( com_sv_running->integer ) {
+		Com_RunAndTimeServerPacket( evFrom, buf );
+	} else {
+		CL_PacketEvent( *evFrom, buf );
+	}
+}
+
+/*
+=================
+Com_ReceivePacketBatches
+
+Drains the socket into the packet ring and dispatches every datagram
+in place, without the Z_Malloc and copies of the SE_PACKET path.
+The slots are MAX_MSGLEN sized, so netchan can reassemble fragments
+directly in them.
+=================
+*/
+static void Com_ReceivePacketBatches( int batch ) {
+	netadr_t	from[NET_MAX_RECV_BATCH];
+	msg_t		msgs[NET_MAX_RECV_BATCH];
+	int			i, count, received;
+
+	do {
+		for ( i = 0 ; i < batch ; i++ ) {
+			MSG_Init( &msgs[i], sys_packetRing[i], sizeof( sys_packetRing[i] ) );
+		}
+
+		count = Sys_GetPackets( from, msgs, batch, &received );
+
+		for ( i = 0 ; i < count ; i++ ) {
+			Com_DispatchPacket( &from[i], &msgs[i] );
+		}
+
+		// a short batch means the socket is empty, dropped
+		// datagrams still count towards a full one
+	} while ( received == batch );
+}
+
 /*
 =================
 Com_EventLoop
@@ -2185,11 +2668,17 @@ int Com_EventLoop( void ) {
 	MSG_Init( &buf, bufData, sizeof( bufData ) );
 
 	while ( 1 ) {
+		// a server frame that errored out may have left a send batch open
+		NET_FlushSendBatch();
 		NET_FlushPacketQueue();
 		ev = Com_GetEvent();
 
 		// if no more events are available
 		if ( ev.evType == SE_NONE ) {
+			if ( Com_PacketBatchSize() ) {
+				Com_ReceivePacketBatches( Com_PacketBatchSize() );
+			}
+
 			// manually send packet events for the loopback channel
 			while ( NET_GetLoopPacket( NS_CLIENT, &evFrom, &buf ) ) {
 				CL_PacketEvent( evFrom, &buf );
@@ -2229,17 +2718,6 @@ int Com_EventLoop( void ) {
 			Cbuf_AddText( "\n" );
 			break;
 		case SE_PACKET:
-			// this cvar allows simulation of connections that
-			// drop a lot of packets.  Note that loopback connections
-			// don't go through here at all.
-			if ( com_dropsim->value > 0 ) {
-				static int seed;
-
-				if ( Q_random( &seed ) < com_dropsim->value ) {
-					break;		// drop this packet
-				}
-			}
-
 			evFrom = *(netadr_t *)ev.evPtr;
 			buf.cursize = ev.evPtrLength - sizeof( evFrom );
 
@@ -2252,11 +2730,7 @@ int Com_EventLoop( void ) {
 				continue;
 			}
 			Com_Memcpy( buf.data, (byte *)((netadr_t *)ev.evPtr + 1), buf.cursize );
-			if ( com_sv_running->integer ) {
-				Com_RunAndTimeServerPacket( &evFrom, &buf );
-			} else {
-				CL_PacketEvent( evFrom, &buf );
-			}
+			Com_DispatchPacket( &evFrom, &buf );
 			break;
 		}
 
@@ -2594,6 +3068,8 @@ void Com_Init( char *commandLine ) {
 
 	com_introPlayed = Cvar_Get( "com_introplayed", "0", CVAR_ARCHIVE);
 
+	net_recvBatch = Cvar_Get( "net_recvBatch", "0", CVAR_ARCHIVE );
+
 	if ( com_developer && com_developer->integer ) {
 		Cmd_AddCommand ("error", Com_Error_f);
 		Cmd_AddCommand ("crash", Com_Crash_f );
@@ -2601,6 +3077,7 @@ void Com_Init( char *commandLine ) {
 	}
 	Cmd_AddCommand ("quit", Com_Quit_f);
 	Cmd_AddCommand ("changeVectors", MSG_ReportChangeVectors_f );
+	Cmd_AddCommand ("huffbench", MSG_HuffBench_f );
 	Cmd_AddCommand ("writeconfig", Com_WriteConfig_f );
 
 	s = va("%s %s %s", Q3_VERSION, PLATFORM_STRING, __DATE__ );
@@ -2746,8 +3223,9 @@ int Com_ModifyMsec( int msec ) {
 		msec *= com_timescale->value;
 	}
 	
-	// don't let it scale below 1 msec
-	if ( msec < 1 && com_timescale->value) {
+	// don't let it scale below 1 msec, a dedicated server
+	// can be called again within the same msec
+	if ( msec < 1 && com_timescale->value && !com_dedicated->integer ) {
 		msec = 1;
 	}
 
@@ -2826,6 +3304,8 @@ void Com_Frame( void ) {
 	// we may want to spin here if things are going too fast
 	if ( !com_dedicated->integer && com_maxfps->integer > 0 && !com_timedemo->integer ) {
 		minMsec = 1000 / com_maxfps->integer;
+	} else if ( com_dedicated->integer ) {
+		minMsec = 0;	// SV_Frame paces itself below a msec
 	} else {
 		minMsec = 1;
 	}
@@ -631,6 +631,8 @@ void Cvar_SetS_f( void ) {
 		return;
 	}
 	v->flags |= CVAR_SERVERINFO;
+	// the value may not have changed, but it's new to the serverinfo
+	cvar_modifiedFlags |= CVAR_SERVERINFO;
 }
 
 /*
@@ -209,9 +209,11 @@ typedef struct fileInPack_s {
 	char					*name;		// name of the file
 	unsigned long			pos;		// file info position in zip
 	struct	fileInPack_s*	next;		// next file in the hash
+	struct	fileInPack_s*	nextInIndex;	// next file in the hash of all the packs
+	struct	searchpath_s*	search;		// the search path of the pack
 } fileInPack_t;
 
-typedef struct {
+typedef struct pack_s {
 	char			pakFilename[MAX_OSPATH];	// c:\quake3\baseq3\pak0.pk3
 	char			pakBasename[MAX_OSPATH];	// pak0
 	char			pakGamename[MAX_OSPATH];	// baseq3
@@ -223,6 +225,11 @@ typedef struct {
 	int				hashSize;					// hash table size (power of 2)
 	fileInPack_t*	*hashTable;					// hash table
 	fileInPack_t*	buildBuffer;				// buffer with the filenames etc.
+	int				numHeaderLongs;				// checksum feed and the crcs
+	int				*headerLongs;
+	int				fileSize;					// -1 if it can't go in the pk3 index
+	int				fileTime;
+	struct pack_s	*next;						// kept over an FS_Restart
 } pack_t;
 
 typedef struct {
@@ -235,10 +242,12 @@ typedef struct searchpath_s {
 
 	pack_t		*pack;		// only one of pack / dir will be non NULL
 	directory_t	*dir;
+	int			rank;		// position in the search order
 } searchpath_t;
 
 static	char		fs_gamedir[MAX_OSPATH];	// this will be a single file name with no separators
 static	cvar_t		*fs_debug;
+static	cvar_t		*fs_mmap;
 static	cvar_t		*fs_homepath;
 
 #ifdef MACOS_X
@@ -277,6 +286,7 @@ typedef struct {
 	qboolean	zipFile;
 	qboolean	streamed;
 	char		name[MAX_ZPATH];
+	char		osPath[MAX_OSPATH];	// the file or the pk3 it was opened from
 } fileHandleData_t;
 
 static fileHandleData_t	fsh[MAX_FILE_HANDLES];
@@ -373,6 +383,129 @@ static long FS_HashFileName( const char *fname, int hashSize ) {
 	return hash;
 }
 
+/*
+=================================================================================
+
+FILE LOOKUP INDEX
+
+The files of every pack are also in one hash table, each chain in search
+order, so looking a file up doesn't have to go through the packs one by
+one.  Directories can't be indexed and are still tried in order, up to the
+pack the index found the file in.  Rebuilt whenever the search paths are
+set up or reordered.
+
+=================================================================================
+*/
+
+static fileInPack_t	**fs_fileIndex;
+static int			fs_fileIndexSize;		// power of two
+static searchpath_t	**fs_searchDirs;		// the directories in search order
+static int			fs_numSearchDirs;
+
+/*
+================
+FS_FreeFileIndex
+================
+*/
+static void FS_FreeFileIndex( void ) {
+	if ( fs_fileIndex ) {
+		Z_Free( fs_fileIndex );
+		fs_fileIndex = NULL;
+	}
+	if ( fs_searchDirs ) {
+		Z_Free( fs_searchDirs );
+		fs_searchDirs = NULL;
+	}
+	fs_fileIndexSize = 0;
+	fs_numSearchDirs = 0;
+}
+
+/*
+================
+FS_BuildFileIndex
+================
+*/
+static void FS_BuildFileIndex( void ) {
+	searchpath_t	*search, **paths;
+	fileInPack_t	*pakFile;
+	int				i, j, numPaths, numFiles;
+	long			hash;
+
+	FS_FreeFileIndex();
+
+	numPaths = numFiles = 0;
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		search->rank = numPaths++;
+		if ( search->pack ) {
+			numFiles += search->pack->numfiles;
+		} else {
+			fs_numSearchDirs++;
+		}
+	}
+
+	for ( fs_fileIndexSize = 1 ; fs_fileIndexSize < numFiles && fs_fileIndexSize < ( 1 << 20 ) ; fs_fileIndexSize <<= 1 ) {
+	}
+	fs_fileIndex = Z_Malloc( fs_fileIndexSize * sizeof( *fs_fileIndex ) );
+	fs_searchDirs = Z_Malloc( ( fs_numSearchDirs + 1 ) * sizeof( *fs_searchDirs ) );
+
+	paths = Z_Malloc( ( numPaths + 1 ) * sizeof( *paths ) );
+	fs_numSearchDirs = 0;
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		paths[search->rank] = search;
+		if ( search->dir ) {
+			fs_searchDirs[fs_numSearchDirs++] = search;
+		}
+	}
+
+	// the first pack in the search goes in last, so it is at the head of
+	// the chains, and a pack's own files go in the same order as its hash
+	for ( i = numPaths - 1 ; i >= 0 ; i-- ) {
+		if ( !paths[i]->pack ) {
+			continue;
+		}
+		for ( j = 0, pakFile = paths[i]->pack->buildBuffer ; j < paths[i]->pack->numfiles ; j++, pakFile++ ) {
+			if ( !pakFile->name ) {
+				continue;
+			}
+			hash = FS_HashFileName( pakFile->name, fs_fileIndexSize );
+			pakFile->search = paths[i];
+			pakFile->nextInIndex = fs_fileIndex[hash];
+			fs_fileIndex[hash] = pakFile;
+		}
+	}
+
+	Z_Free( paths );
+}
+
+/*
+================
+FS_FindFileInPaks
+
+The file in the first pack in the search order that has it, only
+looking at the pure ones if pure is set
+================
+*/
+static fileInPack_t *FS_FindFileInPaks( const char *filename, qboolean pure ) {
+	fileInPack_t	*pakFile;
+
+	if ( !fs_fileIndex ) {
+		return NULL;
+	}
+
+	for ( pakFile = fs_fileIndex[ FS_HashFileName( filename, fs_fileIndexSize ) ] ; pakFile ; pakFile = pakFile->nextInIndex ) {
+		// case and separator insensitive comparisons
+		if ( FS_FilenameCompare( pakFile->name, filename ) ) {
+			continue;
+		}
+		// disregard if it doesn't match one of the allowed pure pak files
+		if ( pure && !FS_PakIsPure( pakFile->search->pack ) ) {
+			continue;
+		}
+		return pakFile;
+	}
+	return NULL;
+}
+
 static fileHandle_t	FS_HandleForFile(void) {
 	int		i;
 
@@ -950,54 +1083,34 @@ separate file or a ZIP file.
 extern qboolean		com_fullyInitialized;
 
 int FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean uniqueFILE ) {
-	searchpath_t	*search;
 	char			*netpath;
 	pack_t			*pak;
 	fileInPack_t	*pakFile;
 	directory_t		*dir;
-	long			hash;
 	unz_s			*zfi;
 	FILE			*temp;
-	int				l;
+	int				i, l;
 	char demoExt[16];
 
-	hash = 0;
-
 	if ( !fs_searchpaths ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
 	}
 
 	if ( file == NULL ) {
 		// just wants to see if file is there
-		for ( search = fs_searchpaths ; search ; search = search->next ) {
-			//
-			if ( search->pack ) {
-				hash = FS_HashFileName(filename, search->pack->hashSize);
-			}
-			// is the element a pak file?
-			if ( search->pack && search->pack->hashTable[hash] ) {
-				// look through all the pak file elements
-				pak = search->pack;
-				pakFile = pak->hashTable[hash];
-				do {
-					// case and separator insensitive comparisons
-					if ( !FS_FilenameCompare( pakFile->name, filename ) ) {
-						// found it!
-						return qtrue;
-					}
-					pakFile = pakFile->next;
-				} while(pakFile != NULL);
-			} else if ( search->dir ) {
-				dir = search->dir;
-			
-				netpath = FS_BuildOSPath( dir->path, dir->gamedir, filename );
-				temp = fopen (netpath, "rb");
-				if ( !temp ) {
-					continue;
-				}
-				fclose(temp);
-				return qtrue;
+		if ( FS_FindFileInPaks( filename, qfalse ) ) {
+			return qtrue;
+		}
+		for ( i = 0 ; i < fs_numSearchDirs ; i++ ) {
+			dir = fs_searchDirs[i]->dir;
+
+			netpath = FS_BuildOSPath( dir->path, dir->gamedir, filename );
+			temp = fopen (netpath, "rb");
+			if ( !temp ) {
+				continue;
 			}
+			fclose(temp);
+			return qtrue;
 		}
 		return qfalse;
 	}
@@ -1028,139 +1141,128 @@ int FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean uniqueF
 	}
 
 	//
-	// search through the path, one element at a time
+	// search through the path, one element at a time: the directories
+	// before the first pure pak with the file, then that pak
 	//
 
 	*file = FS_HandleForFile();
 	fsh[*file].handleFiles.unique = uniqueFILE;
 
-	for ( search = fs_searchpaths ; search ; search = search->next ) {
-		//
-		if ( search->pack ) {
-			hash = FS_HashFileName(filename, search->pack->hashSize);
-		}
-		// is the element a pak file?
-		if ( search->pack && search->pack->hashTable[hash] ) {
-			// disregard if it doesn't match one of the allowed pure pak files
-			if ( !FS_PakIsPure(search->pack) ) {
-				continue;
-			}
-
-			// look through all the pak file elements
-			pak = search->pack;
-			pakFile = pak->hashTable[hash];
-			do {
-				// case and separator insensitive comparisons
-				if ( !FS_FilenameCompare( pakFile->name, filename ) ) {
-					// found it!
-
-					// mark the pak as having been referenced and mark specifics on cgame and ui
-					// shaders, txt, arena files  by themselves do not count as a reference as 
-					// these are loaded from all pk3s 
-					// from every pk3 file.. 
-					l = strlen( filename );
-					if ( !(pak->referenced & FS_GENERAL_REF)) {
-						if ( Q_stricmp(filename + l - 7, ".shader") != 0 &&
-							Q_stricmp(filename + l - 4, ".txt") != 0 &&
-							Q_stricmp(filename + l - 4, ".cfg") != 0 &&
-							Q_stricmp(filename + l - 7, ".config") != 0 &&
-							strstr(filename, "levelshots") == NULL &&
-							Q_stricmp(filename + l - 4, ".bot") != 0 &&
-							Q_stricmp(filename + l - 6, ".arena") != 0 &&
-							Q_stricmp(filename + l - 5, ".menu") != 0) {
-							pak->referenced |= FS_GENERAL_REF;
-						}
-					}
-
-					if (!(pak->referenced & FS_QAGAME_REF) && strstr(filename, "qagame.qvm")) {
-						pak->referenced |= FS_QAGAME_REF;
-					}
-					if (!(pak->referenced & FS_CGAME_REF) && strstr(filename, "cgame.qvm")) {
-						pak->referenced |= FS_CGAME_REF;
-					}
-					if (!(pak->referenced & FS_UI_REF) && strstr(filename, "ui.qvm")) {
-						pak->referenced |= FS_UI_REF;
-					}
-
-					if ( uniqueFILE ) {
-						// open a new file on the pakfile
-						fsh[*file].handleFiles.file.z = unzReOpen (pak->pakFilename, pak->handle);
-						if (fsh[*file].handleFiles.file.z == NULL) {
-							Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->pakFilename);
-						}
-					} else {
-						fsh[*file].handleFiles.file.z = pak->handle;
-					}
-					Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
-					fsh[*file].zipFile = qtrue;
-					zfi = (unz_s *)fsh[*file].handleFiles.file.z;
-					// in case the file was new
-					temp = zfi->file;
-					// set the file position in the zip file (also sets the current file info)
-					unzSetCurrentFileInfoPosition(pak->handle, pakFile->pos);
-					// copy the file info into the unzip structure
-					Com_Memcpy( zfi, pak->handle, sizeof(unz_s) );
-					// we copy this back into the structure
-					zfi->file = temp;
-					// open the file in the zip
-					unzOpenCurrentFile( fsh[*file].handleFiles.file.z );
-					fsh[*file].zipFilePos = pakFile->pos;
-
-					if ( fs_debug->integer ) {
-						Com_Printf( "FS_FOpenFileRead: %s (found in '%s')\n", 
-							filename, pak->pakFilename );
-					}
-					return zfi->cur_file_info.uncompressed_size;
-				}
-				pakFile = pakFile->next;
-			} while(pakFile != NULL);
-		} else if ( search->dir ) {
-			// check a file in the directory tree
-
-			// if we are running restricted, the only files we
-			// will allow to come from the directory are .cfg files
-			l = strlen( filename );
-			// FIXME TTimo I'm not sure about the fs_numServerPaks test
-			// if you are using FS_ReadFile to find out if a file exists,
-			//   this test can make the search fail although the file is in the directory
-			// I had the problem on https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=8
-			// turned out I used FS_FileExists instead
-			if ( fs_numServerPaks ) {
-
-				if ( Q_stricmp( filename + l - 4, ".cfg" )		// for config files
-					&& Q_stricmp( filename + l - 5, ".menu" )	// menu files
-					&& Q_stricmp( filename + l - 5, ".game" )	// menu files
-					&& Q_stricmp( filename + l - strlen(demoExt), demoExt )	// menu files
-					&& Q_stricmp( filename + l - 4, ".dat" ) ) {	// for journal files
-					continue;
-				}
-			}
+	pakFile = FS_FindFileInPaks( filename, qtrue );
 
-			dir = search->dir;
-			
-			netpath = FS_BuildOSPath( dir->path, dir->gamedir, filename );
-			fsh[*file].handleFiles.file.o = fopen (netpath, "rb");
-			if ( !fsh[*file].handleFiles.file.o ) {
-				continue;
-			}
+	for ( i = 0 ; i < fs_numSearchDirs ; i++ ) {
+		if ( pakFile && fs_searchDirs[i]->rank > pakFile->search->rank ) {
+			break;
+		}
+		// check a file in the directory tree
+
+		// if we are running restricted, the only files we
+		// will allow to come from the directory are .cfg files
+		l = strlen( filename );
+		// FIXME TTimo I'm not sure about the fs_numServerPaks test
+		// if you are using FS_ReadFile to find out if a file exists,
+		//   this test can make the search fail although the file is in the directory
+		// I had the problem on https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=8
+		// turned out I used FS_FileExists instead
+		if ( fs_numServerPaks ) {
 
 			if ( Q_stricmp( filename + l - 4, ".cfg" )		// for config files
 				&& Q_stricmp( filename + l - 5, ".menu" )	// menu files
 				&& Q_stricmp( filename + l - 5, ".game" )	// menu files
 				&& Q_stricmp( filename + l - strlen(demoExt), demoExt )	// menu files
 				&& Q_stricmp( filename + l - 4, ".dat" ) ) {	// for journal files
-				fs_fakeChkSum = random();
+				continue;
 			}
+		}
+
+		dir = fs_searchDirs[i]->dir;
+		
+		netpath = FS_BuildOSPath( dir->path, dir->gamedir, filename );
+		fsh[*file].handleFiles.file.o = fopen (netpath, "rb");
+		if ( !fsh[*file].handleFiles.file.o ) {
+			continue;
+		}
+
+		if ( Q_stricmp( filename + l - 4, ".cfg" )		// for config files
+			&& Q_stricmp( filename + l - 5, ".menu" )	// menu files
+			&& Q_stricmp( filename + l - 5, ".game" )	// menu files
+			&& Q_stricmp( filename + l - strlen(demoExt), demoExt )	// menu files
+			&& Q_stricmp( filename + l - 4, ".dat" ) ) {	// for journal files
+			fs_fakeChkSum = random();
+		}
+
+		Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
+		Q_strncpyz( fsh[*file].osPath, netpath, sizeof( fsh[*file].osPath ) );
+		fsh[*file].zipFile = qfalse;
+		if ( fs_debug->integer ) {
+			Com_Printf( "FS_FOpenFileRead: %s (found in '%s/%s')\n", filename,
+				dir->path, dir->gamedir );
+		}
 
-			Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
-			fsh[*file].zipFile = qfalse;
-			if ( fs_debug->integer ) {
-				Com_Printf( "FS_FOpenFileRead: %s (found in '%s/%s')\n", filename,
-					dir->path, dir->gamedir );
+		return FS_filelength (*file);
+	}
+
+	if ( pakFile ) {
+		pak = pakFile->search->pack;
+
+		// mark the pak as having been referenced and mark specifics on cgame and ui
+		// shaders, txt, arena files  by themselves do not count as a reference as 
+		// these are loaded from all pk3s 
+		// from every pk3 file.. 
+		l = strlen( filename );
+		if ( !(pak->referenced & FS_GENERAL_REF)) {
+			if ( Q_stricmp(filename + l - 7, ".shader") != 0 &&
+				Q_stricmp(filename + l - 4, ".txt") != 0 &&
+				Q_stricmp(filename + l - 4, ".cfg") != 0 &&
+				Q_stricmp(filename + l - 7, ".config") != 0 &&
+				strstr(filename, "levelshots") == NULL &&
+				Q_stricmp(filename + l - 4, ".bot") != 0 &&
+				Q_stricmp(filename + l - 6, ".arena") != 0 &&
+				Q_stricmp(filename + l - 5, ".menu") != 0) {
+				pak->referenced |= FS_GENERAL_REF;
 			}
+		}
 
-			return FS_filelength (*file);
-		}		
+		if (!(pak->referenced & FS_QAGAME_REF) && strstr(filename, "qagame.qvm")) {
+			pak->referenced |= FS_QAGAME_REF;
+		}
+		if (!(pak->referenced & FS_CGAME_REF) && strstr(filename, "cgame.qvm")) {
+			pak->referenced |= FS_CGAME_REF;
+		}
+		if (!(pak->referenced & FS_UI_REF) && strstr(filename, "ui.qvm")) {
+			pak->referenced |= FS_UI_REF;
+		}
+
+		if ( uniqueFILE ) {
+			// open a new file on the pakfile
+			fsh[*file].handleFiles.file.z = unzReOpen (pak->pakFilename, pak->handle);
+			if (fsh[*file].handleFiles.file.z == NULL) {
+				Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->pakFilename);
+			}
+		} else {
+			fsh[*file].handleFiles.file.z = pak->handle;
+		}
+		Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
+		Q_strncpyz( fsh[*file].osPath, pak->pakFilename, sizeof( fsh[*file].osPath ) );
+		fsh[*file].zipFile = qtrue;
+		zfi = (unz_s *)fsh[*file].handleFiles.file.z;
+		// in case the file was new
+		temp = zfi->file;
+		// set the file position in the zip file (also sets the current file info)
+		unzSetCurrentFileInfoPosition(pak->handle, pakFile->pos);
+		// copy the file info into the unzip structure
+		Com_Memcpy( zfi, pak->handle, sizeof(unz_s) );
+		// we copy this back into the structure
+		zfi->file = temp;
+		// open the file in the zip
+		unzOpenCurrentFile( fsh[*file].handleFiles.file.z );
+		fsh[*file].zipFilePos = pakFile->pos;
+
+		if ( fs_debug->integer ) {
+			Com_Printf( "FS_FOpenFileRead: %s (found in '%s')\n", 
+				filename, pak->pakFilename );
+		}
+		return zfi->cur_file_info.uncompressed_size;
 	}
 	
 #ifdef FS_MISSING
@@ -1396,10 +1498,7 @@ CONVENIENCE FUNCTIONS FOR ENTIRE FILES
 */
 
 int	FS_FileIsInPAK(const char *filename, int *pChecksum ) {
-	searchpath_t	*search;
-	pack_t			*pak;
 	fileInPack_t	*pakFile;
-	long			hash = 0;
 
 	if ( !fs_searchpaths ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
@@ -1421,38 +1520,14 @@ int	FS_FileIsInPAK(const char *filename, int *pChecksum ) {
 		return -1;
 	}
 
-	//
-	// search through the path, one element at a time
-	//
-
-	for ( search = fs_searchpaths ; search ; search = search->next ) {
-		//
-		if (search->pack) {
-			hash = FS_HashFileName(filename, search->pack->hashSize);
-		}
-		// is the element a pak file?
-		if ( search->pack && search->pack->hashTable[hash] ) {
-			// disregard if it doesn't match one of the allowed pure pak files
-			if ( !FS_PakIsPure(search->pack) ) {
-				continue;
-			}
-
-			// look through all the pak file elements
-			pak = search->pack;
-			pakFile = pak->hashTable[hash];
-			do {
-				// case and separator insensitive comparisons
-				if ( !FS_FilenameCompare( pakFile->name, filename ) ) {
-					if (pChecksum) {
-						*pChecksum = pak->pure_checksum;
-					}
-					return 1;
-				}
-				pakFile = pakFile->next;
-			} while(pakFile != NULL);
-		}
+	pakFile = FS_FindFileInPaks( filename, qtrue );
+	if ( !pakFile ) {
+		return -1;
 	}
-	return -1;
+	if (pChecksum) {
+		*pChecksum = pakFile->search->pack->pure_checksum;
+	}
+	return 1;
 }
 
 /*
@@ -1594,6 +1669,146 @@ void FS_FreeFile( void *buffer ) {
 	}
 }
 
+/*
+=================================================================================
+
+MAPPED FILES
+
+Loose files and the entries stored uncompressed in pk3s can be read straight
+out of a read only mapping of the file they are in.  Every OS file is only
+mapped once, whatever number of its entries are in use, and unmapped when
+the last of them is released.
+
+=================================================================================
+*/
+
+typedef struct fileMapping_s {
+	struct fileMapping_s	*next;
+	char					osPath[MAX_OSPATH];
+	byte					*base;
+	int						length;
+	int						refs;		// buffers handed out of it
+} fileMapping_t;
+
+static fileMapping_t	*fs_mappings;
+
+/*
+============
+FS_MapFile
+
+Like FS_ReadFile, but the buffer points into a mapping of the file when
+possible, so nothing is copied.  The buffer is read only and, unlike the
+one from FS_ReadFile, not 0 terminated.  Release it with FS_UnmapFile.
+============
+*/
+int FS_MapFile( const char *qpath, const void **buffer ) {
+	fileHandle_t	h;
+	fileMapping_t	*mapping;
+	unz_s			*zfi;
+	byte			*base;
+	int				len, offset, length;
+	void			*buf;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
+	}
+
+	if ( !qpath || !qpath[0] ) {
+		Com_Error( ERR_FATAL, "FS_MapFile with empty name\n" );
+	}
+
+	// journaled config files have to go through FS_ReadFile
+	if ( !fs_mmap->integer || ( com_journal && com_journal->integer && strstr( qpath, ".cfg" ) ) ) {
+		len = FS_ReadFile( qpath, &buf );
+		*buffer = buf;
+		return len;
+	}
+
+	len = FS_FOpenFileRead( qpath, &h, qfalse );
+	if ( h == 0 ) {
+		*buffer = NULL;
+		return -1;
+	}
+
+	offset = 0;
+	if ( fsh[h].zipFile ) {
+		zfi = (unz_s *)fsh[h].handleFiles.file.z;
+		if ( zfi->cur_file_info.compression_method != 0 ) {
+			len = 0;		// deflated, read it the usual way
+		} else {
+			offset = zfi->pfile_in_zip_read->pos_in_zipfile + zfi->pfile_in_zip_read->byte_before_the_zipfile;
+		}
+	}
+
+	for ( mapping = fs_mappings ; mapping ; mapping = mapping->next ) {
+		if ( !strcmp( mapping->osPath, fsh[h].osPath ) ) {
+			break;
+		}
+	}
+
+	if ( !mapping && len > 0 ) {
+		base = Sys_MapFile( fsh[h].osPath, &length );
+		if ( base && offset > length - len ) {
+			Sys_UnmapFile( base, length );
+		} else if ( base ) {
+			mapping = Z_Malloc( sizeof( *mapping ) );
+			Q_strncpyz( mapping->osPath, fsh[h].osPath, sizeof( mapping->osPath ) );
+			mapping->base = base;
+			mapping->length = length;
+			mapping->next = fs_mappings;
+			fs_mappings = mapping;
+		}
+	}
+	FS_FCloseFile( h );
+
+	// an empty file can't be told apart from the end of the mapping
+	if ( !mapping || len <= 0 || offset < 0 || offset > mapping->length - len ) {
+		len = FS_ReadFile( qpath, &buf );
+		*buffer = buf;
+		return len;
+	}
+
+	if ( fs_debug->integer ) {
+		Com_Printf( "FS_MapFile: %s (%i bytes at %i in '%s')\n", qpath, len, offset, mapping->osPath );
+	}
+
+	fs_loadCount++;
+	mapping->refs++;
+	*buffer = mapping->base + offset;
+	return len;
+}
+
+/*
+============
+FS_UnmapFile
+
+Releases a buffer from FS_MapFile
+============
+*/
+void FS_UnmapFile( const void *buffer ) {
+	fileMapping_t	*mapping, **prev;
+
+	if ( !buffer ) {
+		Com_Error( ERR_FATAL, "FS_UnmapFile( NULL )" );
+	}
+
+	for ( prev = &fs_mappings ; *prev ; prev = &mapping->next ) {
+		mapping = *prev;
+		if ( (const byte *)buffer < mapping->base || (const byte *)buffer >= mapping->base + mapping->length ) {
+			continue;
+		}
+		if ( --mapping->refs == 0 ) {
+			Sys_UnmapFile( mapping->base, mapping->length );
+			*prev = mapping->next;
+			Z_Free( mapping );
+		}
+		return;
+	}
+
+	// it fell back to FS_ReadFile
+	FS_FreeFile( (void *)buffer );
+}
+
 /*
 ============
 FS_WriteFile
@@ -1635,13 +1850,85 @@ ZIP FILE LOADING
 
 /*
 =================
-FS_LoadZipFile
+FS_AllocPack
 
-Creates a new pak_t in the search chain for the contents
-of a zip file.
+A pack_t with room for numfiles files and namesLen bytes of names
 =================
 */
-static pack_t *FS_LoadZipFile( char *zipfile, const char *basename )
+static pack_t *FS_AllocPack( const char *zipfile, const char *basename, int numfiles, int namesLen )
+{
+	pack_t	*pack;
+	int		i;
+
+	// get the hash table size from the number of files in the zip
+	// because lots of custom pk3 files have less than 32 or 64 files
+	for (i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1) {
+		if (i > numfiles) {
+			break;
+		}
+	}
+
+	pack = Z_Malloc( sizeof( pack_t ) + i * sizeof(fileInPack_t *) );
+	pack->hashSize = i;
+	pack->hashTable = (fileInPack_t **) (((char *) pack) + sizeof( pack_t ));
+	for(i = 0; i < pack->hashSize; i++) {
+		pack->hashTable[i] = NULL;
+	}
+
+	Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
+	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
+
+	// strip .pk3 if needed
+	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
+		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+	}
+
+	pack->numfiles = numfiles;
+	pack->buildBuffer = Z_Malloc( (numfiles * sizeof( fileInPack_t )) + namesLen );
+	pack->headerLongs = Z_Malloc( ( numfiles + 1 ) * sizeof(int) );
+	pack->numHeaderLongs = 1;
+	pack->fileSize = -1;
+
+	return pack;
+}
+
+/*
+=================
+FS_FreePack
+=================
+*/
+static void FS_FreePack( pack_t *pack )
+{
+	unzClose( pack->handle );
+	Z_Free( pack->buildBuffer );
+	Z_Free( pack->headerLongs );
+	Z_Free( pack );
+}
+
+/*
+=================
+FS_PackChecksums
+
+The checksums of the pack from its file crcs and the current checksum feed
+=================
+*/
+static void FS_PackChecksums( pack_t *pack )
+{
+	pack->headerLongs[ 0 ] = LittleLong( fs_checksumFeed );
+	pack->checksum = Com_BlockChecksum( &pack->headerLongs[ 1 ], 4 * ( pack->numHeaderLongs - 1 ) );
+	pack->pure_checksum = Com_BlockChecksum( pack->headerLongs, 4 * pack->numHeaderLongs );
+	pack->checksum = LittleLong( pack->checksum );
+	pack->pure_checksum = LittleLong( pack->pure_checksum );
+}
+
+/*
+=================
+FS_ScanZipFile
+
+Walks the central directory of a zip file
+=================
+*/
+static pack_t *FS_ScanZipFile( const char *zipfile, const char *basename )
 {
 	fileInPack_t	*buildBuffer;
 	pack_t			*pack;
@@ -1652,20 +1939,14 @@ static pack_t *FS_LoadZipFile( char *zipfile, const char *basename )
 	unz_file_info	file_info;
 	int				i, len;
 	long			hash;
-	int				fs_numHeaderLongs;
-	int				*fs_headerLongs;
 	char			*namePtr;
 
-	fs_numHeaderLongs = 0;
-
 	uf = unzOpen(zipfile);
 	err = unzGetGlobalInfo (uf,&gi);
 
 	if (err != UNZ_OK)
 		return NULL;
 
-	fs_packFiles += gi.number_entry;
-
 	len = 0;
 	unzGoToFirstFile(uf);
 	for (i = 0; i < gi.number_entry; i++)
@@ -1678,36 +1959,11 @@ static pack_t *FS_LoadZipFile( char *zipfile, const char *basename )
 		unzGoToNextFile(uf);
 	}
 
-	buildBuffer = Z_Malloc( (gi.number_entry * sizeof( fileInPack_t )) + len );
+	pack = FS_AllocPack( zipfile, basename, gi.number_entry, len );
+	buildBuffer = pack->buildBuffer;
 	namePtr = ((char *) buildBuffer) + gi.number_entry * sizeof( fileInPack_t );
-	fs_headerLongs = Z_Malloc( ( gi.number_entry + 1 ) * sizeof(int) );
-	fs_headerLongs[ fs_numHeaderLongs++ ] = LittleLong( fs_checksumFeed );
-
-	// get the hash table size from the number of files in the zip
-	// because lots of custom pk3 files have less than 32 or 64 files
-	for (i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1) {
-		if (i > gi.number_entry) {
-			break;
-		}
-	}
-
-	pack = Z_Malloc( sizeof( pack_t ) + i * sizeof(fileInPack_t *) );
-	pack->hashSize = i;
-	pack->hashTable = (fileInPack_t **) (((char *) pack) + sizeof( pack_t ));
-	for(i = 0; i < pack->hashSize; i++) {
-		pack->hashTable[i] = NULL;
-	}
-
-	Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
-	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
-
-	// strip .pk3 if needed
-	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
-		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
-	}
 
 	pack->handle = uf;
-	pack->numfiles = gi.number_entry;
 	unzGoToFirstFile(uf);
 
 	for (i = 0; i < gi.number_entry; i++)
@@ -1717,7 +1973,7 @@ static pack_t *FS_LoadZipFile( char *zipfile, const char *basename )
 			break;
 		}
 		if (file_info.uncompressed_size > 0) {
-			fs_headerLongs[fs_numHeaderLongs++] = LittleLong(file_info.crc);
+			pack->headerLongs[pack->numHeaderLongs++] = LittleLong(file_info.crc);
 		}
 		Q_strlwr( filename_inzip );
 		hash = FS_HashFileName(filename_inzip, pack->hashSize);
@@ -1732,14 +1988,474 @@ static pack_t *FS_LoadZipFile( char *zipfile, const char *basename )
 		unzGoToNextFile(uf);
 	}
 
-	pack->checksum = Com_BlockChecksum( &fs_headerLongs[ 1 ], 4 * ( fs_numHeaderLongs - 1 ) );
-	pack->pure_checksum = Com_BlockChecksum( fs_headerLongs, 4 * fs_numHeaderLongs );
-	pack->checksum = LittleLong( pack->checksum );
-	pack->pure_checksum = LittleLong( pack->pure_checksum );
+	// only a complete directory goes in the index
+	if ( i == gi.number_entry ) {
+		pack->fileSize = 0;
+	}
+
+	return pack;
+}
+
+/*
+=================================================================================
+
+PK3 INDEX
+
+What FS_ScanZipFile reads from every pk3 is saved in pk3index.dat in
+fs_homepath, and a pk3 with the same path, size and modification time as a
+record there is set up from the record, without walking its central
+directory.  The index is read in one go on the first FS_Startup.
+
+Loaded packs are also kept over an FS_Restart, and taken back as they are
+if their file hasn't changed, so a map change on a pure server only has to
+work out the new pure checksums.
+
+Records are native byte order:
+	pk3IndexRecord_t
+	path, padded to 4
+	unsigned int	pos[numfiles]
+	int				headerLongs[numHeaderLongs], the crcs without the feed
+	char			names[namesLen], numfiles lowercase names
+	zeros to pad the record to 4
+=================================================================================
+*/
+
+#define	PK3INDEX_NAME		"pk3index.dat"
+#define	PK3INDEX_IDENT		(('X'<<24)+('I'<<16)+('K'<<8)+'P')
+#define	PK3INDEX_VERSION	2
+
+typedef struct {
+	int		ident;
+	int		version;
+	int		numRecords;
+} pk3IndexHeader_t;
+
+typedef struct {
+	int		recordSize;			// this header included
+	int		fileSize;
+	int		fileTime;
+	int		numfiles;
+	int		numHeaderLongs;
+	int		namesLen;
+	int		pathLen;			// padded length of the path
+} pk3IndexRecord_t;
+
+static byte			*fs_pk3Index;			// the whole file, NULL if not read yet
+static int			fs_pk3IndexSize;
+static qboolean		fs_pk3IndexRead;
+static qboolean		fs_pk3IndexDirty;		// a pack wasn't found in the index
+static pack_t		*fs_retainedPacks;		// from before the FS_Restart
+static int			fs_reusedPacks, fs_indexedPacks, fs_scannedPacks;
+
+/*
+=================
+FS_Pk3IndexPath
+=================
+*/
+static char *FS_Pk3IndexPath( void )
+{
+	char	*ospath;
+
+	ospath = FS_BuildOSPath( fs_homepath->string, PK3INDEX_NAME, "" );
+	ospath[strlen(ospath)-1] = '\0';
+	return ospath;
+}
+
+/*
+=================
+FS_CheckPk3IndexRecord
+
+qtrue if the record fits in the index and is consistent
+=================
+*/
+static qboolean FS_CheckPk3IndexRecord( const pk3IndexRecord_t *rec, int left )
+{
+	const char	*names;
+	int			i, size;
+
+	if ( left < sizeof( *rec ) || rec->recordSize < sizeof( *rec ) || rec->recordSize > left
+		|| ( rec->recordSize & 3 ) ) {
+		return qfalse;
+	}
+	if ( rec->numfiles < 0 || rec->numHeaderLongs < 0 || rec->numHeaderLongs > rec->numfiles
+		|| rec->namesLen < rec->numfiles || rec->pathLen <= 0 || ( rec->pathLen & 3 ) ) {
+		return qfalse;
+	}
+	size = sizeof( *rec ) + rec->pathLen + 4 * rec->numfiles + 4 * rec->numHeaderLongs + rec->namesLen;
+	if ( PAD( size, 4 ) != rec->recordSize ) {
+		return qfalse;
+	}
+
+	// the path and the names have to be terminated
+	if ( ((const char *)( rec + 1 ))[rec->pathLen - 1] ) {
+		return qfalse;
+	}
+	names = (const char *)( rec + 1 ) + rec->pathLen + 4 * rec->numfiles + 4 * rec->numHeaderLongs;
+	for ( i = 0, size = 0 ; i < rec->namesLen ; i++ ) {
+		if ( !names[i] ) {
+			size++;
+		}
+	}
+	if ( size != rec->numfiles || names[rec->namesLen - 1] ) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+=================
+FS_ReadPk3Index
+=================
+*/
+static void FS_ReadPk3Index( void )
+{
+	pk3IndexHeader_t	*header;
+	FILE				*f;
+	int					i, ofs, len;
+
+	fs_pk3IndexRead = qtrue;
+
+	f = fopen( FS_Pk3IndexPath(), "rb" );
+	if ( !f ) {
+		return;
+	}
+	fseek( f, 0, SEEK_END );
+	len = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	if ( len < sizeof( pk3IndexHeader_t ) ) {
+		fclose( f );
+		return;
+	}
+
+	fs_pk3Index = Z_Malloc( len );
+	fs_pk3IndexSize = len;
+	if ( fread( fs_pk3Index, 1, len, f ) != len ) {
+		len = 0;
+	}
+	fclose( f );
 
-	Z_Free(fs_headerLongs);
+	// throw away anything that doesn't check out
+	header = (pk3IndexHeader_t *)fs_pk3Index;
+	if ( len && header->ident == PK3INDEX_IDENT && header->version == PK3INDEX_VERSION ) {
+		ofs = sizeof( *header );
+		for ( i = 0 ; i < header->numRecords ; i++ ) {
+			if ( !FS_CheckPk3IndexRecord( (pk3IndexRecord_t *)( fs_pk3Index + ofs ), len - ofs ) ) {
+				break;
+			}
+			ofs += ((pk3IndexRecord_t *)( fs_pk3Index + ofs ))->recordSize;
+		}
+		if ( i == header->numRecords && ofs == len ) {
+			return;
+		}
+	}
+
+	Com_Printf( "Ignoring a bad %s\n", PK3INDEX_NAME );
+	Z_Free( fs_pk3Index );
+	fs_pk3Index = NULL;
+	fs_pk3IndexSize = 0;
+}
+
+/*
+=================
+FS_FindPk3IndexRecord
+=================
+*/
+static pk3IndexRecord_t *FS_FindPk3IndexRecord( const char *zipfile, int fileSize, int fileTime )
+{
+	pk3IndexRecord_t	*rec;
+	int					i, ofs;
+
+	if ( !fs_pk3Index ) {
+		return NULL;
+	}
+
+	ofs = sizeof( pk3IndexHeader_t );
+	for ( i = 0 ; i < ((pk3IndexHeader_t *)fs_pk3Index)->numRecords ; i++ ) {
+		rec = (pk3IndexRecord_t *)( fs_pk3Index + ofs );
+		if ( rec->fileSize == fileSize && rec->fileTime == fileTime && !strcmp( (char *)( rec + 1 ), zipfile ) ) {
+			return rec;
+		}
+		ofs += rec->recordSize;
+	}
+	return NULL;
+}
+
+/*
+=================
+FS_IndexedPack
+
+Sets up a pack from its record in the index
+=================
+*/
+static pack_t *FS_IndexedPack( const char *zipfile, const char *basename, int fileSize, int fileTime )
+{
+	pk3IndexRecord_t	*rec;
+	pack_t				*pack;
+	unzFile				uf;
+	unz_global_info		gi;
+	const unsigned int	*pos;
+	fileInPack_t		*buildBuffer;
+	char				*namePtr;
+	long				hash;
+	int					i;
+
+	rec = FS_FindPk3IndexRecord( zipfile, fileSize, fileTime );
+	if ( !rec ) {
+		return NULL;
+	}
+
+	// opening only reads the end of the central directory
+	uf = unzOpen( zipfile );
+	if ( unzGetGlobalInfo( uf, &gi ) != UNZ_OK || gi.number_entry != rec->numfiles ) {
+		if ( uf ) {
+			unzClose( uf );
+		}
+		return NULL;
+	}
+
+	pack = FS_AllocPack( zipfile, basename, rec->numfiles, rec->namesLen );
+	pack->handle = uf;
+	pack->fileSize = fileSize;
+	pack->fileTime = fileTime;
+
+	pos = (const unsigned int *)( (byte *)( rec + 1 ) + rec->pathLen );
+	Com_Memcpy( pack->headerLongs + 1, pos + rec->numfiles, rec->numHeaderLongs * 4 );
+	pack->numHeaderLongs = 1 + rec->numHeaderLongs;
+
+	buildBuffer = pack->buildBuffer;
+	namePtr = ((char *) buildBuffer) + rec->numfiles * sizeof( fileInPack_t );
+	Com_Memcpy( namePtr, pos + rec->numfiles + rec->numHeaderLongs, rec->namesLen );
+
+	for ( i = 0 ; i < rec->numfiles ; i++ ) {
+		hash = FS_HashFileName( namePtr, pack->hashSize );
+		buildBuffer[i].name = namePtr;
+		buildBuffer[i].pos = pos[i];
+		buildBuffer[i].next = pack->hashTable[hash];
+		pack->hashTable[hash] = &buildBuffer[i];
+		namePtr += strlen( namePtr ) + 1;
+	}
+
+	return pack;
+}
+
+/*
+=================
+FS_RetainedPack
+
+Takes back a pack from before the FS_Restart if its file is unchanged
+=================
+*/
+static pack_t *FS_RetainedPack( const char *zipfile, int fileSize, int fileTime )
+{
+	pack_t	*pack, **prev;
+
+	for ( prev = &fs_retainedPacks ; *prev ; prev = &(*prev)->next ) {
+		pack = *prev;
+		if ( strcmp( pack->pakFilename, zipfile ) ) {
+			continue;
+		}
+		*prev = pack->next;
+		if ( pack->fileSize != fileSize || pack->fileTime != fileTime ) {
+			FS_FreePack( pack );
+			return NULL;
+		}
+		pack->next = NULL;
+		pack->referenced = 0;
+		return pack;
+	}
+	return NULL;
+}
+
+/*
+=================
+FS_FreeRetainedPacks
+=================
+*/
+static void FS_FreeRetainedPacks( void )
+{
+	pack_t	*pack;
+
+	while ( fs_retainedPacks ) {
+		pack = fs_retainedPacks;
+		fs_retainedPacks = pack->next;
+		FS_FreePack( pack );
+	}
+}
+
+/*
+=================
+FS_WritePk3IndexRecord
+=================
+*/
+static void FS_WritePk3IndexRecord( FILE *f, const pack_t *pack )
+{
+	pk3IndexRecord_t	rec;
+	unsigned int		*pos;
+	const char			*names;
+	char				path[MAX_OSPATH + 4];
+	static const char	zeros[4];
+	int					i, pad;
+
+	Com_Memset( path, 0, sizeof( path ) );
+	Q_strncpyz( path, pack->pakFilename, sizeof( path ) );
+
+	names = (const char *)( pack->buildBuffer + pack->numfiles );
+	rec.fileSize = pack->fileSize;
+	rec.fileTime = pack->fileTime;
+	rec.numfiles = pack->numfiles;
+	rec.numHeaderLongs = pack->numHeaderLongs - 1;
+	rec.namesLen = 0;
+	for ( i = 0 ; i < pack->numfiles ; i++ ) {
+		rec.namesLen += strlen( names + rec.namesLen ) + 1;
+	}
+	rec.pathLen = ( strlen( path ) + 4 ) & ~3;
+	rec.recordSize = sizeof( rec ) + rec.pathLen + 4 * rec.numfiles + 4 * rec.numHeaderLongs + rec.namesLen;
+
+	// the next record has to start aligned for the ints in it to be read in place
+	pad = PAD( rec.recordSize, 4 ) - rec.recordSize;
+	rec.recordSize += pad;
+
+	pos = Z_Malloc( pack->numfiles * sizeof( *pos ) + 1 );
+	for ( i = 0 ; i < pack->numfiles ; i++ ) {
+		pos[i] = pack->buildBuffer[i].pos;
+	}
+
+	fwrite( &rec, sizeof( rec ), 1, f );
+	fwrite( path, rec.pathLen, 1, f );
+	fwrite( pos, 4, rec.numfiles, f );
+	fwrite( pack->headerLongs + 1, 4, rec.numHeaderLongs, f );
+	fwrite( names, 1, rec.namesLen, f );
+	fwrite( zeros, 1, pad, f );
+
+	Z_Free( pos );
+}
+
+/*
+=================
+FS_WritePk3Index
+
+Writes a record for every loaded pack, and keeps the records of the pk3
+files that are still there but weren't loaded this time
+=================
+*/
+static void FS_WritePk3Index( void )
+{
+	pk3IndexHeader_t	header;
+	pk3IndexRecord_t	*rec;
+	searchpath_t		*search;
+	FILE				*f;
+	char				*ospath;
+	int					i, ofs, fileSize, fileTime;
+
+	ospath = FS_Pk3IndexPath();
+	if ( FS_CreatePath( ospath ) ) {
+		return;
+	}
+	f = fopen( ospath, "wb" );
+	if ( !f ) {
+		Com_Printf( "Couldn't write %s\n", ospath );
+		return;
+	}
+
+	header.ident = PK3INDEX_IDENT;
+	header.version = PK3INDEX_VERSION;
+	header.numRecords = 0;
+	fwrite( &header, sizeof( header ), 1, f );
+
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		if ( search->pack && search->pack->fileSize != -1 ) {
+			FS_WritePk3IndexRecord( f, search->pack );
+			header.numRecords++;
+		}
+	}
+
+	if ( fs_pk3Index ) {
+		ofs = sizeof( pk3IndexHeader_t );
+		for ( i = 0 ; i < ((pk3IndexHeader_t *)fs_pk3Index)->numRecords ; i++ ) {
+			rec = (pk3IndexRecord_t *)( fs_pk3Index + ofs );
+			ofs += rec->recordSize;
+
+			for ( search = fs_searchpaths ; search ; search = search->next ) {
+				if ( search->pack && !strcmp( search->pack->pakFilename, (char *)( rec + 1 ) ) ) {
+					break;
+				}
+			}
+			if ( search ) {
+				continue;
+			}
+			if ( !Sys_FileStat( (char *)( rec + 1 ), &fileSize, &fileTime )
+				|| fileSize != rec->fileSize || fileTime != rec->fileTime ) {
+				continue;
+			}
+			fwrite( rec, rec->recordSize, 1, f );
+			header.numRecords++;
+		}
+	}
+
+	fseek( f, 0, SEEK_SET );
+	fwrite( &header, sizeof( header ), 1, f );
+	fclose( f );
+
+	// read the new one if there's another startup without a restart
+	if ( fs_pk3Index ) {
+		Z_Free( fs_pk3Index );
+		fs_pk3Index = NULL;
+		fs_pk3IndexSize = 0;
+	}
+	fs_pk3IndexRead = qfalse;
+	fs_pk3IndexDirty = qfalse;
+}
+
+/*
+=================
+FS_LoadZipFile
+
+Creates a new pak_t in the search chain for the contents
+of a zip file.
+=================
+*/
+static pack_t *FS_LoadZipFile( char *zipfile, const char *basename )
+{
+	pack_t			*pack;
+	int				fileSize, fileTime;
+
+	pack = NULL;
+	if ( Sys_FileStat( zipfile, &fileSize, &fileTime ) ) {
+		pack = FS_RetainedPack( zipfile, fileSize, fileTime );
+		if ( pack ) {
+			fs_reusedPacks++;
+		} else {
+			if ( !fs_pk3IndexRead ) {
+				FS_ReadPk3Index();
+			}
+			pack = FS_IndexedPack( zipfile, basename, fileSize, fileTime );
+			if ( pack ) {
+				fs_indexedPacks++;
+			}
+		}
+	} else {
+		fileSize = -1;
+		fileTime = 0;
+	}
+
+	if ( !pack ) {
+		pack = FS_ScanZipFile( zipfile, basename );
+		if ( !pack ) {
+			return NULL;
+		}
+		fs_scannedPacks++;
+		if ( pack->fileSize != -1 && fileSize != -1 ) {
+			pack->fileSize = fileSize;
+			pack->fileTime = fileTime;
+			fs_pk3IndexDirty = qtrue;
+		} else {
+			pack->fileSize = -1;
+		}
+	}
+
+	fs_packFiles += pack->numfiles;
+	FS_PackChecksums( pack );
 
-	pack->buildBuffer = buildBuffer;
 	return pack;
 }
 
@@ -2640,9 +3356,13 @@ void FS_Shutdown( qboolean closemfp ) {
 		next = p->next;
 
 		if ( p->pack ) {
-			unzClose(p->pack->handle);
-			Z_Free( p->pack->buildBuffer );
-			Z_Free( p->pack );
+			// keep it for FS_Startup unless this is the end
+			if ( closemfp ) {
+				FS_FreePack( p->pack );
+			} else {
+				p->pack->next = fs_retainedPacks;
+				fs_retainedPacks = p->pack;
+			}
 		}
 		if ( p->dir ) {
 			Z_Free( p->dir );
@@ -2652,6 +3372,11 @@ void FS_Shutdown( qboolean closemfp ) {
 
 	// any FS_ calls will now be an error until reinitialized
 	fs_searchpaths = NULL;
+	FS_FreeFileIndex();
+
+	if ( closemfp ) {
+		FS_FreeRetainedPacks();
+	}
 
 	Cmd_RemoveCommand( "path" );
 	Cmd_RemoveCommand( "dir" );
@@ -2706,6 +3431,10 @@ static void FS_ReorderPurePaks( void )
 			p_previous = &s->next;
 		}
 	}
+
+	if ( fs_reordered ) {
+		FS_BuildFileIndex();
+	}
 }
 
 /*
@@ -2717,10 +3446,12 @@ static void FS_Startup( const char *gameName )
 {
 	const char *homePath;
 	cvar_t	*fs;
+	int		startTime;
 
 	Com_Printf( "----- FS_Startup -----\n" );
 
 	fs_debug = Cvar_Get( "fs_debug", "0", 0 );
+	fs_mmap = Cvar_Get( "fs_mmap", "1", 0 );
 	fs_basepath = Cvar_Get ("fs_basepath", Sys_DefaultInstallPath(), CVAR_INIT );
 	fs_basegame = Cvar_Get ("fs_basegame", "", CVAR_INIT );
 	homePath = Sys_DefaultHomePath();
@@ -2730,6 +3461,10 @@ static void FS_Startup( const char *gameName )
 	fs_homepath = Cvar_Get ("fs_homepath", homePath, CVAR_INIT );
 	fs_gamedirvar = Cvar_Get ("fs_game", "q3ut4", CVAR_INIT|CVAR_SYSTEMINFO );
 
+	fs_packFiles = 0;
+	fs_reusedPacks = fs_indexedPacks = fs_scannedPacks = 0;
+	startTime = Sys_Milliseconds();
+
 	// add search path elements in reverse priority order
 	if (fs_basepath->string[0]) {
 		FS_AddGameDirectory( fs_basepath->string, gameName );
@@ -2768,6 +3503,14 @@ static void FS_Startup( const char *gameName )
 		}
 	}
 
+	FS_BuildFileIndex();
+
+	// whatever wasn't taken back is gone or changed
+	FS_FreeRetainedPacks();
+	if ( fs_pk3IndexDirty ) {
+		FS_WritePk3Index();
+	}
+
 	Com_ReadCDKey(BASEGAME);
 	fs = Cvar_Get ("fs_game", "", CVAR_INIT|CVAR_SYSTEMINFO );
 	if (fs && fs->string[0] != 0) {
@@ -2797,6 +3540,8 @@ static void FS_Startup( const char *gameName )
 	}
 #endif
 	Com_Printf( "%d files in pk3 files\n", fs_packFiles );
+	Com_Printf( "pk3 files: %d kept, %d from %s, %d scanned in %d msec\n", fs_reusedPacks,
+		fs_indexedPacks, PK3INDEX_NAME, fs_scannedPacks, Sys_Milliseconds() - startTime );
 }
 
 /*
@@ -27,41 +27,42 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "q_shared.h"
 #include "qcommon.h"
 
+// bit position used by the stream functions (Huff_Compress / Huff_Decompress);
+// the offset functions keep their position in the caller's variable so the
+// fixed message tree can be shared between threads
 static int			bloc = 0;
 
 void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+	int b = *offset;
+	if ((b&7) == 0) {
+		fout[(b>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(b>>3)] |= bit << (b&7);
+	*offset = b + 1;
 }
 
 int		Huff_getBit( byte *fin, int *offset) {
 	int t;
-	bloc = *offset;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
-	*offset = bloc;
+	int b = *offset;
+	t = (fin[(b>>3)] >> (b&7)) & 0x1;
+	*offset = b + 1;
 	return t;
 }
 
 /* Add a bit to the output file (buffered) */
-static void add_bit (char bit, byte *fout) {
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+static void add_bit (char bit, byte *fout, int *offset) {
+	if ((*offset&7) == 0) {
+		fout[(*offset>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
+	fout[(*offset>>3)] |= bit << (*offset&7);
+	(*offset)++;
 }
 
 /* Receive one bit from the input file (buffered) */
-static int get_bit (byte *fin) {
+static int get_bit (byte *fin, int *offset) {
 	int t;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
+	t = (fin[(*offset>>3)] >> (*offset&7)) & 0x1;
+	(*offset)++;
 	return t;
 }
 
@@ -255,7 +256,7 @@ void Huff_addRef(huff_t* huff, byte ch) {
 /* Get a symbol */
 int Huff_Receive (node_t *node, int *ch, byte *fin) {
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if (get_bit(fin, &bloc)) {
 			node = node->right;
 		} else {
 			node = node->left;
@@ -270,9 +271,9 @@ int Huff_Receive (node_t *node, int *ch, byte *fin) {
 
 /* Get a symbol */
 void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
-	bloc = *offset;
+	int b = *offset;
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if (get_bit(fin, &b)) {
 			node = node->right;
 		} else {
 			node = node->left;
@@ -284,19 +285,19 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
 //		Com_Error(ERR_DROP, "Illegal tree!\n");
 	}
 	*ch = node->symbol;
-	*offset = bloc;
+	*offset = b;
 }
 
 /* Send the prefix code for this node */
-static void send(node_t *node, node_t *child, byte *fout) {
+static void send(node_t *node, node_t *child, byte *fout, int *offset) {
 	if (node->parent) {
-		send(node->parent, node, fout);
+		send(node->parent, node, fout, offset);
 	}
 	if (child) {
 		if (node->right == child) {
-			add_bit(1, fout);
+			add_bit(1, fout, offset);
 		} else {
-			add_bit(0, fout);
+			add_bit(0, fout, offset);
 		}
 	}
 }
@@ -308,17 +309,131 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout) {
 		/* node_t hasn't been transmitted, send a NYT, then the symbol */
 		Huff_transmit(huff, NYT, fout);
 		for (i = 7; i >= 0; i--) {
-			add_bit((char)((ch >> i) & 0x1), fout);
+			add_bit((char)((ch >> i) & 0x1), fout, &bloc);
 		}
 	} else {
-		send(huff->loc[ch], NULL, fout);
+		send(huff->loc[ch], NULL, fout, &bloc);
 	}
 }
 
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout);
-	*offset = bloc;
+	send(huff->loc[ch], NULL, fout, offset);
+}
+
+/*
+==================
+Huff_BuildCodes
+
+Flattens a tree that won't be updated anymore into code tables
+==================
+*/
+void Huff_BuildCodes( huffman_t *huff, huffCodes_t *codes ) {
+	int				ch, n, i;
+	unsigned int	code;
+	node_t			*node;
+
+	Com_Memset( codes, 0, sizeof( *codes ) );
+	codes->compressor = &huff->compressor;
+	codes->tree = huff->decompressor.tree;
+
+	// the codes are sent from the root down
+	for ( ch = 0 ; ch <= HMAX ; ch++ ) {
+		node = huff->compressor.loc[ch];
+		if ( !node ) {
+			continue;
+		}
+		code = 0;
+		for ( n = 0 ; node->parent ; node = node->parent, n++ ) {
+			if ( n == 32 ) {
+				break;
+			}
+			code = ( code << 1 ) | ( node->parent->right == node );
+		}
+		if ( !node->parent && n ) {
+			codes->code[ch] = code;
+			codes->length[ch] = n;
+		}
+	}
+
+	// every lookup index that starts with a short enough code decodes to it
+	for ( ch = 0 ; ch <= HMAX ; ch++ ) {
+		node = huff->decompressor.loc[ch];
+		if ( !node ) {
+			continue;
+		}
+		code = 0;
+		for ( n = 0 ; node->parent ; node = node->parent, n++ ) {
+			if ( n == HUFF_LOOKUP_BITS ) {
+				break;
+			}
+			code = ( code << 1 ) | ( node->parent->right == node );
+		}
+		if ( node->parent || !n ) {
+			continue;
+		}
+		for ( i = 0 ; i < 1 << ( HUFF_LOOKUP_BITS - n ) ; i++ ) {
+			codes->lookup[ code | ( i << n ) ] = ch | ( n << 9 );
+		}
+	}
+}
+
+/*
+==================
+Huff_offsetReceiveCode
+
+size is the byte size of fin, the lookup peeks further than the tree walk
+==================
+*/
+void Huff_offsetReceiveCode( const huffCodes_t *codes, int *ch, byte *fin, int *offset, int size ) {
+	int				b, entry;
+	unsigned int	peek;
+
+	b = *offset;
+	if ( ( b >> 3 ) + 2 < size ) {
+		peek = fin[b >> 3] | ( fin[(b >> 3) + 1] << 8 ) | ( fin[(b >> 3) + 2] << 16 );
+		entry = codes->lookup[ ( peek >> (b & 7) ) & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 ) ];
+		if ( entry >> 9 ) {
+			*ch = entry & 0x1ff;
+			*offset = b + ( entry >> 9 );
+			return;
+		}
+	}
+
+	Huff_offsetReceive( codes->tree, ch, fin, offset );
+}
+
+/*
+==================
+Huff_offsetTransmitCode
+==================
+*/
+void Huff_offsetTransmitCode( const huffCodes_t *codes, int ch, byte *fout, int *offset ) {
+	int				b, n, take;
+	unsigned int	code;
+
+	n = codes->length[ch];
+	if ( !n ) {
+		Huff_offsetTransmit( codes->compressor, ch, fout, offset );
+		return;
+	}
+
+	// a byte is cleared when its first bit is written, like Huff_putBit does
+	code = codes->code[ch];
+	b = *offset;
+	while ( n > 0 ) {
+		take = 8 - ( b & 7 );
+		if ( take > n ) {
+			take = n;
+		}
+		if ( ( b & 7 ) == 0 ) {
+			fout[b >> 3] = 0;
+		}
+		fout[b >> 3] |= ( code & ( ( 1 << take ) - 1 ) ) << ( b & 7 );
+		code >>= take;
+		b += take;
+		n -= take;
+	}
+	*offset = b;
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
@@ -361,7 +476,7 @@ void Huff_Decompress(msg_t *mbuf, int offset) {
 		if ( ch == NYT ) {								/* We got a NYT, get the symbol associated with it */
 			ch = 0;
 			for ( i = 0; i < 8; i++ ) {
-				ch = (ch<<1) + get_bit(buffer);
+				ch = (ch<<1) + get_bit(buffer, &bloc);
 			}
 		}
     
@@ -373,8 +488,6 @@ void Huff_Decompress(msg_t *mbuf, int offset) {
 	Com_Memcpy(mbuf->data + offset, seq, cch);
 }
 
-extern 	int oldsize;
-
 void Huff_Compress(msg_t *mbuf, int offset) {
 	int			i, ch, size;
 	byte		seq[65536];
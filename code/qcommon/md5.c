@@ -253,7 +253,7 @@ static void MD5Final(struct MD5Context *ctx, unsigned char *digest)
     
     if (digest!=NULL)
 	    memcpy(digest, ctx->buf, 16);
-    memset(ctx, 0, sizeof(ctx));	/* In case it's sensitive */
+    memset(ctx, 0, sizeof(*ctx));	/* In case it's sensitive */
 }
 
 
@@ -308,3 +308,42 @@ char *Com_MD5File( const char *fn, int length, const char *prefix, int prefix_le
 	}
 	return final;
 }
+
+/*
+==================
+Com_MD5HMAC
+
+RFC 2104 HMAC-MD5 of data under key
+==================
+*/
+void Com_MD5HMAC( const byte *key, int keylen, const byte *data, int len, byte digest[16] )
+{
+	MD5_CTX md5;
+	byte pad[64];
+	byte keyDigest[16];
+	int i;
+
+	if( keylen > sizeof( pad ) ) {
+		MD5Init( &md5 );
+		MD5Update( &md5, key, keylen );
+		MD5Final( &md5, keyDigest );
+		key = keyDigest;
+		keylen = sizeof( keyDigest );
+	}
+
+	Com_Memset( pad, 0x36, sizeof( pad ) );
+	for( i = 0; i < keylen; i++ )
+		pad[i] ^= key[i];
+	MD5Init( &md5 );
+	MD5Update( &md5, pad, sizeof( pad ) );
+	MD5Update( &md5, data, len );
+	MD5Final( &md5, digest );
+
+	Com_Memset( pad, 0x5c, sizeof( pad ) );
+	for( i = 0; i < keylen; i++ )
+		pad[i] ^= key[i];
+	MD5Init( &md5 );
+	MD5Update( &md5, pad, sizeof( pad ) );
+	MD5Update( &md5, digest, 16 );
+	MD5Final( &md5, digest );
+}
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "qcommon.h"
 
 static huffman_t		msgHuff;
+static huffCodes_t		msgHuffCodes;		// msgHuff doesn't change after MSG_initHuffman
 
 static qboolean			msgInit = qfalse;
 
@@ -37,8 +38,6 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
-int oldsize = 0;
-
 void MSG_initHuffman( void );
 
 void MSG_Init( msg_t *buf, byte *data, int length ) {
@@ -101,30 +100,46 @@ bit functions
 =============================================================================
 */
 
-int	overflows;
-
-// negative bit values include signs
-void MSG_WriteBits( msg_t *msg, int value, int bits ) {
-	int	i;
-//	FILE*	fp;
-
-	oldsize += bits;
+/*
+==================
+MSG_WriteError
 
-	// this isn't an exact overflow check, but close enough
-	if ( msg->maxsize - msg->cursize < 4 ) {
-		msg->overflowed = qtrue;
-		return;
+The snapshot threads can't Com_Error, so a message with deferErrors set
+keeps its first error and is marked overflowed, for the thread that owns
+it to raise the error once the workers are done
+==================
+*/
+static void MSG_WriteError( msg_t *msg, int code, const char *fmt, int value ) {
+	if ( !msg->deferErrors ) {
+		Com_Error( code, fmt, value );
 	}
+	if ( !msg->error ) {
+		msg->errorCode = code;
+		msg->error = fmt;
+		msg->errorValue = value;
+	}
+	msg->overflowed = qtrue;
+}
 
+/*
+==================
+MSG_CheckBits
+
+Counts values that don't fit in bits, qfalse if bits itself is bad
+and nothing may be written
+==================
+*/
+static qboolean MSG_CheckBits( msg_t *msg, int value, int bits ) {
 	if ( bits == 0 || bits < -31 || bits > 32 ) {
-		Com_Error( ERR_DROP, "MSG_WriteBits: bad bits %i", bits );
+		MSG_WriteError( msg, ERR_DROP, "MSG_WriteBits: bad bits %i", bits );
+		return qfalse;
 	}
 
 	// check for overflows
 	if ( bits != 32 ) {
 		if ( bits > 0 ) {
 			if ( value > ( ( 1 << bits ) - 1 ) || value < 0 ) {
-				overflows++;
+				msg->overflows++;
 			}
 		} else {
 			int	r;
@@ -132,53 +147,330 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 			r = 1 << (bits-1);
 
 			if ( value >  r - 1 || value < -r ) {
-				overflows++;
+				msg->overflows++;
 			}
 		}
 	}
+
+	return qtrue;
+}
+
+/*
+=============================================================================
+
+buffered bit writer
+
+MSG_WriteBits stores every bit and huffman code straight into the message.
+A bitWriter_t collects them in a 64 bit accumulator instead and only stores
+whole bytes, so a run of writes like a delta entity touches each byte once.
+The bits produced are exactly those of the same MSG_WriteBits calls.  The
+message bit position isn't valid again until MSG_EndBitWriter.
+
+=============================================================================
+*/
+
+typedef struct {
+	msg_t		*msg;
+	uint64_t	bits;		// pending bits, first bit in the lsb
+	int			count;		// number of pending bits
+	int			offset;		// byte aligned bit position of the pending bits
+	qboolean	written;
+} bitWriter_t;
+
+/*
+==================
+MSG_BeginBitWriter
+
+A partial byte at the current position is pulled back into the
+accumulator so the stores stay byte aligned.
+==================
+*/
+static void MSG_BeginBitWriter( bitWriter_t *w, msg_t *msg ) {
+	int		o;
+
+	w->msg = msg;
+	w->written = qfalse;
+	w->offset = msg->bit & ~7;
+	o = msg->bit & 7;
+	if ( o && !msg->oob ) {
+		w->bits = msg->data[msg->bit >> 3] & ( ( 1 << o ) - 1 );
+	} else {
+		w->bits = 0;
+	}
+	w->count = o;
+}
+
+/*
+==================
+MSG_FlushBitWriter
+
+Stores the whole bytes of the accumulator.  With room past the end the
+accumulator goes out in one store, which also writes the partial byte.
+==================
+*/
+static void MSG_FlushBitWriter( bitWriter_t *w ) {
+	msg_t	*msg;
+	byte	*p;
+	int		n, i;
+
+	msg = w->msg;
+	n = w->count >> 3;
+	if ( !n ) {
+		return;
+	}
+
+	p = msg->data + ( w->offset >> 3 );
+#ifdef Q3_LITTLE_ENDIAN
+	if ( ( w->offset >> 3 ) + 8 <= msg->maxsize ) {
+		Com_Memcpy( p, &w->bits, 8 );
+	} else
+#endif
+	{
+		for ( i = 0 ; i < n ; i++ ) {
+			p[i] = (byte)( w->bits >> ( i * 8 ) );
+		}
+	}
+
+	w->bits = n == 8 ? 0 : w->bits >> ( n * 8 );
+	w->count -= n * 8;
+	w->offset += n * 8;
+}
+
+/*
+==================
+MSG_EndBitWriter
+
+The bits above the end are zero, like Huff_putBit leaves them.
+==================
+*/
+static void MSG_EndBitWriter( bitWriter_t *w ) {
+	msg_t	*msg;
+
+	msg = w->msg;
+	if ( msg->oob || !w->written ) {
+		return;
+	}
+
+	MSG_FlushBitWriter( w );
+	if ( w->count ) {
+		msg->data[w->offset >> 3] = (byte)w->bits;
+	}
+	msg->bit = w->offset + w->count;
+	msg->cursize = ( msg->bit >> 3 ) + 1;
+}
+
+/*
+==================
+MSG_PutBits
+==================
+*/
+static ID_INLINE void MSG_PutBits( bitWriter_t *w, unsigned int value, int bits ) {
+	if ( w->count + bits > 64 ) {
+		MSG_FlushBitWriter( w );
+	}
+	w->bits |= (uint64_t)value << w->count;
+	w->count += bits;
+}
+
+/*
+==================
+MSG_PutCode
+
+Codes the table doesn't hold go through the tree on the message itself.
+==================
+*/
+static void MSG_PutCode( bitWriter_t *w, int ch ) {
+	int		n;
+
+	n = msgHuffCodes.length[ch];
+	if ( n ) {
+		MSG_PutBits( w, msgHuffCodes.code[ch], n );
+		return;
+	}
+
+	MSG_EndBitWriter( w );
+	Huff_offsetTransmit( msgHuffCodes.compressor, ch, w->msg->data, &w->msg->bit );
+	w->msg->cursize = ( w->msg->bit >> 3 ) + 1;
+	MSG_BeginBitWriter( w, w->msg );
+	w->written = qtrue;
+}
+
+/*
+==================
+MSG_WriteBitsTo
+
+MSG_WriteBits through a bit writer, including its overflow check.
+==================
+*/
+static void MSG_WriteBitsTo( bitWriter_t *w, int value, int bits ) {
+	msg_t	*msg;
+	int		cursize;
+
+	msg = w->msg;
+	if ( msg->oob ) {
+		MSG_WriteBits( msg, value, bits );
+		return;
+	}
+
+	msg->oldsize += bits;
+
+	// same check as MSG_WriteBits against the cursize it would have
+	cursize = w->written ? ( ( w->offset + w->count ) >> 3 ) + 1 : msg->cursize;
+	if ( msg->maxsize - cursize < 4 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+	w->written = qtrue;
+
+	// most fields are flags and bytes
+	if ( bits == 1 ) {
+		if ( value & ~1 ) {
+			msg->overflows++;
+		}
+		MSG_PutBits( w, value & 1, 1 );
+		return;
+	}
+	if ( bits == 8 ) {
+		if ( value & ~0xff ) {
+			msg->overflows++;
+		}
+		MSG_PutCode( w, value & 0xff );
+		return;
+	}
+
+	if ( !MSG_CheckBits( msg, value, bits ) ) {
+		return;
+	}
 	if ( bits < 0 ) {
 		bits = -bits;
 	}
-	if (msg->oob) {
-		if (bits==8) {
-			msg->data[msg->cursize] = value;
-			msg->cursize += 1;
-			msg->bit += 8;
-		} else if (bits==16) {
-			unsigned short *sp = (unsigned short *)&msg->data[msg->cursize];
-			*sp = LittleShort(value);
-			msg->cursize += 2;
-			msg->bit += 16;
-		} else if (bits==32) {
-			unsigned int *ip = (unsigned int *)&msg->data[msg->cursize];
-			*ip = LittleLong(value);
-			msg->cursize += 4;
-			msg->bit += 32;
-		} else {
-			Com_Error(ERR_DROP, "can't read %d bits\n", bits);
-		}
+
+	value &= (0xffffffff>>(32-bits));
+	if ( bits & 7 ) {
+		MSG_PutBits( w, value & ( ( 1 << ( bits & 7 ) ) - 1 ), bits & 7 );
+		value = (unsigned int)value >> ( bits & 7 );
+		bits -= bits & 7;
+	}
+	for ( ; bits > 0 ; bits -= 8 ) {
+		MSG_PutCode( w, value & 0xff );
+		value = (unsigned int)value >> 8;
+	}
+}
+
+// negative bit values include signs
+void MSG_WriteBits( msg_t *msg, int value, int bits ) {
+	bitWriter_t	w;
+
+	if ( !msg->oob ) {
+		MSG_BeginBitWriter( &w, msg );
+		MSG_WriteBitsTo( &w, value, bits );
+		MSG_EndBitWriter( &w );
+		return;
+	}
+
+	msg->oldsize += bits;
+
+	// this isn't an exact overflow check, but close enough
+	if ( msg->maxsize - msg->cursize < 4 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	if ( !MSG_CheckBits( msg, value, bits ) ) {
+		return;
+	}
+	if ( bits < 0 ) {
+		bits = -bits;
+	}
+	if (bits==8) {
+		msg->data[msg->cursize] = value;
+		msg->cursize += 1;
+		msg->bit += 8;
+	} else if (bits==16) {
+		unsigned short *sp = (unsigned short *)&msg->data[msg->cursize];
+		*sp = LittleShort(value);
+		msg->cursize += 2;
+		msg->bit += 16;
+	} else if (bits==32) {
+		unsigned int *ip = (unsigned int *)&msg->data[msg->cursize];
+		*ip = LittleLong(value);
+		msg->cursize += 4;
+		msg->bit += 32;
 	} else {
-//		fp = fopen("c:\\netchan.bin", "a");
-		value &= (0xffffffff>>(32-bits));
-		if (bits&7) {
-			int nbits;
-			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				Huff_putBit((value&1), msg->data, &msg->bit);
-				value = (value>>1);
-			}
-			bits = bits - nbits;
+		MSG_WriteError( msg, ERR_DROP, "can't write %d bits", bits );
+	}
+}
+
+/*
+==================
+MSG_WriteEncodedBits
+
+Appends numBits starting at bit of data, which must be the output of
+MSG_WriteBits on another bitstream message.  The huffman codes don't depend
+on where they start, so this gives the same bits as repeating the writes.
+Like MSG_WriteBits the overflow check isn't exact.
+==================
+*/
+void MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bit, int numBits ) {
+	int		n, v, d;
+
+	if ( numBits <= 0 ) {
+		return;
+	}
+
+	if ( msg->maxsize - ( ( msg->bit + numBits ) >> 3 ) - 1 < 4 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	while ( numBits > 0 ) {
+		n = numBits > 8 ? 8 : numBits;
+
+		v = data[bit >> 3] >> (bit & 7);
+		if ( (bit & 7) + n > 8 ) {
+			v |= data[(bit >> 3) + 1] << (8 - (bit & 7));
 		}
-		if (bits) {
-			for(i=0;i<bits;i+=8) {
-//				fwrite(bp, 1, 1, fp);
-				Huff_offsetTransmit (&msgHuff.compressor, (value&0xff), msg->data, &msg->bit);
-				value = (value>>8);
-			}
+		v &= (1 << n) - 1;
+
+		d = msg->bit;
+		if ( (d & 7) == 0 ) {
+			msg->data[d >> 3] = 0;
 		}
-		msg->cursize = (msg->bit>>3)+1;
-//		fclose(fp);
+		msg->data[d >> 3] |= v << (d & 7);
+		if ( (d & 7) + n > 8 ) {
+			msg->data[(d >> 3) + 1] = v >> (8 - (d & 7));
+		}
+
+		msg->bit += n;
+		bit += n;
+		numBits -= n;
+	}
+	msg->cursize = (msg->bit>>3)+1;
+}
+
+/*
+==================
+MSG_PeekBits
+
+Returns at least 57 bits from bit onwards, the caller
+checks that eight bytes are readable.
+==================
+*/
+static ID_INLINE uint64_t MSG_PeekBits( const byte *data, int bit ) {
+	uint64_t	v;
+#ifdef Q3_LITTLE_ENDIAN
+	Com_Memcpy( &v, data + ( bit >> 3 ), 8 );
+#else
+	const byte	*p;
+	int			i;
+
+	p = data + ( bit >> 3 );
+	v = 0;
+	for ( i = 7 ; i >= 0 ; i-- ) {
+		v = ( v << 8 ) | p[i];
 	}
+#endif
+	return v >> ( bit & 7 );
 }
 
 int MSG_ReadBits( msg_t *msg, int bits ) {
@@ -186,7 +478,8 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 	int			get;
 	qboolean	sgn;
 	int			i, nbits;
-//	FILE*	fp;
+	int			used, entry;
+	uint64_t	window;
 
 	value = 0;
 
@@ -216,22 +509,32 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 			Com_Error(ERR_DROP, "can't read %d bits\n", bits);
 		}
 	} else {
-		nbits = 0;
-		if (bits&7) {
-			nbits = bits&7;
+		nbits = bits&7;
+		bits = bits - nbits;
+		i = 0;
+		if ( ( msg->bit >> 3 ) + 8 <= msg->maxsize ) {
+			// decode from one window until a code misses the lookup
+			window = MSG_PeekBits( msg->data, msg->bit );
+			value = window & ( ( 1 << nbits ) - 1 );
+			used = nbits;
+			for ( ; i < bits ; i += 8 ) {
+				entry = msgHuffCodes.lookup[ ( window >> used ) & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 ) ];
+				if ( !( entry >> 9 ) ) {
+					break;
+				}
+				value |= ( entry & 0x1ff ) << ( i + nbits );
+				used += entry >> 9;
+			}
+			msg->bit += used;
+		} else {
 			for(i=0;i<nbits;i++) {
 				value |= (Huff_getBit(msg->data, &msg->bit)<<i);
 			}
-			bits = bits - nbits;
+			i = 0;
 		}
-		if (bits) {
-//			fp = fopen("c:\\netchan.bin", "a");
-			for(i=0;i<bits;i+=8) {
-				Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit);
-//				fwrite(&get, 1, 1, fp);
-				value |= (get<<(i+nbits));
-			}
-//			fclose(fp);
+		for( ; i<bits ; i+=8 ) {
+			Huff_offsetReceiveCode (&msgHuffCodes, &get, msg->data, &msg->bit, msg->maxsize);
+			value |= (get<<(i+nbits));
 		}
 		msg->readcount = (msg->bit>>3)+1;
 	}
@@ -255,7 +558,7 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 void MSG_WriteChar( msg_t *sb, int c ) {
 #ifdef PARANOID
 	if (c < -128 || c > 127)
-		Com_Error (ERR_FATAL, "MSG_WriteChar: range error");
+		MSG_WriteError (sb, ERR_FATAL, "MSG_WriteChar: range error %i", c);
 #endif
 
 	MSG_WriteBits( sb, c, 8 );
@@ -264,7 +567,7 @@ void MSG_WriteChar( msg_t *sb, int c ) {
 void MSG_WriteByte( msg_t *sb, int c ) {
 #ifdef PARANOID
 	if (c < 0 || c > 255)
-		Com_Error (ERR_FATAL, "MSG_WriteByte: range error");
+		MSG_WriteError (sb, ERR_FATAL, "MSG_WriteByte: range error %i", c);
 #endif
 
 	MSG_WriteBits( sb, c, 8 );
@@ -280,7 +583,7 @@ void MSG_WriteData( msg_t *buf, const void *data, int length ) {
 void MSG_WriteShort( msg_t *sb, int c ) {
 #ifdef PARANOID
 	if (c < ((short)0x8000) || c > (short)0x7fff)
-		Com_Error (ERR_FATAL, "MSG_WriteShort: range error");
+		MSG_WriteError (sb, ERR_FATAL, "MSG_WriteShort: range error %i", c);
 #endif
 
 	MSG_WriteBits( sb, c, 16 );
@@ -710,7 +1013,7 @@ void MSG_WriteDeltaUsercmdKey( msg_t *msg, int key, usercmd_t *from, usercmd_t *
 		from->buttons == to->buttons &&
 		from->weapon == to->weapon) {
 			MSG_WriteBits( msg, 0, 1 );				// no change
-			oldsize += 7;
+			msg->oldsize += 7;
 			return;
 	}
 	key ^= to->serverTime;
@@ -872,6 +1175,7 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 	int			trunc;
 	float		fullFloat;
 	int			*fromF, *toF;
+	bitWriter_t	w;
 
 	numFields = sizeof(entityStateFields)/sizeof(entityStateFields[0]);
 
@@ -892,7 +1196,8 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 	}
 
 	if ( to->number < 0 || to->number >= MAX_GENTITIES ) {
-		Com_Error (ERR_FATAL, "MSG_WriteDeltaEntity: Bad entity number: %i", to->number );
+		MSG_WriteError( msg, ERR_FATAL, "MSG_WriteDeltaEntity: Bad entity number: %i", to->number );
+		return;
 	}
 
 	lc = 0;
@@ -917,24 +1222,25 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 		return;
 	}
 
-	MSG_WriteBits( msg, to->number, GENTITYNUM_BITS );
-	MSG_WriteBits( msg, 0, 1 );			// not removed
-	MSG_WriteBits( msg, 1, 1 );			// we have a delta
+	MSG_BeginBitWriter( &w, msg );
+	MSG_WriteBitsTo( &w, to->number, GENTITYNUM_BITS );
+	MSG_WriteBitsTo( &w, 0, 1 );			// not removed
+	MSG_WriteBitsTo( &w, 1, 1 );			// we have a delta
 
-	MSG_WriteByte( msg, lc );	// # of changes
+	MSG_WriteBitsTo( &w, lc, 8 );	// # of changes
 
-	oldsize += numFields;
+	msg->oldsize += numFields;
 
 	for ( i = 0, field = entityStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
 		toF = (int *)( (byte *)to + field->offset );
 
 		if ( *fromF == *toF ) {
-			MSG_WriteBits( msg, 0, 1 );	// no change
+			MSG_WriteBitsTo( &w, 0, 1 );	// no change
 			continue;
 		}
 
-		MSG_WriteBits( msg, 1, 1 );	// changed
+		MSG_WriteBitsTo( &w, 1, 1 );	// changed
 
 		if ( field->bits == 0 ) {
 			// float
@@ -942,31 +1248,32 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 			trunc = (int)fullFloat;
 
 			if (fullFloat == 0.0f) {
-					MSG_WriteBits( msg, 0, 1 );
-					oldsize += FLOAT_INT_BITS;
+					MSG_WriteBitsTo( &w, 0, 1 );
+					msg->oldsize += FLOAT_INT_BITS;
 			} else {
-				MSG_WriteBits( msg, 1, 1 );
+				MSG_WriteBitsTo( &w, 1, 1 );
 				if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && 
 					trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) ) {
 					// send as small integer
-					MSG_WriteBits( msg, 0, 1 );
-					MSG_WriteBits( msg, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
+					MSG_WriteBitsTo( &w, 0, 1 );
+					MSG_WriteBitsTo( &w, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
 				} else {
 					// send as full floating point value
-					MSG_WriteBits( msg, 1, 1 );
-					MSG_WriteBits( msg, *toF, 32 );
+					MSG_WriteBitsTo( &w, 1, 1 );
+					MSG_WriteBitsTo( &w, *toF, 32 );
 				}
 			}
 		} else {
 			if (*toF == 0) {
-				MSG_WriteBits( msg, 0, 1 );
+				MSG_WriteBitsTo( &w, 0, 1 );
 			} else {
-				MSG_WriteBits( msg, 1, 1 );
+				MSG_WriteBitsTo( &w, 1, 1 );
 				// integer
-				MSG_WriteBits( msg, *toF, field->bits );
+				MSG_WriteBitsTo( &w, *toF, field->bits );
 			}
 		}
 	}
+	MSG_EndBitWriter( &w );
 }
 
 /*
@@ -1173,19 +1480,17 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	int				ammobits;
 	int				powerupbits;
 	int				numFields;
-	int				c;
 	netField_t		*field;
 	int				*fromF, *toF;
 	float			fullFloat;
 	int				trunc, lc;
+	bitWriter_t		w;
 
 	if (!from) {
 		from = &dummy;
 		Com_Memset (&dummy, 0, sizeof(dummy));
 	}
 
-	c = msg->cursize;
-
 	numFields = sizeof( playerStateFields ) / sizeof( playerStateFields[0] );
 
 	lc = 0;
@@ -1197,20 +1502,21 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 		}
 	}
 
-	MSG_WriteByte( msg, lc );	// # of changes
+	MSG_BeginBitWriter( &w, msg );
+	MSG_WriteBitsTo( &w, lc, 8 );	// # of changes
 
-	oldsize += numFields - lc;
+	msg->oldsize += numFields - lc;
 
 	for ( i = 0, field = playerStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
 		toF = (int *)( (byte *)to + field->offset );
 
 		if ( *fromF == *toF ) {
-			MSG_WriteBits( msg, 0, 1 );	// no change
+			MSG_WriteBitsTo( &w, 0, 1 );	// no change
 			continue;
 		}
 
-		MSG_WriteBits( msg, 1, 1 );	// changed
+		MSG_WriteBitsTo( &w, 1, 1 );	// changed
 //		pcount[i]++;
 
 		if ( field->bits == 0 ) {
@@ -1221,19 +1527,18 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 			if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && 
 				trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) ) {
 				// send as small integer
-				MSG_WriteBits( msg, 0, 1 );
-				MSG_WriteBits( msg, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
+				MSG_WriteBitsTo( &w, 0, 1 );
+				MSG_WriteBitsTo( &w, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
 			} else {
 				// send as full floating point value
-				MSG_WriteBits( msg, 1, 1 );
-				MSG_WriteBits( msg, *toF, 32 );
+				MSG_WriteBitsTo( &w, 1, 1 );
+				MSG_WriteBitsTo( &w, *toF, 32 );
 			}
 		} else {
 			// integer
-			MSG_WriteBits( msg, *toF, field->bits );
+			MSG_WriteBitsTo( &w, *toF, field->bits );
 		}
 	}
-	c = msg->cursize - c;
 
 
 	//
@@ -1265,54 +1570,57 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	}
 
 	if (!statsbits && !persistantbits && !ammobits && !powerupbits) {
-		MSG_WriteBits( msg, 0, 1 );	// no change
-		oldsize += 4;
+		MSG_WriteBitsTo( &w, 0, 1 );	// no change
+		msg->oldsize += 4;
+		MSG_EndBitWriter( &w );
 		return;
 	}
-	MSG_WriteBits( msg, 1, 1 );	// changed
+	MSG_WriteBitsTo( &w, 1, 1 );	// changed
 
 	if ( statsbits ) {
-		MSG_WriteBits( msg, 1, 1 );	// changed
-		MSG_WriteBits( msg, statsbits, MAX_STATS );
+		MSG_WriteBitsTo( &w, 1, 1 );	// changed
+		MSG_WriteBitsTo( &w, statsbits, MAX_STATS );
 		for (i=0 ; i<MAX_STATS ; i++)
 			if (statsbits & (1<<i) )
-				MSG_WriteShort (msg, to->stats[i]);
+				MSG_WriteBitsTo( &w, to->stats[i], 16 );
 	} else {
-		MSG_WriteBits( msg, 0, 1 );	// no change
+		MSG_WriteBitsTo( &w, 0, 1 );	// no change
 	}
 
 
 	if ( persistantbits ) {
-		MSG_WriteBits( msg, 1, 1 );	// changed
-		MSG_WriteBits( msg, persistantbits, MAX_PERSISTANT );
+		MSG_WriteBitsTo( &w, 1, 1 );	// changed
+		MSG_WriteBitsTo( &w, persistantbits, MAX_PERSISTANT );
 		for (i=0 ; i<MAX_PERSISTANT ; i++)
 			if (persistantbits & (1<<i) )
-				MSG_WriteShort (msg, to->persistant[i]);
+				MSG_WriteBitsTo( &w, to->persistant[i], 16 );
 	} else {
-		MSG_WriteBits( msg, 0, 1 );	// no change
+		MSG_WriteBitsTo( &w, 0, 1 );	// no change
 	}
 
 
 	if ( ammobits ) {
-		MSG_WriteBits( msg, 1, 1 );	// changed
-		MSG_WriteBits( msg, ammobits, MAX_WEAPONS );
+		MSG_WriteBitsTo( &w, 1, 1 );	// changed
+		MSG_WriteBitsTo( &w, ammobits, MAX_WEAPONS );
 		for (i=0 ; i<MAX_WEAPONS ; i++)
 			if (ammobits & (1<<i) )
-				MSG_WriteShort (msg, to->ammo[i]);
+				MSG_WriteBitsTo( &w, to->ammo[i], 16 );
 	} else {
-		MSG_WriteBits( msg, 0, 1 );	// no change
+		MSG_WriteBitsTo( &w, 0, 1 );	// no change
 	}
 
 
 	if ( powerupbits ) {
-		MSG_WriteBits( msg, 1, 1 );	// changed
-		MSG_WriteBits( msg, powerupbits, MAX_POWERUPS );
+		MSG_WriteBitsTo( &w, 1, 1 );	// changed
+		MSG_WriteBitsTo( &w, powerupbits, MAX_POWERUPS );
 		for (i=0 ; i<MAX_POWERUPS ; i++)
 			if (powerupbits & (1<<i) )
-				MSG_WriteLong( msg, to->powerups[i] );
+				MSG_WriteBitsTo( &w, to->powerups[i], 32 );
 	} else {
-		MSG_WriteBits( msg, 0, 1 );	// no change
+		MSG_WriteBitsTo( &w, 0, 1 );	// no change
 	}
+
+	MSG_EndBitWriter( &w );
 }
 
 
@@ -1726,6 +2034,7 @@ void MSG_initHuffman( void ) {
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+	Huff_BuildCodes( &msgHuff, &msgHuffCodes );
 }
 
 /*
@@ -1764,3 +2073,223 @@ void MSG_NUinitHuffman() {
 */
 
 //===========================================================================
+
+/*
+=============================================================================
+
+huffman benchmark
+
+=============================================================================
+*/
+
+#define	HUFFBENCH_POOL		0x40000
+#define	HUFFBENCH_MESSAGES	1024
+
+typedef struct {
+	byte	*data;
+	int		size;
+} huffBenchMsg_t;
+
+/*
+==================
+MSG_HuffBenchMessages
+
+Makes up messages that look like snapshots, with delta compressed entities
+==================
+*/
+static int MSG_HuffBenchMessages( huffBenchMsg_t *msgs, byte *pool ) {
+	msg_t			msg;
+	entityState_t	from, to;
+	int				seed, num, used, i, j;
+
+	seed = 0x5eed;
+	used = 0;
+	for ( num = 0 ; num < HUFFBENCH_MESSAGES && used + MAX_MSGLEN / 4 <= HUFFBENCH_POOL ; num++ ) {
+		MSG_Init( &msg, pool + used, MAX_MSGLEN / 4 );
+		MSG_WriteLong( &msg, num );
+		MSG_WriteByte( &msg, svc_snapshot );
+		MSG_WriteLong( &msg, num * 50 );
+		for ( i = 0 ; i < 16 ; i++ ) {
+			for ( j = 0 ; j < sizeof( from ) / 4 ; j++ ) {
+				((int *)&from)[j] = Q_rand( &seed ) & 0xff;
+				((int *)&to)[j] = ( Q_rand( &seed ) & 3 ) ? ((int *)&from)[j] : Q_rand( &seed ) & 0xfff;
+			}
+			from.number = to.number = Q_rand( &seed ) & ( MAX_GENTITIES - 2 );
+			MSG_WriteDeltaEntity( &msg, &from, &to, qtrue );
+		}
+		MSG_WriteBits( &msg, MAX_GENTITIES - 1, GENTITYNUM_BITS );
+		msgs[num].data = msg.data;
+		msgs[num].size = msg.cursize;
+		used += msg.cursize;
+	}
+
+	return num;
+}
+
+/*
+==================
+MSG_HuffBenchDemo
+
+Reads the messages of a server side demo
+==================
+*/
+static int MSG_HuffBenchDemo( huffBenchMsg_t *msgs, byte *pool, const char *name ) {
+	byte	*file, *p;
+	int		len, size, num, used;
+
+	len = FS_ReadFile( name, (void **)&file );
+	if ( !file ) {
+		Com_Printf( "couldn't read %s\n", name );
+		return 0;
+	}
+
+	used = 0;
+	p = file;
+	for ( num = 0 ; num < HUFFBENCH_MESSAGES && p + 8 <= file + len ; num++ ) {
+		size = LittleLong( ((int *)p)[1] );
+		p += 8;
+		if ( size <= 0 || size > MAX_MSGLEN || p + size > file + len || used + size > HUFFBENCH_POOL ) {
+			break;
+		}
+		msgs[num].data = pool + used;
+		msgs[num].size = size;
+		Com_Memcpy( pool + used, p, size );
+		used += size;
+		p += size;
+	}
+
+	FS_FreeFile( file );
+	return num;
+}
+
+/*
+==================
+MSG_HuffBench_f
+
+Round-trips messages through the huffman tree walk and the code tables,
+checks that both give the same symbols and bits and times them.
+huffbench [server demo] [iterations]
+==================
+*/
+void MSG_HuffBench_f( void ) {
+	huffBenchMsg_t	*msgs;
+	byte			*pool, *in, *out1, *out2;
+	int				*syms;
+	int				numMsgs, iterations, numSyms, totalBytes;
+	int				i, j, n, ch, offset, end, bit1, bit2;
+	int				start, walkDecode, tableDecode, walkEncode, tableEncode;
+
+	if ( !msgInit ) {
+		MSG_initHuffman();
+	}
+
+	iterations = 100;
+	if ( Cmd_Argc() > 2 ) {
+		iterations = atoi( Cmd_Argv( 2 ) );
+	}
+	if ( iterations < 1 ) {
+		iterations = 1;
+	}
+
+	msgs = Z_Malloc( HUFFBENCH_MESSAGES * sizeof( *msgs ) );
+	pool = Z_Malloc( HUFFBENCH_POOL );
+	in = Z_Malloc( MAX_MSGLEN + 4 );
+	out1 = Z_Malloc( MAX_MSGLEN + 4 );
+	out2 = Z_Malloc( MAX_MSGLEN + 4 );
+	syms = Z_Malloc( MAX_MSGLEN * 8 * sizeof( *syms ) );
+
+	if ( Cmd_Argc() > 1 && Q_stricmp( Cmd_Argv( 1 ), "-" ) ) {
+		numMsgs = MSG_HuffBenchDemo( msgs, pool, Cmd_Argv( 1 ) );
+	} else {
+		numMsgs = MSG_HuffBenchMessages( msgs, pool );
+	}
+
+	walkDecode = tableDecode = walkEncode = tableEncode = 0;
+	totalBytes = 0;
+
+	for ( i = 0 ; i < numMsgs ; i++ ) {
+		// the tree walk reads a little past the end
+		Com_Memset( in, 0, MAX_MSGLEN + 4 );
+		Com_Memcpy( in, msgs[i].data, msgs[i].size );
+		end = msgs[i].size * 8;
+		totalBytes += msgs[i].size;
+
+		// decode everything as symbols, then check the tables agree
+		numSyms = 0;
+		for ( offset = 0 ; offset < end ; numSyms++ ) {
+			Huff_offsetReceive( msgHuff.decompressor.tree, &syms[numSyms], in, &offset );
+		}
+		bit1 = offset;
+		for ( j = 0, offset = 0 ; j < numSyms ; j++ ) {
+			Huff_offsetReceiveCode( &msgHuffCodes, &ch, in, &offset, MAX_MSGLEN + 4 );
+			if ( ch != syms[j] ) {
+				break;
+			}
+		}
+		if ( j != numSyms || offset != bit1 ) {
+			Com_Printf( "message %i: table decode differs at symbol %i\n", i, j );
+			break;
+		}
+
+		// encoding the symbols again must give the same bits both ways
+		bit1 = bit2 = 0;
+		for ( j = 0 ; j < numSyms ; j++ ) {
+			Huff_offsetTransmit( &msgHuff.compressor, syms[j], out1, &bit1 );
+			Huff_offsetTransmitCode( &msgHuffCodes, syms[j], out2, &bit2 );
+		}
+		if ( bit1 != bit2 || memcmp( out1, out2, bit1 >> 3 ) || 
+			( ( out1[bit1 >> 3] ^ out2[bit1 >> 3] ) & ( ( 1 << ( bit1 & 7 ) ) - 1 ) ) ) {
+			Com_Printf( "message %i: table encode differs\n", i );
+			break;
+		}
+		if ( memcmp( out1, in, end >> 3 ) ) {
+			Com_Printf( "message %i: didn't round-trip\n", i );
+			break;
+		}
+
+		start = Sys_Milliseconds();
+		for ( n = 0 ; n < iterations ; n++ ) {
+			for ( offset = 0 ; offset < end ; ) {
+				Huff_offsetReceive( msgHuff.decompressor.tree, &ch, in, &offset );
+			}
+		}
+		walkDecode += Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		for ( n = 0 ; n < iterations ; n++ ) {
+			for ( offset = 0 ; offset < end ; ) {
+				Huff_offsetReceiveCode( &msgHuffCodes, &ch, in, &offset, MAX_MSGLEN + 4 );
+			}
+		}
+		tableDecode += Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		for ( n = 0 ; n < iterations ; n++ ) {
+			for ( j = 0, offset = 0 ; j < numSyms ; j++ ) {
+				Huff_offsetTransmit( &msgHuff.compressor, syms[j], out1, &offset );
+			}
+		}
+		walkEncode += Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		for ( n = 0 ; n < iterations ; n++ ) {
+			for ( j = 0, offset = 0 ; j < numSyms ; j++ ) {
+				Huff_offsetTransmitCode( &msgHuffCodes, syms[j], out2, &offset );
+			}
+		}
+		tableEncode += Sys_Milliseconds() - start;
+	}
+
+	if ( i == numMsgs && numMsgs ) {
+		Com_Printf( "%i messages, %i bytes, %i iterations, all identical\n", numMsgs, totalBytes, iterations );
+		Com_Printf( "decode: tree %i msec, tables %i msec\n", walkDecode, tableDecode );
+		Com_Printf( "encode: tree %i msec, tables %i msec\n", walkEncode, tableEncode );
+	}
+
+	Z_Free( syms );
+	Z_Free( out2 );
+	Z_Free( out1 );
+	Z_Free( in );
+	Z_Free( pool );
+	Z_Free( msgs );
+}
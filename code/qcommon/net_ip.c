@@ -20,6 +20,14 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
 
+#ifdef __linux__
+// recvmmsg and sendmmsg are GNU extensions
+#define _GNU_SOURCE
+#define USE_RECVMMSG
+#define USE_SENDMMSG
+#define USE_TIMERFD
+#endif
+
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
 
@@ -64,6 +72,11 @@ static qboolean	winsockInitialized = qfalse;
 #include <sys/filio.h>
 #endif
 
+#ifdef USE_TIMERFD
+#include <sys/timerfd.h>
+#include <poll.h>
+#endif
+
 typedef int SOCKET;
 #define INVALID_SOCKET		-1
 #define SOCKET_ERROR			-1
@@ -77,6 +90,7 @@ static qboolean usingSocks = qfalse;
 static qboolean networkingEnabled = qfalse;
 
 static cvar_t	*net_noudp;
+static cvar_t	*net_sendBatch;
 
 static cvar_t	*net_socksEnabled;
 static cvar_t	*net_socksServer;
@@ -88,10 +102,34 @@ static struct sockaddr	socksRelayAddr;
 static SOCKET	ip_socket;
 static SOCKET	socks_socket;
 
+#ifdef USE_TIMERFD
+static int		net_timer = -1;		// monotonic timer NET_SleepUsec polls with the socket
+#endif
+
 #define	MAX_IPS		16
 static	int		numIP;
 static	byte	localIP[MAX_IPS][4];
 
+// syscall accounting for net_stats
+static	unsigned	recvSyscalls;
+static	unsigned	recvPackets;
+static	unsigned	sendSyscalls;
+static	unsigned	sendPackets;
+
+// outgoing datagrams collected between NET_BeginSendBatch and NET_FlushSendBatch
+#define	NET_MAX_SEND_BATCH	256
+
+typedef struct {
+	struct sockaddr	addr;
+	netadrtype_t	type;
+	int				length;
+	byte			data[1500];		// room for a full netchan fragment plus the socks header
+} sendSlot_t;
+
+static	sendSlot_t	sendBatch[NET_MAX_SEND_BATCH];
+static	int			sendBatchCount;
+static	qboolean	sendBatching;
+
 //=============================================================================
 
 
@@ -223,6 +261,43 @@ qboolean Sys_StringToAdr( const char *s, netadr_t *a ) {
 
 //=============================================================================
 
+/*
+==================
+NET_ParsePacket
+
+Fills in net_from and the read position of a datagram that has just
+been received into net_message->data with ret bytes
+==================
+*/
+static qboolean NET_ParsePacket( struct sockaddr *from, socklen_t fromlen, int ret, netadr_t *net_from, msg_t *net_message ) {
+	memset( ((struct sockaddr_in *)from)->sin_zero, 0, 8 );
+
+	if ( usingSocks && memcmp( from, &socksRelayAddr, fromlen ) == 0 ) {
+		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
+			return qfalse;
+		}
+		net_from->type = NA_IP;
+		net_from->ip[0] = net_message->data[4];
+		net_from->ip[1] = net_message->data[5];
+		net_from->ip[2] = net_message->data[6];
+		net_from->ip[3] = net_message->data[7];
+		net_from->port = *(short *)&net_message->data[8];
+		net_message->readcount = 10;
+	}
+	else {
+		SockadrToNetadr( from, net_from );
+		net_message->readcount = 0;
+	}
+
+	if( ret == net_message->maxsize ) {
+		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
+		return qfalse;
+	}
+
+	net_message->cursize = ret;
+	return qtrue;
+}
+
 /*
 ==================
 Sys_GetPacket
@@ -248,6 +323,7 @@ qboolean Sys_GetPacket( netadr_t *net_from, msg_t *net_message ) {
 #ifdef _DEBUG
 	recvfromCount++;		// performance check
 #endif
+	recvSyscalls++;
 	ret = recvfrom( ip_socket, net_message->data, net_message->maxsize, 0, (struct sockaddr *)&from, &fromlen );
 	if (ret == SOCKET_ERROR)
 	{
@@ -260,38 +336,205 @@ qboolean Sys_GetPacket( netadr_t *net_from, msg_t *net_message ) {
 		return qfalse;
 	}
 
-	memset( ((struct sockaddr_in *)&from)->sin_zero, 0, 8 );
+	recvPackets++;
+	return NET_ParsePacket( &from, fromlen, ret, net_from, net_message );
+}
 
-	if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
-		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
-			return qfalse;
+/*
+==================
+Sys_GetPackets
+
+Receives up to count datagrams into the caller supplied messages, which
+must already point at buffers of their final size.  On Linux this is a
+single recvmmsg call, elsewhere it falls back to repeated recvfrom.
+Returns the number of valid packets stored, packets that fail
+NET_ParsePacket are dropped and the remaining ones are packed down.
+The number of datagrams taken off the socket, dropped ones included,
+goes in received, so the caller can tell a full batch from an empty
+socket.
+==================
+*/
+int Sys_GetPackets( netadr_t *net_from, msg_t *net_messages, int count, int *received ) {
+#ifdef USE_RECVMMSG
+	struct mmsghdr	hdrs[NET_MAX_RECV_BATCH];
+	struct iovec	iovs[NET_MAX_RECV_BATCH];
+	struct sockaddr	from[NET_MAX_RECV_BATCH];
+	int				i, ret, valid;
+
+	*received = 0;
+	if( !ip_socket ) {
+		return 0;
+	}
+
+	if( count > NET_MAX_RECV_BATCH ) {
+		count = NET_MAX_RECV_BATCH;
+	}
+
+	for( i = 0 ; i < count ; i++ ) {
+		iovs[i].iov_base = net_messages[i].data;
+		iovs[i].iov_len = net_messages[i].maxsize;
+		memset( &hdrs[i], 0, sizeof( hdrs[i] ) );
+		hdrs[i].msg_hdr.msg_name = &from[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof( from[i] );
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	recvSyscalls++;
+	ret = recvmmsg( ip_socket, hdrs, count, MSG_DONTWAIT, NULL );
+	if( ret == SOCKET_ERROR ) {
+		if( errno == ENOSYS ) {
+			// kernel without recvmmsg, don't try again
+			Com_Printf( "WARNING: recvmmsg not supported, disabling batched receive\n" );
+			Cvar_Set( "net_recvBatch", "0" );
+		} else if( errno != EAGAIN && errno != ECONNRESET ) {
+			Com_Printf( "NET_GetPackets: %s\n", NET_ErrorString() );
 		}
-		net_from->type = NA_IP;
-		net_from->ip[0] = net_message->data[4];
-		net_from->ip[1] = net_message->data[5];
-		net_from->ip[2] = net_message->data[6];
-		net_from->ip[3] = net_message->data[7];
-		net_from->port = *(short *)&net_message->data[8];
-		net_message->readcount = 10;
+		return 0;
 	}
-	else {
-		SockadrToNetadr( &from, net_from );
-		net_message->readcount = 0;
+
+	recvPackets += ret;
+	*received = ret;
+
+	valid = 0;
+	for( i = 0 ; i < ret ; i++ ) {
+		if( !NET_ParsePacket( &from[i], hdrs[i].msg_hdr.msg_namelen, hdrs[i].msg_len,
+			&net_from[i], &net_messages[i] ) ) {
+			continue;
+		}
+		if( valid != i ) {
+			// swap the buffers so every slot still owns a distinct one
+			msg_t	tmp;
+
+			tmp = net_messages[valid];
+			net_messages[valid] = net_messages[i];
+			net_messages[i] = tmp;
+			net_from[valid] = net_from[i];
+		}
+		valid++;
 	}
 
-	if( ret == net_message->maxsize ) {
-		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-		return qfalse;
+	return valid;
+#else
+	int			i, valid;
+	unsigned	before;
+
+	valid = 0;
+	for( i = 0 ; i < count ; i++ ) {
+		before = recvPackets;
+		if( Sys_GetPacket( &net_from[valid], &net_messages[valid] ) ) {
+			valid++;
+		} else if( recvPackets == before ) {
+			break;		// nothing left on the socket
+		}
 	}
 
-	net_message->cursize = ret;
-	return qtrue;
+	*received = i;
+	return valid;
+#endif
+}
+
+/*
+==================
+NET_Stats_f
+
+Prints how many datagrams each send and receive syscall handled on average
+==================
+*/
+static void NET_Stats_f( void ) {
+	Com_Printf( "%u packets received in %u syscalls", recvPackets, recvSyscalls );
+	if( recvSyscalls ) {
+		Com_Printf( " (%.2f packets per syscall)", (float)recvPackets / recvSyscalls );
+	}
+	Com_Printf( "\n" );
+
+	Com_Printf( "%u packets sent in %u syscalls", sendPackets, sendSyscalls );
+	if( sendSyscalls ) {
+		Com_Printf( " (%.2f packets per syscall)", (float)sendPackets / sendSyscalls );
+	}
+	Com_Printf( "\n" );
+
+	if( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		recvPackets = 0;
+		recvSyscalls = 0;
+		sendPackets = 0;
+		sendSyscalls = 0;
+	}
 }
 
 //=============================================================================
 
 static char socksBuf[4096];
 
+/*
+==================
+NET_SendError
+==================
+*/
+static void NET_SendError( netadrtype_t type ) {
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( ( err == EADDRNOTAVAIL ) && ( ( type == NA_BROADCAST ) ) ) {
+		return;
+	}
+
+	Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+}
+
+/*
+==================
+NET_BatchPacket
+
+Appends a datagram to the outgoing batch, flushing first if it is full.
+Returns qfalse if the packet doesn't fit a batch slot and has to be sent
+on its own.
+==================
+*/
+static qboolean NET_BatchPacket( int length, const void *data, netadr_t to ) {
+	sendSlot_t	*slot;
+
+	if( length + 10 > sizeof( slot->data ) ) {
+		// keep the ordering, everything queued goes out first
+		NET_FlushSendBatch();
+		sendBatching = qtrue;
+		return qfalse;
+	}
+
+	if( sendBatchCount == NET_MAX_SEND_BATCH ) {
+		NET_FlushSendBatch();
+		sendBatching = qtrue;
+	}
+
+	slot = &sendBatch[sendBatchCount++];
+	slot->type = to.type;
+
+	NetadrToSockadr( &to, &slot->addr );
+
+	if( usingSocks && to.type == NA_IP ) {
+		slot->data[0] = 0;	// reserved
+		slot->data[1] = 0;
+		slot->data[2] = 0;	// fragment (not fragmented)
+		slot->data[3] = 1;	// address type: IPV4
+		*(int *)&slot->data[4] = ((struct sockaddr_in *)&slot->addr)->sin_addr.s_addr;
+		*(short *)&slot->data[8] = ((struct sockaddr_in *)&slot->addr)->sin_port;
+		memcpy( &slot->data[10], data, length );
+		slot->length = length + 10;
+		slot->addr = socksRelayAddr;
+	}
+	else {
+		memcpy( slot->data, data, length );
+		slot->length = length;
+	}
+
+	return qtrue;
+}
+
 /*
 ==================
 Sys_SendPacket
@@ -310,8 +553,14 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 		return;
 	}
 
+	if( sendBatching && NET_BatchPacket( length, data, to ) ) {
+		return;
+	}
+
 	NetadrToSockadr( &to, &addr );
 
+	sendSyscalls++;
+	sendPackets++;
 	if( usingSocks && to.type == NA_IP ) {
 		socksBuf[0] = 0;	// reserved
 		socksBuf[1] = 0;
@@ -326,22 +575,91 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 		ret = sendto( ip_socket, data, length, 0, &addr, sizeof(addr) );
 	}
 	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
-
-		// wouldblock is silent
-		if( err == EAGAIN ) {
-			return;
-		}
+		NET_SendError( to.type );
+	}
+}
 
-		// some PPP links do not allow broadcasts and return an error
-		if( ( err == EADDRNOTAVAIL ) && ( ( to.type == NA_BROADCAST ) ) ) {
-			return;
-		}
+/*
+==================
+NET_BeginSendBatch
 
-		Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+Until the matching NET_FlushSendBatch, every datagram handed to
+Sys_SendPacket is queued instead of sent.  The server wraps each
+frame in this so that all snapshots go out in a few sendmmsg calls.
+Packets delayed by sv_packetdelay / cl_packetdelay are still held
+in NET_QueuePacket first and only join a batch once released.
+==================
+*/
+void NET_BeginSendBatch( void ) {
+	if( !net_sendBatch || !net_sendBatch->integer || !ip_socket ) {
+		return;
 	}
+	sendBatching = qtrue;
 }
 
+/*
+==================
+NET_FlushSendBatch
+
+Sends everything queued since NET_BeginSendBatch and ends batching
+==================
+*/
+void NET_FlushSendBatch( void ) {
+	int		i;
+#ifdef USE_SENDMMSG
+	struct mmsghdr	hdrs[NET_MAX_SEND_BATCH];
+	struct iovec	iovs[NET_MAX_SEND_BATCH];
+	int				ret;
+#endif
+
+	sendBatching = qfalse;
+
+	if( !sendBatchCount ) {
+		return;
+	}
+
+	if( !ip_socket ) {
+		sendBatchCount = 0;
+		return;
+	}
+
+	sendPackets += sendBatchCount;
+
+#ifdef USE_SENDMMSG
+	for( i = 0 ; i < sendBatchCount ; i++ ) {
+		iovs[i].iov_base = sendBatch[i].data;
+		iovs[i].iov_len = sendBatch[i].length;
+		memset( &hdrs[i], 0, sizeof( hdrs[i] ) );
+		hdrs[i].msg_hdr.msg_name = &sendBatch[i].addr;
+		hdrs[i].msg_hdr.msg_namelen = sizeof( sendBatch[i].addr );
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	i = 0;
+	while( i < sendBatchCount ) {
+		sendSyscalls++;
+		ret = sendmmsg( ip_socket, &hdrs[i], sendBatchCount - i, 0 );
+		if( ret == SOCKET_ERROR ) {
+			// the datagram at i failed, report it and carry on with the rest
+			NET_SendError( sendBatch[i].type );
+			i++;
+			continue;
+		}
+		i += ret;
+	}
+#else
+	for( i = 0 ; i < sendBatchCount ; i++ ) {
+		sendSyscalls++;
+		if( sendto( ip_socket, sendBatch[i].data, sendBatch[i].length, 0,
+			&sendBatch[i].addr, sizeof( sendBatch[i].addr ) ) == SOCKET_ERROR ) {
+			NET_SendError( sendBatch[i].type );
+		}
+	}
+#endif
+
+	sendBatchCount = 0;
+}
 
 //=============================================================================
 
@@ -847,6 +1165,21 @@ void NET_GetLocalAddress( void ) {
 }
 #endif
 
+/*
+====================
+NET_OpenTimer
+
+Without the timer NET_SleepUsec waits in select()
+====================
+*/
+static void NET_OpenTimer( void ) {
+#ifdef USE_TIMERFD
+	if ( net_timer == -1 ) {
+		net_timer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+	}
+#endif
+}
+
 /*
 ====================
 NET_OpenIP
@@ -867,6 +1200,7 @@ void NET_OpenIP( void ) {
 		ip_socket = NET_IPSocket( ip->string, port + i );
 		if ( ip_socket ) {
 			Cvar_SetValue( "net_port", port + i );
+			NET_OpenTimer();
 			if ( net_socksEnabled->integer ) {
 				NET_OpenSocks( port + i );
 			}
@@ -896,6 +1230,9 @@ static qboolean NET_GetCvars( void ) {
 	}
 	net_noudp = Cvar_Get( "net_noudp", "0", CVAR_LATCH | CVAR_ARCHIVE );
 
+	// doesn't need the socket reopened, so it isn't part of modified
+	net_sendBatch = Cvar_Get( "net_sendBatch", "0", CVAR_ARCHIVE );
+
 
 	if( net_socksEnabled && net_socksEnabled->modified ) {
 		modified = qtrue;
@@ -972,11 +1309,20 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if( stop ) {
+		NET_FlushSendBatch();
+
 		if ( ip_socket && ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = 0;
 		}
 
+#ifdef USE_TIMERFD
+		if ( net_timer != -1 ) {
+			close( net_timer );
+			net_timer = -1;
+		}
+#endif
+
 		if ( socks_socket && socks_socket != INVALID_SOCKET ) {
 			closesocket( socks_socket );
 			socks_socket = 0;
@@ -1013,6 +1359,8 @@ void NET_Init( void ) {
 	// this is really just to get the cvars registered
 	NET_GetCvars();
 
+	Cmd_AddCommand( "net_stats", NET_Stats_f );
+
 	NET_Config( qtrue );
 }
 
@@ -1038,14 +1386,19 @@ void NET_Shutdown( void ) {
 
 /*
 ====================
-NET_Sleep
+NET_SleepUsec
 
-Sleeps msec or until something happens on the network
+Sleeps usec or until there is a packet.  On linux a timerfd polled
+with the socket wakes on the deadline, select() takes usec everywhere.
 ====================
 */
-void NET_Sleep( int msec ) {
+void NET_SleepUsec( int usec ) {
 	struct timeval timeout;
 	fd_set	fdset;
+#ifdef USE_TIMERFD
+	struct pollfd		fds[2];
+	struct itimerspec	its;
+#endif
 
 	if (!com_dedicated->integer)
 		return; // we're not a server, just run full speed
@@ -1053,16 +1406,50 @@ void NET_Sleep( int msec ) {
 	if (!ip_socket)
 		return;
 
-	if (msec < 0 )
+	if (usec < 0 )
+		return;
+
+#ifdef USE_TIMERFD
+	if ( net_timer != -1 && usec ) {
+		// arming the timer also clears an old expiration, so it
+		// never has to be read
+		Com_Memset( &its, 0, sizeof( its ) );
+		its.it_value.tv_sec = usec / 1000000;
+		its.it_value.tv_nsec = ( usec % 1000000 ) * 1000;
+		timerfd_settime( net_timer, 0, &its, NULL );
+
+		fds[0].fd = ip_socket;
+		fds[0].events = POLLIN;
+		fds[1].fd = net_timer;
+		fds[1].events = POLLIN;
+
+		// the timeout is only a backstop for the timer
+		poll( fds, 2, usec / 1000 + 10 );
 		return;
+	}
+#endif
 
 	FD_ZERO(&fdset);
 	FD_SET(ip_socket, &fdset);
-	timeout.tv_sec = msec/1000;
-	timeout.tv_usec = (msec%1000)*1000;
+	timeout.tv_sec = usec/1000000;
+	timeout.tv_usec = usec%1000000;
 	select(ip_socket+1, &fdset, NULL, NULL, &timeout);
 }
 
+/*
+====================
+NET_Sleep
+
+Sleeps msec or until something happens on the network
+====================
+*/
+void NET_Sleep( int msec ) {
+	if (msec < 0 )
+		return;
+
+	NET_SleepUsec( msec * 1000 );
+}
+
 
 /*
 ====================
@@ -48,6 +48,12 @@ typedef struct {
 	int		cursize;
 	int		readcount;
 	int		bit;				// for bitwise reads and writes
+	int		oldsize;			// bits delta compression saved, for debugging
+	int		overflows;			// values written that didn't fit their bits
+	qboolean	deferErrors;	// keep write errors in the message instead of a Com_Error
+	int		errorCode;			// first deferred error, raised by the owner
+	const char	*error;			// format of the error, with errorValue
+	int		errorValue;
 } msg_t;
 
 void MSG_Init (msg_t *buf, byte *data, int length);
@@ -67,6 +73,7 @@ struct entityState_s;
 struct playerState_s;
 
 void MSG_WriteBits( msg_t *msg, int value, int bits );
+void MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bit, int numBits );
 
 void MSG_WriteChar (msg_t *sb, int c);
 void MSG_WriteByte (msg_t *sb, int c);
@@ -110,6 +117,7 @@ void MSG_ReadDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct pl
 
 
 void MSG_ReportChangeVectors_f( void );
+void MSG_HuffBench_f( void );
 
 //============================================================================
 
@@ -157,6 +165,8 @@ void		NET_Shutdown( void );
 void		NET_Restart( void );
 void		NET_Config( qboolean enableNetworking );
 void		NET_FlushPacketQueue(void);
+void		NET_BeginSendBatch( void );
+void		NET_FlushSendBatch( void );
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
 void		QDECL NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
@@ -168,6 +178,7 @@ const char	*NET_AdrToString (netadr_t a);
 qboolean	NET_StringToAdr ( const char *s, netadr_t *a);
 qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_message);
 void		NET_Sleep(int msec);
+void		NET_SleepUsec( int usec );
 
 
 #define	MAX_MSGLEN				16384		// max length of a message, which may
@@ -324,10 +335,23 @@ vm_t	*VM_Restart( vm_t *vm );
 
 intptr_t		QDECL VM_Call( vm_t *vm, int callNum, ... );
 
+qboolean	VM_RecordStart( vm_t *vm, const char *name, int frameCall, int frames );
+void	VM_RecordStop( void );
+// records the calls into a qvm until frames calls to frameCall have returned,
+// vmreplay runs them again on each engine
+
+qboolean	VM_ProfileStart( vm_t *vm );
+qboolean	VM_ProfileSample( vm_t *vm, void *pc );
+void	VM_ProfileReset( vm_t *vm );
+void	VM_ProfilePrint( vm_t *vm, int lines );
+// program counter samples from Sys_StartProfileTimer are counted per instruction
+// of a compiled vm, VM_ProfileSample returns qfalse for a pc outside its code
+
 void	VM_Debug( int level );
 
 void	*VM_ArgPtr( intptr_t intValue );
 void	*VM_ExplicitArgPtr( vm_t *vm, intptr_t intValue );
+void	*VM_ArgArray( intptr_t intValue, int count, int size );
 
 #define	VMA(x) VM_ArgPtr(args[x])
 static ID_INLINE float _vmf(intptr_t x)
@@ -605,6 +629,14 @@ void	FS_ForceFlush( fileHandle_t f );
 void	FS_FreeFile( void *buffer );
 // frees the memory returned by FS_ReadFile
 
+int		FS_MapFile( const char *qpath, const void **buffer );
+// like FS_ReadFile, but returns a pointer into a read only mapping of the
+// file when it is a loose file or stored uncompressed in a pk3, with no
+// 0 at the end.  -1 length == not present
+
+void	FS_UnmapFile( const void *buffer );
+// releases the buffer returned by FS_MapFile
+
 void	FS_WriteFile( const char *qpath, const void *buffer, int size );
 // writes a complete file, creating any subdirectories needed
 
@@ -760,6 +792,7 @@ void 		Com_Quit_f( void );
 int			Com_Milliseconds( void );	// will be journaled properly
 unsigned	Com_BlockChecksum( const void *buffer, int length );
 char		*Com_MD5File(const char *filename, int length, const char *prefix, int prefix_len);
+void		Com_MD5HMAC( const byte *key, int keylen, const byte *data, int len, byte digest[16] );
 int			Com_HashKey(char *string, int maxlen);
 int			Com_Filter(char *filter, char *name, int casesensitive);
 int			Com_FilterPath(char *filter, char *name, int casesensitive);
@@ -776,6 +809,7 @@ extern	cvar_t	*com_developer;
 extern	cvar_t	*com_dedicated;
 extern	cvar_t	*com_speeds;
 extern	cvar_t	*com_timescale;
+extern	cvar_t	*com_fixedtime;
 extern	cvar_t	*com_sv_running;
 extern	cvar_t	*com_cl_running;
 extern	cvar_t	*com_version;
@@ -1009,6 +1043,14 @@ void	Sys_Print( const char *msg );
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds (void);
 
+// microsecond profiling clock, it wraps so only differences mean anything
+unsigned int	Sys_Microseconds( void );
+
+// calls sample with the interrupted program counter, NULL if unknown, about
+// hz times a second of cpu time, possibly from a signal handler
+qboolean	Sys_StartProfileTimer( int hz, void (*sample)( void *pc ) );
+void		Sys_StopProfileTimer( void );
+
 void	Sys_SnapVector( float *v );
 
 qboolean Sys_RandomBytes( byte *string, int len );
@@ -1023,6 +1065,10 @@ void	Sys_SetErrorText( const char *text );
 void	Sys_SendPacket( int length, const void *data, netadr_t to );
 qboolean Sys_GetPacket( netadr_t *net_from, msg_t *net_message );
 
+#define	NET_MAX_RECV_BATCH	64	// upper bound for net_recvBatch
+int		Sys_GetPackets( netadr_t *net_from, msg_t *net_messages, int count, int *received );
+// receives up to count packets in one go, returns how many were stored
+
 qboolean	Sys_StringToAdr( const char *s, netadr_t *a );
 //Does NOT parse port numbers, only base addresses.
 
@@ -1030,6 +1076,9 @@ qboolean	Sys_IsLANAddress (netadr_t adr);
 void		Sys_ShowIP(void);
 
 void	Sys_Mkdir( const char *path );
+qboolean Sys_FileStat( const char *path, int *size, int *mtime );
+void	*Sys_MapFile( const char *path, int *length );
+void	Sys_UnmapFile( void *base, int length );
 char	*Sys_Cwd( void );
 void	Sys_SetDefaultInstallPath(const char *path);
 char	*Sys_DefaultInstallPath(void);
@@ -1086,6 +1135,19 @@ typedef struct {
 	huff_t		decompressor;
 } huffman_t;
 
+// code tables for a tree that doesn't change anymore, Huff_offsetTransmitCode
+// and Huff_offsetReceiveCode give the same bits as the tree walking versions
+#define	HUFF_LOOKUP_BITS	11
+
+typedef struct {
+	unsigned int	code[HMAX+1];		// bits in sending order, the first one lowest
+	byte			length[HMAX+1];		// 0 if the code is too long, the tree is used
+	unsigned short	lookup[1<<HUFF_LOOKUP_BITS];	// symbol | length << 9 for the next bits,
+											// 0 when the code is longer than the lookup
+	huff_t			*compressor;
+	node_t			*tree;
+} huffCodes_t;
+
 void	Huff_Compress(msg_t *buf, int offset);
 void	Huff_Decompress(msg_t *buf, int offset);
 void	Huff_Init(huffman_t *huff);
@@ -1096,6 +1158,9 @@ void	Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset);
 void	Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset);
 void	Huff_putBit( int bit, byte *fout, int *offset);
 int		Huff_getBit( byte *fout, int *offset);
+void	Huff_BuildCodes( huffman_t *huff, huffCodes_t *codes );
+void	Huff_offsetReceiveCode( const huffCodes_t *codes, int *ch, byte *fin, int *offset, int size );
+void	Huff_offsetTransmitCode( const huffCodes_t *codes, int ch, byte *fout, int *offset );
 
 extern huffman_t clientHuffTables;
 
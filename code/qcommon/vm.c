@@ -44,6 +44,8 @@ int		vm_debugLevel;
 vm_t	vmTable[MAX_VM];
 
 
+static cvar_t	*vm_threaded;
+
 void VM_VmInfo_f( void );
 void VM_VmProfile_f( void );
 
@@ -70,9 +72,14 @@ void VM_Init( void ) {
 	Cvar_Get( "vm_cgame", "2", CVAR_ARCHIVE );	// !@# SHIP WITH SET TO 2
 	Cvar_Get( "vm_game", "2", CVAR_ARCHIVE );	// !@# SHIP WITH SET TO 2
 	Cvar_Get( "vm_ui", "2", CVAR_ARCHIVE );		// !@# SHIP WITH SET TO 2
+	vm_threaded = Cvar_Get( "vm_threaded", "1", CVAR_ARCHIVE );
 
 	Cmd_AddCommand ("vmprofile", VM_VmProfile_f );
 	Cmd_AddCommand ("vminfo", VM_VmInfo_f );
+	Cmd_AddCommand ("vmreplay", VM_Replay_f );
+#if !defined( NO_VM_COMPILED ) && defined( __x86_64__ )
+	Cmd_AddCommand ("vmbench", VM_Bench_f );
+#endif
 
 	Com_Memset( vmTable, 0, sizeof( vmTable ) );
 }
@@ -225,16 +232,15 @@ void VM_LoadSymbols( vm_t *vm ) {
 	int		segment;
 	int		numInstructions;
 
-	// don't load symbols if not developer
-	if ( !com_developer->integer ) {
-		return;
-	}
-
+	// the profilers want symbols whenever there are some,
+	// but only developers are told when there aren't
 	COM_StripExtension(vm->name, name, sizeof(name));
 	Com_sprintf( symbols, sizeof( symbols ), "vm/%s.map", name );
 	len = FS_ReadFile( symbols, (void **)&mapfile );
 	if ( !mapfile ) {
-		Com_Printf( "Couldn't load symbol file: %s\n", symbols );
+		if ( com_developer->integer ) {
+			Com_Printf( "Couldn't load symbol file: %s\n", symbols );
+		}
 		return;
 	}
 
@@ -504,9 +510,6 @@ If image ends in .qvm it will be interpreted, otherwise
 it will attempt to load as a system dll
 ================
 */
-
-#define	STACK_SIZE	0x20000
-
 vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), 
 				vmInterpret_t interpret ) {
 	vm_t		*vm;
@@ -568,21 +571,25 @@ vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *),
 	vm->codeLength = header->codeLength;
 
 	vm->compiled = qfalse;
+	vm->threaded = qfalse;
 
 #ifdef NO_VM_COMPILED
 	if(interpret >= VMI_COMPILED) {
 		Com_Printf("Architecture doesn't have a bytecode compiler, using interpreter\n");
 		interpret = VMI_BYTECODE;
+		vm->threaded = vm_threaded->integer;
 	}
 #else
 	if ( interpret >= VMI_COMPILED ) {
 		vm->compiled = qtrue;
 		VM_Compile( vm, header );
+		// VM_Compile may have reset vm->compiled if compilation failed
+		vm->threaded = !vm->compiled && vm_threaded->integer;
 	}
 #endif
-	// VM_Compile may have reset vm->compiled if compilation failed
-	if (!vm->compiled)
-	{
+	if ( vm->threaded ) {
+		VM_PrepareThreaded( vm, header );
+	} else if ( !vm->compiled ) {
 		VM_PrepareInterpreter( vm, header );
 	}
 
@@ -608,6 +615,14 @@ VM_Free
 */
 void VM_Free( vm_t *vm ) {
 
+	if ( vm->recording ) {
+		VM_RecordStop();
+	}
+
+	if ( vm->profileCounts ) {
+		Z_Free( vm->profileCounts );
+	}
+
 	if(vm->destroy)
 		vm->destroy(vm);
 
@@ -634,7 +649,12 @@ void VM_Free( vm_t *vm ) {
 
 void VM_Clear(void) {
 	int i;
+
+	VM_RecordStop();
 	for (i=0;i<MAX_VM; i++) {
+		if ( vmTable[i].profileCounts ) {
+			Z_Free( vmTable[i].profileCounts );
+		}
 		if ( vmTable[i].dllHandle ) {
 			Sys_UnloadDll( vmTable[i].dllHandle );
 		}
@@ -660,6 +680,29 @@ void *VM_ArgPtr( intptr_t intValue ) {
 	}
 }
 
+/*
+============
+VM_ArgArray
+
+VM_ArgPtr for count elements of size bytes, which must all be in the VM data
+============
+*/
+void *VM_ArgArray( intptr_t intValue, int count, int size ) {
+	if ( !intValue || currentVM == NULL ) {
+		return NULL;
+	}
+
+	if ( currentVM->entryPoint ) {
+		return (void *)(currentVM->dataBase + intValue);
+	}
+
+	if ( count < 0 || count > ( currentVM->dataMask + 1 ) / size
+		|| ( intValue & currentVM->dataMask ) + count * size > currentVM->dataMask + 1 ) {
+		Com_Error( ERR_DROP, "VM_ArgArray: %i elements of %i bytes out of range", count, size );
+	}
+	return (void *)(currentVM->dataBase + (intValue & currentVM->dataMask));
+}
+
 void *VM_ExplicitArgPtr( vm_t *vm, intptr_t intValue ) {
 	if ( !intValue ) {
 		return NULL;
@@ -679,6 +722,26 @@ void *VM_ExplicitArgPtr( vm_t *vm, intptr_t intValue ) {
 }
 
 
+/*
+==============
+VM_Run
+
+Runs a call with the engine the vm was prepared for
+==============
+*/
+int VM_Run( vm_t *vm, int *args ) {
+#ifndef NO_VM_COMPILED
+	if ( vm->compiled ) {
+		return VM_CallCompiled( vm, args );
+	}
+#endif
+	if ( vm->threaded ) {
+		return VM_CallThreaded( vm, args );
+	}
+	return VM_CallInterpreted( vm, args );
+}
+
+
 /*
 ==============
 VM_Call
@@ -738,12 +801,10 @@ intptr_t	QDECL VM_Call( vm_t *vm, int callnum, ... ) {
                             args[8],  args[9]);
 	} else {
 #if id386 // i386 calling convention doesn't need conversion
-#ifndef NO_VM_COMPILED
-		if ( vm->compiled )
-			r = VM_CallCompiled( vm, (int*)&callnum );
+		if ( vm->recording )
+			r = VM_RecordCall( vm, (int*)&callnum );
 		else
-#endif
-			r = VM_CallInterpreted( vm, (int*)&callnum );
+			r = VM_Run( vm, (int*)&callnum );
 #else
 		struct {
 			int callnum;
@@ -757,12 +818,10 @@ intptr_t	QDECL VM_Call( vm_t *vm, int callnum, ... ) {
 			a.args[i] = va_arg(ap, int);
 		}
 		va_end(ap);
-#ifndef NO_VM_COMPILED
-		if ( vm->compiled )
-			r = VM_CallCompiled( vm, &a.callnum );
+		if ( vm->recording )
+			r = VM_RecordCall( vm, &a.callnum );
 		else
-#endif
-			r = VM_CallInterpreted( vm, &a.callnum );
+			r = VM_Run( vm, &a.callnum );
 #endif
 	}
 
@@ -810,6 +869,16 @@ void VM_VmProfile_f( void ) {
 		return;
 	}
 
+	// fold in the program counter samples, if there are any
+	if ( vm->profileCounts ) {
+		for ( i = 0 ; i < vm->instructionPointersLength / 4 ; i++ ) {
+			if ( vm->profileCounts[i] ) {
+				VM_ValueToFunctionSymbol( vm, vm->instructionPointers[i] )->profileCount += vm->profileCounts[i];
+			}
+		}
+		VM_ProfileReset( vm );
+	}
+
 	sorted = Z_Malloc( vm->numSymbols * sizeof( *sorted ) );
 	sorted[0] = vm->symbols;
 	total = sorted[0]->profileCount;
@@ -835,6 +904,232 @@ void VM_VmProfile_f( void ) {
 	Z_Free( sorted );
 }
 
+/*
+==============================================================
+
+Sampled profiles
+
+A profile timer hands program counters to VM_ProfileSample, which counts
+the ones inside compiled code against the bytecode instruction that was
+compiled to them.  Nothing runs in the compiled code itself, so a profile
+costs the same in a release build as in a debug one.
+
+VM_ProfilePrint splits the instructions into functions at every OP_ENTER,
+which needs the bytecode again, so the functions are named from the .map
+symbols when there are any and by their first instruction otherwise.
+
+==============================================================
+*/
+
+typedef struct {
+	int		instruction;		// the OP_ENTER
+	int		samples;
+} vmProfileFunc_t;
+
+/*
+=================
+VM_ProfileStart
+
+Returns qfalse if vm has no compiled code to map program counters back from
+=================
+*/
+qboolean VM_ProfileStart( vm_t *vm ) {
+	if ( !vm || !vm->compiled || !vm->instructionPointersLength ) {
+		return qfalse;
+	}
+
+	if ( !vm->profileCounts ) {
+		vm->profileCounts = Z_Malloc( vm->instructionPointersLength );
+	}
+	return qtrue;
+}
+
+/*
+=================
+VM_ProfileSample
+
+Can be called from a signal handler, so it only counts
+=================
+*/
+qboolean VM_ProfileSample( vm_t *vm, void *pc ) {
+	int		*counts;
+	int		offset;
+	int		low, high, mid;
+
+	counts = vm->profileCounts;
+	if ( !counts || (byte *)pc < vm->codeBase || (byte *)pc >= vm->codeBase + vm->codeLength ) {
+		return qfalse;
+	}
+	offset = (byte *)pc - vm->codeBase;
+
+	// the last instruction compiled at or before offset
+	low = 0;
+	high = vm->instructionPointersLength / 4 - 1;
+	while ( low < high ) {
+		mid = ( low + high + 1 ) / 2;
+		if ( vm->instructionPointers[mid] <= offset ) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	counts[low]++;
+	return qtrue;
+}
+
+/*
+=================
+VM_ProfileReset
+=================
+*/
+void VM_ProfileReset( vm_t *vm ) {
+	if ( vm && vm->profileCounts ) {
+		Com_Memset( vm->profileCounts, 0, vm->instructionPointersLength );
+	}
+}
+
+/*
+=================
+VM_ProfileFunctions
+
+Folds the instruction counts into one entry per OP_ENTER in the qvm file,
+returns the number of functions or -1 if the file can't be read
+=================
+*/
+static int VM_ProfileFunctions( vm_t *vm, vmProfileFunc_t *funcs, int maxFuncs ) {
+	char		filename[MAX_QPATH];
+	vmHeader_t	*header;
+	byte		*code;
+	int			pc, instruction, count, numInstructions;
+	int			op;
+
+	Com_sprintf( filename, sizeof( filename ), "vm/%s.qvm", vm->name );
+	FS_ReadFile( filename, (void **)&header );
+	if ( !header ) {
+		return -1;
+	}
+
+	code = (byte *)header + LittleLong( header->codeOffset );
+	numInstructions = vm->instructionPointersLength / 4;
+	count = 0;
+	pc = 0;
+	for ( instruction = 0 ; instruction < numInstructions ; instruction++ ) {
+		if ( pc >= LittleLong( header->codeLength ) ) {
+			break;
+		}
+		op = code[ pc++ ];
+
+		if ( op == OP_ENTER && count < maxFuncs ) {
+			funcs[count].instruction = instruction;
+			funcs[count].samples = 0;
+			count++;
+		}
+		if ( count ) {
+			funcs[count - 1].samples += vm->profileCounts[instruction];
+		}
+
+		switch ( op ) {
+		case OP_ENTER:
+		case OP_CONST:
+		case OP_LOCAL:
+		case OP_LEAVE:
+		case OP_EQ:
+		case OP_NE:
+		case OP_LTI:
+		case OP_LEI:
+		case OP_GTI:
+		case OP_GEI:
+		case OP_LTU:
+		case OP_LEU:
+		case OP_GTU:
+		case OP_GEU:
+		case OP_EQF:
+		case OP_NEF:
+		case OP_LTF:
+		case OP_LEF:
+		case OP_GTF:
+		case OP_GEF:
+		case OP_BLOCK_COPY:
+			pc += 4;
+			break;
+		case OP_ARG:
+			pc++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	FS_FreeFile( header );
+	return count;
+}
+
+static int QDECL VM_ProfileFuncSort( const void *a, const void *b ) {
+	return ((vmProfileFunc_t *)b)->samples - ((vmProfileFunc_t *)a)->samples;
+}
+
+/*
+=================
+VM_ProfilePrint
+
+Flat profile of the lines functions with the most samples, 0 for all of them
+=================
+*/
+void VM_ProfilePrint( vm_t *vm, int lines ) {
+	vmProfileFunc_t	*funcs;
+	vmSymbol_t		*sym;
+	const char		*name;
+	int				i, count, maxFuncs, total, cumulative;
+
+	if ( !vm || !vm->profileCounts ) {
+		Com_Printf( "no samples in compiled code\n" );
+		return;
+	}
+
+	maxFuncs = vm->instructionPointersLength / 4;
+	funcs = Z_Malloc( maxFuncs * sizeof( *funcs ) );
+	count = VM_ProfileFunctions( vm, funcs, maxFuncs );
+	if ( count < 0 ) {
+		Com_Printf( "couldn't read vm/%s.qvm to find its functions\n", vm->name );
+		Z_Free( funcs );
+		return;
+	}
+
+	total = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		total += funcs[i].samples;
+	}
+	if ( !total ) {
+		Com_Printf( "no samples in compiled code\n" );
+		Z_Free( funcs );
+		return;
+	}
+
+	qsort( funcs, count, sizeof( *funcs ), VM_ProfileFuncSort );
+
+	if ( lines <= 0 || lines > count ) {
+		lines = count;
+	}
+
+	Com_Printf( "%i samples in %s\n", total, vm->name );
+	Com_Printf( "     %%  cumul%%  samples function\n" );
+	cumulative = 0;
+	for ( i = 0 ; i < lines && funcs[i].samples ; i++ ) {
+		cumulative += funcs[i].samples;
+		sym = VM_ValueToFunctionSymbol( vm, vm->instructionPointers[ funcs[i].instruction ] );
+		if ( vm->numSymbols && sym->symName[0] ) {
+			name = sym->symName;
+		} else {
+			name = va( "instruction %i", funcs[i].instruction );
+		}
+		Com_Printf( "%6.2f %6.2f %8i %s\n", 100.0f * funcs[i].samples / total,
+			100.0f * cumulative / total, funcs[i].samples, name );
+	}
+
+	Z_Free( funcs );
+}
+
 /*
 ==============
 VM_VmInfo_f
@@ -858,6 +1153,8 @@ void VM_VmInfo_f( void ) {
 		}
 		if ( vm->compiled ) {
 			Com_Printf( "compiled on load\n" );
+		} else if ( vm->threaded ) {
+			Com_Printf( "threaded interpreter\n" );
 		} else {
 			Com_Printf( "interpreted\n" );
 		}
@@ -120,6 +120,8 @@ typedef struct vmSymbol_s {
 	char	symName[1];		// variable sized
 } vmSymbol_t;
 
+#define	STACK_SIZE	0x20000				// programStack space at the end of the image
+
 #define	VM_OFFSET_PROGRAM_STACK		0
 #define	VM_OFFSET_SYSTEM_CALL		4
 
@@ -142,6 +144,8 @@ struct vm_s {
 	qboolean	currentlyInterpreting;
 
 	qboolean	compiled;
+	qboolean	threaded;			// cells for VM_CallThreaded in codeBase
+	qboolean	recording;			// calls go through VM_RecordCall
 	byte		*codeBase;
 	int			codeLength;
 
@@ -156,6 +160,8 @@ struct vm_s {
 	int			numSymbols;
 	struct vmSymbol_s	*symbols;
 
+	int			*profileCounts;		// sampled program counters per instruction, Z_Malloc'd
+
 	int			callLevel;			// for debug indenting
 	int			breakFunction;		// increment breakCount on function entry to this
 	int			breakCount;
@@ -172,10 +178,22 @@ extern	int		vm_debugLevel;
 
 void VM_Compile( vm_t *vm, vmHeader_t *header );
 int	VM_CallCompiled( vm_t *vm, int *args );
+#if !defined( NO_VM_COMPILED ) && defined( __x86_64__ )
+void VM_Bench_f( void );
+#endif
 
 void VM_PrepareInterpreter( vm_t *vm, vmHeader_t *header );
 int	VM_CallInterpreted( vm_t *vm, int *args );
 
+void VM_PrepareThreaded( vm_t *vm, vmHeader_t *header );
+int	VM_CallThreaded( vm_t *vm, int *args );
+
+vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc );
+int	VM_Run( vm_t *vm, int *args );
+
+int	VM_RecordCall( vm_t *vm, int *args );
+void VM_Replay_f( void );
+
 vmSymbol_t *VM_ValueToFunctionSymbol( vm_t *vm, int value );
 int VM_SymbolToValue( vm_t *vm, const char *symbol );
 const char *VM_ValueToSymbol( vm_t *vm, int value );
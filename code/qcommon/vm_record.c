@@ -0,0 +1,648 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// vm_record.c -- recording the calls into a qvm and replaying them on each engine
+
+#include "vm_local.h"
+
+/*
+=============================================================================
+
+A recording is a copy of the data image followed by the events:
+
+VMREC_CALL		the call arguments, then what the engine changed in the
+				image since the last top level call returned
+VMREC_SYSCALL	callnum, return value, then what the system call changed
+				after its pointer arguments
+VMREC_RETURN	the value the call returned
+VMREC_END
+
+Changes are runs of offset, length and bytes, ended by an offset of -1.
+When a system call calls back into the vm, the nested call is recorded
+before the system call, and the replay runs it when the vm makes that
+system call.
+
+Only VMREC_WINDOW bytes after each pointer argument are compared, so a
+system call that writes further than that makes the replay diverge, which
+vmreplay reports.  So do recordings of a different qvm.
+
+=============================================================================
+*/
+
+#define	VMREC_IDENT		(('C'<<24)+('E'<<16)+('R'<<8)+'Q')
+#define	VMREC_VERSION	1
+
+#define	VMREC_ARGS		10			// callnum and the vmMain arguments
+#define	VMREC_POINTERS	10			// system call arguments checked for writes
+#define	VMREC_WINDOW	4096
+#define	VMREC_GAP		16			// equal bytes that end a run
+
+typedef enum {
+	VMREC_CALL = 1,
+	VMREC_SYSCALL,
+	VMREC_RETURN,
+	VMREC_END
+} vmRecordEvent_t;
+
+typedef struct {
+	int		ident;
+	int		version;
+	char	module[MAX_QPATH];
+	int		checksum;				// of the qvm file
+	int		dataLength;
+	int		frameCall;
+} vmRecordHeader_t;
+
+typedef struct {
+	vm_t			*vm;
+	fileHandle_t	f;
+	char			filename[MAX_QPATH];
+	intptr_t		(*systemCall)( intptr_t *parms );
+	byte			*shadow;		// the image when the last top level call returned
+	int				frameCall;
+	int				framesLeft;
+	int				frames;
+	int				depth;
+} vmRecord_t;
+
+static vmRecord_t	vmRecord;
+
+/*
+=================
+VM_RecordChecksum
+=================
+*/
+static int VM_RecordChecksum( const char *module ) {
+	char	filename[MAX_QPATH];
+	void	*buffer;
+	int		length, checksum;
+
+	Com_sprintf( filename, sizeof( filename ), "vm/%s.qvm", module );
+	length = FS_ReadFile( filename, &buffer );
+	if ( !buffer ) {
+		return 0;
+	}
+	checksum = Com_BlockChecksum( buffer, length );
+	FS_FreeFile( buffer );
+
+	return checksum;
+}
+
+/*
+=================
+VM_RecordInt
+=================
+*/
+static void VM_RecordInt( int value ) {
+	FS_Write( &value, sizeof( value ), vmRecord.f );
+}
+
+/*
+=================
+VM_RecordRuns
+
+Writes the runs where cur differs from old, base is the image offset of both
+=================
+*/
+static void VM_RecordRuns( const byte *old, const byte *cur, int base, int length ) {
+	int		i, start, end;
+
+	i = 0;
+	while ( i < length ) {
+		if ( i + 64 <= length && !memcmp( old + i, cur + i, 64 ) ) {
+			i += 64;
+			continue;
+		}
+		if ( old[i] == cur[i] ) {
+			i++;
+			continue;
+		}
+
+		start = i;
+		end = ++i;
+		for ( ; i < length && i - end < VMREC_GAP ; i++ ) {
+			if ( old[i] != cur[i] ) {
+				end = i + 1;
+			}
+		}
+
+		VM_RecordInt( base + start );
+		VM_RecordInt( end - start );
+		FS_Write( cur + start, end - start, vmRecord.f );
+	}
+}
+
+/*
+=================
+VM_RecordSystemCall
+=================
+*/
+static intptr_t VM_RecordSystemCall( intptr_t *args ) {
+	byte		before[VMREC_POINTERS][VMREC_WINDOW];
+	int			base[VMREC_POINTERS];
+	int			length[VMREC_POINTERS];
+	vm_t		*vm;
+	intptr_t	r;
+	int			i, count, dataLength;
+
+	vm = vmRecord.vm;
+	dataLength = vm->dataMask + 1;
+
+	for ( i = 1, count = 0 ; i <= VMREC_POINTERS ; i++ ) {
+		if ( args[i] <= 0 || args[i] >= dataLength ) {
+			continue;
+		}
+		base[count] = args[i];
+		length[count] = dataLength - base[count];
+		if ( length[count] > VMREC_WINDOW ) {
+			length[count] = VMREC_WINDOW;
+		}
+		Com_Memcpy( before[count], vm->dataBase + base[count], length[count] );
+		count++;
+	}
+
+	r = vmRecord.systemCall( args );
+
+	// the system call may have stopped the recording
+	if ( vmRecord.vm != vm ) {
+		return r;
+	}
+
+	VM_RecordInt( VMREC_SYSCALL );
+	VM_RecordInt( args[0] );
+	VM_RecordInt( r );
+	for ( i = 0 ; i < count ; i++ ) {
+		VM_RecordRuns( before[i], vm->dataBase + base[i], base[i], length[i] );
+	}
+	VM_RecordInt( -1 );
+
+	return r;
+}
+
+/*
+=================
+VM_RecordCall
+
+Runs a call from VM_Call while recording
+=================
+*/
+int VM_RecordCall( vm_t *vm, int *args ) {
+	int		r;
+
+	if ( vm != vmRecord.vm ) {
+		return VM_Run( vm, args );
+	}
+
+	VM_RecordInt( VMREC_CALL );
+	FS_Write( args, VMREC_ARGS * sizeof( int ), vmRecord.f );
+	if ( !vmRecord.depth ) {
+		VM_RecordRuns( vmRecord.shadow, vm->dataBase, 0, vm->dataMask + 1 );
+	}
+	VM_RecordInt( -1 );
+
+	vmRecord.depth++;
+	r = VM_Run( vm, args );
+	vmRecord.depth--;
+
+	VM_RecordInt( VMREC_RETURN );
+	VM_RecordInt( r );
+
+	if ( !vmRecord.depth ) {
+		Com_Memcpy( vmRecord.shadow, vm->dataBase, vm->dataMask + 1 );
+		if ( args[0] == vmRecord.frameCall ) {
+			vmRecord.frames++;
+			if ( --vmRecord.framesLeft <= 0 ) {
+				VM_RecordStop();
+			}
+		}
+	}
+
+	return r;
+}
+
+/*
+=================
+VM_RecordStart
+
+Records into vmrecord/<name>.rec in the homepath
+=================
+*/
+qboolean VM_RecordStart( vm_t *vm, const char *name, int frameCall, int frames ) {
+	vmRecordHeader_t	header;
+	int					dataLength;
+
+	if ( vmRecord.vm ) {
+		Com_Printf( "Already recording %s\n", vmRecord.filename );
+		return qfalse;
+	}
+	if ( !vm || vm->dllHandle || !vm->dataBase ) {
+		Com_Printf( "Only a qvm can be recorded\n" );
+		return qfalse;
+	}
+	dataLength = vm->dataMask + 1;
+	if ( vm->programStack != dataLength ) {
+		Com_Printf( "Can't start recording %s from inside a call\n", vm->name );
+		return qfalse;
+	}
+	if ( dataLength > Z_AvailableMemory() / 2 ) {
+		Com_Printf( "Not enough zone memory to record %s\n", vm->name );
+		return qfalse;
+	}
+
+	Com_sprintf( vmRecord.filename, sizeof( vmRecord.filename ), "vmrecord/%s.rec", name );
+	vmRecord.f = FS_SV_FOpenFileWrite( vmRecord.filename );
+	if ( !vmRecord.f ) {
+		Com_Printf( "Couldn't write %s\n", vmRecord.filename );
+		return qfalse;
+	}
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	header.ident = VMREC_IDENT;
+	header.version = VMREC_VERSION;
+	Q_strncpyz( header.module, vm->name, sizeof( header.module ) );
+	header.checksum = VM_RecordChecksum( vm->name );
+	header.dataLength = dataLength;
+	header.frameCall = frameCall;
+	FS_Write( &header, sizeof( header ), vmRecord.f );
+	FS_Write( vm->dataBase, dataLength, vmRecord.f );
+
+	vmRecord.shadow = Z_Malloc( dataLength );
+	Com_Memcpy( vmRecord.shadow, vm->dataBase, dataLength );
+
+	vmRecord.vm = vm;
+	vmRecord.systemCall = vm->systemCall;
+	vmRecord.frameCall = frameCall;
+	vmRecord.framesLeft = frames;
+	vmRecord.frames = 0;
+	vmRecord.depth = 0;
+
+	vm->systemCall = VM_RecordSystemCall;
+	vm->recording = qtrue;
+
+	Com_Printf( "Recording %i frames of %s to %s\n", frames, vm->name, vmRecord.filename );
+
+	return qtrue;
+}
+
+/*
+=================
+VM_RecordStop
+=================
+*/
+void VM_RecordStop( void ) {
+	vm_t	*vm;
+
+	if ( !vmRecord.vm ) {
+		return;
+	}
+
+	VM_RecordInt( VMREC_END );
+	FS_FCloseFile( vmRecord.f );
+
+	vm = vmRecord.vm;
+	vm->systemCall = vmRecord.systemCall;
+	vm->recording = qfalse;
+
+	Z_Free( vmRecord.shadow );
+
+	Com_Printf( "Recorded %i frames of %s to %s\n", vmRecord.frames, vm->name, vmRecord.filename );
+
+	Com_Memset( &vmRecord, 0, sizeof( vmRecord ) );
+}
+
+/*
+=============================================================================
+
+REPLAY
+
+=============================================================================
+*/
+
+typedef enum {
+	VMREPLAY_INTERPRETED,
+	VMREPLAY_THREADED,
+#ifndef NO_VM_COMPILED
+	VMREPLAY_COMPILED,
+#endif
+
+	VMREPLAY_ENGINES
+} vmReplayEngine_t;
+
+static const char *vmReplayEngineNames[VMREPLAY_ENGINES] = {
+	"interpreted",
+	"threaded",
+#ifndef NO_VM_COMPILED
+	"compiled",
+#endif
+};
+
+typedef struct {
+	vm_t			*vm;
+	const byte		*data;
+	int				length;
+	int				ofs;			// of the next event
+	int				frameCall;
+	int				frames;
+	unsigned int	frameUsec;
+	int				syscalls;
+	int				mismatches;		// calls that returned something else
+	qboolean		diverged;		// the events no longer match the calls
+} vmReplay_t;
+
+static vmReplay_t	vmReplay;
+
+/*
+=================
+VM_ReplayInt
+=================
+*/
+static int VM_ReplayInt( void ) {
+	int		value;
+
+	if ( vmReplay.ofs + sizeof( value ) > vmReplay.length ) {
+		vmReplay.diverged = qtrue;
+		return VMREC_END;
+	}
+	Com_Memcpy( &value, vmReplay.data + vmReplay.ofs, sizeof( value ) );
+	vmReplay.ofs += sizeof( value );
+
+	return value;
+}
+
+/*
+=================
+VM_ReplayRuns
+=================
+*/
+static void VM_ReplayRuns( void ) {
+	int		ofs, length;
+
+	while ( 1 ) {
+		ofs = VM_ReplayInt();
+		if ( ofs == -1 || vmReplay.diverged ) {
+			return;
+		}
+		length = VM_ReplayInt();
+		if ( ofs < 0 || length < 0 || length > vmReplay.vm->dataMask + 1 - ofs
+			|| length > vmReplay.length - vmReplay.ofs ) {
+			vmReplay.diverged = qtrue;
+			return;
+		}
+		Com_Memcpy( vmReplay.vm->dataBase + ofs, vmReplay.data + vmReplay.ofs, length );
+		vmReplay.ofs += length;
+	}
+}
+
+/*
+=================
+VM_ReplayCall
+
+Runs the call event that was just read
+=================
+*/
+static int VM_ReplayCall( void ) {
+	int				args[VMREC_ARGS];
+	int				i, r;
+	unsigned int	start;
+
+	for ( i = 0 ; i < VMREC_ARGS ; i++ ) {
+		args[i] = VM_ReplayInt();
+	}
+	VM_ReplayRuns();
+	if ( vmReplay.diverged ) {
+		return 0;
+	}
+
+	start = Sys_Microseconds();
+	r = VM_Run( vmReplay.vm, args );
+	if ( args[0] == vmReplay.frameCall ) {
+		vmReplay.frameUsec += Sys_Microseconds() - start;
+		vmReplay.frames++;
+	}
+
+	if ( VM_ReplayInt() != VMREC_RETURN ) {
+		vmReplay.diverged = qtrue;
+	} else if ( VM_ReplayInt() != r ) {
+		vmReplay.mismatches++;
+	}
+
+	return r;
+}
+
+/*
+=================
+VM_ReplaySystemCall
+=================
+*/
+static intptr_t VM_ReplaySystemCall( intptr_t *args ) {
+	int		event, r;
+
+	vmReplay.syscalls++;
+
+	while ( !vmReplay.diverged ) {
+		event = VM_ReplayInt();
+		if ( event == VMREC_CALL ) {
+			VM_ReplayCall();
+			continue;
+		}
+		if ( event != VMREC_SYSCALL || VM_ReplayInt() != args[0] ) {
+			vmReplay.diverged = qtrue;
+			break;
+		}
+		r = VM_ReplayInt();
+		VM_ReplayRuns();
+		return r;
+	}
+
+	return 0;
+}
+
+/*
+=================
+VM_ReplayLoad
+
+Loads the qvm for one engine, like VM_Create
+=================
+*/
+static qboolean VM_ReplayLoad( vm_t *vm, const char *module, vmReplayEngine_t engine ) {
+	vmHeader_t	*header;
+
+	Com_Memset( vm, 0, sizeof( *vm ) );
+	Q_strncpyz( vm->name, module, sizeof( vm->name ) );
+	vm->systemCall = VM_ReplaySystemCall;
+
+	if ( !( header = VM_LoadQVM( vm, qtrue ) ) ) {
+		return qfalse;
+	}
+
+	vm->instructionPointersLength = header->instructionCount * 4;
+	vm->instructionPointers = Hunk_Alloc( vm->instructionPointersLength, h_high );
+	vm->codeLength = header->codeLength;
+
+	switch ( engine ) {
+#ifndef NO_VM_COMPILED
+	case VMREPLAY_COMPILED:
+		vm->compiled = qtrue;
+		VM_Compile( vm, header );
+		break;
+#endif
+	case VMREPLAY_THREADED:
+		vm->threaded = qtrue;
+		VM_PrepareThreaded( vm, header );
+		break;
+	default:
+		VM_PrepareInterpreter( vm, header );
+		break;
+	}
+
+	FS_FreeFile( header );
+
+	vm->programStack = vm->dataMask + 1;
+	vm->stackBottom = vm->programStack - STACK_SIZE;
+
+	return vm->compiled || vm->threaded || engine == VMREPLAY_INTERPRETED;
+}
+
+/*
+=================
+VM_ReplayEngine
+=================
+*/
+static void VM_ReplayEngine( const vmRecordHeader_t *header, int length, vmReplayEngine_t engine, int runs ) {
+	static vm_t		vm;
+	vm_t			*savedVM;
+	unsigned int	start, total;
+	float			usecPerFrame;
+	int				run;
+
+	if ( !VM_ReplayLoad( &vm, header->module, engine ) || vm.dataMask + 1 != header->dataLength ) {
+		Com_Printf( "%s: couldn't load %s\n", vmReplayEngineNames[engine], header->module );
+		if ( vm.destroy ) {
+			vm.destroy( &vm );
+		}
+		return;
+	}
+
+	Com_Memset( &vmReplay, 0, sizeof( vmReplay ) );
+	vmReplay.vm = &vm;
+	vmReplay.data = (const byte *)header;
+	vmReplay.length = length;
+	vmReplay.frameCall = header->frameCall;
+
+	savedVM = currentVM;
+	currentVM = &vm;
+
+	total = 0;
+	for ( run = 0 ; run < runs && !vmReplay.diverged ; run++ ) {
+		Com_Memcpy( vm.dataBase, header + 1, header->dataLength );
+		vmReplay.ofs = sizeof( *header ) + header->dataLength;
+
+		start = Sys_Microseconds();
+		while ( !vmReplay.diverged ) {
+			switch ( VM_ReplayInt() ) {
+			case VMREC_CALL:
+				VM_ReplayCall();
+				continue;
+			case VMREC_END:
+				break;
+			default:
+				vmReplay.diverged = qtrue;
+				break;
+			}
+			break;
+		}
+		total += Sys_Microseconds() - start;
+	}
+
+	currentVM = savedVM;
+
+	if ( vmReplay.frames ) {
+		usecPerFrame = vmReplay.frameUsec / (float)vmReplay.frames;
+	} else {
+		usecPerFrame = 0;
+	}
+	Com_Printf( "%-11s %5i frames %9.3f msec %9.2f usec/frame %7i syscalls %5i mismatches %s\n",
+		vmReplayEngineNames[engine], vmReplay.frames / run, total / ( 1000.0f * run ), usecPerFrame,
+		vmReplay.syscalls / run, vmReplay.mismatches, vmReplay.diverged ? S_COLOR_RED "diverged" : "" );
+
+	if ( vm.destroy ) {
+		vm.destroy( &vm );
+	}
+	Com_Memset( &vm, 0, sizeof( vm ) );
+}
+
+/*
+=================
+VM_Replay_f
+
+vmreplay <name> [runs]
+
+Runs a recording on every engine.  The scratch vms are allocated past
+a hunk mark that is cleared afterwards, so no server can be running.
+=================
+*/
+void VM_Replay_f( void ) {
+	vmRecordHeader_t	*header;
+	fileHandle_t		f;
+	char				filename[MAX_QPATH];
+	int					length, runs, engine;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: vmreplay <name> [runs]\n" );
+		return;
+	}
+	if ( com_sv_running->integer ) {
+		Com_Printf( "vmreplay can't run while a server is running\n" );
+		return;
+	}
+
+	runs = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1;
+	if ( runs <= 0 ) {
+		runs = 1;
+	}
+
+	Com_sprintf( filename, sizeof( filename ), "vmrecord/%s.rec", Cmd_Argv( 1 ) );
+	length = FS_SV_FOpenFileRead( filename, &f );
+	if ( !f ) {
+		Com_Printf( "Couldn't read %s\n", filename );
+		return;
+	}
+
+	Hunk_SetMark();
+
+	header = Hunk_Alloc( length, h_low );
+	if ( FS_Read( header, length, f ) != length || length < sizeof( *header )
+		|| header->ident != VMREC_IDENT || header->version != VMREC_VERSION
+		|| header->dataLength <= 0 || ( header->dataLength & ( header->dataLength - 1 ) )
+		|| header->dataLength > length - sizeof( *header ) ) {
+		Com_Printf( "%s is not a recording\n", filename );
+	} else if ( VM_RecordChecksum( header->module ) != header->checksum ) {
+		Com_Printf( "vm/%s.qvm is not the one that was recorded\n", header->module );
+	} else {
+		Com_Printf( "%s: %s, %i bytes, %i runs\n", filename, header->module, length, runs );
+		for ( engine = 0 ; engine < VMREPLAY_ENGINES ; engine++ ) {
+			VM_ReplayEngine( header, length, engine, runs );
+		}
+	}
+	FS_FCloseFile( f );
+
+	Hunk_ClearToMark();
+}
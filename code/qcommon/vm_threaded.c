@@ -0,0 +1,704 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// vm_threaded.c -- pre-decoded, direct threaded qvm interpreter
+
+#include "vm_local.h"
+
+/*
+=============================================================================
+
+The code is decoded once into one cell per instruction, holding the
+opcode, its operand and, with computed goto, the address of the code that
+runs it, so each instruction ends by jumping straight to the next one.
+Compilers without computed goto switch on the opcode instead.  Branch and
+call targets are instruction numbers, which are cell indexes.
+
+The most common pairs of instructions, and the CONST ADD LOAD4 of a
+structure field load, are fused: the first cell gets a superinstruction
+that does the work of all of them and skips the other cells.  Those keep
+their own opcodes, so jumping to them still works.
+
+The top of the opStack is kept in a local.
+
+This is the interpreter for builds without a compiler, and for qvms the
+compiler fails on.  vm_threaded 0 uses the switch interpreter instead.
+
+=============================================================================
+*/
+
+#if defined( __GNUC__ )
+#define	VM_COMPUTED_GOTO
+#endif
+
+// superinstructions, numbered after the opcodes
+typedef enum {
+	OPX_LOCAL_LOAD4 = OP_CVFI + 1,
+	OPX_CONST_LOAD4,
+	OPX_CONST_ADD,
+	OPX_CONST_ADD_LOAD4,
+	OPX_ADD_LOAD4,
+	OPX_CONST_STORE4,
+	OPX_CONST_CALL,
+	OPX_CONST_JUMP,
+	OPX_CONST_EQ,
+	OPX_CONST_NE,
+	OPX_CONST_LTI,
+	OPX_CONST_LEI,
+	OPX_CONST_GTI,
+	OPX_CONST_GEI,
+	OPX_END,				// after the last instruction
+
+	OPX_NUM
+} vmThreadedOp_t;
+
+typedef struct {
+#ifdef VM_COMPUTED_GOTO
+	const void	*label;
+#endif
+	int			op;
+	int			arg;
+} vmCell_t;
+
+#define	OPSTACK_SIZE	1024
+#define	OPSTACK_GUARD	64		// deeper than any expression
+
+#ifdef VM_COMPUTED_GOTO
+static const void * const	*vmThreadedLabels;
+#endif
+
+typedef union {
+	float	f;
+	int		i;
+} vmFloat_t;
+
+static ID_INLINE float VM_IntToFloat( int i ) {
+	vmFloat_t	v;
+
+	v.i = i;
+	return v.f;
+}
+
+static ID_INLINE int VM_FloatToInt( float f ) {
+	vmFloat_t	v;
+
+	v.f = f;
+	return v.i;
+}
+
+/*
+====================
+VM_ThreadedFuse
+
+The superinstruction for the cells from first on, or 0
+====================
+*/
+static int VM_ThreadedFuse( const vmCell_t *first, int left, int count ) {
+	const vmCell_t	*second;
+
+	if ( left < 2 ) {
+		return 0;
+	}
+	second = first + 1;
+
+	switch ( first->op ) {
+	case OP_LOCAL:
+		if ( second->op == OP_LOAD4 ) {
+			return OPX_LOCAL_LOAD4;
+		}
+		break;
+	case OP_ADD:
+		if ( second->op == OP_LOAD4 ) {
+			return OPX_ADD_LOAD4;
+		}
+		break;
+	case OP_CONST:
+		switch ( second->op ) {
+		case OP_LOAD4:
+			return OPX_CONST_LOAD4;
+		case OP_ADD:
+			if ( left >= 3 && first[2].op == OP_LOAD4 ) {
+				return OPX_CONST_ADD_LOAD4;
+			}
+			return OPX_CONST_ADD;
+		case OP_STORE4:
+			return OPX_CONST_STORE4;
+		case OP_CALL:
+			return OPX_CONST_CALL;
+		case OP_JUMP:
+			// a bad target is left for OP_JUMP to catch
+			if ( first->arg >= 0 && first->arg < count ) {
+				return OPX_CONST_JUMP;
+			}
+			break;
+		case OP_EQ:
+			return OPX_CONST_EQ;
+		case OP_NE:
+			return OPX_CONST_NE;
+		case OP_LTI:
+			return OPX_CONST_LTI;
+		case OP_LEI:
+			return OPX_CONST_LEI;
+		case OP_GTI:
+			return OPX_CONST_GTI;
+		case OP_GEI:
+			return OPX_CONST_GEI;
+		}
+		break;
+	}
+	return 0;
+}
+
+/*
+====================
+VM_PrepareThreaded
+====================
+*/
+void VM_PrepareThreaded( vm_t *vm, vmHeader_t *header ) {
+	vmCell_t	*cells;
+	byte		*code;
+	int			count, instruction, pc, op, fused;
+
+	count = header->instructionCount;
+	cells = Hunk_Alloc( ( count + 1 ) * sizeof( *cells ), h_high );
+	code = (byte *)header + header->codeOffset;
+
+	pc = 0;
+	for ( instruction = 0 ; instruction < count ; instruction++ ) {
+		if ( pc >= header->codeLength ) {
+			Com_Error( ERR_DROP, "VM_PrepareThreaded: %s code ends at instruction %i", vm->name, instruction );
+		}
+		vm->instructionPointers[ instruction ] = instruction;
+
+		op = code[ pc++ ];
+		if ( op > OP_CVFI ) {
+			Com_Error( ERR_DROP, "VM_PrepareThreaded: bad opcode %i at instruction %i in %s", op, instruction, vm->name );
+		}
+		cells[ instruction ].op = op;
+		cells[ instruction ].arg = 0;
+
+		switch ( op ) {
+		case OP_ENTER:
+		case OP_CONST:
+		case OP_LOCAL:
+		case OP_LEAVE:
+		case OP_EQ:
+		case OP_NE:
+		case OP_LTI:
+		case OP_LEI:
+		case OP_GTI:
+		case OP_GEI:
+		case OP_LTU:
+		case OP_LEU:
+		case OP_GTU:
+		case OP_GEU:
+		case OP_EQF:
+		case OP_NEF:
+		case OP_LTF:
+		case OP_LEF:
+		case OP_GTF:
+		case OP_GEF:
+		case OP_BLOCK_COPY:
+			if ( pc + 4 > header->codeLength ) {
+				Com_Error( ERR_DROP, "VM_PrepareThreaded: %s code ends at instruction %i", vm->name, instruction );
+			}
+			Com_Memcpy( &cells[ instruction ].arg, code + pc, 4 );
+			cells[ instruction ].arg = LittleLong( cells[ instruction ].arg );
+			pc += 4;
+			break;
+		case OP_ARG:
+			cells[ instruction ].arg = code[ pc++ ];
+			break;
+		default:
+			break;
+		}
+
+		if ( op >= OP_EQ && op <= OP_GEF
+			&& ( cells[ instruction ].arg < 0 || cells[ instruction ].arg >= count ) ) {
+			Com_Error( ERR_DROP, "VM_PrepareThreaded: bad branch target at instruction %i in %s", instruction, vm->name );
+		}
+	}
+	cells[ count ].op = OPX_END;
+	cells[ count ].arg = 0;
+
+	fused = 0;
+	for ( instruction = 0 ; instruction < count ; instruction++ ) {
+		op = VM_ThreadedFuse( &cells[ instruction ], count - instruction, count );
+		if ( op ) {
+			cells[ instruction ].op = op;
+			instruction += ( op == OPX_CONST_ADD_LOAD4 ) ? 2 : 1;
+			fused++;
+		}
+	}
+
+#ifdef VM_COMPUTED_GOTO
+	if ( !vmThreadedLabels ) {
+		VM_CallThreaded( NULL, NULL );
+	}
+	for ( instruction = 0 ; instruction <= count ; instruction++ ) {
+		cells[ instruction ].label = vmThreadedLabels[ cells[ instruction ].op ];
+	}
+#endif
+
+	vm->codeBase = (byte *)cells;
+
+	Com_Printf( "VM file %s prepared for the threaded interpreter, %i superinstructions\n", vm->name, fused );
+}
+
+/*
+====================
+VM_CallThreaded
+
+See VM_CallInterpreted for the stack layout.  With VM_COMPUTED_GOTO a NULL
+vm only hands the dispatch table to VM_PrepareThreaded.
+====================
+*/
+#ifdef VM_COMPUTED_GOTO
+#define	OPCODE( op )	L_##op:
+#define	DISPATCH()		goto *ip->label
+#else
+#define	OPCODE( op )	case op:
+#define	DISPATCH()		goto dispatch
+#endif
+
+#define	NEXT()			ip++; DISPATCH()
+#define	NEXT2()			ip += 2; DISPATCH()
+#define	NEXT3()			ip += 3; DISPATCH()
+
+#define	PUSH( v )		( *++opStack = tos, tos = ( v ) )
+#define	POP()			( *opStack-- )
+
+// r1 is the left side, v the right side
+#define	BRANCH( cond )	r1 = opStack[0]; v = tos; tos = opStack[-1]; opStack -= 2; \
+						if ( cond ) { ip = cells + ip->arg; DISPATCH(); } \
+						NEXT()
+
+// the constant is the right side, the branch is the second cell
+#define	BRANCH_CONST( cond )	r1 = tos; v = ip->arg; tos = POP(); \
+						if ( cond ) { ip = cells + ip[1].arg; DISPATCH(); } \
+						NEXT2()
+
+int	VM_CallThreaded( vm_t *vm, int *args ) {
+#ifdef VM_COMPUTED_GOTO
+	static const void * const	labels[OPX_NUM] = {
+		&&L_OP_UNDEF, &&L_OP_IGNORE, &&L_OP_BREAK,
+		&&L_OP_ENTER, &&L_OP_LEAVE, &&L_OP_CALL, &&L_OP_PUSH, &&L_OP_POP,
+		&&L_OP_CONST, &&L_OP_LOCAL, &&L_OP_JUMP,
+		&&L_OP_EQ, &&L_OP_NE, &&L_OP_LTI, &&L_OP_LEI, &&L_OP_GTI, &&L_OP_GEI,
+		&&L_OP_LTU, &&L_OP_LEU, &&L_OP_GTU, &&L_OP_GEU,
+		&&L_OP_EQF, &&L_OP_NEF, &&L_OP_LTF, &&L_OP_LEF, &&L_OP_GTF, &&L_OP_GEF,
+		&&L_OP_LOAD1, &&L_OP_LOAD2, &&L_OP_LOAD4, &&L_OP_STORE1, &&L_OP_STORE2, &&L_OP_STORE4,
+		&&L_OP_ARG, &&L_OP_BLOCK_COPY,
+		&&L_OP_SEX8, &&L_OP_SEX16, &&L_OP_NEGI, &&L_OP_ADD, &&L_OP_SUB,
+		&&L_OP_DIVI, &&L_OP_DIVU, &&L_OP_MODI, &&L_OP_MODU, &&L_OP_MULI, &&L_OP_MULU,
+		&&L_OP_BAND, &&L_OP_BOR, &&L_OP_BXOR, &&L_OP_BCOM,
+		&&L_OP_LSH, &&L_OP_RSHI, &&L_OP_RSHU,
+		&&L_OP_NEGF, &&L_OP_ADDF, &&L_OP_SUBF, &&L_OP_DIVF, &&L_OP_MULF,
+		&&L_OP_CVIF, &&L_OP_CVFI,
+		&&L_OPX_LOCAL_LOAD4, &&L_OPX_CONST_LOAD4, &&L_OPX_CONST_ADD, &&L_OPX_CONST_ADD_LOAD4, &&L_OPX_ADD_LOAD4,
+		&&L_OPX_CONST_STORE4, &&L_OPX_CONST_CALL, &&L_OPX_CONST_JUMP,
+		&&L_OPX_CONST_EQ, &&L_OPX_CONST_NE, &&L_OPX_CONST_LTI, &&L_OPX_CONST_LEI,
+		&&L_OPX_CONST_GTI, &&L_OPX_CONST_GEI,
+		&&L_OPX_END
+	};
+#endif
+	int			stack[OPSTACK_SIZE];
+	int			*opStack;
+	int			tos, r1, v;
+	int			programStack;
+	int			stackOnEntry;
+	int			dataMask;
+	int			count;
+	byte		*image;
+	vmCell_t	*cells, *ip;
+
+#ifdef VM_COMPUTED_GOTO
+	if ( !vm ) {
+		vmThreadedLabels = labels;
+		return 0;
+	}
+#endif
+
+	vm->currentlyInterpreting = qtrue;
+
+	// we might be called recursively, so this might not be the very top
+	programStack = stackOnEntry = vm->programStack;
+
+	image = vm->dataBase;
+	dataMask = vm->dataMask;
+	cells = (vmCell_t *)vm->codeBase;
+	count = vm->instructionPointersLength / 4;
+
+	// stack[0] is never read, the first push stores the empty top there
+	opStack = stack;
+	tos = 0;
+
+	programStack -= 48;
+
+	*(int *)&image[ programStack + 44] = args[9];
+	*(int *)&image[ programStack + 40] = args[8];
+	*(int *)&image[ programStack + 36] = args[7];
+	*(int *)&image[ programStack + 32] = args[6];
+	*(int *)&image[ programStack + 28] = args[5];
+	*(int *)&image[ programStack + 24] = args[4];
+	*(int *)&image[ programStack + 20] = args[3];
+	*(int *)&image[ programStack + 16] = args[2];
+	*(int *)&image[ programStack + 12] = args[1];
+	*(int *)&image[ programStack + 8 ] = args[0];
+	*(int *)&image[ programStack + 4 ] = 0;	// return stack
+	*(int *)&image[ programStack ] = -1;	// will terminate the loop on return
+
+	ip = cells;
+
+#ifdef VM_COMPUTED_GOTO
+	DISPATCH();
+#else
+dispatch:
+	switch ( ip->op ) {
+	default:
+		Com_Error( ERR_DROP, "VM_CallThreaded: bad opcode %i", ip->op );
+#endif
+
+	OPCODE( OP_UNDEF )
+	OPCODE( OP_IGNORE )
+		NEXT();
+	OPCODE( OP_BREAK )
+		vm->breakCount++;
+		NEXT();
+	OPCODE( OPX_END )
+		Com_Error( ERR_DROP, "VM_CallThreaded: ran off the end of %s", vm->name );
+
+	OPCODE( OP_ENTER )
+		programStack -= ip->arg;
+		if ( programStack <= vm->stackBottom ) {
+			Com_Error( ERR_DROP, "VM stack overflow" );
+		}
+		if ( opStack >= stack + OPSTACK_SIZE - OPSTACK_GUARD ) {
+			Com_Error( ERR_DROP, "VM opStack overflow" );
+		}
+		NEXT();
+
+	OPCODE( OP_LEAVE )
+		programStack += ip->arg;
+		v = *(int *)&image[ programStack ];
+		if ( v == -1 ) {
+			goto done;
+		}
+		if ( (unsigned)v >= count ) {
+			Com_Error( ERR_DROP, "VM program counter out of range in OP_LEAVE" );
+		}
+		ip = cells + v;
+		DISPATCH();
+
+	OPCODE( OP_CALL )
+		v = tos;
+		tos = POP();
+		r1 = ip - cells + 1;
+		goto call;
+	OPCODE( OPX_CONST_CALL )
+		v = ip->arg;
+		r1 = ip - cells + 2;
+		goto call;
+
+	// push and pop are only needed for discarded or bad function return values
+	OPCODE( OP_PUSH )
+		PUSH( 0 );
+		NEXT();
+	OPCODE( OP_POP )
+		tos = POP();
+		NEXT();
+
+	OPCODE( OP_CONST )
+		PUSH( ip->arg );
+		NEXT();
+	OPCODE( OP_LOCAL )
+		PUSH( ip->arg + programStack );
+		NEXT();
+
+	OPCODE( OP_JUMP )
+		v = tos;
+		tos = POP();
+		if ( (unsigned)v >= count ) {
+			Com_Error( ERR_DROP, "VM program counter out of range in OP_JUMP" );
+		}
+		ip = cells + v;
+		DISPATCH();
+	OPCODE( OPX_CONST_JUMP )
+		ip = cells + ip->arg;
+		DISPATCH();
+
+	OPCODE( OP_EQ )
+		BRANCH( r1 == v );
+	OPCODE( OP_NE )
+		BRANCH( r1 != v );
+	OPCODE( OP_LTI )
+		BRANCH( r1 < v );
+	OPCODE( OP_LEI )
+		BRANCH( r1 <= v );
+	OPCODE( OP_GTI )
+		BRANCH( r1 > v );
+	OPCODE( OP_GEI )
+		BRANCH( r1 >= v );
+	OPCODE( OP_LTU )
+		BRANCH( (unsigned)r1 < (unsigned)v );
+	OPCODE( OP_LEU )
+		BRANCH( (unsigned)r1 <= (unsigned)v );
+	OPCODE( OP_GTU )
+		BRANCH( (unsigned)r1 > (unsigned)v );
+	OPCODE( OP_GEU )
+		BRANCH( (unsigned)r1 >= (unsigned)v );
+	OPCODE( OP_EQF )
+		BRANCH( VM_IntToFloat( r1 ) == VM_IntToFloat( v ) );
+	OPCODE( OP_NEF )
+		BRANCH( VM_IntToFloat( r1 ) != VM_IntToFloat( v ) );
+	OPCODE( OP_LTF )
+		BRANCH( VM_IntToFloat( r1 ) < VM_IntToFloat( v ) );
+	OPCODE( OP_LEF )
+		BRANCH( VM_IntToFloat( r1 ) <= VM_IntToFloat( v ) );
+	OPCODE( OP_GTF )
+		BRANCH( VM_IntToFloat( r1 ) > VM_IntToFloat( v ) );
+	OPCODE( OP_GEF )
+		BRANCH( VM_IntToFloat( r1 ) >= VM_IntToFloat( v ) );
+
+	OPCODE( OPX_CONST_EQ )
+		BRANCH_CONST( r1 == v );
+	OPCODE( OPX_CONST_NE )
+		BRANCH_CONST( r1 != v );
+	OPCODE( OPX_CONST_LTI )
+		BRANCH_CONST( r1 < v );
+	OPCODE( OPX_CONST_LEI )
+		BRANCH_CONST( r1 <= v );
+	OPCODE( OPX_CONST_GTI )
+		BRANCH_CONST( r1 > v );
+	OPCODE( OPX_CONST_GEI )
+		BRANCH_CONST( r1 >= v );
+
+	OPCODE( OP_LOAD1 )
+		tos = image[ tos & dataMask ];
+		NEXT();
+	OPCODE( OP_LOAD2 )
+		tos = *(unsigned short *)&image[ tos & dataMask ];
+		NEXT();
+	OPCODE( OP_LOAD4 )
+		tos = *(int *)&image[ tos & dataMask ];
+		NEXT();
+	OPCODE( OPX_LOCAL_LOAD4 )
+		PUSH( *(int *)&image[ ( ip->arg + programStack ) & dataMask ] );
+		NEXT2();
+	OPCODE( OPX_CONST_LOAD4 )
+		PUSH( *(int *)&image[ ip->arg & dataMask ] );
+		NEXT2();
+	OPCODE( OPX_CONST_ADD_LOAD4 )
+		tos = *(int *)&image[ ( tos + ip->arg ) & dataMask ];
+		NEXT3();
+	OPCODE( OPX_ADD_LOAD4 )
+		v = POP() + tos;
+		tos = *(int *)&image[ v & dataMask ];
+		NEXT2();
+
+	OPCODE( OP_STORE1 )
+		image[ opStack[0] & dataMask ] = tos;
+		tos = opStack[-1];
+		opStack -= 2;
+		NEXT();
+	OPCODE( OP_STORE2 )
+		*(short *)&image[ opStack[0] & ( dataMask & ~1 ) ] = tos;
+		tos = opStack[-1];
+		opStack -= 2;
+		NEXT();
+	OPCODE( OP_STORE4 )
+		*(int *)&image[ opStack[0] & ( dataMask & ~3 ) ] = tos;
+		tos = opStack[-1];
+		opStack -= 2;
+		NEXT();
+	OPCODE( OPX_CONST_STORE4 )
+		*(int *)&image[ tos & ( dataMask & ~3 ) ] = ip->arg;
+		tos = POP();
+		NEXT2();
+
+	OPCODE( OP_ARG )
+		// single byte offset from programStack
+		*(int *)&image[ ( ip->arg + programStack ) & dataMask ] = tos;
+		tos = POP();
+		NEXT();
+
+	OPCODE( OP_BLOCK_COPY )
+		{
+			int		*src, *dest;
+			int		i, n, srci, desti;
+
+			// the same range clipping and copy order as the switch interpreter
+			n = ip->arg;
+			srci = tos & dataMask;
+			desti = opStack[0] & dataMask;
+			n = ( ( srci + n ) & dataMask ) - srci;
+			n = ( ( desti + n ) & dataMask ) - desti;
+
+			src = (int *)&image[ srci ];
+			dest = (int *)&image[ desti ];
+			if ( ( (intptr_t)src | (intptr_t)dest | n ) & 3 ) {
+				Com_Printf( S_COLOR_YELLOW "Warning: OP_BLOCK_COPY not dword aligned\n" );
+			}
+			n >>= 2;
+			for ( i = n - 1 ; i >= 0 ; i-- ) {
+				dest[i] = src[i];
+			}
+			tos = opStack[-1];
+			opStack -= 2;
+		}
+		NEXT();
+
+	OPCODE( OP_SEX8 )
+		tos = (signed char)tos;
+		NEXT();
+	OPCODE( OP_SEX16 )
+		tos = (short)tos;
+		NEXT();
+
+	OPCODE( OP_NEGI )
+		tos = -tos;
+		NEXT();
+	OPCODE( OP_ADD )
+		tos = POP() + tos;
+		NEXT();
+	OPCODE( OPX_CONST_ADD )
+		tos += ip->arg;
+		NEXT2();
+	OPCODE( OP_SUB )
+		tos = POP() - tos;
+		NEXT();
+	OPCODE( OP_DIVI )
+		tos = POP() / tos;
+		NEXT();
+	OPCODE( OP_DIVU )
+		tos = (unsigned)POP() / (unsigned)tos;
+		NEXT();
+	OPCODE( OP_MODI )
+		tos = POP() % tos;
+		NEXT();
+	OPCODE( OP_MODU )
+		tos = (unsigned)POP() % (unsigned)tos;
+		NEXT();
+	OPCODE( OP_MULI )
+		tos = POP() * tos;
+		NEXT();
+	OPCODE( OP_MULU )
+		tos = (unsigned)POP() * (unsigned)tos;
+		NEXT();
+
+	OPCODE( OP_BAND )
+		tos = POP() & tos;
+		NEXT();
+	OPCODE( OP_BOR )
+		tos = POP() | tos;
+		NEXT();
+	OPCODE( OP_BXOR )
+		tos = POP() ^ tos;
+		NEXT();
+	OPCODE( OP_BCOM )
+		tos = ~tos;
+		NEXT();
+
+	OPCODE( OP_LSH )
+		tos = POP() << tos;
+		NEXT();
+	OPCODE( OP_RSHI )
+		tos = POP() >> tos;
+		NEXT();
+	OPCODE( OP_RSHU )
+		tos = (unsigned)POP() >> tos;
+		NEXT();
+
+	OPCODE( OP_NEGF )
+		tos = VM_FloatToInt( -VM_IntToFloat( tos ) );
+		NEXT();
+	OPCODE( OP_ADDF )
+		tos = VM_FloatToInt( VM_IntToFloat( POP() ) + VM_IntToFloat( tos ) );
+		NEXT();
+	OPCODE( OP_SUBF )
+		tos = VM_FloatToInt( VM_IntToFloat( POP() ) - VM_IntToFloat( tos ) );
+		NEXT();
+	OPCODE( OP_DIVF )
+		tos = VM_FloatToInt( VM_IntToFloat( POP() ) / VM_IntToFloat( tos ) );
+		NEXT();
+	OPCODE( OP_MULF )
+		tos = VM_FloatToInt( VM_IntToFloat( POP() ) * VM_IntToFloat( tos ) );
+		NEXT();
+
+	OPCODE( OP_CVIF )
+		tos = VM_FloatToInt( (float)tos );
+		NEXT();
+	OPCODE( OP_CVFI )
+		tos = (int)VM_IntToFloat( tos );
+		NEXT();
+
+#ifndef VM_COMPUTED_GOTO
+	}
+#endif
+
+	// v is the target, r1 the instruction to return to
+call:
+	*(int *)&image[ programStack ] = r1;
+	if ( v < 0 ) {
+		// system call
+		intptr_t	r;
+		intptr_t	*argptr;
+#if __WORDSIZE == 64
+		intptr_t	argarr[16];
+		int			i;
+#endif
+
+		// save the stack to allow recursive VM entry
+		vm->programStack = programStack - 4;
+		*(int *)&image[ programStack + 4 ] = -1 - v;
+
+		argptr = (intptr_t *)&image[ programStack + 4 ];
+#if __WORDSIZE == 64
+		// the vm has ints on the stack, we expect
+		// longs so we have to convert it
+		for ( i = 0 ; i < 16 ; i++ ) {
+			argarr[i] = *(int *)&image[ programStack + 4 + 4*i ];
+		}
+		argptr = argarr;
+#endif
+		r = vm->systemCall( argptr );
+
+		PUSH( r );
+		ip = cells + r1;
+		DISPATCH();
+	}
+	if ( v >= count ) {
+		Com_Error( ERR_DROP, "VM program counter out of range in OP_CALL" );
+	}
+	ip = cells + v;
+	DISPATCH();
+
+done:
+	vm->currentlyInterpreting = qfalse;
+
+	if ( opStack != &stack[1] ) {
+		Com_Error( ERR_DROP, "VM_CallThreaded: opStack = %ld", (long int) ( opStack - stack ) );
+	}
+
+	vm->programStack = stackOnEntry;
+
+	return tos;
+}
@@ -60,6 +60,9 @@ void assemble_line(const char* input, size_t len);
 
 static void VM_Destroy_Compiled(vm_t* self);
 
+static cvar_t	*vm_legacyCompiler;
+static cvar_t	*vm_cache;
+
 /*
  
   |=====================|
@@ -74,6 +77,7 @@ static void VM_Destroy_Compiled(vm_t* self);
   rsi	stack pointer (opStack)
   rdi	program frame pointer (programStack)
   r8    pointer data (vm->dataBase)
+  r9    jitHelpers, for the direct compiler
   r10   start of generated code
 */
 
@@ -447,12 +451,881 @@ static void block_copy_vm(unsigned dest, unsigned src, unsigned count)
 	memcpy(currentVM->dataBase+dest, currentVM->dataBase+src, count);
 }
 
+/*
+=================================================================================
+
+DIRECT CODE EMISSION
+
+The instructions are encoded straight into the code buffer, in two passes:
+the first one only measures, so the second one knows where every
+instruction starts.  Jumps are always rel32, so both passes emit the same
+sizes.
+
+The top of the opStack is kept out of memory, as a constant or in eax,
+until something needs it there.  A constant feeds a load, store, compare,
+call or jump as an immediate, and results stay in eax for the operation
+that uses them.  Every instruction that can be jumped to starts with the
+whole opStack in memory.
+
+The code holds no addresses, so it runs wherever it is mapped.  The table
+of instruction offsets is appended to it and read rip relative, and C
+functions are called through jitHelpers, which VM_CallCompiled passes in
+r9.  That is what lets VM_LoadCache map a saved image and run it as is.
+
+=================================================================================
+*/
+
+typedef enum {
+	TOP_MEM,		// the whole opStack is in memory
+	TOP_CONST,		// the top is jitConst, not pushed yet
+	TOP_EAX			// the top is in eax, not pushed yet
+} jitTop_t;
+
+typedef enum {
+	HELPER_SYSCALL,
+	HELPER_BLOCK_COPY
+} jitHelper_t;
+
+static void		*jitHelpers[] = {
+	callAsmCall,
+	block_copy_vm
+};
+
+static byte		*jitCode;		// NULL on the first pass
+static int		jitOfs;
+static int		jitTableOfs;	// instruction offsets, after the code
+static int		*jitInstructionPointers;
+static int		jitDataMask;
+static jitTop_t	jitTop;
+static int		jitConst;
+
+static void Emit1( int v ) {
+	if ( jitCode ) {
+		jitCode[ jitOfs ] = v;
+	}
+	jitOfs++;
+}
+
+static void Emit2( int v ) {
+	Emit1( v & 255 );
+	Emit1( ( v >> 8 ) & 255 );
+}
+
+static void Emit4( int v ) {
+	Emit1( v & 255 );
+	Emit1( ( v >> 8 ) & 255 );
+	Emit1( ( v >> 16 ) & 255 );
+	Emit1( ( v >> 24 ) & 255 );
+}
+
+static int Hex( int c ) {
+	if ( c >= 'a' && c <= 'f' ) {
+		return 10 + c - 'a';
+	}
+	if ( c >= 'A' && c <= 'F' ) {
+		return 10 + c - 'A';
+	}
+	if ( c >= '0' && c <= '9' ) {
+		return c - '0';
+	}
+
+	Com_Error( ERR_DROP, "Hex: bad char '%c'", c );
+
+	return 0;
+}
+
+static void EmitString( const char *string ) {
+	int		c1, c2;
+	int		v;
+
+	while ( 1 ) {
+		c1 = string[0];
+		c2 = string[1];
+
+		v = ( Hex( c1 ) << 4 ) | Hex( c2 );
+		Emit1( v );
+
+		if ( !string[2] ) {
+			break;
+		}
+		string += 3;
+	}
+}
+
+// the offsets are only right on the second pass
+static void EmitRel32( int instruction ) {
+	Emit4( jitInstructionPointers[ instruction ] - ( jitOfs + 4 ) );
+}
+
+// short forward jumps inside the code of one instruction
+static int EmitRel8( void ) {
+	Emit1( 0 );
+	return jitOfs - 1;
+}
+
+static void PatchRel8( int at ) {
+	if ( jitOfs - ( at + 1 ) > 127 ) {
+		Com_Error( ERR_DROP, "VM_Compile: short jump out of range" );
+	}
+	if ( jitCode ) {
+		jitCode[ at ] = jitOfs - ( at + 1 );
+	}
+}
+
 /*
 =================
-VM_Compile
+FlushTop
+
+Puts the top of the opStack in memory
 =================
 */
-void VM_Compile( vm_t *vm, vmHeader_t *header ) {
+static void FlushTop( void ) {
+	switch ( jitTop ) {
+	case TOP_CONST:
+		EmitString( "48 83 C6 04" );	// add rsi, 4
+		EmitString( "C7 06" );			// mov dword ptr [rsi], 0x12345678
+		Emit4( jitConst );
+		break;
+	case TOP_EAX:
+		EmitString( "48 83 C6 04" );	// add rsi, 4
+		EmitString( "89 06" );			// mov dword ptr [rsi], eax
+		break;
+	default:
+		break;
+	}
+	jitTop = TOP_MEM;
+}
+
+/*
+=================
+PopTop
+
+Pops the top of the opStack into eax, or ecx if toECX is set
+=================
+*/
+static void PopTop( qboolean toECX ) {
+	switch ( jitTop ) {
+	case TOP_CONST:
+		Emit1( toECX ? 0xB9 : 0xB8 );	// mov ecx/eax, 0x12345678
+		Emit4( jitConst );
+		break;
+	case TOP_EAX:
+		if ( toECX ) {
+			EmitString( "89 C1" );		// mov ecx, eax
+		}
+		break;
+	default:
+		EmitString( toECX ? "8B 0E" : "8B 06" );	// mov ecx/eax, dword ptr [rsi]
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		break;
+	}
+	jitTop = TOP_MEM;
+}
+
+/*
+=================
+PopTopFloat
+
+Pops the top of the opStack into xmm1
+=================
+*/
+static void PopTopFloat( void ) {
+	if ( jitTop == TOP_MEM ) {
+		EmitString( "F3 0F 10 0E" );	// movss xmm1, dword ptr [rsi]
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		return;
+	}
+	PopTop( qfalse );
+	EmitString( "66 0F 6E C8" );		// movd xmm1, eax
+}
+
+/*
+=================
+EmitBinaryOp
+
+eax = second op top, the result stays in eax
+=================
+*/
+static void EmitBinaryOp( const char *opECX, const char *opImm ) {
+	int		c;
+
+	if ( jitTop == TOP_CONST ) {
+		c = jitConst;
+		jitTop = TOP_MEM;
+		EmitString( "8B 06" );			// mov eax, dword ptr [rsi]
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		EmitString( opImm );			// op eax, 0x12345678
+		Emit4( c );
+	} else {
+		PopTop( qtrue );
+		EmitString( "8B 06" );			// mov eax, dword ptr [rsi]
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		EmitString( opECX );			// op eax, ecx
+	}
+	jitTop = TOP_EAX;
+}
+
+/*
+=================
+EmitShift
+=================
+*/
+static void EmitShift( const char *opCL, const char *opImm ) {
+	int		c;
+
+	if ( jitTop == TOP_CONST ) {
+		c = jitConst;
+		jitTop = TOP_MEM;
+		EmitString( "8B 06" );			// mov eax, dword ptr [rsi]
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		EmitString( opImm );			// shift eax, 0x12
+		Emit1( c & 31 );
+	} else {
+		PopTop( qtrue );
+		EmitString( "8B 06" );			// mov eax, dword ptr [rsi]
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		EmitString( opCL );				// shift eax, cl
+	}
+	jitTop = TOP_EAX;
+}
+
+/*
+=================
+EmitDivide
+=================
+*/
+static void EmitDivide( qboolean isSigned, qboolean modulo ) {
+	PopTop( qtrue );
+	EmitString( "8B 06" );				// mov eax, dword ptr [rsi]
+	EmitString( "48 83 EE 04" );		// sub rsi, 4
+	if ( isSigned ) {
+		EmitString( "99" );				// cdq
+		EmitString( "F7 F9" );			// idiv ecx
+	} else {
+		EmitString( "31 D2" );			// xor edx, edx
+		EmitString( "F7 F1" );			// div ecx
+	}
+	if ( modulo ) {
+		EmitString( "89 D0" );			// mov eax, edx
+	}
+	jitTop = TOP_EAX;
+}
+
+/*
+=================
+EmitFloatOp
+=================
+*/
+static void EmitFloatOp( const char *op ) {
+	PopTopFloat();
+	EmitString( "F3 0F 10 06" );		// movss xmm0, dword ptr [rsi]
+	EmitString( "48 83 EE 04" );		// sub rsi, 4
+	EmitString( op );					// op xmm0, xmm1
+	EmitString( "66 0F 7E C0" );		// movd eax, xmm0
+	jitTop = TOP_EAX;
+}
+
+/*
+=================
+EmitBranch
+
+Compares second op top and jumps to target on jcc
+=================
+*/
+static void EmitBranch( int jcc, int target ) {
+	int		c;
+
+	if ( jitTop == TOP_CONST ) {
+		c = jitConst;
+		jitTop = TOP_MEM;
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		EmitString( "81 7E 04" );		// cmp dword ptr [rsi+4], 0x12345678
+		Emit4( c );
+	} else {
+		PopTop( qfalse );
+		EmitString( "48 83 EE 04" );	// sub rsi, 4
+		EmitString( "39 46 04" );		// cmp dword ptr [rsi+4], eax
+	}
+	Emit1( 0x0F );						// jcc target
+	Emit1( jcc );
+	EmitRel32( target );
+}
+
+/*
+=================
+EmitFloatBranch
+
+The parity flag is set when either side is a NaN
+=================
+*/
+static void EmitFloatBranch( int jcc, qboolean unordered, int target ) {
+	int		skip;
+
+	PopTopFloat();
+	EmitString( "F3 0F 10 06" );		// movss xmm0, dword ptr [rsi]
+	EmitString( "48 83 EE 04" );		// sub rsi, 4
+	EmitString( "0F 2E C1" );			// ucomiss xmm0, xmm1
+	if ( unordered ) {
+		EmitString( "0F 8A" );			// jp target
+		EmitRel32( target );
+		skip = -1;
+	} else {
+		EmitString( "7A" );				// jp skip
+		skip = EmitRel8();
+	}
+	Emit1( 0x0F );						// jcc target
+	Emit1( jcc );
+	EmitRel32( target );
+	if ( skip >= 0 ) {
+		PatchRel8( skip );
+	}
+}
+
+/*
+=================
+EmitLoad
+=================
+*/
+static void EmitLoad( const char *opDisp, const char *opIndex ) {
+	int		c;
+
+	if ( jitTop == TOP_CONST ) {
+		c = jitConst;
+		jitTop = TOP_MEM;
+		EmitString( opDisp );			// mov eax, [r8 + 0x12345678]
+		Emit4( c & jitDataMask );
+	} else {
+		PopTop( qfalse );
+		EmitString( "25" );				// and eax, dataMask
+		Emit4( jitDataMask );
+		EmitString( opIndex );			// mov eax, [r8 + rax]
+	}
+	jitTop = TOP_EAX;
+}
+
+/*
+=================
+EmitStore
+
+Stores the top at the address in ebx, size bytes
+=================
+*/
+static void EmitStoreEBX( int size, int c, qboolean isConst ) {
+	EmitString( "81 E3" );				// and ebx, dataMask
+	Emit4( jitDataMask );
+	if ( isConst ) {
+		switch ( size ) {
+		case 1:
+			EmitString( "41 C6 04 18" );		// mov byte ptr [r8 + rbx], 0x12
+			Emit1( c );
+			break;
+		case 2:
+			EmitString( "66 41 C7 04 18" );		// mov word ptr [r8 + rbx], 0x1234
+			Emit2( c );
+			break;
+		default:
+			EmitString( "41 C7 04 18" );		// mov dword ptr [r8 + rbx], 0x12345678
+			Emit4( c );
+			break;
+		}
+	} else {
+		switch ( size ) {
+		case 1:
+			EmitString( "41 88 04 18" );		// mov byte ptr [r8 + rbx], al
+			break;
+		case 2:
+			EmitString( "66 41 89 04 18" );		// mov word ptr [r8 + rbx], ax
+			break;
+		default:
+			EmitString( "41 89 04 18" );		// mov dword ptr [r8 + rbx], eax
+			break;
+		}
+	}
+}
+
+static void EmitStore( int size ) {
+	qboolean	isConst;
+	int			c;
+
+	isConst = ( jitTop == TOP_CONST );
+	c = jitConst;
+	if ( isConst ) {
+		jitTop = TOP_MEM;
+	} else {
+		PopTop( qfalse );
+	}
+	EmitString( "8B 1E" );				// mov ebx, dword ptr [rsi]
+	EmitString( "48 83 EE 04" );		// sub rsi, 4
+	EmitStoreEBX( size, c, isConst );
+}
+
+/*
+=================
+EmitAlignedCall
+
+Calls a C function with the stack aligned
+=================
+*/
+static void EmitAlignedCall( jitHelper_t helper ) {
+	EmitString( "48 89 E3" );			// mov rbx, rsp
+	EmitString( "48 83 EB 08" );		// sub rbx, 8
+	EmitString( "48 83 E3 7F" );		// and rbx, 127
+	EmitString( "48 29 DC" );			// sub rsp, rbx
+	EmitString( "53" );					// push rbx
+	EmitString( "49 8B 41" );			// mov rax, qword ptr [r9 + helper * 8]
+	Emit1( helper * 8 );
+	EmitString( "FF D0" );				// call rax
+	EmitString( "5B" );					// pop rbx
+	EmitString( "48 01 DC" );			// add rsp, rbx
+}
+
+static void EmitSaveRegisters( void ) {
+	EmitString( "56" );					// push rsi
+	EmitString( "57" );					// push rdi
+	EmitString( "41 50" );				// push r8
+	EmitString( "41 51" );				// push r9
+	EmitString( "41 52" );				// push r10
+}
+
+static void EmitRestoreRegisters( void ) {
+	EmitString( "41 5A" );				// pop r10
+	EmitString( "41 59" );				// pop r9
+	EmitString( "41 58" );				// pop r8
+	EmitString( "5F" );					// pop rdi
+	EmitString( "5E" );					// pop rsi
+}
+
+/*
+=================
+EmitSyscall
+
+The negated system call number is in eax, the result is left there
+=================
+*/
+static void EmitSyscall( void ) {
+	EmitSaveRegisters();
+	EmitString( "F7 D8" );				// neg eax
+	EmitString( "FF C8" );				// dec eax
+										// first argument already in rdi
+	EmitString( "48 89 C6" );			// mov rsi, rax
+	EmitAlignedCall( HELPER_SYSCALL );
+	EmitRestoreRegisters();
+}
+
+/*
+=================
+VM_CompileDirect
+
+qfalse if the code can't be compiled
+=================
+*/
+static qboolean VM_CompileDirect( vm_t *vm, vmHeader_t *header ) {
+	byte		*code, *jused;
+	int			op, pc, pass;
+	int			instruction, iarg, barg;
+	int			c, skipVM, skipSyscall;
+	qboolean	ok;
+
+	code = (byte *)header + header->codeOffset;
+	jitInstructionPointers = vm->instructionPointers;
+	jitDataMask = vm->dataMask;
+
+	// everything that can be jumped to has to start with the opStack in
+	// memory: branch targets, constant jumps, switch tables and functions
+	jused = Z_Malloc( header->instructionCount + 2 );
+	Com_Memset( jused, 0, header->instructionCount + 2 );
+	for ( c = 0 ; c < vm->numJumpTableTargets ; c++ ) {
+		iarg = ((int *)vm->jumpTableTargets)[c];
+		if ( iarg >= 0 && iarg < header->instructionCount ) {
+			jused[ iarg ] = 1;
+		}
+	}
+
+	ok = qtrue;
+	pc = 0;
+	for ( instruction = 0 ; instruction < header->instructionCount ; instruction++ ) {
+		if ( pc >= header->codeLength ) {
+			ok = qfalse;
+			break;
+		}
+		op = code[ pc ];
+		iarg = 0;
+		if ( op_argsize[op] == 4 ) {
+			iarg = *(int *)( code + pc + 1 );
+		}
+		pc += 1 + op_argsize[op];
+
+		if ( op >= OP_EQ && op <= OP_GEF ) {
+			if ( iarg < 0 || iarg >= header->instructionCount ) {
+				ok = qfalse;
+				break;
+			}
+			jused[ iarg ] = 1;
+		} else if ( op == OP_CONST && pc < header->codeLength && code[ pc ] == OP_JUMP ) {
+			if ( iarg >= 0 && iarg < header->instructionCount ) {
+				jused[ iarg ] = 1;
+			}
+		} else if ( op == OP_ENTER ) {
+			jused[ instruction ] = 1;
+		}
+	}
+	if ( !ok ) {
+		Com_Printf( S_COLOR_RED "VM_Compile: bad code in %s at instruction %i\n", vm->name, instruction );
+		Z_Free( jused );
+		return qfalse;
+	}
+
+	jitCode = NULL;
+	for ( pass = 0 ; pass < 2 ; pass++ ) {
+		jitOfs = 0;
+		jitTop = TOP_MEM;
+		pc = 0;
+
+		for ( instruction = 0 ; instruction < header->instructionCount ; instruction++ ) {
+			op = code[ pc++ ];
+			iarg = barg = 0;
+			if ( op_argsize[op] == 4 ) {
+				iarg = *(int *)( code + pc );
+				pc += 4;
+			} else if ( op_argsize[op] == 1 ) {
+				barg = code[ pc++ ];
+			}
+
+			if ( jused[ instruction ] ) {
+				FlushTop();
+			}
+			vm->instructionPointers[ instruction ] = jitOfs;
+
+			switch ( op ) {
+			case OP_IGNORE:
+				break;
+			case OP_BREAK:
+				EmitString( "CC" );				// int 3
+				break;
+			case OP_ENTER:
+				EmitString( "81 EF" );			// sub edi, 0x12345678
+				Emit4( iarg );
+				EmitString( "81 E7" );			// and edi, dataMask
+				Emit4( vm->dataMask );
+				break;
+			case OP_LEAVE:
+				FlushTop();						// the return value
+				EmitString( "81 C7" );			// add edi, 0x12345678
+				Emit4( iarg );
+				EmitString( "C3" );				// ret
+				break;
+			case OP_CALL:
+				if ( jitTop == TOP_CONST ) {
+					c = jitConst;
+					jitTop = TOP_MEM;
+					EmitString( "41 C7 04 38" );	// mov dword ptr [r8 + rdi], instruction+1
+					Emit4( instruction + 1 );
+					if ( c >= 0 ) {
+						if ( c >= header->instructionCount ) {
+							ok = qfalse;
+							break;
+						}
+						EmitString( "E8" );			// call function
+						EmitRel32( c );
+					} else {
+						EmitString( "B8" );			// mov eax, syscall
+						Emit4( c );
+						EmitSyscall();
+						jitTop = TOP_EAX;
+					}
+					break;
+				}
+				PopTop( qfalse );
+				EmitString( "41 C7 04 38" );	// mov dword ptr [r8 + rdi], instruction+1
+				Emit4( instruction + 1 );
+				EmitString( "85 C0" );			// test eax, eax
+				EmitString( "7C" );				// jl syscall
+				skipVM = EmitRel8();
+				EmitString( "48 8D 1D" );		// lea rbx, instruction table
+				Emit4( jitTableOfs - ( jitOfs + 4 ) );
+				EmitString( "8B 04 83" );		// mov eax, dword ptr [rbx + rax * 4]
+				EmitString( "4C 01 D0" );		// add rax, r10
+				EmitString( "FF D0" );			// call rax
+				EmitString( "EB" );				// jmp done
+				skipSyscall = EmitRel8();
+				PatchRel8( skipVM );
+				EmitSyscall();
+				EmitString( "48 83 C6 04" );	// add rsi, 4
+				EmitString( "89 06" );			// mov dword ptr [rsi], eax
+				PatchRel8( skipSyscall );
+				break;
+			case OP_PUSH:
+				FlushTop();
+				EmitString( "48 83 C6 04" );	// add rsi, 4
+				break;
+			case OP_POP:
+				if ( jitTop == TOP_MEM ) {
+					EmitString( "48 83 EE 04" );	// sub rsi, 4
+				}
+				jitTop = TOP_MEM;
+				break;
+			case OP_CONST:
+				FlushTop();
+				jitTop = TOP_CONST;
+				jitConst = iarg;
+				break;
+			case OP_LOCAL:
+				FlushTop();
+				EmitString( "8D 87" );			// lea eax, [rdi + 0x12345678]
+				Emit4( iarg );
+				jitTop = TOP_EAX;
+				break;
+			case OP_JUMP:
+				if ( jitTop == TOP_CONST ) {
+					c = jitConst;
+					jitTop = TOP_MEM;
+					if ( c < 0 || c >= header->instructionCount ) {
+						ok = qfalse;
+						break;
+					}
+					EmitString( "E9" );			// jmp target
+					EmitRel32( c );
+					break;
+				}
+				PopTop( qfalse );
+				EmitString( "48 8D 1D" );		// lea rbx, instruction table
+				Emit4( jitTableOfs - ( jitOfs + 4 ) );
+				EmitString( "8B 04 83" );		// mov eax, dword ptr [rbx + rax * 4]
+				EmitString( "4C 01 D0" );		// add rax, r10
+				EmitString( "FF E0" );			// jmp rax
+				break;
+			case OP_EQ:
+				EmitBranch( 0x84, iarg );		// je
+				break;
+			case OP_NE:
+				EmitBranch( 0x85, iarg );		// jne
+				break;
+			case OP_LTI:
+				EmitBranch( 0x8C, iarg );		// jl
+				break;
+			case OP_LEI:
+				EmitBranch( 0x8E, iarg );		// jle
+				break;
+			case OP_GTI:
+				EmitBranch( 0x8F, iarg );		// jg
+				break;
+			case OP_GEI:
+				EmitBranch( 0x8D, iarg );		// jge
+				break;
+			case OP_LTU:
+				EmitBranch( 0x82, iarg );		// jb
+				break;
+			case OP_LEU:
+				EmitBranch( 0x86, iarg );		// jbe
+				break;
+			case OP_GTU:
+				EmitBranch( 0x87, iarg );		// ja
+				break;
+			case OP_GEU:
+				EmitBranch( 0x83, iarg );		// jae
+				break;
+			case OP_EQF:
+				EmitFloatBranch( 0x84, qfalse, iarg );	// je
+				break;
+			case OP_NEF:
+				EmitFloatBranch( 0x85, qtrue, iarg );	// jne
+				break;
+			case OP_LTF:
+				EmitFloatBranch( 0x82, qfalse, iarg );	// jb
+				break;
+			case OP_LEF:
+				EmitFloatBranch( 0x86, qfalse, iarg );	// jbe
+				break;
+			case OP_GTF:
+				EmitFloatBranch( 0x87, qfalse, iarg );	// ja
+				break;
+			case OP_GEF:
+				EmitFloatBranch( 0x83, qfalse, iarg );	// jae
+				break;
+			case OP_LOAD1:
+				EmitLoad( "41 0F B6 80", "41 0F B6 04 00" );	// movzx eax, byte ptr
+				break;
+			case OP_LOAD2:
+				EmitLoad( "41 0F B7 80", "41 0F B7 04 00" );	// movzx eax, word ptr
+				break;
+			case OP_LOAD4:
+				EmitLoad( "41 8B 80", "41 8B 04 00" );			// mov eax, dword ptr
+				break;
+			case OP_STORE1:
+				EmitStore( 1 );
+				break;
+			case OP_STORE2:
+				EmitStore( 2 );
+				break;
+			case OP_STORE4:
+				EmitStore( 4 );
+				break;
+			case OP_ARG:
+				c = jitConst;
+				if ( jitTop == TOP_CONST ) {
+					jitTop = TOP_MEM;
+					EmitString( "8D 9F" );		// lea ebx, [rdi + 0x12345678]
+					Emit4( barg );
+					EmitStoreEBX( 4, c, qtrue );
+				} else {
+					PopTop( qfalse );
+					EmitString( "8D 9F" );		// lea ebx, [rdi + 0x12345678]
+					Emit4( barg );
+					EmitStoreEBX( 4, 0, qfalse );
+				}
+				break;
+			case OP_BLOCK_COPY:
+				FlushTop();
+				EmitString( "48 83 EE 08" );	// sub rsi, 8
+				EmitSaveRegisters();
+				EmitString( "8B 7E 04" );		// mov edi, dword ptr [rsi+4]
+				EmitString( "8B 76 08" );		// mov esi, dword ptr [rsi+8]
+				EmitString( "BA" );				// mov edx, count
+				Emit4( iarg );
+				EmitAlignedCall( HELPER_BLOCK_COPY );
+				EmitRestoreRegisters();
+				break;
+			case OP_SEX8:
+				PopTop( qfalse );
+				EmitString( "0F BE C0" );		// movsx eax, al
+				jitTop = TOP_EAX;
+				break;
+			case OP_SEX16:
+				PopTop( qfalse );
+				EmitString( "0F BF C0" );		// movsx eax, ax
+				jitTop = TOP_EAX;
+				break;
+			case OP_NEGI:
+				PopTop( qfalse );
+				EmitString( "F7 D8" );			// neg eax
+				jitTop = TOP_EAX;
+				break;
+			case OP_BCOM:
+				PopTop( qfalse );
+				EmitString( "F7 D0" );			// not eax
+				jitTop = TOP_EAX;
+				break;
+			case OP_ADD:
+				EmitBinaryOp( "01 C8", "05" );			// add
+				break;
+			case OP_SUB:
+				EmitBinaryOp( "29 C8", "2D" );			// sub
+				break;
+			case OP_MULI:
+			case OP_MULU:
+				EmitBinaryOp( "0F AF C1", "69 C0" );	// imul, the low half is the same
+				break;
+			case OP_BAND:
+				EmitBinaryOp( "21 C8", "25" );			// and
+				break;
+			case OP_BOR:
+				EmitBinaryOp( "09 C8", "0D" );			// or
+				break;
+			case OP_BXOR:
+				EmitBinaryOp( "31 C8", "35" );			// xor
+				break;
+			case OP_DIVI:
+				EmitDivide( qtrue, qfalse );
+				break;
+			case OP_DIVU:
+				EmitDivide( qfalse, qfalse );
+				break;
+			case OP_MODI:
+				EmitDivide( qtrue, qtrue );
+				break;
+			case OP_MODU:
+				EmitDivide( qfalse, qtrue );
+				break;
+			case OP_LSH:
+				EmitShift( "D3 E0", "C1 E0" );	// shl
+				break;
+			case OP_RSHI:
+				EmitShift( "D3 F8", "C1 F8" );	// sar
+				break;
+			case OP_RSHU:
+				EmitShift( "D3 E8", "C1 E8" );	// shr
+				break;
+			case OP_NEGF:
+				PopTop( qfalse );
+				EmitString( "35 00 00 00 80" );	// xor eax, 0x80000000
+				jitTop = TOP_EAX;
+				break;
+			case OP_ADDF:
+				EmitFloatOp( "F3 0F 58 C1" );	// addss xmm0, xmm1
+				break;
+			case OP_SUBF:
+				EmitFloatOp( "F3 0F 5C C1" );	// subss xmm0, xmm1
+				break;
+			case OP_DIVF:
+				EmitFloatOp( "F3 0F 5E C1" );	// divss xmm0, xmm1
+				break;
+			case OP_MULF:
+				EmitFloatOp( "F3 0F 59 C1" );	// mulss xmm0, xmm1
+				break;
+			case OP_CVIF:
+				PopTop( qfalse );
+				EmitString( "F3 0F 2A C0" );	// cvtsi2ss xmm0, eax
+				EmitString( "66 0F 7E C0" );	// movd eax, xmm0
+				jitTop = TOP_EAX;
+				break;
+			case OP_CVFI:
+				PopTop( qfalse );
+				EmitString( "66 0F 6E C0" );	// movd xmm0, eax
+				EmitString( "F3 0F 2C C0" );	// cvttss2si eax, xmm0
+				jitTop = TOP_EAX;
+				break;
+			default:
+				ok = qfalse;
+				break;
+			}
+
+			if ( !ok ) {
+				Com_Printf( S_COLOR_RED "VM_Compile: can't compile instruction %i (op %i) in %s\n",
+					instruction, op, vm->name );
+				if ( jitCode ) {
+					munmap( jitCode, vm->codeLength );
+				}
+				jitCode = NULL;
+				Z_Free( jused );
+				return qfalse;
+			}
+		}
+		FlushTop();
+
+		if ( !pass ) {
+			jitTableOfs = ( jitOfs + 3 ) & ~3;
+			vm->codeLength = jitTableOfs + header->instructionCount * 4;
+			jitCode = mmap( NULL, vm->codeLength, PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0 );
+			if ( jitCode == (void *)-1 ) {
+				Com_Error( ERR_DROP, "VM_CompileX86: can't mmap memory" );
+			}
+		} else if ( ( ( jitOfs + 3 ) & ~3 ) != jitTableOfs ) {
+			Com_Error( ERR_DROP, "VM_Compile: code size changed between passes" );
+		}
+	}
+
+	Z_Free( jused );
+
+	Com_Memcpy( jitCode + jitTableOfs, vm->instructionPointers, header->instructionCount * 4 );
+
+	if ( mprotect( jitCode, vm->codeLength, PROT_READ|PROT_EXEC ) ) {
+		Com_Error( ERR_DROP, "VM_CompileX86: mprotect failed" );
+	}
+	vm->codeBase = jitCode;
+	jitCode = NULL;
+
+	return qtrue;
+}
+
+/*
+=================
+VM_CompileAsm
+
+The old compiler, through the assembler, kept for vm_legacyCompiler and
+vmbench
+=================
+*/
+static void VM_CompileAsm( vm_t *vm, vmHeader_t *header ) {
 	unsigned char op;
 	int pc;
 	unsigned instruction;
@@ -460,7 +1333,6 @@ void VM_Compile( vm_t *vm, vmHeader_t *header ) {
 	unsigned iarg = 0;
 	unsigned char barg = 0;
 	int neednilabel = 0;
-	struct timeval tvstart =  {0, 0};
 
 #ifdef USE_GAS
 	byte* compiledcode;
@@ -474,8 +1346,6 @@ void VM_Compile( vm_t *vm, vmHeader_t *header ) {
 	FILE* fh_s;
 	int fd_s, fd_o;
 
-	gettimeofday(&tvstart, NULL);
-
 	Com_Printf("compiling %s\n", vm->name);
 
 #ifdef DEBUG_VM
@@ -526,8 +1396,6 @@ void VM_Compile( vm_t *vm, vmHeader_t *header ) {
 	int pass;
 	size_t compiledOfs = 0;
 
-	gettimeofday(&tvstart, NULL);
-
 	for (pass = 0; pass < 2; ++pass) {
 
 	if(pass)
@@ -1021,16 +1889,224 @@ out:
 	}
 #endif
 #endif // USE_GAS
+}
 
-	if(vm->compiled)
-	{
-		struct timeval tvdone =  {0, 0};
-		struct timeval dur =  {0, 0};
-		Com_Printf( "VM file %s compiled to %i bytes of code (%p - %p)\n", vm->name, vm->codeLength, vm->codeBase, vm->codeBase+vm->codeLength );
 
-		gettimeofday(&tvdone, NULL);
-		timersub(&tvdone, &tvstart, &dur);
-		Com_Printf( "compilation took %lu.%06lu seconds\n", dur.tv_sec, dur.tv_usec );
+/*
+=================================================================================
+
+COMPILED CODE CACHE
+
+The code from the direct compiler is saved in vmcache/<fs_game>/ under the
+homepath, named by the module and the checksum of the qvm code so that
+servers running different mods or versions from one homepath each keep
+their own image.  The header also carries the build of this compiler.  The next
+VM_Create of the same qvm maps the file read only and executable and runs
+it in place.  Any difference in the header or a bad image checksum, and
+the qvm is compiled again.
+
+=================================================================================
+*/
+
+#define	VMCACHE_IDENT		(('C'<<24)+('M'<<16)+('V'<<8)+'Q')
+#define	VMCACHE_VERSION		1
+#define	VMCACHE_BUILD		__DATE__ " " __TIME__
+
+typedef struct {
+	int		ident;
+	int		version;
+	char	build[32];			// VMCACHE_BUILD of the writer
+
+	int		qvmChecksum;		// code and jump table targets
+	int		qvmCodeLength;
+	int		instructionCount;
+	int		dataMask;
+
+	int		imageLength;		// code and instruction table
+	int		imageChecksum;
+} vmCacheHeader_t;
+
+/*
+=================
+VM_CacheChecksum
+=================
+*/
+static int VM_CacheChecksum( vm_t *vm, vmHeader_t *header ) {
+	unsigned	checksum;
+
+	checksum = Com_BlockChecksum( (byte *)header + header->codeOffset, header->codeLength );
+	if ( vm->numJumpTableTargets ) {
+		checksum ^= Com_BlockChecksum( vm->jumpTableTargets, vm->numJumpTableTargets * 4 );
+	}
+	return checksum;
+}
+
+/*
+=================
+VM_Destroy_Cached
+=================
+*/
+static void VM_Destroy_Cached( vm_t *self ) {
+	munmap( self->codeBase - sizeof( vmCacheHeader_t ), self->codeLength + sizeof( vmCacheHeader_t ) );
+}
+
+/*
+=================
+VM_CacheName
+
+Path of the cached code under the homepath
+=================
+*/
+static void VM_CacheName( vm_t *vm, int qvmChecksum, char *name, int size ) {
+	char	*game;
+
+	game = Cvar_VariableString( "fs_game" );
+	if ( !game[0] ) {
+		game = BASEGAME;
+	}
+	Com_sprintf( name, size, "vmcache/%s/%s-%08x.jit", game, vm->name, qvmChecksum );
+}
+
+/*
+=================
+VM_LoadCache
+
+Maps the cached code for the qvm, qfalse if there isn't a good one
+=================
+*/
+static qboolean VM_LoadCache( vm_t *vm, vmHeader_t *header, int qvmChecksum ) {
+	vmCacheHeader_t	*cache;
+	struct stat		st;
+	byte			*base;
+	char			name[MAX_QPATH];
+	char			*ospath;
+	int				fd, tableLength;
+
+	VM_CacheName( vm, qvmChecksum, name, sizeof( name ) );
+	ospath = FS_BuildOSPath( Cvar_VariableString( "fs_homepath" ), name, "" );
+	ospath[strlen( ospath ) - 1] = '\0';
+
+	fd = open( ospath, O_RDONLY );
+	if ( fd == -1 ) {
+		return qfalse;
+	}
+	if ( fstat( fd, &st ) == -1 || st.st_size < sizeof( *cache ) ) {
+		close( fd );
+		return qfalse;
+	}
+	base = mmap( NULL, st.st_size, PROT_READ|PROT_EXEC, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( base == (void *)-1 ) {
+		// a noexec homepath
+		Com_Printf( "VM_LoadCache: can't map %s: %s\n", ospath, strerror( errno ) );
+		return qfalse;
+	}
+
+	cache = (vmCacheHeader_t *)base;
+	tableLength = header->instructionCount * 4;
+	if ( cache->ident != VMCACHE_IDENT || cache->version != VMCACHE_VERSION
+		|| strncmp( cache->build, VMCACHE_BUILD, sizeof( cache->build ) )
+		|| cache->qvmChecksum != qvmChecksum || cache->qvmCodeLength != header->codeLength
+		|| cache->instructionCount != header->instructionCount || cache->dataMask != vm->dataMask
+		|| cache->imageLength != st.st_size - sizeof( *cache ) || cache->imageLength < tableLength
+		|| Com_BlockChecksum( base + sizeof( *cache ), cache->imageLength ) != cache->imageChecksum ) {
+		munmap( base, st.st_size );
+		return qfalse;
+	}
+
+	vm->codeBase = base + sizeof( *cache );
+	vm->codeLength = cache->imageLength;
+	Com_Memcpy( vm->instructionPointers, vm->codeBase + vm->codeLength - tableLength, tableLength );
+	vm->destroy = VM_Destroy_Cached;
+
+	return qtrue;
+}
+
+/*
+=================
+VM_WriteCache
+
+Saves the code VM_CompileDirect just made
+=================
+*/
+static void VM_WriteCache( vm_t *vm, vmHeader_t *header, int qvmChecksum ) {
+	vmCacheHeader_t	cache;
+	fileHandle_t	f;
+	char			path[MAX_QPATH];
+	char			temp[MAX_QPATH];
+
+	Com_Memset( &cache, 0, sizeof( cache ) );
+	cache.ident = VMCACHE_IDENT;
+	cache.version = VMCACHE_VERSION;
+	Q_strncpyz( cache.build, VMCACHE_BUILD, sizeof( cache.build ) );
+	cache.qvmChecksum = qvmChecksum;
+	cache.qvmCodeLength = header->codeLength;
+	cache.instructionCount = header->instructionCount;
+	cache.dataMask = vm->dataMask;
+	cache.imageLength = vm->codeLength;
+	cache.imageChecksum = Com_BlockChecksum( vm->codeBase, vm->codeLength );
+
+	// written to a temp file of this process and renamed over the old
+	// image, which another server sharing the homepath can still have mapped
+	VM_CacheName( vm, qvmChecksum, path, sizeof( path ) );
+	Com_sprintf( temp, sizeof( temp ), "%s.%i.tmp", path, (int)getpid() );
+	f = FS_SV_FOpenFileWrite( temp );
+	if ( !f ) {
+		Com_Printf( "VM_WriteCache: couldn't write %s\n", temp );
+		return;
+	}
+	FS_Write( &cache, sizeof( cache ), f );
+	FS_Write( vm->codeBase, vm->codeLength, f );
+	FS_FCloseFile( f );
+
+	FS_SV_Rename( temp, path );
+}
+
+/*
+=================
+VM_Compile
+=================
+*/
+void VM_Compile( vm_t *vm, vmHeader_t *header ) {
+	unsigned int	start, usec;
+	qboolean		cached;
+	int				checksum;
+
+	vm_legacyCompiler = Cvar_Get( "vm_legacyCompiler", "0", 0 );
+	vm_cache = Cvar_Get( "vm_cache", "1", CVAR_ARCHIVE );
+
+	start = Sys_Microseconds();
+
+	// only the direct compiler's code can be cached
+	cached = !vm_legacyCompiler->integer && vm_cache->integer;
+	checksum = 0;
+	if ( cached ) {
+		checksum = VM_CacheChecksum( vm, header );
+		if ( VM_LoadCache( vm, header, checksum ) ) {
+			usec = Sys_Microseconds() - start;
+			Com_Printf( "VM file %s mapped from the cache, %i bytes of code (%p - %p)\n", vm->name, vm->codeLength, vm->codeBase, vm->codeBase+vm->codeLength );
+			Com_Printf( "loading took %u.%06u seconds\n", usec / 1000000, usec % 1000000 );
+			return;
+		}
+	}
+
+	if ( vm_legacyCompiler->integer ) {
+		VM_CompileAsm( vm, header );
+	} else if ( !VM_CompileDirect( vm, header ) ) {
+		vm->compiled = qfalse;
+	}
+	if ( !vm->compiled ) {
+		return;
+	}
+	usec = Sys_Microseconds() - start;
+
+	vm->destroy = VM_Destroy_Compiled;
+
+	Com_Printf( "VM file %s compiled to %i bytes of code (%p - %p)\n", vm->name, vm->codeLength, vm->codeBase, vm->codeBase+vm->codeLength );
+	Com_Printf( "compilation took %u.%06u seconds\n", usec / 1000000, usec % 1000000 );
+
+	if ( cached ) {
+		VM_WriteCache( vm, header, checksum );
 	}
 }
 
@@ -1065,6 +2141,7 @@ int	VM_CallCompiled( vm_t *vm, int *args ) {
 	byte	*image;
 	void	*entryPoint;
 	void	*opStack;
+	void	**helpers;
 	int stack[1024] = { 0xDEADBEEF };
 
 	currentVM = vm;
@@ -1107,20 +2184,22 @@ int	VM_CallCompiled( vm_t *vm, int *args ) {
 	// off we go into generated code...
 	entryPoint = getentrypoint(vm);
 	opStack = &stack;
+	helpers = jitHelpers;
 
 	__asm__ __volatile__ (
 		"	movq %5,%%rsi		\r\n" \
 		"	movl %4,%%edi		\r\n" \
 		"	movq %2,%%r10		\r\n" \
 		"	movq %3,%%r8		\r\n" \
+		"	movq %6,%%r9		\r\n" \
 		"       subq $24, %%rsp # fix alignment as call pushes one value \r\n" \
 		"	callq *%%r10		\r\n" \
 		"       addq $24, %%rsp          \r\n" \
 		"	movl %%edi, %0		\r\n" \
 		"	movq %%rsi, %1		\r\n" \
 		: "=m" (programStack), "=m" (opStack)
-		: "m" (entryPoint), "m" (vm->dataBase), "m" (programStack), "m" (opStack)
-		: "%rsi", "%rdi", "%rax", "%rbx", "%rcx", "%rdx", "%r8", "%r10", "%r15", "%xmm0"
+		: "m" (entryPoint), "m" (vm->dataBase), "m" (programStack), "m" (opStack), "m" (helpers)
+		: "%rsi", "%rdi", "%rax", "%rbx", "%rcx", "%rdx", "%r8", "%r9", "%r10", "%r15", "%xmm0", "%xmm1"
 	);
 
 	if ( opStack != &stack[1] ) {
@@ -1136,3 +2215,237 @@ int	VM_CallCompiled( vm_t *vm, int *args ) {
 
 	return *(int *)opStack;
 }
+
+/*
+=================================================================================
+
+BENCHMARK
+
+vmbench compiles a small built in program with both compilers and times
+calls into it.  Given a module it also times compiling vm/<module>.qvm
+with both.
+
+=================================================================================
+*/
+
+#define	BENCH_DATA		0x10000
+#define	BENCH_EXIT		42
+#define	BENCH_FUNC		48
+
+// vmMain( n ): sum of table[i & 15] + BenchFunc( i ) for i < n, passed
+// through a system call; BenchFunc( x ): (int)( x * 0.5f ) + x / 3
+static const int benchProgram[][2] = {
+	{ OP_ENTER, 32 },
+	{ OP_LOCAL, 16 }, { OP_CONST, 0 }, { OP_STORE4, 0 },
+	{ OP_LOCAL, 20 }, { OP_CONST, 0 }, { OP_STORE4, 0 },
+	// 7: loop
+	{ OP_LOCAL, 16 }, { OP_LOAD4, 0 }, { OP_LOCAL, 40 }, { OP_LOAD4, 0 }, { OP_GEI, BENCH_EXIT },
+	{ OP_LOCAL, 20 }, { OP_LOCAL, 20 }, { OP_LOAD4, 0 },
+	{ OP_LOCAL, 16 }, { OP_LOAD4, 0 }, { OP_CONST, 15 }, { OP_BAND, 0 }, { OP_CONST, 2 }, { OP_LSH, 0 },
+	{ OP_LOAD4, 0 }, { OP_ADD, 0 }, { OP_STORE4, 0 },
+	{ OP_LOCAL, 20 }, { OP_LOCAL, 20 }, { OP_LOAD4, 0 },
+	{ OP_LOCAL, 16 }, { OP_LOAD4, 0 }, { OP_ARG, 8 }, { OP_CONST, BENCH_FUNC }, { OP_CALL, 0 },
+	{ OP_ADD, 0 }, { OP_STORE4, 0 },
+	{ OP_LOCAL, 16 }, { OP_LOCAL, 16 }, { OP_LOAD4, 0 }, { OP_CONST, 1 }, { OP_ADD, 0 }, { OP_STORE4, 0 },
+	{ OP_CONST, 7 }, { OP_JUMP, 0 },
+	// BENCH_EXIT
+	{ OP_LOCAL, 20 }, { OP_LOAD4, 0 }, { OP_ARG, 8 }, { OP_CONST, -1 }, { OP_CALL, 0 }, { OP_LEAVE, 32 },
+	// BENCH_FUNC
+	{ OP_ENTER, 8 },
+	{ OP_LOCAL, 16 }, { OP_LOAD4, 0 }, { OP_CVIF, 0 }, { OP_CONST, 0x3f000000 }, { OP_MULF, 0 }, { OP_CVFI, 0 },
+	{ OP_LOCAL, 16 }, { OP_LOAD4, 0 }, { OP_CONST, 3 }, { OP_DIVI, 0 }, { OP_ADD, 0 }, { OP_LEAVE, 8 }
+};
+
+static intptr_t VM_BenchSystemCall( intptr_t *args ) {
+	return args[1] ^ 0x5555;
+}
+
+/*
+=================
+VM_BenchCompile
+
+Compiles with the old or the new compiler, returns the time in usec or
+-1 if it failed
+=================
+*/
+static int VM_BenchCompile( vm_t *vm, vmHeader_t *header, qboolean legacy ) {
+	unsigned int	start;
+
+	vm->compiled = qtrue;
+	start = Sys_Microseconds();
+	if ( legacy ) {
+		VM_CompileAsm( vm, header );
+	} else if ( !VM_CompileDirect( vm, header ) ) {
+		vm->compiled = qfalse;
+	}
+	if ( !vm->compiled ) {
+		return -1;
+	}
+	return Sys_Microseconds() - start;
+}
+
+/*
+=================
+VM_BenchProgram
+=================
+*/
+static void VM_BenchProgram( int calls ) {
+	static vm_t		vm;
+	vmHeader_t		*header;
+	vm_t			*savedVM;
+	byte			*code;
+	int				i, count, length, legacy, usec, result;
+	int				args[11];
+	unsigned int	start;
+
+	count = sizeof( benchProgram ) / sizeof( benchProgram[0] );
+	header = Z_Malloc( sizeof( *header ) + count * 5 );
+	code = (byte *)( header + 1 );
+	for ( i = 0, length = 0 ; i < count ; i++ ) {
+		code[length++] = benchProgram[i][0];
+		if ( op_argsize[ benchProgram[i][0] ] == 4 ) {
+			*(int *)( code + length ) = benchProgram[i][1];
+			length += 4;
+		} else if ( op_argsize[ benchProgram[i][0] ] == 1 ) {
+			code[length++] = benchProgram[i][1];
+		}
+	}
+	header->vmMagic = VM_MAGIC;
+	header->instructionCount = count;
+	header->codeOffset = sizeof( *header );
+	header->codeLength = length;
+
+	savedVM = currentVM;
+	Com_Printf( "built in program, %i calls\n", calls );
+	for ( legacy = 1 ; legacy >= 0 ; legacy-- ) {
+		Com_Memset( &vm, 0, sizeof( vm ) );
+		Q_strncpyz( vm.name, "vmbench", sizeof( vm.name ) );
+		vm.systemCall = VM_BenchSystemCall;
+		vm.dataBase = Z_Malloc( BENCH_DATA );
+		vm.dataMask = BENCH_DATA - 1;
+		vm.programStack = BENCH_DATA;
+		vm.stackBottom = BENCH_DATA - 0x4000;
+		vm.instructionPointers = Z_Malloc( count * 4 );
+		for ( i = 0 ; i < 16 ; i++ ) {
+			((int *)vm.dataBase)[i] = i * 3;
+		}
+
+		usec = VM_BenchCompile( &vm, header, legacy );
+		if ( usec < 0 ) {
+			Com_Printf( "%s: failed to compile\n", legacy ? "assembler" : "direct" );
+		} else {
+			Com_Memset( args, 0, sizeof( args ) );
+			args[0] = 64;
+			result = VM_CallCompiled( &vm, args );
+
+			start = Sys_Microseconds();
+			for ( i = 0 ; i < calls ; i++ ) {
+				VM_CallCompiled( &vm, args );
+			}
+			Com_Printf( "%-9s  compile %6i usec  %6i bytes  %8.3f usec/call  result %i\n",
+				legacy ? "assembler" : "direct", usec, vm.codeLength,
+				( Sys_Microseconds() - start ) / (float)calls, result );
+
+			VM_Destroy_Compiled( &vm );
+		}
+
+		Z_Free( vm.instructionPointers );
+		Z_Free( vm.dataBase );
+	}
+	currentVM = savedVM;
+
+	Z_Free( header );
+}
+
+/*
+=================
+VM_BenchModule
+=================
+*/
+static void VM_BenchModule( const char *module, int compiles ) {
+	static vm_t		vm;
+	vmHeader_t		*header;
+	char			filename[MAX_QPATH];
+	int				i, length, legacy, usec, total, dataLength;
+
+	Com_sprintf( filename, sizeof( filename ), "vm/%s.qvm", module );
+	length = FS_ReadFile( filename, (void **)&header );
+	if ( !header ) {
+		Com_Printf( "couldn't load %s\n", filename );
+		return;
+	}
+
+	if ( length < sizeof( *header ) || ( LittleLong( header->vmMagic ) != VM_MAGIC
+		&& LittleLong( header->vmMagic ) != VM_MAGIC_VER2 ) ) {
+		Com_Printf( "%s is not a qvm\n", filename );
+		FS_FreeFile( header );
+		return;
+	}
+	for ( i = 0 ; i < sizeof( *header ) / 4 ; i++ ) {
+		((int *)header)[i] = LittleLong( ((int *)header)[i] );
+	}
+	if ( header->codeOffset < 0 || header->codeLength <= 0 || header->codeOffset + header->codeLength > length ) {
+		Com_Printf( "%s has a bad header\n", filename );
+		FS_FreeFile( header );
+		return;
+	}
+
+	Com_Memset( &vm, 0, sizeof( vm ) );
+	Q_strncpyz( vm.name, module, sizeof( vm.name ) );
+	dataLength = header->dataLength + header->litLength + header->bssLength;
+	for ( i = 0 ; dataLength > ( 1 << i ) ; i++ ) {
+	}
+	vm.dataMask = ( 1 << i ) - 1;
+	if ( header->vmMagic == VM_MAGIC_VER2 && header->dataOffset + header->dataLength
+		+ header->litLength + header->jtrgLength <= length ) {
+		vm.jumpTableTargets = (byte *)header + header->dataOffset + header->dataLength + header->litLength;
+		vm.numJumpTableTargets = header->jtrgLength >> 2;
+		for ( i = 0 ; i < vm.numJumpTableTargets ; i++ ) {
+			((int *)vm.jumpTableTargets)[i] = LittleLong( ((int *)vm.jumpTableTargets)[i] );
+		}
+	}
+	vm.instructionPointers = Z_Malloc( header->instructionCount * 4 );
+
+	Com_Printf( "%s, %i instructions, %i compiles\n", filename, header->instructionCount, compiles );
+	for ( legacy = 1 ; legacy >= 0 ; legacy-- ) {
+		total = 0;
+		for ( i = 0 ; i < compiles ; i++ ) {
+			usec = VM_BenchCompile( &vm, header, legacy );
+			if ( usec < 0 ) {
+				break;
+			}
+			total += usec;
+			VM_Destroy_Compiled( &vm );
+		}
+		if ( i < compiles ) {
+			Com_Printf( "%s: failed to compile\n", legacy ? "assembler" : "direct" );
+			continue;
+		}
+		Com_Printf( "%-9s  compile %8.3f msec  %8i bytes\n", legacy ? "assembler" : "direct",
+			total / ( compiles * 1000.0f ), vm.codeLength );
+	}
+
+	Z_Free( vm.instructionPointers );
+	FS_FreeFile( header );
+}
+
+/*
+=================
+VM_Bench_f
+
+vmbench [module] [calls]
+=================
+*/
+void VM_Bench_f( void ) {
+	int		calls;
+
+	calls = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 0;
+	if ( calls <= 0 ) {
+		calls = 100000;
+	}
+
+	VM_BenchProgram( calls );
+	if ( Cmd_Argc() > 1 ) {
+		VM_BenchModule( Cmd_Argv( 1 ), 10 );
+	}
+}
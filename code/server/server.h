@@ -33,6 +33,13 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #define	MAX_ENT_CLUSTERS	16
 
+// one entry of an entity in a per-cluster list, the lists are circular
+// with a sentinel head so entries can unlink without knowing their cluster
+typedef struct clusterLink_s {
+	struct clusterLink_s	*prev, *next;
+	struct svEntity_s		*ent;
+} clusterLink_t;
+
 typedef struct svEntity_s {
 	struct worldSector_s *worldSector;
 	struct svEntity_s *nextEntityInWorldSector;
@@ -42,7 +49,8 @@ typedef struct svEntity_s {
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
+	clusterLink_t	clusterLinks[MAX_ENT_CLUSTERS];	// entries in sv.clusterEntities
+	int			numClusterLinks;
 } svEntity_t;
 
 typedef enum {
@@ -60,12 +68,20 @@ typedef struct {
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=475
 	// the serverId associated with the current checksumFeed (always <= serverId)
 	int       checksumFeedServerId;	
-	int				snapshotCounter;	// incremented for each snapshot built
-	int				timeResidual;		// <= 1000 / sv_frame->value
+	int				timeResidual;		// usec, < 1000000 / sv_fps->value
+	int				timeFraction;		// usec of game time run but not yet in sv.time
+	int				frameRemainder;		// 1000000 % sv_fps carried between frames, see SV_FrameUsec
+	unsigned int	frameClock;			// Sys_Microseconds of the last SV_Frame
+	unsigned int	tickClock;			// Sys_Microseconds of the last game frame
+	qboolean		frameClockStarted;
+	qboolean		tickClockStarted;
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	struct cmodel_s	*models[MAX_MODELS];
 	char			*configstrings[MAX_CONFIGSTRINGS];
 	svEntity_t		svEntities[MAX_GENTITIES];
+	clusterLink_t	*clusterEntities;	// linked entities per PVS cluster, plus a last list
+										// for the ones touching too many clusters
+	int				numClusters;
 
 	char			*entityParsePoint;	// used during game VM init
 
@@ -102,6 +118,7 @@ typedef struct {
 	int				first_entity;		// into the circular sv_packet_entities[]
 										// the entities MUST be in increasing state number
 										// order, otherwise the delta compression will fail
+	int				stamp;				// svs.snapshotStamp when the entities were stored
 	int				messageSent;		// time the message was transmitted
 	int				messageAcked;		// time the message was acked
 	int				messageSize;		// used to rate drop packets
@@ -191,40 +208,20 @@ typedef struct client_s {
 //=============================================================================
 
 
-// MAX_CHALLENGES is made large to prevent a denial
-// of service attack that could cycle all of them
-// out before legitimate users connected
-#define	MAX_CHALLENGES	1024
-
 #define	AUTHORIZE_TIMEOUT	5000
 
-typedef struct {
+// one per address, kept from getchallenge until it drops out of the
+// table, see SV_GetChallenge
+typedef struct challenge_s {
 	netadr_t	adr;
 	int			challenge;
 	int			challengePing;
-	int			time;				// time the last packet was sent to the autherize server
 	int			pingTime;			// time the challenge response was sent to client
-	int			firstTime;			// time the adr was first used, for authorize timeout checks
 	qboolean	connected;
-} challenge_t;
-
-typedef struct {
-	netadr_t	adr;
-	int		time;
-} receipt_t;
-
-typedef struct {
-	netadr_t	adr;
-	int		time;
-	int		count;
-	qboolean	flood;
-} floodBan_t;
-
-// MAX_INFO_RECEIPTS is the maximum number of getstatus+getinfo responses that we send
-// in a two second time period.
-#define MAX_INFO_RECEIPTS	48
 
-#define MAX_INFO_FLOOD_BANS	36
+	struct challenge_s	*hashNext;	// also links the free list
+	struct challenge_s	*lruPrev, *lruNext;
+} challenge_t;
 
 #define	MAX_MASTERS	8				// max recipients for heartbeat packets
 
@@ -241,10 +238,9 @@ typedef struct {
 	int			numSnapshotEntities;		// sv_maxclients->integer*PACKET_BACKUP*MAX_PACKET_ENTITIES
 	int			nextSnapshotEntities;		// next snapshotEntities to use
 	entityState_t	*snapshotEntities;		// [numSnapshotEntities]
+	int			snapshotStamp;				// bumped whenever the entities may have changed,
+											// snapshots stored under one stamp hold equal states
 	int			nextHeartbeatTime;
-	challenge_t	challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
-	receipt_t	infoReceipts[MAX_INFO_RECEIPTS];	// prevent getinfo/getstatus flood and DRDoS attacks
-	floodBan_t	infoFloodBans[MAX_INFO_FLOOD_BANS];
 	netadr_t	redirectAddress;			// for rcon return messages
 
 	netadr_t	authorizeAddress;			// for rcon return messages
@@ -305,12 +301,26 @@ extern	cvar_t	*sv_demonotice;
 
 extern	cvar_t	*sv_serverFullMessage;
 
+extern	cvar_t	*sv_snapshotThreads;
+extern	cvar_t	*sv_deltaCache;
+extern	cvar_t	*sv_profile;
+extern	cvar_t	*sv_profileFile;
+extern	cvar_t	*sv_profileInterval;
+extern	cvar_t	*sv_drdosSources;
+extern	cvar_t	*sv_drdosGlobalRate;
+extern	cvar_t	*sv_maxChallenges;
+extern	cvar_t	*sv_broadphase;
+extern	cvar_t	*sv_traceCache;
+
 //===========================================================
 
 //
 // sv_main.c
 //
 void SV_FinalMessage (char *message);
+void SV_InvalidateStatusCache( void );
+void SV_StatusCache_f( void );
+void SV_DRDoS_f( void );
 void QDECL SV_SendServerCommand( client_t *cl, const char *fmt, ...);
 
 
@@ -347,6 +357,7 @@ void SV_GetChallenge( netadr_t from );
 void SV_DirectConnect( netadr_t from );
 
 void SV_AuthorizeIpPacket( netadr_t from );
+void SV_ChallengeTest_f( void );
 
 void SV_ExecuteClientMessage( client_t *cl, msg_t *msg );
 void SV_UserinfoChanged( client_t *cl );
@@ -374,10 +385,47 @@ void SV_WriteFrameToClient (client_t *client, msg_t *msg);
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
 void SV_SendClientSnapshot( client_t *client );
+void SV_ShutdownSnapshotThreads( void );
+void SV_DeltaCache_f( void );
+
+//
+// sv_profile.c
+//
+typedef enum {
+	PROF_FRAME,
+	PROF_PACKETS,
+	PROF_CALCPINGS,
+	PROF_BOTFRAME,
+	PROF_GAMEFRAME,
+	PROF_TIMEOUTS,
+	PROF_SENDMESSAGES,
+	PROF_SNAPSHOTBUILD,
+	PROF_SNAPSHOTENCODE,
+	PROF_SNAPSHOTTRANSMIT,
+	PROF_TICKINTERVAL,			// between game frames, not a phase
+	PROF_TICKJITTER,			// distance of the interval from the sv_fps one
+
+	PROF_NUM_PHASES
+} svProfilePhase_t;
+
+unsigned int SV_ProfileStart( void );
+void SV_ProfileAdd( svProfilePhase_t phase, unsigned int start );
+void SV_ProfileSample( svProfilePhase_t phase, unsigned int usec );
+void SV_ProfileEndFrame( void );
+void SV_Profile_f( void );
+
+extern qboolean	gameProfiling;		// gameprofile is timing system calls
+
+intptr_t SV_GameProfileSystemCall( intptr_t *args );
+unsigned int SV_GameProfileFrameStart( void );
+void SV_GameProfileFrameEnd( unsigned int start );
+void SV_GameProfileStop( void );
+void SV_GameProfile_f( void );
 
 //
 // sv_game.c
 //
+intptr_t SV_GameSystemCall( intptr_t *args );
 int	SV_NumForGentity( sharedEntity_t *ent );
 sharedEntity_t *SV_GentityNum( int num );
 playerState_t *SV_GameClientNum( int num );
@@ -387,6 +435,7 @@ void		SV_InitGameProgs ( void );
 void		SV_ShutdownGameProgs ( void );
 void		SV_RestartGameProgs( void );
 qboolean	SV_inPVS (const vec3_t p1, const vec3_t p2);
+void		SV_VmRecord_f( void );
 
 //
 // sv_bot.c
@@ -428,6 +477,7 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 
 
 void SV_SectorList_f( void );
+void SV_TraceBench_f( void );
 
 
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
@@ -458,6 +508,25 @@ void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, c
 void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, int capsule );
 // clip to a specific entity
 
+void SV_TraceBatch( gameTrace_t *traces, int count );
+// the same as an SV_Trace for each of the traces, but the entities are only looked up once
+
+void SV_TraceCacheInvalidate( void );
+// drops the world results remembered with sv_traceCache
+
+void SV_TraceCache_f( void );
+
+//
+// sv_broadphase.c
+//
+void SV_BroadphaseClear( void );
+void SV_BroadphaseLink( int entityNum, const vec3_t absmin, const vec3_t absmax );
+void SV_BroadphaseUnlink( int entityNum );
+const float *SV_BroadphaseBounds( int entityNum );
+void SV_BroadphaseQuery( const vec3_t mins, const vec3_t maxs,
+						qboolean (*touch)( int entityNum, void *data ), void *data );
+// calls touch for the entities whose boxes intersect mins / maxs until it returns qfalse
+
 //
 // sv_net_chan.c
 //
@@ -543,6 +543,8 @@ void SV_BotInitBotLib(void) {
 	botlib_import.FS_Write = FS_Write;
 	botlib_import.FS_FCloseFile = FS_FCloseFile;
 	botlib_import.FS_Seek = FS_Seek;
+	botlib_import.FS_MapFile = FS_MapFile;
+	botlib_import.FS_UnmapFile = FS_UnmapFile;
 
 	//debug lines
 	botlib_import.DebugLineCreate = BotImport_DebugLineCreate;
@@ -0,0 +1,460 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// sv_broadphase.c -- dynamic bounding box tree for area queries
+
+#include "server.h"
+
+/*
+===============================================================================
+
+AABB TREE
+
+Every linked entity is a leaf of a binary tree of bounding boxes.  The leaf
+box is the entity's absmin / absmax grown by BROADPHASE_MARGIN, so an
+entity that moves a little only has its exact box updated and the tree is
+left alone.  Leaves are inserted next to the sibling that grows the tree
+surface the least, and the tree is kept balanced with AVL rotations on the
+way back up.
+
+The nodes live in one array and the exact boxes in another indexed by
+entity number, so a query never touches the sharedEntity_t memory.
+
+A query finds the same entities as the sector tree but in tree order, so a
+trace that hits two entities at the same fraction can return the other
+one.  That changes game results, so sv_broadphase is off by default.
+
+===============================================================================
+*/
+
+#define	BROADPHASE_MARGIN	16
+#define	BROADPHASE_NODES	( MAX_GENTITIES * 2 )
+#define	BROADPHASE_STACK	64
+
+typedef struct {
+	vec3_t		mins, maxs;
+	int			parent;			// next free node when not in use
+	int			children[2];	// -1 for leaves
+	int			height;			// 0 for leaves
+	int			entityNum;
+} broadphaseNode_t;
+
+typedef struct {
+	vec3_t		mins, maxs;
+} broadphaseBounds_t;
+
+static broadphaseNode_t		bpNodes[BROADPHASE_NODES];
+static int					bpRoot;
+static int					bpFreeNodes;
+
+static broadphaseBounds_t	bpBounds[MAX_GENTITIES];	// exact boxes of the linked entities
+static int					bpLeafs[MAX_GENTITIES];		// -1 if the entity isn't in the tree
+
+/*
+===============
+SV_BroadphaseClear
+===============
+*/
+void SV_BroadphaseClear( void ) {
+	int		i;
+
+	for ( i = 0 ; i < BROADPHASE_NODES - 1 ; i++ ) {
+		bpNodes[i].parent = i + 1;
+		bpNodes[i].height = -1;
+	}
+	bpNodes[i].parent = -1;
+	bpNodes[i].height = -1;
+	bpFreeNodes = 0;
+	bpRoot = -1;
+
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		bpLeafs[i] = -1;
+	}
+}
+
+/*
+===============
+SV_BroadphaseAllocNode
+===============
+*/
+static int SV_BroadphaseAllocNode( void ) {
+	int		node;
+
+	// there are always enough nodes for every entity
+	node = bpFreeNodes;
+	bpFreeNodes = bpNodes[node].parent;
+	bpNodes[node].parent = -1;
+	bpNodes[node].children[0] = bpNodes[node].children[1] = -1;
+	bpNodes[node].height = 0;
+	bpNodes[node].entityNum = -1;
+	return node;
+}
+
+/*
+===============
+SV_BroadphaseFreeNode
+===============
+*/
+static void SV_BroadphaseFreeNode( int node ) {
+	bpNodes[node].parent = bpFreeNodes;
+	bpNodes[node].height = -1;
+	bpFreeNodes = node;
+}
+
+/*
+===============
+SV_BroadphaseArea
+
+Half the surface area of the union of the two boxes
+===============
+*/
+static float SV_BroadphaseArea( const broadphaseNode_t *a, const broadphaseNode_t *b ) {
+	vec3_t	size;
+	int		i;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		size[i] = ( a->maxs[i] > b->maxs[i] ? a->maxs[i] : b->maxs[i] )
+			- ( a->mins[i] < b->mins[i] ? a->mins[i] : b->mins[i] );
+	}
+	return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+/*
+===============
+SV_BroadphaseRefit
+
+Recomputes a node box and height from its children
+===============
+*/
+static void SV_BroadphaseRefit( int node ) {
+	broadphaseNode_t	*n, *a, *b;
+	int					i;
+
+	n = &bpNodes[node];
+	a = &bpNodes[n->children[0]];
+	b = &bpNodes[n->children[1]];
+	for ( i = 0 ; i < 3 ; i++ ) {
+		n->mins[i] = a->mins[i] < b->mins[i] ? a->mins[i] : b->mins[i];
+		n->maxs[i] = a->maxs[i] > b->maxs[i] ? a->maxs[i] : b->maxs[i];
+	}
+	n->height = 1 + ( a->height > b->height ? a->height : b->height );
+}
+
+/*
+===============
+SV_BroadphaseRotate
+
+Lifts child side of node a into its place.  The lifted node keeps its
+taller child and hands the shorter one to node a.
+===============
+*/
+static int SV_BroadphaseRotate( int a, int side ) {
+	broadphaseNode_t	*na, *nc;
+	int					c, f, g, parent;
+
+	na = &bpNodes[a];
+	c = na->children[side];
+	nc = &bpNodes[c];
+	f = nc->children[0];
+	g = nc->children[1];
+
+	// c takes the place of a
+	parent = na->parent;
+	nc->parent = parent;
+	if ( parent == -1 ) {
+		bpRoot = c;
+	} else if ( bpNodes[parent].children[0] == a ) {
+		bpNodes[parent].children[0] = c;
+	} else {
+		bpNodes[parent].children[1] = c;
+	}
+	nc->children[0] = a;
+	na->parent = c;
+
+	// the taller grandchild stays with c, the other one goes to a
+	if ( bpNodes[f].height > bpNodes[g].height ) {
+		nc->children[1] = f;
+		na->children[side] = g;
+		bpNodes[g].parent = a;
+	} else {
+		nc->children[1] = g;
+		na->children[side] = f;
+		bpNodes[f].parent = a;
+	}
+
+	SV_BroadphaseRefit( a );
+	SV_BroadphaseRefit( c );
+	return c;
+}
+
+/*
+===============
+SV_BroadphaseBalance
+
+Returns the node that ends up where node was
+===============
+*/
+static int SV_BroadphaseBalance( int node ) {
+	broadphaseNode_t	*n;
+	int					balance;
+
+	n = &bpNodes[node];
+	if ( n->height < 2 ) {
+		return node;
+	}
+
+	balance = bpNodes[n->children[1]].height - bpNodes[n->children[0]].height;
+	if ( balance > 1 ) {
+		return SV_BroadphaseRotate( node, 1 );
+	}
+	if ( balance < -1 ) {
+		return SV_BroadphaseRotate( node, 0 );
+	}
+	return node;
+}
+
+/*
+===============
+SV_BroadphaseFixUpwards
+===============
+*/
+static void SV_BroadphaseFixUpwards( int node ) {
+	while ( node != -1 ) {
+		node = SV_BroadphaseBalance( node );
+		SV_BroadphaseRefit( node );
+		node = bpNodes[node].parent;
+	}
+}
+
+/*
+===============
+SV_BroadphaseInsertLeaf
+===============
+*/
+static void SV_BroadphaseInsertLeaf( int leaf ) {
+	broadphaseNode_t	*l, *n;
+	float				area, combined, inherit, cost, childCost[2];
+	int					node, sibling, parent, oldParent, i;
+
+	l = &bpNodes[leaf];
+	if ( bpRoot == -1 ) {
+		bpRoot = leaf;
+		l->parent = -1;
+		return;
+	}
+
+	// find the sibling that grows the tree the least
+	node = bpRoot;
+	while ( bpNodes[node].children[0] != -1 ) {
+		n = &bpNodes[node];
+		area = SV_BroadphaseArea( n, n );
+		combined = SV_BroadphaseArea( n, l );
+
+		// making a new parent for this node and the leaf
+		cost = 2 * combined;
+		// every node further down also grows its ancestors
+		inherit = 2 * ( combined - area );
+
+		for ( i = 0 ; i < 2 ; i++ ) {
+			broadphaseNode_t	*child = &bpNodes[n->children[i]];
+
+			childCost[i] = SV_BroadphaseArea( child, l ) + inherit;
+			if ( child->children[0] != -1 ) {
+				childCost[i] -= SV_BroadphaseArea( child, child );
+			}
+		}
+
+		if ( cost < childCost[0] && cost < childCost[1] ) {
+			break;
+		}
+		node = n->children[ childCost[1] < childCost[0] ];
+	}
+	sibling = node;
+
+	// put a new parent over the sibling and the leaf
+	oldParent = bpNodes[sibling].parent;
+	parent = SV_BroadphaseAllocNode();
+	l = &bpNodes[leaf];
+	bpNodes[parent].parent = oldParent;
+	bpNodes[parent].children[0] = sibling;
+	bpNodes[parent].children[1] = leaf;
+	bpNodes[sibling].parent = parent;
+	l->parent = parent;
+
+	if ( oldParent == -1 ) {
+		bpRoot = parent;
+	} else if ( bpNodes[oldParent].children[0] == sibling ) {
+		bpNodes[oldParent].children[0] = parent;
+	} else {
+		bpNodes[oldParent].children[1] = parent;
+	}
+
+	SV_BroadphaseFixUpwards( parent );
+}
+
+/*
+===============
+SV_BroadphaseRemoveLeaf
+===============
+*/
+static void SV_BroadphaseRemoveLeaf( int leaf ) {
+	int		parent, grandParent, sibling;
+
+	if ( leaf == bpRoot ) {
+		bpRoot = -1;
+		return;
+	}
+
+	parent = bpNodes[leaf].parent;
+	grandParent = bpNodes[parent].parent;
+	sibling = bpNodes[parent].children[ bpNodes[parent].children[0] == leaf ];
+
+	// the sibling takes the place of the parent
+	bpNodes[sibling].parent = grandParent;
+	SV_BroadphaseFreeNode( parent );
+	if ( grandParent == -1 ) {
+		bpRoot = sibling;
+		return;
+	}
+
+	if ( bpNodes[grandParent].children[0] == parent ) {
+		bpNodes[grandParent].children[0] = sibling;
+	} else {
+		bpNodes[grandParent].children[1] = sibling;
+	}
+	SV_BroadphaseFixUpwards( grandParent );
+}
+
+/*
+===============
+SV_BroadphaseLink
+
+Adds the entity, or updates its box if it's already in the tree
+===============
+*/
+void SV_BroadphaseLink( int entityNum, const vec3_t absmin, const vec3_t absmax ) {
+	broadphaseNode_t	*n;
+	int					leaf;
+
+	VectorCopy( absmin, bpBounds[entityNum].mins );
+	VectorCopy( absmax, bpBounds[entityNum].maxs );
+
+	leaf = bpLeafs[entityNum];
+	if ( leaf != -1 ) {
+		n = &bpNodes[leaf];
+		if ( absmin[0] >= n->mins[0] && absmin[1] >= n->mins[1] && absmin[2] >= n->mins[2]
+			&& absmax[0] <= n->maxs[0] && absmax[1] <= n->maxs[1] && absmax[2] <= n->maxs[2] ) {
+			return;		// still inside the leaf box
+		}
+		SV_BroadphaseRemoveLeaf( leaf );
+	} else {
+		leaf = SV_BroadphaseAllocNode();
+		bpNodes[leaf].entityNum = entityNum;
+		bpLeafs[entityNum] = leaf;
+	}
+
+	n = &bpNodes[leaf];
+	n->mins[0] = absmin[0] - BROADPHASE_MARGIN;
+	n->mins[1] = absmin[1] - BROADPHASE_MARGIN;
+	n->mins[2] = absmin[2] - BROADPHASE_MARGIN;
+	n->maxs[0] = absmax[0] + BROADPHASE_MARGIN;
+	n->maxs[1] = absmax[1] + BROADPHASE_MARGIN;
+	n->maxs[2] = absmax[2] + BROADPHASE_MARGIN;
+	SV_BroadphaseInsertLeaf( leaf );
+}
+
+/*
+===============
+SV_BroadphaseUnlink
+===============
+*/
+void SV_BroadphaseUnlink( int entityNum ) {
+	int		leaf;
+
+	leaf = bpLeafs[entityNum];
+	if ( leaf == -1 ) {
+		return;
+	}
+	bpLeafs[entityNum] = -1;
+	SV_BroadphaseRemoveLeaf( leaf );
+	SV_BroadphaseFreeNode( leaf );
+}
+
+/*
+===============
+SV_BroadphaseBounds
+
+The absmin and then absmax the entity was last linked with
+===============
+*/
+const float *SV_BroadphaseBounds( int entityNum ) {
+	return bpBounds[entityNum].mins;
+}
+
+/*
+===============
+SV_BroadphaseQuery
+
+Calls touch for every entity whose absmin / absmax intersects the given
+bounds, until it returns qfalse
+===============
+*/
+void SV_BroadphaseQuery( const vec3_t mins, const vec3_t maxs,
+						qboolean (*touch)( int entityNum, void *data ), void *data ) {
+	int					stack[BROADPHASE_STACK];
+	int					top;
+	broadphaseNode_t	*n;
+	broadphaseBounds_t	*b;
+
+	if ( bpRoot == -1 ) {
+		return;
+	}
+
+	stack[0] = bpRoot;
+	top = 1;
+	while ( top ) {
+		n = &bpNodes[stack[--top]];
+
+		if ( n->mins[0] > maxs[0] || n->mins[1] > maxs[1] || n->mins[2] > maxs[2]
+			|| n->maxs[0] < mins[0] || n->maxs[1] < mins[1] || n->maxs[2] < mins[2] ) {
+			continue;
+		}
+
+		if ( n->children[0] != -1 ) {
+			if ( top > BROADPHASE_STACK - 2 ) {
+				Com_Error( ERR_DROP, "SV_BroadphaseQuery: stack overflow" );
+			}
+			stack[top++] = n->children[1];
+			stack[top++] = n->children[0];
+			continue;
+		}
+
+		b = &bpBounds[n->entityNum];
+		if ( b->mins[0] > maxs[0] || b->mins[1] > maxs[1] || b->mins[2] > maxs[2]
+			|| b->maxs[0] < mins[0] || b->maxs[1] < mins[1] || b->maxs[2] < mins[2] ) {
+			continue;
+		}
+
+		if ( !touch( n->entityNum, data ) ) {
+			return;
+		}
+	}
+}
@@ -1388,6 +1388,14 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("tracecache", SV_TraceCache_f);
+	Cmd_AddCommand ("deltacache", SV_DeltaCache_f);
+	Cmd_AddCommand ("svprofile", SV_Profile_f);
+	Cmd_AddCommand ("gameprofile", SV_GameProfile_f);
+	Cmd_AddCommand ("vmrecord", SV_VmRecord_f);
+	Cmd_AddCommand ("statuscache", SV_StatusCache_f);
+	Cmd_AddCommand ("drdos", SV_DRDoS_f);
+	Cmd_AddCommand ("challengetest", SV_ChallengeTest_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 #ifndef PRE_RELEASE_DEMO
 	Cmd_AddCommand ("devmap", SV_Map_f);
@@ -1428,10 +1436,14 @@ void SV_RemoveOperatorCommands( void ) {
 	Cmd_RemoveCommand ("dumpuser");
 	Cmd_RemoveCommand ("map_restart");
 	Cmd_RemoveCommand ("sectorlist");
+	Cmd_RemoveCommand ("tracecache");
 	Cmd_RemoveCommand ("say");
 	Cmd_RemoveCommand ("tell");
         Cmd_RemoveCommand ("startserverdemo");
         Cmd_RemoveCommand ("stopserverdemo");
 #endif
+
+	// replays against the world of the running server, SV_Startup adds it
+	Cmd_RemoveCommand ("tracebench");
 }
 
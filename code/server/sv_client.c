@@ -25,6 +25,329 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 static void SV_CloseDownload( client_t *cl );
 
+/*
+==============================================================================
+
+Challenges
+
+A challenge is the full 32 bit HMAC of the address and the time it was
+sent, and a record of it is kept in a hash on the address.  A connect
+has to come from the same address with the stored value, and a challenge
+nobody connected with is only good for CHALLENGE_TIMEOUT.  An address
+holds one record, so asking again for a challenge before connecting
+gets the same one back.
+
+Up to sv_maxChallenges records are kept, dropping the least recently
+used one, so a getchallenge flood costs an HMAC and an O(1) table update
+per packet.  Challenges that were connected with keep the first challenge
+ping and stay valid for as long as they're in the table.
+
+==============================================================================
+*/
+
+#define	CHALLENGE_TIMEOUT		16000	// a first connect must come within 16 seconds
+
+static byte			challengeSecret[32];
+
+static challenge_t	*challenges;			// [numChallenges]
+static challenge_t	**challengeHash;		// [1 << challengeHashBits]
+static int			numChallenges;
+static int			challengeHashBits;
+static challenge_t	*freeChallenges;
+static challenge_t	challengeLRU;			// head of the used list, most recent first
+
+/*
+=================
+SV_InitChallenges
+
+(Re)allocates the table when sv_maxChallenges has changed
+=================
+*/
+static void SV_InitChallenges( void ) {
+	int		i, wanted;
+
+	wanted = sv_maxChallenges->integer;
+	if ( wanted < 64 ) {
+		wanted = 64;
+	} else if ( wanted > 65536 ) {
+		wanted = 65536;
+	}
+
+	if ( challenges && numChallenges == wanted ) {
+		return;
+	}
+
+	if ( !challenges ) {
+		Com_RandomBytes( challengeSecret, sizeof( challengeSecret ) );
+	} else {
+		Z_Free( challenges );
+		Z_Free( challengeHash );
+	}
+
+	for ( i = 0 ; ( 1 << i ) < wanted ; i++ ) {
+	}
+	challengeHashBits = i;
+	numChallenges = wanted;
+	challenges = Z_Malloc( numChallenges * sizeof( *challenges ) );
+	challengeHash = Z_Malloc( ( 1 << challengeHashBits ) * sizeof( *challengeHash ) );
+
+	freeChallenges = NULL;
+	for ( i = numChallenges - 1 ; i >= 0 ; i-- ) {
+		challenges[i].hashNext = freeChallenges;
+		freeChallenges = &challenges[i];
+	}
+	challengeLRU.lruNext = challengeLRU.lruPrev = &challengeLRU;
+}
+
+/*
+=================
+SV_ChallengeHash
+=================
+*/
+static challenge_t **SV_ChallengeHash( netadr_t adr ) {
+	unsigned int	key;
+
+	key = ( adr.ip[0] << 24 ) | ( adr.ip[1] << 16 ) | ( adr.ip[2] << 8 ) | adr.ip[3];
+	key ^= adr.port * 0x9e3779b1u;
+	return &challengeHash[ ( key * 2654435761u ) >> ( 32 - challengeHashBits ) ];
+}
+
+/*
+=================
+SV_ChallengeMAC
+
+The challenge sent to adr at time
+=================
+*/
+static int SV_ChallengeMAC( netadr_t adr, int time ) {
+	byte	data[11];
+	byte	digest[16];
+
+	data[0] = adr.type;
+	Com_Memcpy( data + 1, adr.ip, 4 );
+	data[5] = adr.port & 255;
+	data[6] = adr.port >> 8;
+	data[7] = time & 255;
+	data[8] = ( time >> 8 ) & 255;
+	data[9] = ( time >> 16 ) & 255;
+	data[10] = ( time >> 24 ) & 255;
+	Com_MD5HMAC( challengeSecret, sizeof( challengeSecret ), data, sizeof( data ), digest );
+
+	return ( digest[0] << 24 ) | ( digest[1] << 16 ) | ( digest[2] << 8 ) | digest[3];
+}
+
+/*
+=================
+SV_LinkChallenge
+
+Moves challenge to the head of the LRU list
+=================
+*/
+static void SV_LinkChallenge( challenge_t *challenge ) {
+	challenge->lruNext = challengeLRU.lruNext;
+	challenge->lruPrev = &challengeLRU;
+	challenge->lruNext->lruPrev = challenge;
+	challengeLRU.lruNext = challenge;
+}
+
+/*
+=================
+SV_UnlinkChallenge
+=================
+*/
+static void SV_UnlinkChallenge( challenge_t *challenge ) {
+	challenge->lruPrev->lruNext = challenge->lruNext;
+	challenge->lruNext->lruPrev = challenge->lruPrev;
+}
+
+/*
+=================
+SV_FreeChallenge
+=================
+*/
+static void SV_FreeChallenge( challenge_t *challenge ) {
+	challenge_t		**link;
+
+	for ( link = SV_ChallengeHash( challenge->adr ) ; *link != challenge ; link = &(*link)->hashNext ) {
+	}
+	*link = challenge->hashNext;
+	SV_UnlinkChallenge( challenge );
+
+	Com_Memset( challenge, 0, sizeof( *challenge ) );
+	challenge->hashNext = freeChallenges;
+	freeChallenges = challenge;
+}
+
+/*
+=================
+SV_LookupChallenge
+
+The record for adr, or NULL
+=================
+*/
+static challenge_t *SV_LookupChallenge( netadr_t adr ) {
+	challenge_t		*challenge;
+
+	for ( challenge = *SV_ChallengeHash( adr ) ; challenge ; challenge = challenge->hashNext ) {
+		if ( NET_CompareAdr( adr, challenge->adr ) ) {
+			return challenge;
+		}
+	}
+	return NULL;
+}
+
+/*
+=================
+SV_IssueChallenge
+
+Returns the record holding the challenge to send to adr at time,
+making a new one unless adr already has one it hasn't connected with
+=================
+*/
+static challenge_t *SV_IssueChallenge( netadr_t adr, int time ) {
+	challenge_t		**hash, *challenge;
+
+	SV_InitChallenges();
+
+	challenge = SV_LookupChallenge( adr );
+	if ( challenge && !challenge->connected && time - challenge->pingTime <= CHALLENGE_TIMEOUT ) {
+		SV_UnlinkChallenge( challenge );
+		SV_LinkChallenge( challenge );
+		challenge->pingTime = time;
+		return challenge;
+	}
+
+	// a new challenge for the address starts over
+	if ( challenge ) {
+		SV_FreeChallenge( challenge );
+	}
+	if ( !freeChallenges ) {
+		SV_FreeChallenge( challengeLRU.lruPrev );
+	}
+	challenge = freeChallenges;
+	freeChallenges = challenge->hashNext;
+
+	hash = SV_ChallengeHash( adr );
+	challenge->adr = adr;
+	challenge->challenge = SV_ChallengeMAC( adr, time );
+	challenge->pingTime = time;
+	challenge->connected = qfalse;
+	challenge->hashNext = *hash;
+	*hash = challenge;
+	SV_LinkChallenge( challenge );
+	return challenge;
+}
+
+/*
+=================
+SV_FindChallenge
+
+Returns the stored challenge for a connect from adr at time, or NULL if
+adr wasn't sent value or it timed out before the first connect
+=================
+*/
+static challenge_t *SV_FindChallenge( netadr_t adr, int value, int time ) {
+	challenge_t		*challenge;
+
+	SV_InitChallenges();
+
+	challenge = SV_LookupChallenge( adr );
+	if ( !challenge || challenge->challenge != value ) {
+		return NULL;
+	}
+	if ( !challenge->connected && time - challenge->pingTime > CHALLENGE_TIMEOUT ) {
+		SV_FreeChallenge( challenge );
+		return NULL;
+	}
+
+	SV_UnlinkChallenge( challenge );
+	SV_LinkChallenge( challenge );
+	return challenge;
+}
+
+/*
+=================
+SV_ChallengeTest_f
+
+Checks that a challenge is only good from the address it was sent to,
+with the value that was sent, and not after it timed out.  Uses
+addresses from TEST-NET-1 and frees their records again.
+=================
+*/
+void SV_ChallengeTest_f( void ) {
+	netadr_t	a, b, c;
+	challenge_t	*ch;
+	int			value, time, failed;
+
+	Com_Memset( &a, 0, sizeof( a ) );
+	a.type = NA_IP;
+	a.ip[0] = 192; a.ip[1] = 0; a.ip[2] = 2; a.ip[3] = 1;
+	a.port = BigShort( 27960 );
+	b = a;
+	b.ip[3] = 2;
+	c = a;
+	c.port = BigShort( 27961 );
+
+	time = svs.time;
+	failed = 0;
+
+	value = SV_IssueChallenge( a, time )->challenge;
+	if ( SV_IssueChallenge( a, time + 100 )->challenge != value ) {
+		Com_Printf( "challengetest: asking again changed the challenge\n" );
+		failed++;
+	}
+	if ( SV_FindChallenge( b, value, time + 200 ) ) {
+		Com_Printf( "challengetest: accepted from another ip\n" );
+		failed++;
+	}
+	if ( SV_FindChallenge( c, value, time + 200 ) ) {
+		Com_Printf( "challengetest: accepted from another port\n" );
+		failed++;
+	}
+	if ( SV_FindChallenge( a, value ^ 1, time + 200 ) ) {
+		Com_Printf( "challengetest: accepted a wrong value\n" );
+		failed++;
+	}
+	ch = SV_FindChallenge( a, value, time + 200 );
+	if ( !ch ) {
+		Com_Printf( "challengetest: rejected the right challenge\n" );
+		failed++;
+	} else {
+		SV_FreeChallenge( ch );
+	}
+
+	value = SV_IssueChallenge( b, time )->challenge;
+	if ( SV_FindChallenge( b, value, time + CHALLENGE_TIMEOUT + 1 ) ) {
+		Com_Printf( "challengetest: accepted a timed out challenge\n" );
+		failed++;
+	}
+
+	// a connected challenge doesn't time out
+	ch = SV_IssueChallenge( c, time );
+	ch->connected = qtrue;
+	value = ch->challenge;
+	if ( !SV_FindChallenge( c, value, time + CHALLENGE_TIMEOUT * 4 ) ) {
+		Com_Printf( "challengetest: a connected challenge timed out\n" );
+		failed++;
+	}
+
+	if ( ( ch = SV_LookupChallenge( a ) ) != NULL ) {
+		SV_FreeChallenge( ch );
+	}
+	if ( ( ch = SV_LookupChallenge( b ) ) != NULL ) {
+		SV_FreeChallenge( ch );
+	}
+	if ( ( ch = SV_LookupChallenge( c ) ) != NULL ) {
+		SV_FreeChallenge( ch );
+	}
+
+	if ( failed ) {
+		Com_Printf( "challengetest: %i checks FAILED\n", failed );
+	} else {
+		Com_Printf( "challengetest: all checks passed\n" );
+	}
+}
+
 /*
 =================
 SV_GetChallenge
@@ -44,9 +367,6 @@ sent to that ip.
 =================
 */
 void SV_GetChallenge( netadr_t from ) {
-	int		i;
-	int		oldest;
-	int		oldestTime;
 	challenge_t	*challenge;
 
 	// ignore if we are in single player
@@ -54,37 +374,11 @@ void SV_GetChallenge( netadr_t from ) {
 		return;
 	}
 
-	oldest = 0;
-	oldestTime = 0x7fffffff;
-
-	// see if we already have a challenge for this ip
-	challenge = &svs.challenges[0];
-	for (i = 0 ; i < MAX_CHALLENGES ; i++, challenge++) {
-		if ( !challenge->connected && NET_CompareAdr( from, challenge->adr ) ) {
-			break;
-		}
-		if ( challenge->time < oldestTime ) {
-			oldestTime = challenge->time;
-			oldest = i;
-		}
-	}
-
-	if (i == MAX_CHALLENGES) {
-		// this is the first time this client has asked for a challenge
-		challenge = &svs.challenges[oldest];
-
-		challenge->challenge = ( (rand() << 16) ^ rand() ) ^ svs.time;
-		challenge->adr = from;
-		challenge->firstTime = svs.time;
-		challenge->time = svs.time;
-		challenge->connected = qfalse;
-		i = oldest;
-	}
+	challenge = SV_IssueChallenge( from, svs.time );
 
 	///////////////////////////////////////////////////////
 	// separator for playerdb.patch and challengeping.patch
 	///////////////////////////////////////////////////////
-		challenge->pingTime = svs.time;
 		NET_OutOfBandPrint( NS_SERVER, from, "challengeResponse %i", challenge->challenge );
 		return;
 }
@@ -99,8 +393,8 @@ challengeResponse to it
 ====================
 */
 void SV_AuthorizeIpPacket( netadr_t from ) {
-	int		challenge;
-	int		i;
+	int		value;
+	challenge_t	*challenge;
 	char	*s;
 	char	*r;
 
@@ -109,55 +403,59 @@ void SV_AuthorizeIpPacket( netadr_t from ) {
 		return;
 	}
 
-	challenge = atoi( Cmd_Argv( 1 ) );
+	value = atoi( Cmd_Argv( 1 ) );
 
-	for (i = 0 ; i < MAX_CHALLENGES ; i++) {
-		if ( svs.challenges[i].challenge == challenge ) {
-			break;
+	// this only comes from the authorize server, so a walk is fine
+	challenge = NULL;
+	if ( challenges ) {
+		for ( challenge = challengeLRU.lruNext ; challenge != &challengeLRU ; challenge = challenge->lruNext ) {
+			if ( challenge->challenge == value ) {
+				break;
+			}
 		}
 	}
-	if ( i == MAX_CHALLENGES ) {
+	if ( !challenge || challenge == &challengeLRU ) {
 		Com_Printf( "SV_AuthorizeIpPacket: challenge not found\n" );
 		return;
 	}
 
 	// send a packet back to the original client
-	svs.challenges[i].pingTime = svs.time;
+	challenge->pingTime = svs.time;
 	s = Cmd_Argv( 2 );
 	r = Cmd_Argv( 3 );			// reason
 
 	if ( !Q_stricmp( s, "demo" ) ) {
 		// they are a demo client trying to connect to a real server
-		NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, "print\nServer is not a demo server\n" );
+		NET_OutOfBandPrint( NS_SERVER, challenge->adr, "print\nServer is not a demo server\n" );
 		// clear the challenge record so it won't timeout and let them through
-		Com_Memset( &svs.challenges[i], 0, sizeof( svs.challenges[i] ) );
+		SV_FreeChallenge( challenge );
 		return;
 	}
 	if ( !Q_stricmp( s, "accept" ) ) {
-		NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, 
-			"challengeResponse %i", svs.challenges[i].challenge );
+		NET_OutOfBandPrint( NS_SERVER, challenge->adr, 
+			"challengeResponse %i", challenge->challenge );
 		return;
 	}
 	if ( !Q_stricmp( s, "unknown" ) ) {
 		if (!r) {
-			NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, "print\nAwaiting CD key authorization\n" );
+			NET_OutOfBandPrint( NS_SERVER, challenge->adr, "print\nAwaiting CD key authorization\n" );
 		} else {
-			NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, "print\n%s\n", r);
+			NET_OutOfBandPrint( NS_SERVER, challenge->adr, "print\n%s\n", r);
 		}
 		// clear the challenge record so it won't timeout and let them through
-		Com_Memset( &svs.challenges[i], 0, sizeof( svs.challenges[i] ) );
+		SV_FreeChallenge( challenge );
 		return;
 	}
 
 	// authorization failed
 	if (!r) {
-		NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, "print\nSomeone is using this CD Key\n" );
+		NET_OutOfBandPrint( NS_SERVER, challenge->adr, "print\nSomeone is using this CD Key\n" );
 	} else {
-		NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, "print\n%s\n", r );
+		NET_OutOfBandPrint( NS_SERVER, challenge->adr, "print\n%s\n", r );
 	}
 
 	// clear the challenge record so it won't timeout and let them through
-	Com_Memset( &svs.challenges[i], 0, sizeof( svs.challenges[i] ) );
+	SV_FreeChallenge( challenge );
 }
 
 /*
@@ -504,18 +802,14 @@ void SV_DirectConnect( netadr_t from ) {
 	// see if the challenge is valid (LAN clients don't need to challenge)
 	if ( !NET_IsLocalAddress (from) ) {
 		int		ping;
+		challenge_t	*ch;
 
-		for (i=0 ; i<MAX_CHALLENGES ; i++) {
-			if (NET_CompareAdr(from, svs.challenges[i].adr)) {
-				if ( challenge == svs.challenges[i].challenge ) {
-					break;		// good
-				}
-			}
-		}
-		if (i == MAX_CHALLENGES) {
+		ch = SV_FindChallenge( from, challenge, svs.time );
+		if ( !ch ) {
 			NET_OutOfBandPrint( NS_SERVER, from, "print\nNo or bad challenge for address.\n" );
 			return;
 		}
+		i = ch - challenges;
 
 		///////////////////////////////////////////////////////
 		// separator for playerdb.patch and challengeping.patch
@@ -525,16 +819,16 @@ void SV_DirectConnect( netadr_t from ) {
 		// (high ping, ban, server full, or other) and repeatedly sending a connect packet against the same
 		// challenge.  Prevent this situation by only logging the first time we hit SV_DirectConnect()
 		// for this challenge.
-		if (!svs.challenges[i].connected) {
-			ping = svs.time - svs.challenges[i].pingTime;
-			svs.challenges[i].challengePing = ping;
+		if (!ch->connected) {
+			ping = svs.time - ch->pingTime;
+			ch->challengePing = ping;
 			Com_Printf("Client %i connecting with %i challenge ping\n", i, ping);
 		}
 		else {
-			ping = svs.challenges[i].challengePing;
+			ping = ch->challengePing;
 			Com_DPrintf("Client %i connecting again with %i challenge ping\n", i, ping);
 		}
-		svs.challenges[i].connected = qtrue;
+		ch->connected = qtrue;
 
 		// never reject a LAN client based on ping
 		if ( !Sys_IsLANAddress( from ) ) {
@@ -217,6 +217,7 @@ void SV_AdjustAreaPortalState( sharedEntity_t *ent, qboolean open ) {
 		return;
 	}
 	CM_AdjustAreaPortalState( svEnt->areanum, svEnt->areanum2, open );
+	SV_TraceCacheInvalidate();
 }
 
 
@@ -300,12 +301,12 @@ static int	FloatAsInt( float f ) {
 
 /*
 ====================
-SV_GameSystemCalls
+SV_GameSystemCall
 
 The module is making a system call
 ====================
 */
-intptr_t SV_GameSystemCalls( intptr_t *args ) {
+intptr_t SV_GameSystemCall( intptr_t *args ) {
 	switch( args[0] ) {
 	case G_PRINT:
 		Com_Printf( "%s", (const char*)VMA(1) );
@@ -381,6 +382,11 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 	case G_TRACECAPSULE:
 		SV_Trace( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], /*int capsule*/ qtrue );
 		return 0;
+	case G_TRACEBATCH:
+		if ( args[2] > 0 ) {
+			SV_TraceBatch( VM_ArgArray( args[1], args[2], sizeof( gameTrace_t ) ), args[2] );
+		}
+		return 0;
 	case G_POINT_CONTENTS:
 		return SV_PointContents( VMA(1), args[2] );
 	case G_SET_BRUSH_MODEL:
@@ -859,6 +865,20 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 	return -1;
 }
 
+/*
+====================
+SV_GameSystemCalls
+
+Goes through the profiler while gameprofile runs
+====================
+*/
+intptr_t SV_GameSystemCalls( intptr_t *args ) {
+	if ( gameProfiling ) {
+		return SV_GameProfileSystemCall( args );
+	}
+	return SV_GameSystemCall( args );
+}
+
 /*
 ===============
 SV_ShutdownGameProgs
@@ -871,6 +891,7 @@ void SV_ShutdownGameProgs( void ) {
 		return;
 	}
 	VM_Call( gvm, GAME_SHUTDOWN, qfalse );
+	SV_GameProfileStop();
 	VM_Free( gvm );
 	gvm = NULL;
 }
@@ -971,3 +992,39 @@ qboolean SV_GameCommand( void ) {
 	return VM_Call( gvm, GAME_CONSOLE_COMMAND );
 }
 
+
+/*
+====================
+SV_VmRecord_f
+
+vmrecord <frames> [name]
+vmrecord stop
+====================
+*/
+void SV_VmRecord_f( void ) {
+	int		frames;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: vmrecord <frames> [name]\n" );
+		Com_Printf( "       vmrecord stop\n" );
+		return;
+	}
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "stop" ) ) {
+		VM_RecordStop();
+		return;
+	}
+
+	if ( !gvm || sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	frames = atoi( Cmd_Argv( 1 ) );
+	if ( frames <= 0 ) {
+		Com_Printf( "Bad frame count %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	VM_RecordStart( gvm, Cmd_Argc() > 2 ? Cmd_Argv( 2 ) : "qagame", GAME_RUN_FRAME, frames );
+}
@@ -286,6 +286,9 @@ void SV_Startup( void ) {
 	}
 
 	Cvar_Set( "sv_running", "1" );
+
+	// removed again by SV_Shutdown
+	Cmd_AddCommand ("tracebench", SV_TraceBench_f);
 }
 
 
@@ -404,6 +407,9 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 	qboolean	isBot;
 	char		systemInfo[16384];
 	const char	*p;
+	int			start;
+
+	start = Sys_Milliseconds();
 
 	// shut down the existing game if it is running
 	SV_ShutdownGameProgs();
@@ -603,6 +609,7 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 
 	SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 	cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+	SV_InvalidateStatusCache();
 
 	// any media configstring setting now should issue a warning
 	// and any configstring changes should be reliably transmitted
@@ -614,6 +621,7 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 
 	Hunk_SetMark();
 
+	Com_Printf ("Map change: %i msec\n", Sys_Milliseconds() - start);
 	Com_Printf ("-----------------------------------\n");
 }
 
@@ -692,6 +700,17 @@ void SV_Init (void) {
 	sv_demonotice = Cvar_Get ("sv_demonotice", "Big Brother is watching you!", CVAR_ARCHIVE);
 
 	sv_serverFullMessage = Cvar_Get ("sv_serverFullMessage", "Server is full", CVAR_ARCHIVE);
+
+	sv_snapshotThreads = Cvar_Get ("sv_snapshotThreads", "0", CVAR_ARCHIVE);
+	sv_deltaCache = Cvar_Get ("sv_deltaCache", "0", CVAR_ARCHIVE);
+	sv_profile = Cvar_Get ("sv_profile", "1", CVAR_ARCHIVE);
+	sv_profileFile = Cvar_Get ("sv_profileFile", "", CVAR_ARCHIVE);
+	sv_profileInterval = Cvar_Get ("sv_profileInterval", "10", CVAR_ARCHIVE);
+	sv_drdosSources = Cvar_Get ("sv_drdosSources", "16384", CVAR_ARCHIVE);
+	sv_drdosGlobalRate = Cvar_Get ("sv_drdosGlobalRate", "24", CVAR_ARCHIVE);
+	sv_maxChallenges = Cvar_Get ("sv_maxChallenges", "1024", CVAR_ARCHIVE);
+	sv_broadphase = Cvar_Get ("sv_broadphase", "0", CVAR_ARCHIVE);
+	sv_traceCache = Cvar_Get ("sv_traceCache", "0", CVAR_ARCHIVE);
 		
 	// initialize bot cvars so they are listed and can be set before loading the botlib
 	SV_BotInitCvars();
@@ -754,6 +773,7 @@ void SV_Shutdown( char *finalmsg ) {
 
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
+	SV_ShutdownSnapshotThreads();
 	SV_ShutdownGameProgs();
 
 	// free current level
@@ -70,6 +70,17 @@ cvar_t	*sv_demonotice;
 
 cvar_t	*sv_serverFullMessage;
 
+cvar_t	*sv_snapshotThreads;		// threads used to build client snapshots, 0 = serial
+cvar_t	*sv_deltaCache;			// share encoded entity deltas between clients
+cvar_t	*sv_profile;			// per phase SV_Frame timings for svprofile
+cvar_t	*sv_profileFile;		// file the timings are written to, "" = none
+cvar_t	*sv_profileInterval;	// seconds between sv_profileFile writes
+cvar_t	*sv_drdosSources;	// getinfo/getstatus source table size
+cvar_t	*sv_drdosGlobalRate;	// getinfo/getstatus replies per second
+cvar_t	*sv_maxChallenges;	// connected challenges remembered
+cvar_t	*sv_broadphase;		// area queries use the AABB tree instead of the sector tree
+cvar_t	*sv_traceCache;		// remember world traces until the next game frame
+
 /*
 =============================================================================
 
@@ -345,37 +356,150 @@ CONNECTIONLESS COMMANDS
 ==============================================================================
 */
 
+/*
+==============================================================================
+
+Cached status and info replies
+
+Server browsers poll getstatus and getinfo all the time.  The replies only
+change with the serverinfo and systeminfo cvars and with the connected
+clients' names, scores and pings, so the bodies are kept here and rebuilt
+when one of those changes.  Every request still checks the clients, but
+that's a compare per slot instead of a Cvar_InfoString walk and a
+Com_sprintf per player.  Only the challenge is added per request, the
+same way Info_SetValueForKey would add it.
+
+==============================================================================
+*/
+
+typedef struct {
+	qboolean	infoValid;							// serverinfo cvars
+	char		serverInfo[MAX_INFO_STRING];
+	qboolean	hasChallengeKey;					// a cvar called challenge, take the slow path
+	qboolean	playersValid;
+	char		players[MAX_MSGLEN];
+	qboolean	shortInfoValid;						// getinfo reply, less the challenge
+	char		shortInfo[MAX_INFO_STRING];
+	qboolean	shortInfoFull;						// a key didn't fit, take the slow path
+
+	// what the replies were built from
+	int			maxclients;
+	qboolean	connected[MAX_CLIENTS];
+	int			score[MAX_CLIENTS];
+	int			ping[MAX_CLIENTS];
+	char		name[MAX_CLIENTS][MAX_NAME_LENGTH];
+
+	// statuscache counters
+	int			hits;
+	int			misses;
+	unsigned int	hitUsec;
+	unsigned int	missUsec;
+} statusCache_t;
+
+static statusCache_t	statusCache;
+
 /*
 ================
-SVC_Status
+SV_InvalidateStatusCache
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+Called where the serverinfo and systeminfo modified flags are cleared
 ================
 */
-void SVC_Status( netadr_t from ) {
-	char	player[1024];
-	char	status[MAX_MSGLEN];
-	int		i;
-	client_t	*cl;
+void SV_InvalidateStatusCache( void ) {
+	statusCache.infoValid = qfalse;
+	statusCache.shortInfoValid = qfalse;
+}
+
+/*
+================
+SV_CheckStatusCache
+
+Drops the cached parts the current server state no longer matches
+================
+*/
+static void SV_CheckStatusCache( void ) {
+	int				i;
+	qboolean		connected;
+	client_t		*cl;
 	playerState_t	*ps;
-	int		statusLength;
-	int		playerLength;
-	char	infostring[MAX_INFO_STRING];
 
-	// ignore if we are in single player
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
+	if ( cvar_modifiedFlags & ( CVAR_SERVERINFO | CVAR_SYSTEMINFO ) ) {
+		SV_InvalidateStatusCache();
+	}
+
+	if ( statusCache.maxclients != sv_maxclients->integer ) {
+		statusCache.maxclients = sv_maxclients->integer;
+		Com_Memset( statusCache.connected, 0, sizeof( statusCache.connected ) );
+		statusCache.playersValid = qfalse;
+		statusCache.shortInfoValid = qfalse;
+	}
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		connected = cl->state >= CS_CONNECTED;
+		if ( connected != statusCache.connected[i] ) {
+			statusCache.connected[i] = connected;
+			statusCache.playersValid = qfalse;
+			statusCache.shortInfoValid = qfalse;
+		}
+		if ( !connected ) {
+			continue;
+		}
+
+		ps = SV_GameClientNum( i );
+		if ( ps->persistant[PERS_SCORE] != statusCache.score[i] || cl->ping != statusCache.ping[i] ||
+			strcmp( cl->name, statusCache.name[i] ) ) {
+			statusCache.score[i] = ps->persistant[PERS_SCORE];
+			statusCache.ping[i] = cl->ping;
+			Q_strncpyz( statusCache.name[i], cl->name, sizeof( statusCache.name[i] ) );
+			statusCache.playersValid = qfalse;
+		}
+	}
+}
+
+/*
+================
+SV_StatusChallenge
+
+The "\challenge\<arg>" that Info_SetValueForKey would add in front of
+an infostring of length, or an empty string if it wouldn't add one
+================
+*/
+static void SV_StatusChallenge( char *out, int outSize, const char *challenge, int length ) {
+	const char	*blacklist = "\\;\"";
+
+	out[0] = 0;
+	for ( ; *blacklist ; blacklist++ ) {
+		if ( strchr( challenge, *blacklist ) ) {
+			Com_Printf( S_COLOR_YELLOW "Can't use keys or values with a '%c': %s = %s\n",
+				*blacklist, "challenge", challenge );
+			return;
+		}
+	}
+	if ( !challenge[0] ) {
 		return;
 	}
 
-	strcpy( infostring, Cvar_InfoString( CVAR_SERVERINFO ) );
+	Com_sprintf( out, outSize, "\\challenge\\%s", challenge );
+	if ( strlen( out ) + length >= MAX_INFO_STRING ) {
+		Com_Printf( "Info string length exceeded\n" );
+		out[0] = 0;
+	}
+}
 
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+/*
+================
+SV_BuildStatusPlayers
+================
+*/
+static void SV_BuildStatusPlayers( void ) {
+	char	player[1024];
+	int		i;
+	client_t	*cl;
+	playerState_t	*ps;
+	int		statusLength;
+	int		playerLength;
 
-	status[0] = 0;
+	statusCache.players[0] = 0;
 	statusLength = 0;
 
 	for (i=0 ; i < sv_maxclients->integer ; i++) {
@@ -385,43 +509,46 @@ void SVC_Status( netadr_t from ) {
 			Com_sprintf (player, sizeof(player), "%i %i \"%s\"\n", 
 				ps->persistant[PERS_SCORE], cl->ping, cl->name);
 			playerLength = strlen(player);
-			if (statusLength + playerLength >= sizeof(status) ) {
+			if (statusLength + playerLength >= sizeof(statusCache.players) ) {
 				break;		// can't hold any more
 			}
-			strcpy (status + statusLength, player);
+			strcpy (statusCache.players + statusLength, player);
 			statusLength += playerLength;
 		}
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
+	statusCache.playersValid = qtrue;
 }
 
 /*
 ================
-SVC_Info
+SV_SetInfoKey
 
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
+Info_SetValueForKey that notes when the key didn't fit
 ================
 */
-void SVC_Info( netadr_t from ) {
-	int		i, count;
-	char	*gamedir;
-	char	infostring[MAX_INFO_STRING];
+static void SV_SetInfoKey( char *s, const char *key, const char *value, qboolean *full ) {
+	int		length;
 
-	// ignore if we are in single player
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
-		return;
+	length = strlen( s );
+	Info_SetValueForKey( s, key, value );
+	if ( strlen( s ) == length && value[0] && !strpbrk( value, "\\;\"" ) ) {
+		*full = qtrue;
 	}
+}
 
-	/*
-	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
-	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
-	 */
+/*
+================
+SV_BuildShortInfo
 
-	// A maximum challenge length of 128 should be more than plenty.
-	if(strlen(Cmd_Argv(1)) > 128)
-		return;
+The getinfo reply.  The challenge goes in first and Info_SetValueForKey
+puts new keys in front, so it ends up as the last key and the cached
+reply can be built without it.
+================
+*/
+static void SV_BuildShortInfo( char *infostring, const char *challenge, qboolean *full ) {
+	int		i, count;
+	char	*gamedir;
 
 	// don't count privateclients
 	count = 0;
@@ -432,32 +559,176 @@ void SVC_Info( netadr_t from ) {
 	}
 
 	infostring[0] = 0;
+	*full = qfalse;
 
 	// echo back the parameter to status. so servers can use it as a challenge
 	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+	if ( challenge ) {
+		Info_SetValueForKey( infostring, "challenge", challenge );
+	}
 
-	Info_SetValueForKey( infostring, "protocol", va("%i", PROTOCOL_VERSION) );
-	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
-	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
-	Info_SetValueForKey( infostring, "clients", va("%i", count) );
-	Info_SetValueForKey( infostring, "sv_maxclients", 
-		va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
-	Info_SetValueForKey( infostring, "gametype", va("%i", sv_gametype->integer ) );
-	Info_SetValueForKey( infostring, "pure", va("%i", sv_pure->integer ) );
+	SV_SetInfoKey( infostring, "protocol", va("%i", PROTOCOL_VERSION), full );
+	SV_SetInfoKey( infostring, "hostname", sv_hostname->string, full );
+	SV_SetInfoKey( infostring, "mapname", sv_mapname->string, full );
+	SV_SetInfoKey( infostring, "clients", va("%i", count), full );
+	SV_SetInfoKey( infostring, "sv_maxclients", 
+		va("%i", sv_maxclients->integer - sv_privateClients->integer ), full );
+	SV_SetInfoKey( infostring, "gametype", va("%i", sv_gametype->integer ), full );
+	SV_SetInfoKey( infostring, "pure", va("%i", sv_pure->integer ), full );
 
 	if( sv_minPing->integer ) {
-		Info_SetValueForKey( infostring, "minPing", va("%i", sv_minPing->integer) );
+		SV_SetInfoKey( infostring, "minPing", va("%i", sv_minPing->integer), full );
 	}
 	if( sv_maxPing->integer ) {
-		Info_SetValueForKey( infostring, "maxPing", va("%i", sv_maxPing->integer) );
+		SV_SetInfoKey( infostring, "maxPing", va("%i", sv_maxPing->integer), full );
 	}
 	gamedir = Cvar_VariableString( "fs_game" );
 	if( *gamedir ) {
-		Info_SetValueForKey( infostring, "game", gamedir );
+		SV_SetInfoKey( infostring, "game", gamedir, full );
+	}
+}
+
+/*
+================
+SV_CountStatusRequest
+================
+*/
+static void SV_CountStatusRequest( qboolean hit, unsigned int start ) {
+	if ( hit ) {
+		statusCache.hits++;
+		statusCache.hitUsec += Sys_Microseconds() - start;
+	} else {
+		statusCache.misses++;
+		statusCache.missUsec += Sys_Microseconds() - start;
+	}
+}
+
+/*
+================
+SV_StatusCache_f
+
+statuscache [reset]
+================
+*/
+void SV_StatusCache_f( void ) {
+	int		total;
+	float	hitCost, missCost;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		statusCache.hits = statusCache.misses = 0;
+		statusCache.hitUsec = statusCache.missUsec = 0;
+		return;
+	}
+
+	total = statusCache.hits + statusCache.misses;
+	hitCost = statusCache.hits ? (float)statusCache.hitUsec / statusCache.hits : 0.0f;
+	missCost = statusCache.misses ? (float)statusCache.missUsec / statusCache.misses : 0.0f;
+
+	Com_Printf( "%i hits, %i rebuilds, %.1f%% hit rate\n", statusCache.hits, statusCache.misses,
+		total ? 100.0f * statusCache.hits / total : 0.0f );
+	Com_Printf( "%.1f usec per hit, %.1f usec per rebuild\n", hitCost, missCost );
+	if ( statusCache.misses ) {
+		Com_Printf( "about %.1f msec of cpu saved\n",
+			statusCache.hits * ( missCost - hitCost ) / 1000.0f );
+	}
+}
+
+/*
+================
+SVC_Status
+
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
+================
+*/
+void SVC_Status( netadr_t from ) {
+	char	challenge[MAX_INFO_STRING];
+	char	infostring[MAX_INFO_STRING];
+	unsigned int	start;
+	qboolean	hit;
+
+	// ignore if we are in single player
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
+		return;
+	}
+
+	start = Sys_Microseconds();
+	SV_CheckStatusCache();
+	hit = statusCache.infoValid && statusCache.playersValid;
+
+	if ( !statusCache.infoValid ) {
+		strcpy( statusCache.serverInfo, Cvar_InfoString( CVAR_SERVERINFO ) );
+		statusCache.hasChallengeKey = strstr( statusCache.serverInfo, "\\challenge\\" ) != NULL;
+		statusCache.infoValid = qtrue;
+	}
+	if ( !statusCache.playersValid ) {
+		SV_BuildStatusPlayers();
+	}
+
+	// echo back the parameter to status. so master servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	if ( statusCache.hasChallengeKey ) {
+		strcpy( infostring, statusCache.serverInfo );
+		Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+		NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, statusCache.players );
+	} else {
+		SV_StatusChallenge( challenge, sizeof( challenge ), Cmd_Argv(1), strlen( statusCache.serverInfo ) );
+		NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s%s\n%s", challenge,
+			statusCache.serverInfo, statusCache.players );
+	}
+
+	SV_CountStatusRequest( hit, start );
+}
+
+/*
+================
+SVC_Info
+
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
+================
+*/
+void SVC_Info( netadr_t from ) {
+	char	challenge[MAX_INFO_STRING];
+	char	infostring[MAX_INFO_STRING];
+	unsigned int	start;
+	qboolean	hit, full;
+
+	// ignore if we are in single player
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
+		return;
+	}
+
+	/*
+	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
+	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
+	 */
+
+	// A maximum challenge length of 128 should be more than plenty.
+	if(strlen(Cmd_Argv(1)) > 128)
+		return;
+
+	start = Sys_Microseconds();
+	SV_CheckStatusCache();
+	hit = statusCache.shortInfoValid;
+
+	if ( !statusCache.shortInfoValid ) {
+		SV_BuildShortInfo( statusCache.shortInfo, NULL, &statusCache.shortInfoFull );
+		statusCache.shortInfoValid = qtrue;
+	}
+
+	SV_StatusChallenge( challenge, sizeof( challenge ), Cmd_Argv(1), 0 );
+
+	// the keys only go in the same way with the challenge in front if they all fit
+	if ( statusCache.shortInfoFull || strlen( statusCache.shortInfo ) + strlen( challenge ) >= MAX_INFO_STRING ) {
+		SV_BuildShortInfo( infostring, challenge[0] ? Cmd_Argv(1) : NULL, &full );
+		NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	} else {
+		NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s%s", statusCache.shortInfo, challenge );
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	SV_CountStatusRequest( hit, start );
 }
 
 /*
@@ -554,28 +825,191 @@ void SVC_RemoteCommand( netadr_t from, msg_t *msg ) {
 }
 
 /*
-=================
-SV_CheckDRDoS
+==============================================================================
+
+getinfo/getstatus rate limiting
 
 DRDoS stands for "Distributed Reflected Denial of Service".
 See here: http://www.lemuria.org/security/application-drdos.html
 
+Every xx.xx.xx.0/24 source gets a token bucket good for three replies in
+two seconds.  A source that asks for more is banned for two minutes.  The
+ban is lifted after three seconds if the source stops, and renewed if it
+keeps flooding.  A global bucket of sv_drdosGlobalRate replies a second
+caps the total, so spoofed requests from many prefixes can't be turned
+into a flood either.
+
+The sources are kept in an open addressed hash of sv_drdosSources slots,
+at most DRDOS_MAX_SOURCES.  At 32 bytes a slot the largest table is too
+big for the zone, so it is malloced.
+A source is looked up within DRDOS_PROBES slots of its hash.  A source
+that is idle and unbanned holds nothing a fresh one wouldn't, so its slot
+is simply reused, and when the probe window is full the source seen
+longest ago is dropped.
+
+==============================================================================
+*/
+
+#define	DRDOS_PROBES			16
+#define	DRDOS_MAX_SOURCES		( 1 << 20 )
+#define	DRDOS_MAX_GLOBAL_RATE	100000		// keeps rate * 2000 tokens well inside an int
+#define	DRDOS_BURST				3000		// replies per source, in 1/1000ths
+#define	DRDOS_REFILL_MS			2000		// time for an empty source bucket to fill
+#define	DRDOS_BAN_MS			120000
+#define	DRDOS_UNBAN_MS			3000
+#define	DRDOS_UNBAN_COUNT		5
+#define	DRDOS_RENEW_COUNT		180
+
+typedef struct {
+	int			prefix;			// first three address bytes, -1 if the slot was never used
+	int			lastTime;		// svs.time of the last request
+	int			tokens;			// replies left, in 1/1000ths
+	qboolean	banned;
+	int			banTime;
+	int			banCount;		// requests since the ban started or was renewed
+	qboolean	flood;
+	int			drops;			// requests not answered since the source was added
+} infoSource_t;
+
+static infoSource_t	*infoSources;
+static int			numInfoSources;		// power of two
+static int			infoSourceBits;
+
+static int			infoGlobalTokens;	// 1/1000ths of a reply
+static int			infoGlobalTime;
+static int			infoEvictions;
+static int			infoGlobalDrops;
+
+/*
+=================
+SV_InitInfoSources
+
+(Re)allocates the table when sv_drdosSources has changed
+=================
+*/
+static void SV_InitInfoSources( void ) {
+	int		i, wanted;
+
+	wanted = sv_drdosSources->integer;
+	if ( wanted < 256 ) {
+		wanted = 256;
+	} else if ( wanted > DRDOS_MAX_SOURCES ) {
+		wanted = DRDOS_MAX_SOURCES;
+	}
+	for ( i = 8 ; ( 1 << i ) < wanted ; i++ ) {
+	}
+
+	if ( infoSources && numInfoSources == ( 1 << i ) ) {
+		return;
+	}
+
+	if ( infoSources ) {
+		free( infoSources );
+	}
+	infoSourceBits = i;
+	numInfoSources = 1 << i;
+	infoSources = calloc( numInfoSources, sizeof( *infoSources ) );
+	if ( !infoSources ) {
+		Com_Error( ERR_FATAL, "SV_InitInfoSources: failed on allocation of %i sources", numInfoSources );
+	}
+	for ( i = 0 ; i < numInfoSources ; i++ ) {
+		infoSources[i].prefix = -1;
+	}
+	infoEvictions = 0;
+}
+
+/*
+=================
+SV_InfoSourceIdle
+
+True if the source is in the same state as one never seen
+=================
+*/
+static qboolean SV_InfoSourceIdle( const infoSource_t *src ) {
+	int		elapsed;
+
+	if ( src->prefix == -1 ) {
+		return qtrue;
+	}
+
+	// svs.time starts over after a shutdown
+	elapsed = svs.time - src->lastTime;
+	if ( elapsed < 0 ) {
+		return qtrue;
+	}
+	if ( src->banned && svs.time - src->banTime < DRDOS_BAN_MS ) {
+		return qfalse;
+	}
+	return elapsed >= DRDOS_REFILL_MS;
+}
+
+/*
+=================
+SV_FindInfoSource
+=================
+*/
+static infoSource_t *SV_FindInfoSource( int prefix ) {
+	int				i, slot, mask;
+	infoSource_t	*src, *reuse, *oldest;
+
+	mask = numInfoSources - 1;
+	slot = ( (unsigned int)prefix * 2654435761u ) >> ( 32 - infoSourceBits );
+	reuse = oldest = NULL;
+
+	for ( i = 0 ; i < DRDOS_PROBES ; i++ ) {
+		src = &infoSources[ ( slot + i ) & mask ];
+		if ( src->prefix == prefix ) {
+			if ( SV_InfoSourceIdle( src ) ) {
+				break;		// start it over, but keep the drop count
+			}
+			return src;
+		}
+		if ( src->prefix == -1 ) {
+			// nothing was ever stored past here
+			if ( !reuse ) {
+				reuse = src;
+			}
+			break;
+		}
+		if ( !reuse && SV_InfoSourceIdle( src ) ) {
+			reuse = src;
+		}
+		if ( !oldest || src->lastTime - oldest->lastTime < 0 ) {
+			oldest = src;
+		}
+	}
+
+	if ( i < DRDOS_PROBES && src->prefix == prefix ) {
+		reuse = src;
+	} else {
+		if ( !reuse ) {
+			reuse = oldest;
+			infoEvictions++;
+		}
+		reuse->drops = 0;
+	}
+
+	reuse->prefix = prefix;
+	reuse->lastTime = svs.time;
+	reuse->tokens = DRDOS_BURST;
+	reuse->banned = qfalse;
+	reuse->banCount = 0;
+	reuse->flood = qfalse;
+	return reuse;
+}
+
+/*
+=================
+SV_CheckDRDoS
+
 Returns qfalse if we're good.  qtrue return value means we need to block.
 If the address isn't NA_IP, it's automatically denied.
 =================
 */
 qboolean SV_CheckDRDoS(netadr_t from)
 {
-	netadr_t	exactFrom;
-	int		i;
-	floodBan_t	*ban;
-	int		oldestBan;
-	int		oldestBanTime;
-	int		globalCount;
-	int		specificCount;
-	receipt_t	*receipt;
-	int		oldest;
-	int		oldestTime;
+	infoSource_t	*src;
+	int				elapsed, rate;
 	static int	lastGlobalLogTime = 0;
 
 	// Usually the network is smart enough to not allow incoming UDP packets
@@ -584,88 +1018,80 @@ qboolean SV_CheckDRDoS(netadr_t from)
 	// NA_LOOPBACK qualifies as a LAN address.
 	if (Sys_IsLANAddress(from)) { return qfalse; }
 
-	exactFrom = from;
-	if (from.type == NA_IP) {
-		from.ip[3] = 0; // xx.xx.xx.0
-	}
-	else {
+	if (from.type != NA_IP) {
 		// So we got a connectionless packet but it's not IPv4, so
 		// what is it?  I don't care, it doesn't matter, we'll just block it.
 		// This probably won't even happen.
 		return qtrue;
 	}
 
+	SV_InitInfoSources();
+	src = SV_FindInfoSource( ( from.ip[0] << 16 ) | ( from.ip[1] << 8 ) | from.ip[2] );
+
 	// This quick exit strategy while we're being bombarded by getinfo/getstatus requests
 	// directed at a specific IP address doesn't really impact server performance.
-	// The code below does its duty very quickly if we're handling a flood packet.
-	ban = &svs.infoFloodBans[0];
-	oldestBan = 0;
-	oldestBanTime = 0x7fffffff;
-	for (i = 0; i < MAX_INFO_FLOOD_BANS; i++, ban++) {
-		if (svs.time - ban->time < 120000 && // Two minute ban.
-				NET_CompareBaseAdr(from, ban->adr)) {
-			ban->count++;
-			if (!ban->flood && ((svs.time - ban->time) >= 3000) && ban->count <= 5) {
-				Com_DPrintf("Unban info flood protect for address %s, they're not flooding\n",
-						NET_AdrToString(exactFrom));
-				Com_Memset(ban, 0, sizeof(floodBan_t));
-				oldestBan = i;
-				break;
-			}
-			if (ban->count >= 180) {
+	if ( src->banned && svs.time - src->banTime < DRDOS_BAN_MS ) {
+		src->banCount++;
+		src->lastTime = svs.time;
+		if ( !src->flood && svs.time - src->banTime >= DRDOS_UNBAN_MS && src->banCount <= DRDOS_UNBAN_COUNT ) {
+			Com_DPrintf("Unban info flood protect for address %s, they're not flooding\n",
+					NET_AdrToString(from));
+			src->banned = qfalse;
+			src->tokens = DRDOS_BURST;
+		} else {
+			if ( src->banCount >= DRDOS_RENEW_COUNT ) {
 				Com_DPrintf("Renewing info flood ban for address %s, received %i getinfo/getstatus requests in %i milliseconds\n",
-						NET_AdrToString(exactFrom), ban->count, svs.time - ban->time);
-				ban->time = svs.time;
-				ban->count = 0;
-				ban->flood = qtrue;
+						NET_AdrToString(from), src->banCount, svs.time - src->banTime);
+				src->banTime = svs.time;
+				src->banCount = 0;
+				src->flood = qtrue;
 			}
+			src->drops++;
 			return qtrue;
 		}
-		if (ban->time < oldestBanTime) {
-			oldestBanTime = ban->time;
-			oldestBan = i;
-		}
 	}
+	src->banned = qfalse;
 
-	// Count receipts in last 2 seconds.
-	globalCount = 0;
-	specificCount = 0;
-	receipt = &svs.infoReceipts[0];
-	oldest = 0;
-	oldestTime = 0x7fffffff;
-	for (i = 0; i < MAX_INFO_RECEIPTS; i++, receipt++) {
-		if (receipt->time + 2000 > svs.time) {
-			if (receipt->time) {
-				// When the server starts, all receipt times are at zero.  Furthermore,
-				// svs.time is close to zero.  We check that the receipt time is already
-				// set so that during the first two seconds after server starts, queries
-				// from the master servers don't get ignored.  As a consequence a potentially
-				// unlimited number of getinfo+getstatus responses may be sent during the
-				// first frame of a server's life.
-				globalCount++;
-			}
-			if (NET_CompareBaseAdr(from, receipt->adr)) {
-				specificCount++;
-			}
-		}
-		if (receipt->time < oldestTime) {
-			oldestTime = receipt->time;
-			oldest = i;
-		}
+	// refill the source bucket
+	elapsed = svs.time - src->lastTime;
+	src->lastTime = svs.time;
+	if ( elapsed > DRDOS_REFILL_MS ) {
+		elapsed = DRDOS_REFILL_MS;
+	}
+	src->tokens += elapsed * DRDOS_BURST / DRDOS_REFILL_MS;
+	if ( src->tokens > DRDOS_BURST ) {
+		src->tokens = DRDOS_BURST;
 	}
 
-	if (specificCount >= 3) { // Already sent 3 to this IP in last 2 seconds.
+	if ( src->tokens < 1000 ) { // Already sent 3 to this /24 in last 2 seconds.
 		Com_Printf("Possible DRDoS attack to address %s, putting into temporary getinfo/getstatus ban list\n",
-					NET_AdrToString(exactFrom));
-		ban = &svs.infoFloodBans[oldestBan];
-		ban->adr = from;
-		ban->time = svs.time;
-		ban->count = 0;
-		ban->flood = qfalse;
+					NET_AdrToString(from));
+		src->banned = qtrue;
+		src->banTime = svs.time;
+		src->banCount = 0;
+		src->flood = qfalse;
+		src->drops++;
 		return qtrue;
 	}
 
-	if (globalCount == MAX_INFO_RECEIPTS) { // All receipts happened in last 2 seconds.
+	// refill the global bucket, two seconds worth at most
+	rate = sv_drdosGlobalRate->integer;
+	if ( rate < 1 ) {
+		rate = 1;
+	} else if ( rate > DRDOS_MAX_GLOBAL_RATE ) {
+		rate = DRDOS_MAX_GLOBAL_RATE;
+	}
+	elapsed = svs.time - infoGlobalTime;
+	infoGlobalTime = svs.time;
+	if ( elapsed < 0 || elapsed > 2000 ) {
+		elapsed = 2000;
+	}
+	infoGlobalTokens += elapsed * rate;
+	if ( infoGlobalTokens > rate * 2000 ) {
+		infoGlobalTokens = rate * 2000;
+	}
+
+	if ( infoGlobalTokens < 1000 ) {
 		// Detect time wrap where the server sets time back to zero.  Problem
 		// is that we're using a static variable here that doesn't get zeroed out when
 		// the time wraps.  TTimo's way of doing this is casting everything including
@@ -677,15 +1103,77 @@ qboolean SV_CheckDRDoS(netadr_t from)
 			Com_Printf("Detected flood of arbitrary getinfo/getstatus connectionless packets\n");
 			lastGlobalLogTime = svs.time;
 		}
+		src->drops++;
+		infoGlobalDrops++;
 		return qtrue;
 	}
 
-	receipt = &svs.infoReceipts[oldest];
-	receipt->adr = from;
-	receipt->time = svs.time;
+	src->tokens -= 1000;
+	infoGlobalTokens -= 1000;
 	return qfalse;
 }
 
+/*
+=================
+SV_DRDoS_f
+
+drdos [reset]: the sources that were refused the most
+=================
+*/
+#define	DRDOS_LIST		16
+
+void SV_DRDoS_f( void ) {
+	infoSource_t	*src, *top[DRDOS_LIST];
+	int				i, j, used, banned;
+
+	if ( !infoSources ) {
+		Com_Printf( "no getinfo/getstatus sources yet\n" );
+		return;
+	}
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		for ( i = 0 ; i < numInfoSources ; i++ ) {
+			infoSources[i].drops = 0;
+		}
+		infoEvictions = infoGlobalDrops = 0;
+		return;
+	}
+
+	Com_Memset( top, 0, sizeof( top ) );
+	used = banned = 0;
+	for ( i = 0, src = infoSources ; i < numInfoSources ; i++, src++ ) {
+		if ( SV_InfoSourceIdle( src ) && !src->drops ) {
+			continue;
+		}
+		used++;
+		if ( src->banned && svs.time - src->banTime < DRDOS_BAN_MS ) {
+			banned++;
+		}
+		if ( !src->drops ) {
+			continue;
+		}
+		for ( j = DRDOS_LIST ; j > 0 && ( !top[j - 1] || top[j - 1]->drops < src->drops ) ; j-- ) {
+			if ( j < DRDOS_LIST ) {
+				top[j] = top[j - 1];
+			}
+		}
+		if ( j < DRDOS_LIST ) {
+			top[j] = src;
+		}
+	}
+
+	Com_Printf( "%i of %i source slots in use, %i banned, %i evicted\n", used, numInfoSources,
+		banned, infoEvictions );
+	Com_Printf( "%i requests over the global limit\n", infoGlobalDrops );
+	for ( i = 0 ; i < DRDOS_LIST && top[i] ; i++ ) {
+		src = top[i];
+		Com_Printf( "%3i.%3i.%3i.0/24 %8i dropped%s\n", ( src->prefix >> 16 ) & 255,
+			( src->prefix >> 8 ) & 255, src->prefix & 255, src->drops,
+			!src->banned || svs.time - src->banTime >= DRDOS_BAN_MS ? "" :
+			( src->flood ? ", flooding" : ", banned" ) );
+	}
+}
+
 /*
 =================
 SV_ConnectionlessPacket
@@ -755,7 +1243,7 @@ void SV_ConnectionlessPacket( netadr_t from, msg_t *msg ) {
 SV_ReadPackets
 =================
 */
-void SV_PacketEvent( netadr_t from, msg_t *msg ) {
+static void SV_ProcessPacket( netadr_t from, msg_t *msg ) {
 	int			i;
 	client_t	*cl;
 	int			qport;
@@ -812,6 +1300,19 @@ void SV_PacketEvent( netadr_t from, msg_t *msg ) {
 	NET_OutOfBandPrint( NS_SERVER, from, "disconnect" );
 }
 
+/*
+=================
+SV_PacketEvent
+=================
+*/
+void SV_PacketEvent( netadr_t from, msg_t *msg ) {
+	unsigned int	start;
+
+	start = SV_ProfileStart();
+	SV_ProcessPacket( from, msg );
+	SV_ProfileAdd( PROF_PACKETS, start );
+}
+
 
 /*
 ===================
@@ -950,6 +1451,29 @@ qboolean SV_CheckPaused( void ) {
 	return qtrue;
 }
 
+/*
+==================
+SV_FrameUsec
+
+The length of the next game frame.  1000000 / sv_fps rounds down, so the
+remainder is carried in sv.frameRemainder and the frames it adds up to a
+whole usec in are one usec longer, which makes the long run rate exactly
+sv_fps frames a second
+==================
+*/
+static int SV_FrameUsec( void ) {
+	int		usec;
+
+	usec = 1000000 / sv_fps->integer;
+	if ( sv.frameRemainder % sv_fps->integer + 1000000 % sv_fps->integer >= sv_fps->integer ) {
+		usec++;
+	}
+	usec *= com_timescale->value;
+
+	// don't let it scale below 1ms
+	return usec < 1000 ? 1000 : usec;
+}
+
 /*
 ==================
 SV_Frame
@@ -959,8 +1483,10 @@ happen before SV_Frame is called
 ==================
 */
 void SV_Frame( int msec ) {
-	int		frameMsec;
+	int		frameUsec;
 	int		startTime;
+	int		usec, step, numFrames;
+	unsigned int	now, frameStart, phaseStart, gameStart;
 
 	// the menu kills the server with this cvar
 	if ( sv_killserver->integer ) {
@@ -990,22 +1516,42 @@ void SV_Frame( int msec ) {
 		Cvar_Set( "sv_fps", "10" );
 	}
 
-	frameMsec = 1000 / sv_fps->integer * com_timescale->value;
+	// frames are timed in usec, so sv_fps values that don't divide 1000
+	// still give exactly sv_fps frames a second
 	// don't let it scale below 1ms
-	if(frameMsec < 1)
+	if ( 1000000 / sv_fps->integer * com_timescale->value < 1000 )
 	{
 		Cvar_Set("timescale", va("%f", sv_fps->integer / 1000.0f));
-		frameMsec = 1;
 	}
+	frameUsec = SV_FrameUsec();
+
+	// a dedicated server running in real time reads the clock itself,
+	// msec only has whole milliseconds
+	now = Sys_Microseconds();
+	if ( com_dedicated->integer && sv.frameClockStarted && !com_fixedtime->integer &&
+		com_timescale->value == 1.0f ) {
+		usec = now - sv.frameClock;
+		if ( usec > 5000000 ) {
+			usec = 5000000;		// same clamp as Com_ModifyMsec
+		}
+	} else {
+		usec = msec * 1000;
+	}
+	sv.frameClock = now;
+	sv.frameClockStarted = qtrue;
 
-	sv.timeResidual += msec;
+	sv.timeResidual += usec;
 
-	if (!com_dedicated->integer) SV_BotFrame (sv.time + sv.timeResidual);
+	if (!com_dedicated->integer) {
+		phaseStart = SV_ProfileStart();
+		SV_BotFrame (sv.time + sv.timeResidual / 1000);
+		SV_ProfileAdd( PROF_BOTFRAME, phaseStart );
+	}
 
-	if ( com_dedicated->integer && sv.timeResidual < frameMsec ) {
-		// NET_Sleep will give the OS time slices until either get a packet
+	if ( com_dedicated->integer && sv.timeResidual < frameUsec ) {
+		// NET_SleepUsec will give the OS time slices until either get a packet
 		// or time enough for a server frame has gone by
-		NET_Sleep(frameMsec - sv.timeResidual);
+		NET_SleepUsec(frameUsec - sv.timeResidual);
 		return;
 	}
 
@@ -1031,14 +1577,21 @@ void SV_Frame( int msec ) {
 		return;
 	}
 
+	frameStart = SV_ProfileStart();
+
+	// collect everything this frame sends and flush it at the end
+	NET_BeginSendBatch();
+
 	// update infostrings if anything has been changed
 	if ( cvar_modifiedFlags & CVAR_SERVERINFO ) {
 		SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+		SV_InvalidateStatusCache();
 	}
 	if ( cvar_modifiedFlags & CVAR_SYSTEMINFO ) {
 		SV_SetConfigstring( CS_SYSTEMINFO, Cvar_InfoString_Big( CVAR_SYSTEMINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SYSTEMINFO;
+		SV_InvalidateStatusCache();
 	}
 
 	if ( com_speeds->integer ) {
@@ -1048,35 +1601,75 @@ void SV_Frame( int msec ) {
 	}
 
 	// update ping based on the all received frames
+	phaseStart = SV_ProfileStart();
 	SV_CalcPings();
+	SV_ProfileAdd( PROF_CALCPINGS, phaseStart );
+
+	if (com_dedicated->integer) {
+		phaseStart = SV_ProfileStart();
+		SV_BotFrame (sv.time);
+		SV_ProfileAdd( PROF_BOTFRAME, phaseStart );
+	}
 
-	if (com_dedicated->integer) SV_BotFrame (sv.time);
+	// how far this tick is from where sv_fps puts it
+	phaseStart = SV_ProfileStart();
+	numFrames = sv.timeResidual / frameUsec;
+	if ( sv.tickClockStarted && numFrames ) {
+		usec = phaseStart - sv.tickClock;
+		SV_ProfileSample( PROF_TICKINTERVAL, usec );
+		SV_ProfileSample( PROF_TICKJITTER, abs( usec - numFrames * frameUsec ) );
+	}
+	if ( numFrames ) {
+		sv.tickClock = phaseStart;
+		sv.tickClockStarted = qtrue;
+	}
 
 	// run the game simulation in chunks
-	while ( sv.timeResidual >= frameMsec ) {
-		sv.timeResidual -= frameMsec;
-		svs.time += frameMsec;
-		sv.time += frameMsec;
+	while ( sv.timeResidual >= frameUsec ) {
+		sv.timeResidual -= frameUsec;
+		sv.frameRemainder = ( sv.frameRemainder + 1000000 % sv_fps->integer ) % sv_fps->integer;
+
+		// the game only sees whole msec, the rest carries to the next frame
+		sv.timeFraction += frameUsec;
+		step = sv.timeFraction / 1000;
+		sv.timeFraction -= step * 1000;
+		svs.time += step;
+		sv.time += step;
 
 		// let everything in the world think and move
+		SV_TraceCacheInvalidate();
+		gameStart = SV_GameProfileFrameStart();
 		VM_Call (gvm, GAME_RUN_FRAME, sv.time);
+		SV_GameProfileFrameEnd( gameStart );
+
+		frameUsec = SV_FrameUsec();
 	}
+	SV_ProfileAdd( PROF_GAMEFRAME, phaseStart );
 
 	if ( com_speeds->integer ) {
 		time_game = Sys_Milliseconds () - startTime;
 	}
 
 	// check timeouts
+	phaseStart = SV_ProfileStart();
 	SV_CheckTimeouts();
+	SV_ProfileAdd( PROF_TIMEOUTS, phaseStart );
 	
 	// check user info buffer thingy
 	SV_CheckClientUserinfoTimer();
 
 	// send messages back to the clients
+	phaseStart = SV_ProfileStart();
 	SV_SendClientMessages();
+	SV_ProfileAdd( PROF_SENDMESSAGES, phaseStart );
 
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat();
+
+	NET_FlushSendBatch();
+
+	SV_ProfileAdd( PROF_FRAME, frameStart );
+	SV_ProfileEndFrame();
 }
 
 //============================================================================
@@ -0,0 +1,847 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+
+#include "server.h"
+
+/*
+=============================================================================
+
+Server frame profiler
+
+Every SV_Frame phase adds its microseconds to an accumulator, and
+SV_ProfileEndFrame turns the accumulators into one sample per phase.  The
+last PROFILE_WINDOW samples are kept in a ring and counted in a log-linear
+histogram, eight buckets per power of two, so p50 and p99 come out of the
+histogram without sorting anything on the frame.  Bucket values are upper
+bounds, within 12.5% of the real times.  The window max is exact.
+
+Packets are processed between frames, so their time goes to the frame
+that follows them.
+
+=============================================================================
+*/
+
+#define	PROFILE_WINDOW		2048		// frames in the rolling window
+#define	PROFILE_BUCKETS		240			// enough for 32 bit times
+
+typedef struct {
+	const char		*name;
+	unsigned int	accum;						// this frame so far
+	unsigned int	samples[PROFILE_WINDOW];
+	unsigned short	buckets[PROFILE_BUCKETS];	// samples in the window
+	unsigned int	peak;						// since the last reset
+} profilePhase_t;
+
+static profilePhase_t	profilePhases[PROF_NUM_PHASES] = {
+	{ "frame" },
+	{ "packets" },
+	{ "calcpings" },
+	{ "botframe" },
+	{ "gameframe" },
+	{ "timeouts" },
+	{ "sendmessages" },
+	{ "snapshotbuild" },
+	{ "snapshotencode" },
+	{ "snapshottransmit" },
+	{ "tickinterval" },
+	{ "tickjitter" }
+};
+
+static int		profileFrames;			// samples recorded since the last reset
+static int		profileNextWrite;		// Sys_Milliseconds of the next stats file
+
+/*
+=================
+SV_ProfileBucket
+=================
+*/
+static int SV_ProfileBucket( unsigned int usec ) {
+	int		e;
+
+	if ( usec < 8 ) {
+		return usec;
+	}
+	for ( e = 3 ; e < 31 && usec >> ( e + 1 ) ; e++ ) {
+	}
+	return ( e - 2 ) * 8 + ( ( usec >> ( e - 3 ) ) & 7 );
+}
+
+/*
+=================
+SV_ProfileBucketValue
+
+The largest time that falls in bucket
+=================
+*/
+static unsigned int SV_ProfileBucketValue( int bucket ) {
+	int		e;
+
+	if ( bucket < 8 ) {
+		return bucket;
+	}
+	e = bucket / 8 + 2;
+	return ( (unsigned int)( 9 + ( bucket & 7 ) ) << ( e - 3 ) ) - 1;
+}
+
+/*
+=================
+SV_ProfileStart
+=================
+*/
+unsigned int SV_ProfileStart( void ) {
+	return Sys_Microseconds();
+}
+
+/*
+=================
+SV_ProfileAdd
+
+Adds the time since start, from SV_ProfileStart, to phase
+=================
+*/
+void SV_ProfileAdd( svProfilePhase_t phase, unsigned int start ) {
+	profilePhases[phase].accum += Sys_Microseconds() - start;
+}
+
+/*
+=================
+SV_ProfileSample
+
+Adds a time that wasn't measured with SV_ProfileStart
+=================
+*/
+void SV_ProfileSample( svProfilePhase_t phase, unsigned int usec ) {
+	profilePhases[phase].accum += usec;
+}
+
+/*
+=================
+SV_ProfileReset
+=================
+*/
+static void SV_ProfileReset( void ) {
+	int		i;
+
+	for ( i = 0 ; i < PROF_NUM_PHASES ; i++ ) {
+		profilePhases[i].accum = 0;
+		profilePhases[i].peak = 0;
+		Com_Memset( profilePhases[i].buckets, 0, sizeof( profilePhases[i].buckets ) );
+	}
+	profileFrames = 0;
+}
+
+/*
+=================
+SV_ProfilePercentile
+=================
+*/
+static unsigned int SV_ProfilePercentile( const profilePhase_t *phase, int count, int percent ) {
+	int		i, rank, total;
+
+	rank = ( count - 1 ) * percent / 100;
+	total = 0;
+	for ( i = 0 ; i < PROFILE_BUCKETS ; i++ ) {
+		total += phase->buckets[i];
+		if ( total > rank ) {
+			return SV_ProfileBucketValue( i );
+		}
+	}
+	return 0;
+}
+
+/*
+=================
+SV_ProfileWindowMax
+=================
+*/
+static unsigned int SV_ProfileWindowMax( const profilePhase_t *phase, int count ) {
+	int				i;
+	unsigned int	max;
+
+	max = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( phase->samples[i] > max ) {
+			max = phase->samples[i];
+		}
+	}
+	return max;
+}
+
+/*
+=================
+SV_ProfileWriteStats
+
+One line per phase: name p50 p99 max peak, all in microseconds
+=================
+*/
+static void SV_ProfileWriteStats( void ) {
+	fileHandle_t	f;
+	profilePhase_t	*phase;
+	int				i, count;
+
+	f = FS_FOpenFileWrite( sv_profileFile->string );
+	if ( !f ) {
+		Com_Printf( "SV_ProfileWriteStats: couldn't open %s\n", sv_profileFile->string );
+		Cvar_Set( "sv_profileFile", "" );
+		return;
+	}
+
+	count = profileFrames < PROFILE_WINDOW ? profileFrames : PROFILE_WINDOW;
+	FS_Printf( f, "time %i\nframes %i\nwindow %i\n", svs.time, profileFrames, count );
+	for ( i = 0, phase = profilePhases ; i < PROF_NUM_PHASES ; i++, phase++ ) {
+		FS_Printf( f, "%s %u %u %u %u\n", phase->name,
+			SV_ProfilePercentile( phase, count, 50 ), SV_ProfilePercentile( phase, count, 99 ),
+			SV_ProfileWindowMax( phase, count ), phase->peak );
+	}
+
+	FS_FCloseFile( f );
+}
+
+/*
+=================
+SV_ProfileEndFrame
+
+Called at the end of every SV_Frame that ran the game
+=================
+*/
+void SV_ProfileEndFrame( void ) {
+	profilePhase_t	*phase;
+	int				i, slot, now;
+	unsigned int	usec;
+
+	if ( !sv_profile->integer ) {
+		for ( i = 0 ; i < PROF_NUM_PHASES ; i++ ) {
+			profilePhases[i].accum = 0;
+		}
+		return;
+	}
+
+	slot = profileFrames % PROFILE_WINDOW;
+	for ( i = 0, phase = profilePhases ; i < PROF_NUM_PHASES ; i++, phase++ ) {
+		usec = phase->accum;
+		phase->accum = 0;
+
+		if ( profileFrames >= PROFILE_WINDOW ) {
+			phase->buckets[ SV_ProfileBucket( phase->samples[slot] ) ]--;
+		}
+		phase->samples[slot] = usec;
+		phase->buckets[ SV_ProfileBucket( usec ) ]++;
+		if ( usec > phase->peak ) {
+			phase->peak = usec;
+		}
+	}
+
+	// keep the count from wrapping while staying a multiple of the window
+	profileFrames++;
+	if ( profileFrames == PROFILE_WINDOW * 2 ) {
+		profileFrames = PROFILE_WINDOW;
+	}
+
+	if ( sv_profileFile->string[0] ) {
+		now = Sys_Milliseconds();
+		if ( now - profileNextWrite >= 0 ) {
+			profileNextWrite = now + 1000 * ( sv_profileInterval->integer > 1 ? sv_profileInterval->integer : 1 );
+			SV_ProfileWriteStats();
+		}
+	}
+}
+
+/*
+=================
+SV_Profile_f
+
+svprofile [reset]
+=================
+*/
+void SV_Profile_f( void ) {
+	profilePhase_t	*phase;
+	int				i, count;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		SV_ProfileReset();
+		return;
+	}
+
+	if ( !sv_profile->integer ) {
+		Com_Printf( "sv_profile is off\n" );
+	}
+
+	count = profileFrames < PROFILE_WINDOW ? profileFrames : PROFILE_WINDOW;
+	Com_Printf( "last %i frames, times in usec\n", count );
+	Com_Printf( "phase                 p50      p99      max     peak\n" );
+	Com_Printf( "---------------- -------- -------- -------- --------\n" );
+	for ( i = 0, phase = profilePhases ; i < PROF_NUM_PHASES ; i++, phase++ ) {
+		Com_Printf( "%-16s %8u %8u %8u %8u\n", phase->name,
+			SV_ProfilePercentile( phase, count, 50 ), SV_ProfilePercentile( phase, count, 99 ),
+			SV_ProfileWindowMax( phase, count ), phase->peak );
+	}
+}
+
+/*
+=============================================================================
+
+Game module profiler
+
+While gameprofile runs, every system call the game makes is counted and
+timed, and a profile timer samples the program counter.  Samples that land
+in the compiled qvm are counted per instruction by VM_ProfileSample, the rest
+go to the system call being made, to the game frame if the vm is being
+interpreted, or to everything else the process does.  The times of a system
+call include any calls back into the vm it made.
+
+=============================================================================
+*/
+
+#define	GAME_PROFILE_SYSCALLS	1024		// above the last BOTLIB_ call
+#define	GAME_PROFILE_HZ			1000
+
+typedef struct {
+	unsigned int	calls;
+	double			usec;
+	unsigned int	peak;
+	volatile int	samples;
+} gameSyscallProfile_t;
+
+typedef struct {
+	int				callnum;
+	const char		*name;
+} gameSyscallName_t;
+
+static struct {
+	int				startTime;			// Sys_Milliseconds
+	int				stopTime;			// 0 while running
+	qboolean		sampling;			// the profile timer is running
+	qboolean		compiled;			// gvm samples are counted per instruction
+
+	int				frames;
+	double			frameUsec;
+	unsigned int	framePeak;
+
+	volatile int	syscall;			// being made, -1 for none
+	volatile int	inFrame;
+
+	volatile int	samples;
+	volatile int	vmSamples;
+	volatile int	frameSamples;		// in the game frame but not in compiled code or a call
+
+	gameSyscallProfile_t	syscalls[GAME_PROFILE_SYSCALLS];
+} gameProfile;
+
+qboolean	gameProfiling;
+
+static const gameSyscallName_t	gameSyscallNames[] = {
+	{ G_PRINT, "G_PRINT" },
+	{ G_ERROR, "G_ERROR" },
+	{ G_MILLISECONDS, "G_MILLISECONDS" },
+	{ G_CVAR_REGISTER, "G_CVAR_REGISTER" },
+	{ G_CVAR_UPDATE, "G_CVAR_UPDATE" },
+	{ G_CVAR_SET, "G_CVAR_SET" },
+	{ G_CVAR_VARIABLE_INTEGER_VALUE, "G_CVAR_VARIABLE_INTEGER_VALUE" },
+	{ G_CVAR_VARIABLE_STRING_BUFFER, "G_CVAR_VARIABLE_STRING_BUFFER" },
+	{ G_ARGC, "G_ARGC" },
+	{ G_ARGV, "G_ARGV" },
+	{ G_FS_FOPEN_FILE, "G_FS_FOPEN_FILE" },
+	{ G_FS_READ, "G_FS_READ" },
+	{ G_FS_WRITE, "G_FS_WRITE" },
+	{ G_FS_FCLOSE_FILE, "G_FS_FCLOSE_FILE" },
+	{ G_SEND_CONSOLE_COMMAND, "G_SEND_CONSOLE_COMMAND" },
+	{ G_LOCATE_GAME_DATA, "G_LOCATE_GAME_DATA" },
+	{ G_DROP_CLIENT, "G_DROP_CLIENT" },
+	{ G_SEND_SERVER_COMMAND, "G_SEND_SERVER_COMMAND" },
+	{ G_SET_CONFIGSTRING, "G_SET_CONFIGSTRING" },
+	{ G_GET_CONFIGSTRING, "G_GET_CONFIGSTRING" },
+	{ G_GET_USERINFO, "G_GET_USERINFO" },
+	{ G_SET_USERINFO, "G_SET_USERINFO" },
+	{ G_GET_SERVERINFO, "G_GET_SERVERINFO" },
+	{ G_SET_BRUSH_MODEL, "G_SET_BRUSH_MODEL" },
+	{ G_TRACE, "G_TRACE" },
+	{ G_POINT_CONTENTS, "G_POINT_CONTENTS" },
+	{ G_IN_PVS, "G_IN_PVS" },
+	{ G_IN_PVS_IGNORE_PORTALS, "G_IN_PVS_IGNORE_PORTALS" },
+	{ G_ADJUST_AREA_PORTAL_STATE, "G_ADJUST_AREA_PORTAL_STATE" },
+	{ G_AREAS_CONNECTED, "G_AREAS_CONNECTED" },
+	{ G_LINKENTITY, "G_LINKENTITY" },
+	{ G_UNLINKENTITY, "G_UNLINKENTITY" },
+	{ G_ENTITIES_IN_BOX, "G_ENTITIES_IN_BOX" },
+	{ G_ENTITY_CONTACT, "G_ENTITY_CONTACT" },
+	{ G_BOT_ALLOCATE_CLIENT, "G_BOT_ALLOCATE_CLIENT" },
+	{ G_BOT_FREE_CLIENT, "G_BOT_FREE_CLIENT" },
+	{ G_GET_USERCMD, "G_GET_USERCMD" },
+	{ G_GET_ENTITY_TOKEN, "G_GET_ENTITY_TOKEN" },
+	{ G_FS_GETFILELIST, "G_FS_GETFILELIST" },
+	{ G_DEBUG_POLYGON_CREATE, "G_DEBUG_POLYGON_CREATE" },
+	{ G_DEBUG_POLYGON_DELETE, "G_DEBUG_POLYGON_DELETE" },
+	{ G_REAL_TIME, "G_REAL_TIME" },
+	{ G_SNAPVECTOR, "G_SNAPVECTOR" },
+	{ G_TRACECAPSULE, "G_TRACECAPSULE" },
+	{ G_ENTITY_CONTACTCAPSULE, "G_ENTITY_CONTACTCAPSULE" },
+	{ G_FS_SEEK, "G_FS_SEEK" },
+	{ G_TRACEBATCH, "G_TRACEBATCH" },
+	{ TRAP_MEMSET, "TRAP_MEMSET" },
+	{ TRAP_MEMCPY, "TRAP_MEMCPY" },
+	{ TRAP_STRNCPY, "TRAP_STRNCPY" },
+	{ TRAP_SIN, "TRAP_SIN" },
+	{ TRAP_COS, "TRAP_COS" },
+	{ TRAP_ATAN2, "TRAP_ATAN2" },
+	{ TRAP_SQRT, "TRAP_SQRT" },
+	{ TRAP_MATRIXMULTIPLY, "TRAP_MATRIXMULTIPLY" },
+	{ TRAP_ANGLEVECTORS, "TRAP_ANGLEVECTORS" },
+	{ TRAP_PERPENDICULARVECTOR, "TRAP_PERPENDICULARVECTOR" },
+	{ TRAP_FLOOR, "TRAP_FLOOR" },
+	{ TRAP_CEIL, "TRAP_CEIL" },
+	{ BOTLIB_SETUP, "BOTLIB_SETUP" },
+	{ BOTLIB_SHUTDOWN, "BOTLIB_SHUTDOWN" },
+	{ BOTLIB_LIBVAR_SET, "BOTLIB_LIBVAR_SET" },
+	{ BOTLIB_LIBVAR_GET, "BOTLIB_LIBVAR_GET" },
+	{ BOTLIB_PC_ADD_GLOBAL_DEFINE, "BOTLIB_PC_ADD_GLOBAL_DEFINE" },
+	{ BOTLIB_START_FRAME, "BOTLIB_START_FRAME" },
+	{ BOTLIB_LOAD_MAP, "BOTLIB_LOAD_MAP" },
+	{ BOTLIB_UPDATENTITY, "BOTLIB_UPDATENTITY" },
+	{ BOTLIB_TEST, "BOTLIB_TEST" },
+	{ BOTLIB_GET_SNAPSHOT_ENTITY, "BOTLIB_GET_SNAPSHOT_ENTITY" },
+	{ BOTLIB_GET_CONSOLE_MESSAGE, "BOTLIB_GET_CONSOLE_MESSAGE" },
+	{ BOTLIB_USER_COMMAND, "BOTLIB_USER_COMMAND" },
+	{ BOTLIB_AAS_ENABLE_ROUTING_AREA, "BOTLIB_AAS_ENABLE_ROUTING_AREA" },
+	{ BOTLIB_AAS_BBOX_AREAS, "BOTLIB_AAS_BBOX_AREAS" },
+	{ BOTLIB_AAS_AREA_INFO, "BOTLIB_AAS_AREA_INFO" },
+	{ BOTLIB_AAS_ENTITY_INFO, "BOTLIB_AAS_ENTITY_INFO" },
+	{ BOTLIB_AAS_INITIALIZED, "BOTLIB_AAS_INITIALIZED" },
+	{ BOTLIB_AAS_PRESENCE_TYPE_BOUNDING_BOX, "BOTLIB_AAS_PRESENCE_TYPE_BOUNDING_BOX" },
+	{ BOTLIB_AAS_TIME, "BOTLIB_AAS_TIME" },
+	{ BOTLIB_AAS_POINT_AREA_NUM, "BOTLIB_AAS_POINT_AREA_NUM" },
+	{ BOTLIB_AAS_TRACE_AREAS, "BOTLIB_AAS_TRACE_AREAS" },
+	{ BOTLIB_AAS_POINT_CONTENTS, "BOTLIB_AAS_POINT_CONTENTS" },
+	{ BOTLIB_AAS_NEXT_BSP_ENTITY, "BOTLIB_AAS_NEXT_BSP_ENTITY" },
+	{ BOTLIB_AAS_VALUE_FOR_BSP_EPAIR_KEY, "BOTLIB_AAS_VALUE_FOR_BSP_EPAIR_KEY" },
+	{ BOTLIB_AAS_VECTOR_FOR_BSP_EPAIR_KEY, "BOTLIB_AAS_VECTOR_FOR_BSP_EPAIR_KEY" },
+	{ BOTLIB_AAS_FLOAT_FOR_BSP_EPAIR_KEY, "BOTLIB_AAS_FLOAT_FOR_BSP_EPAIR_KEY" },
+	{ BOTLIB_AAS_INT_FOR_BSP_EPAIR_KEY, "BOTLIB_AAS_INT_FOR_BSP_EPAIR_KEY" },
+	{ BOTLIB_AAS_AREA_REACHABILITY, "BOTLIB_AAS_AREA_REACHABILITY" },
+	{ BOTLIB_AAS_AREA_TRAVEL_TIME_TO_GOAL_AREA, "BOTLIB_AAS_AREA_TRAVEL_TIME_TO_GOAL_AREA" },
+	{ BOTLIB_AAS_SWIMMING, "BOTLIB_AAS_SWIMMING" },
+	{ BOTLIB_AAS_PREDICT_CLIENT_MOVEMENT, "BOTLIB_AAS_PREDICT_CLIENT_MOVEMENT" },
+	{ BOTLIB_EA_SAY, "BOTLIB_EA_SAY" },
+	{ BOTLIB_EA_SAY_TEAM, "BOTLIB_EA_SAY_TEAM" },
+	{ BOTLIB_EA_COMMAND, "BOTLIB_EA_COMMAND" },
+	{ BOTLIB_EA_ACTION, "BOTLIB_EA_ACTION" },
+	{ BOTLIB_EA_GESTURE, "BOTLIB_EA_GESTURE" },
+	{ BOTLIB_EA_TALK, "BOTLIB_EA_TALK" },
+	{ BOTLIB_EA_ATTACK, "BOTLIB_EA_ATTACK" },
+	{ BOTLIB_EA_USE, "BOTLIB_EA_USE" },
+	{ BOTLIB_EA_RESPAWN, "BOTLIB_EA_RESPAWN" },
+	{ BOTLIB_EA_CROUCH, "BOTLIB_EA_CROUCH" },
+	{ BOTLIB_EA_MOVE_UP, "BOTLIB_EA_MOVE_UP" },
+	{ BOTLIB_EA_MOVE_DOWN, "BOTLIB_EA_MOVE_DOWN" },
+	{ BOTLIB_EA_MOVE_FORWARD, "BOTLIB_EA_MOVE_FORWARD" },
+	{ BOTLIB_EA_MOVE_BACK, "BOTLIB_EA_MOVE_BACK" },
+	{ BOTLIB_EA_MOVE_LEFT, "BOTLIB_EA_MOVE_LEFT" },
+	{ BOTLIB_EA_MOVE_RIGHT, "BOTLIB_EA_MOVE_RIGHT" },
+	{ BOTLIB_EA_SELECT_WEAPON, "BOTLIB_EA_SELECT_WEAPON" },
+	{ BOTLIB_EA_JUMP, "BOTLIB_EA_JUMP" },
+	{ BOTLIB_EA_DELAYED_JUMP, "BOTLIB_EA_DELAYED_JUMP" },
+	{ BOTLIB_EA_MOVE, "BOTLIB_EA_MOVE" },
+	{ BOTLIB_EA_VIEW, "BOTLIB_EA_VIEW" },
+	{ BOTLIB_EA_END_REGULAR, "BOTLIB_EA_END_REGULAR" },
+	{ BOTLIB_EA_GET_INPUT, "BOTLIB_EA_GET_INPUT" },
+	{ BOTLIB_EA_RESET_INPUT, "BOTLIB_EA_RESET_INPUT" },
+	{ BOTLIB_AI_LOAD_CHARACTER, "BOTLIB_AI_LOAD_CHARACTER" },
+	{ BOTLIB_AI_FREE_CHARACTER, "BOTLIB_AI_FREE_CHARACTER" },
+	{ BOTLIB_AI_CHARACTERISTIC_FLOAT, "BOTLIB_AI_CHARACTERISTIC_FLOAT" },
+	{ BOTLIB_AI_CHARACTERISTIC_BFLOAT, "BOTLIB_AI_CHARACTERISTIC_BFLOAT" },
+	{ BOTLIB_AI_CHARACTERISTIC_INTEGER, "BOTLIB_AI_CHARACTERISTIC_INTEGER" },
+	{ BOTLIB_AI_CHARACTERISTIC_BINTEGER, "BOTLIB_AI_CHARACTERISTIC_BINTEGER" },
+	{ BOTLIB_AI_CHARACTERISTIC_STRING, "BOTLIB_AI_CHARACTERISTIC_STRING" },
+	{ BOTLIB_AI_ALLOC_CHAT_STATE, "BOTLIB_AI_ALLOC_CHAT_STATE" },
+	{ BOTLIB_AI_FREE_CHAT_STATE, "BOTLIB_AI_FREE_CHAT_STATE" },
+	{ BOTLIB_AI_QUEUE_CONSOLE_MESSAGE, "BOTLIB_AI_QUEUE_CONSOLE_MESSAGE" },
+	{ BOTLIB_AI_REMOVE_CONSOLE_MESSAGE, "BOTLIB_AI_REMOVE_CONSOLE_MESSAGE" },
+	{ BOTLIB_AI_NEXT_CONSOLE_MESSAGE, "BOTLIB_AI_NEXT_CONSOLE_MESSAGE" },
+	{ BOTLIB_AI_NUM_CONSOLE_MESSAGE, "BOTLIB_AI_NUM_CONSOLE_MESSAGE" },
+	{ BOTLIB_AI_INITIAL_CHAT, "BOTLIB_AI_INITIAL_CHAT" },
+	{ BOTLIB_AI_REPLY_CHAT, "BOTLIB_AI_REPLY_CHAT" },
+	{ BOTLIB_AI_CHAT_LENGTH, "BOTLIB_AI_CHAT_LENGTH" },
+	{ BOTLIB_AI_ENTER_CHAT, "BOTLIB_AI_ENTER_CHAT" },
+	{ BOTLIB_AI_STRING_CONTAINS, "BOTLIB_AI_STRING_CONTAINS" },
+	{ BOTLIB_AI_FIND_MATCH, "BOTLIB_AI_FIND_MATCH" },
+	{ BOTLIB_AI_MATCH_VARIABLE, "BOTLIB_AI_MATCH_VARIABLE" },
+	{ BOTLIB_AI_UNIFY_WHITE_SPACES, "BOTLIB_AI_UNIFY_WHITE_SPACES" },
+	{ BOTLIB_AI_REPLACE_SYNONYMS, "BOTLIB_AI_REPLACE_SYNONYMS" },
+	{ BOTLIB_AI_LOAD_CHAT_FILE, "BOTLIB_AI_LOAD_CHAT_FILE" },
+	{ BOTLIB_AI_SET_CHAT_GENDER, "BOTLIB_AI_SET_CHAT_GENDER" },
+	{ BOTLIB_AI_SET_CHAT_NAME, "BOTLIB_AI_SET_CHAT_NAME" },
+	{ BOTLIB_AI_RESET_GOAL_STATE, "BOTLIB_AI_RESET_GOAL_STATE" },
+	{ BOTLIB_AI_RESET_AVOID_GOALS, "BOTLIB_AI_RESET_AVOID_GOALS" },
+	{ BOTLIB_AI_PUSH_GOAL, "BOTLIB_AI_PUSH_GOAL" },
+	{ BOTLIB_AI_POP_GOAL, "BOTLIB_AI_POP_GOAL" },
+	{ BOTLIB_AI_EMPTY_GOAL_STACK, "BOTLIB_AI_EMPTY_GOAL_STACK" },
+	{ BOTLIB_AI_DUMP_AVOID_GOALS, "BOTLIB_AI_DUMP_AVOID_GOALS" },
+	{ BOTLIB_AI_DUMP_GOAL_STACK, "BOTLIB_AI_DUMP_GOAL_STACK" },
+	{ BOTLIB_AI_GOAL_NAME, "BOTLIB_AI_GOAL_NAME" },
+	{ BOTLIB_AI_GET_TOP_GOAL, "BOTLIB_AI_GET_TOP_GOAL" },
+	{ BOTLIB_AI_GET_SECOND_GOAL, "BOTLIB_AI_GET_SECOND_GOAL" },
+	{ BOTLIB_AI_CHOOSE_LTG_ITEM, "BOTLIB_AI_CHOOSE_LTG_ITEM" },
+	{ BOTLIB_AI_CHOOSE_NBG_ITEM, "BOTLIB_AI_CHOOSE_NBG_ITEM" },
+	{ BOTLIB_AI_TOUCHING_GOAL, "BOTLIB_AI_TOUCHING_GOAL" },
+	{ BOTLIB_AI_ITEM_GOAL_IN_VIS_BUT_NOT_VISIBLE, "BOTLIB_AI_ITEM_GOAL_IN_VIS_BUT_NOT_VISIBLE" },
+	{ BOTLIB_AI_GET_LEVEL_ITEM_GOAL, "BOTLIB_AI_GET_LEVEL_ITEM_GOAL" },
+	{ BOTLIB_AI_AVOID_GOAL_TIME, "BOTLIB_AI_AVOID_GOAL_TIME" },
+	{ BOTLIB_AI_INIT_LEVEL_ITEMS, "BOTLIB_AI_INIT_LEVEL_ITEMS" },
+	{ BOTLIB_AI_UPDATE_ENTITY_ITEMS, "BOTLIB_AI_UPDATE_ENTITY_ITEMS" },
+	{ BOTLIB_AI_LOAD_ITEM_WEIGHTS, "BOTLIB_AI_LOAD_ITEM_WEIGHTS" },
+	{ BOTLIB_AI_FREE_ITEM_WEIGHTS, "BOTLIB_AI_FREE_ITEM_WEIGHTS" },
+	{ BOTLIB_AI_SAVE_GOAL_FUZZY_LOGIC, "BOTLIB_AI_SAVE_GOAL_FUZZY_LOGIC" },
+	{ BOTLIB_AI_ALLOC_GOAL_STATE, "BOTLIB_AI_ALLOC_GOAL_STATE" },
+	{ BOTLIB_AI_FREE_GOAL_STATE, "BOTLIB_AI_FREE_GOAL_STATE" },
+	{ BOTLIB_AI_RESET_MOVE_STATE, "BOTLIB_AI_RESET_MOVE_STATE" },
+	{ BOTLIB_AI_MOVE_TO_GOAL, "BOTLIB_AI_MOVE_TO_GOAL" },
+	{ BOTLIB_AI_MOVE_IN_DIRECTION, "BOTLIB_AI_MOVE_IN_DIRECTION" },
+	{ BOTLIB_AI_RESET_AVOID_REACH, "BOTLIB_AI_RESET_AVOID_REACH" },
+	{ BOTLIB_AI_RESET_LAST_AVOID_REACH, "BOTLIB_AI_RESET_LAST_AVOID_REACH" },
+	{ BOTLIB_AI_REACHABILITY_AREA, "BOTLIB_AI_REACHABILITY_AREA" },
+	{ BOTLIB_AI_MOVEMENT_VIEW_TARGET, "BOTLIB_AI_MOVEMENT_VIEW_TARGET" },
+	{ BOTLIB_AI_ALLOC_MOVE_STATE, "BOTLIB_AI_ALLOC_MOVE_STATE" },
+	{ BOTLIB_AI_FREE_MOVE_STATE, "BOTLIB_AI_FREE_MOVE_STATE" },
+	{ BOTLIB_AI_INIT_MOVE_STATE, "BOTLIB_AI_INIT_MOVE_STATE" },
+	{ BOTLIB_AI_CHOOSE_BEST_FIGHT_WEAPON, "BOTLIB_AI_CHOOSE_BEST_FIGHT_WEAPON" },
+	{ BOTLIB_AI_GET_WEAPON_INFO, "BOTLIB_AI_GET_WEAPON_INFO" },
+	{ BOTLIB_AI_LOAD_WEAPON_WEIGHTS, "BOTLIB_AI_LOAD_WEAPON_WEIGHTS" },
+	{ BOTLIB_AI_ALLOC_WEAPON_STATE, "BOTLIB_AI_ALLOC_WEAPON_STATE" },
+	{ BOTLIB_AI_FREE_WEAPON_STATE, "BOTLIB_AI_FREE_WEAPON_STATE" },
+	{ BOTLIB_AI_RESET_WEAPON_STATE, "BOTLIB_AI_RESET_WEAPON_STATE" },
+	{ BOTLIB_AI_GENETIC_PARENTS_AND_CHILD_SELECTION, "BOTLIB_AI_GENETIC_PARENTS_AND_CHILD_SELECTION" },
+	{ BOTLIB_AI_INTERBREED_GOAL_FUZZY_LOGIC, "BOTLIB_AI_INTERBREED_GOAL_FUZZY_LOGIC" },
+	{ BOTLIB_AI_MUTATE_GOAL_FUZZY_LOGIC, "BOTLIB_AI_MUTATE_GOAL_FUZZY_LOGIC" },
+	{ BOTLIB_AI_GET_NEXT_CAMP_SPOT_GOAL, "BOTLIB_AI_GET_NEXT_CAMP_SPOT_GOAL" },
+	{ BOTLIB_AI_GET_MAP_LOCATION_GOAL, "BOTLIB_AI_GET_MAP_LOCATION_GOAL" },
+	{ BOTLIB_AI_NUM_INITIAL_CHATS, "BOTLIB_AI_NUM_INITIAL_CHATS" },
+	{ BOTLIB_AI_GET_CHAT_MESSAGE, "BOTLIB_AI_GET_CHAT_MESSAGE" },
+	{ BOTLIB_AI_REMOVE_FROM_AVOID_GOALS, "BOTLIB_AI_REMOVE_FROM_AVOID_GOALS" },
+	{ BOTLIB_AI_PREDICT_VISIBLE_POSITION, "BOTLIB_AI_PREDICT_VISIBLE_POSITION" },
+	{ BOTLIB_AI_SET_AVOID_GOAL_TIME, "BOTLIB_AI_SET_AVOID_GOAL_TIME" },
+	{ BOTLIB_AI_ADD_AVOID_SPOT, "BOTLIB_AI_ADD_AVOID_SPOT" },
+	{ BOTLIB_AAS_ALTERNATIVE_ROUTE_GOAL, "BOTLIB_AAS_ALTERNATIVE_ROUTE_GOAL" },
+	{ BOTLIB_AAS_PREDICT_ROUTE, "BOTLIB_AAS_PREDICT_ROUTE" },
+	{ BOTLIB_AAS_POINT_REACHABILITY_AREA_INDEX, "BOTLIB_AAS_POINT_REACHABILITY_AREA_INDEX" },
+	{ BOTLIB_PC_LOAD_SOURCE, "BOTLIB_PC_LOAD_SOURCE" },
+	{ BOTLIB_PC_FREE_SOURCE, "BOTLIB_PC_FREE_SOURCE" },
+	{ BOTLIB_PC_READ_TOKEN, "BOTLIB_PC_READ_TOKEN" },
+	{ BOTLIB_PC_SOURCE_FILE_AND_LINE, "BOTLIB_PC_SOURCE_FILE_AND_LINE" },
+};
+
+/*
+=================
+SV_GameSyscallName
+=================
+*/
+static const char *SV_GameSyscallName( int callnum ) {
+	static char	name[16];
+	int			i;
+
+	for ( i = 0 ; i < sizeof( gameSyscallNames ) / sizeof( gameSyscallNames[0] ) ; i++ ) {
+		if ( gameSyscallNames[i].callnum == callnum ) {
+			return gameSyscallNames[i].name;
+		}
+	}
+	Com_sprintf( name, sizeof( name ), "syscall %i", callnum );
+	return name;
+}
+
+/*
+=================
+SV_GameProfileSample
+
+Called by the profile timer, possibly from a signal handler
+=================
+*/
+static void SV_GameProfileSample( void *pc ) {
+	int		syscall;
+
+	gameProfile.samples++;
+
+	if ( gameProfile.compiled && VM_ProfileSample( gvm, pc ) ) {
+		gameProfile.vmSamples++;
+		return;
+	}
+
+	syscall = gameProfile.syscall;
+	if ( syscall >= 0 ) {
+		gameProfile.syscalls[syscall].samples++;
+	} else if ( gameProfile.inFrame ) {
+		gameProfile.frameSamples++;
+	}
+}
+
+/*
+=================
+SV_GameProfileSystemCall
+
+SV_GameSystemCalls while the profile runs
+=================
+*/
+intptr_t SV_GameProfileSystemCall( intptr_t *args ) {
+	gameSyscallProfile_t	*call;
+	unsigned int	start, usec;
+	intptr_t		ret;
+	int				outer;
+
+	if ( args[0] < 0 || args[0] >= GAME_PROFILE_SYSCALLS ) {
+		return SV_GameSystemCall( args );
+	}
+	call = &gameProfile.syscalls[ args[0] ];
+
+	outer = gameProfile.syscall;
+	gameProfile.syscall = args[0];
+	start = Sys_Microseconds();
+
+	ret = SV_GameSystemCall( args );
+
+	usec = Sys_Microseconds() - start;
+	gameProfile.syscall = outer;
+
+	call->calls++;
+	call->usec += usec;
+	if ( usec > call->peak ) {
+		call->peak = usec;
+	}
+	return ret;
+}
+
+/*
+=================
+SV_GameProfileFrameStart
+=================
+*/
+unsigned int SV_GameProfileFrameStart( void ) {
+	if ( !gameProfiling ) {
+		return 0;
+	}
+
+	// a com_error in the last frame could have left these set
+	gameProfile.syscall = -1;
+	gameProfile.inFrame = 1;
+	return Sys_Microseconds();
+}
+
+/*
+=================
+SV_GameProfileFrameEnd
+=================
+*/
+void SV_GameProfileFrameEnd( unsigned int start ) {
+	unsigned int	usec;
+
+	if ( !gameProfiling ) {
+		return;
+	}
+
+	usec = Sys_Microseconds() - start;
+	gameProfile.inFrame = 0;
+	gameProfile.frames++;
+	gameProfile.frameUsec += usec;
+	if ( usec > gameProfile.framePeak ) {
+		gameProfile.framePeak = usec;
+	}
+}
+
+/*
+=================
+SV_GameProfileReset
+=================
+*/
+static void SV_GameProfileReset( void ) {
+	int		i;
+
+	gameProfile.startTime = Sys_Milliseconds();
+	if ( gameProfile.stopTime ) {
+		gameProfile.stopTime = gameProfile.startTime;
+	}
+	gameProfile.frames = 0;
+	gameProfile.frameUsec = 0;
+	gameProfile.framePeak = 0;
+	gameProfile.samples = 0;
+	gameProfile.vmSamples = 0;
+	gameProfile.frameSamples = 0;
+	for ( i = 0 ; i < GAME_PROFILE_SYSCALLS ; i++ ) {
+		gameProfile.syscalls[i].calls = 0;
+		gameProfile.syscalls[i].usec = 0;
+		gameProfile.syscalls[i].peak = 0;
+		gameProfile.syscalls[i].samples = 0;
+	}
+	VM_ProfileReset( gvm );
+}
+
+/*
+=================
+SV_GameProfileStart
+=================
+*/
+static void SV_GameProfileStart( int hz ) {
+	if ( !gvm ) {
+		Com_Printf( "No game loaded.\n" );
+		return;
+	}
+	if ( gameProfiling ) {
+		Com_Printf( "gameprofile is already running\n" );
+		return;
+	}
+
+	gameProfile.stopTime = 0;
+	gameProfile.syscall = -1;
+	gameProfile.inFrame = 0;
+	gameProfile.compiled = VM_ProfileStart( gvm );
+	SV_GameProfileReset();
+
+	gameProfiling = qtrue;
+	gameProfile.sampling = Sys_StartProfileTimer( hz, SV_GameProfileSample );
+
+	if ( !gameProfile.sampling ) {
+		Com_Printf( "No profile timer on this system, only timing system calls\n" );
+	} else if ( !gameProfile.compiled ) {
+		Com_Printf( "The game isn't compiled, only timing system calls and sampling them\n" );
+	}
+}
+
+/*
+=================
+SV_GameProfileStop
+
+Also called before the game is freed, the results stay until the next start
+=================
+*/
+void SV_GameProfileStop( void ) {
+	if ( !gameProfiling ) {
+		return;
+	}
+
+	if ( gameProfile.sampling ) {
+		Sys_StopProfileTimer();
+		gameProfile.sampling = qfalse;
+	}
+	gameProfiling = qfalse;
+	gameProfile.compiled = qfalse;
+	gameProfile.inFrame = 0;
+	gameProfile.stopTime = Sys_Milliseconds();
+}
+
+static int QDECL SV_GameProfileSort( const void *a, const void *b ) {
+	double	ua, ub;
+
+	ua = gameProfile.syscalls[ *(const int *)a ].usec;
+	ub = gameProfile.syscalls[ *(const int *)b ].usec;
+	if ( ua < ub ) {
+		return 1;
+	}
+	if ( ua > ub ) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+=================
+SV_GameProfilePrint
+
+Flat profiles of the system calls by total time and of the vm functions by
+samples, lines long each, 0 for everything
+=================
+*/
+static void SV_GameProfilePrint( int lines ) {
+	gameSyscallProfile_t	*call;
+	int		sorted[GAME_PROFILE_SYSCALLS];
+	int		i, count, msec, frames;
+	int		syscallSamples;
+	double	syscallUsec;
+
+	if ( !gameProfile.startTime ) {
+		Com_Printf( "gameprofile hasn't been started\n" );
+		return;
+	}
+	msec = ( gameProfile.stopTime ? gameProfile.stopTime : Sys_Milliseconds() ) - gameProfile.startTime;
+	frames = gameProfile.frames ? gameProfile.frames : 1;
+
+	count = 0;
+	syscallUsec = 0;
+	syscallSamples = 0;
+	for ( i = 0 ; i < GAME_PROFILE_SYSCALLS ; i++ ) {
+		if ( gameProfile.syscalls[i].calls ) {
+			sorted[count++] = i;
+			syscallUsec += gameProfile.syscalls[i].usec;
+		}
+		syscallSamples += gameProfile.syscalls[i].samples;
+	}
+	qsort( sorted, count, sizeof( sorted[0] ), SV_GameProfileSort );
+
+	Com_Printf( "gameprofile %s, %i.%i seconds, %i game frames of %.1f usec average, %u peak\n",
+		gameProfiling ? "running" : "stopped", msec / 1000, msec % 1000 / 100,
+		gameProfile.frames, gameProfile.frameUsec / frames, gameProfile.framePeak );
+	if ( gameProfile.samples ) {
+		Com_Printf( "%i samples: %i in compiled qvm code, %i in system calls, %i in game frames outside both, %i elsewhere\n",
+			gameProfile.samples, gameProfile.vmSamples, syscallSamples, gameProfile.frameSamples,
+			gameProfile.samples - gameProfile.vmSamples - syscallSamples - gameProfile.frameSamples );
+	}
+
+	if ( count ) {
+		Com_Printf( "system calls, also the ones made outside game frames:\n" );
+		Com_Printf( "     %%  calls/frame usec/frame  usec/call     peak  samples name\n" );
+	}
+	for ( i = 0 ; i < count && ( lines <= 0 || i < lines ) ; i++ ) {
+		call = &gameProfile.syscalls[ sorted[i] ];
+		Com_Printf( "%6.2f %12.2f %10.1f %10.2f %8u %8i %s\n",
+			syscallUsec ? 100.0 * call->usec / syscallUsec : 0.0,
+			(double)call->calls / frames, call->usec / frames, call->usec / call->calls,
+			call->peak, call->samples, SV_GameSyscallName( sorted[i] ) );
+	}
+
+	if ( gvm && gameProfile.vmSamples ) {
+		VM_ProfilePrint( gvm, lines );
+	}
+}
+
+/*
+=================
+SV_GameProfile_f
+
+gameprofile [start [hz] | stop | reset | print [lines]]
+=================
+*/
+void SV_GameProfile_f( void ) {
+	char	*cmd;
+	int		hz;
+
+	cmd = Cmd_Argv( 1 );
+	if ( !Q_stricmp( cmd, "start" ) ) {
+		hz = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : GAME_PROFILE_HZ;
+		if ( hz <= 0 || hz > 10000 ) {
+			Com_Printf( "the sample rate has to be between 1 and 10000 hz\n" );
+			return;
+		}
+		SV_GameProfileStart( hz );
+	} else if ( !Q_stricmp( cmd, "stop" ) ) {
+		SV_GameProfileStop();
+	} else if ( !Q_stricmp( cmd, "reset" ) ) {
+		SV_GameProfileReset();
+	} else if ( !cmd[0] || !Q_stricmp( cmd, "print" ) ) {
+		SV_GameProfilePrint( Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 25 );
+	} else {
+		Com_Printf( "usage: gameprofile [start [hz] | stop | reset | print [lines]]\n" );
+	}
+}
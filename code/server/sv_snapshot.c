@@ -22,6 +22,10 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "server.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 
 /*
 =============================================================================
@@ -45,6 +49,135 @@ A normal server packet will look like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+Entity delta cache
+
+Clients that acked the same earlier snapshot need the same delta for an
+entity, so with sv_deltaCache the encoded bits are kept for the rest of
+SV_SendClientMessages and copied into the other clients' messages.  Entries
+are keyed by entity number and the stamp of the source snapshot, the target
+is always the entity's current state.
+
+=============================================================================
+*/
+
+#define	DELTA_CACHE_SIZE	4096		// entries, must be a power of two
+#define	DELTA_CACHE_BYTES	0x40000		// room for the encoded bits
+#define	DELTA_BASELINE		-1			// source stamp for deltas from the baseline
+
+typedef struct {
+	int		stamp;				// deltaCacheStamp the entry was made under
+	int		number;
+	int		fromStamp;
+	int		bit;				// into deltaCacheData
+	int		numBits;
+} deltaCacheEntry_t;
+
+static deltaCacheEntry_t	deltaCache[DELTA_CACHE_SIZE];
+static byte					deltaCacheData[DELTA_CACHE_BYTES];
+static msg_t				deltaCacheMsg;
+static int					deltaCacheStamp;
+static int					deltaCacheEntries;
+static qboolean				deltaCacheActive;
+
+static int					deltaCacheHits;
+static int					deltaCacheMisses;
+static int					deltaCacheFull;
+static unsigned int			deltaCacheBytesCopied;
+
+/*
+=============
+SV_ResetDeltaCache
+=============
+*/
+static void SV_ResetDeltaCache( void ) {
+	deltaCacheStamp++;
+	deltaCacheEntries = 0;
+	MSG_Init( &deltaCacheMsg, deltaCacheData, sizeof( deltaCacheData ) );
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity through the delta cache
+=============
+*/
+static void SV_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, 
+								 qboolean force, int fromStamp ) {
+	int					i, start;
+	unsigned int		hash;
+	deltaCacheEntry_t	*entry;
+
+	if ( !deltaCacheActive ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	hash = (unsigned int)fromStamp * 1031 + to->number;
+	entry = NULL;
+	for ( i = 0 ; i < DELTA_CACHE_SIZE ; i++ ) {
+		entry = &deltaCache[ ( hash + i ) & ( DELTA_CACHE_SIZE - 1 ) ];
+		if ( entry->stamp != deltaCacheStamp ) {
+			break;
+		}
+		if ( entry->number == to->number && entry->fromStamp == fromStamp ) {
+			deltaCacheHits++;
+			deltaCacheBytesCopied += entry->numBits >> 3;
+			MSG_WriteEncodedBits( msg, deltaCacheData, entry->bit, entry->numBits );
+			return;
+		}
+	}
+
+	deltaCacheMisses++;
+	start = msg->bit;
+	MSG_WriteDeltaEntity( msg, from, to, force );
+
+	// keep it for the other clients, the table is never filled
+	// beyond half so there is always a free entry
+	if ( msg->overflowed || deltaCacheEntries >= DELTA_CACHE_SIZE / 2 ) {
+		return;
+	}
+	if ( deltaCacheMsg.bit + ( msg->bit - start ) > ( DELTA_CACHE_BYTES - 8 ) * 8 ) {
+		deltaCacheFull++;
+		return;
+	}
+
+	entry->stamp = deltaCacheStamp;
+	entry->number = to->number;
+	entry->fromStamp = fromStamp;
+	entry->bit = deltaCacheMsg.bit;
+	entry->numBits = msg->bit - start;
+	MSG_WriteEncodedBits( &deltaCacheMsg, msg->data, start, entry->numBits );
+	deltaCacheEntries++;
+}
+
+/*
+=============
+SV_DeltaCache_f
+=============
+*/
+void SV_DeltaCache_f( void ) {
+	int		total;
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		deltaCacheHits = deltaCacheMisses = deltaCacheFull = 0;
+		deltaCacheBytesCopied = 0;
+		return;
+	}
+
+	total = deltaCacheHits + deltaCacheMisses;
+	Com_Printf( "delta cache %s\n", !sv_deltaCache->integer ? "off" : 
+		( sv_snapshotThreads->integer > 1 ? "off while snapshot threads run" : "on" ) );
+	Com_Printf( "%i hits, %i misses, %.1f%% hit rate\n", deltaCacheHits, deltaCacheMisses,
+		total ? 100.0f * deltaCacheHits / total : 0.0f );
+	Com_Printf( "%u KB copied from the cache, %i entries left out when full\n",
+		deltaCacheBytesCopied >> 10, deltaCacheFull );
+}
+
+
 /*
 =============
 SV_EmitPacketEntities
@@ -88,7 +221,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emited if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			SV_WriteDeltaEntity (msg, oldent, newent, qfalse, from->stamp );
 			oldindex++;
 			newindex++;
 			continue;
@@ -96,7 +229,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			SV_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue, DELTA_BASELINE );
 			newindex++;
 			continue;
 		}
@@ -116,33 +249,31 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_SnapshotDeltaFrame
+
+Picks the previous frame the new snapshot will be delta compressed
+against, or NULL for a full snapshot.  Must be called after the
+snapshot's entities have been stored.
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
-	int					lastframe;
-	int					i;
-	int					snapFlags;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+static clientSnapshot_t *SV_SnapshotDeltaFrame( client_t *client, int *lastframe ) {
+	clientSnapshot_t	*oldframe;
 
 	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
 		// client is asking for a retransmit
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else if ( client->netchan.outgoingSequence - client->deltaMessage 
 		>= (PACKET_BACKUP - 3) ) {
 		// client hasn't gotten a good message through in a long time
 		Com_DPrintf ("%s: Delta request from out of date packet.\n", client->name);
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else if (client->demo_recording && client->demo_deltas <= 0) {
 		// if we're recording this client, force full frames every now and then
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 		Com_DPrintf("Forced a full frame for %s\n", client->name);
 		// once we reach 1 full frame for every 1024 delta frames we stay there
 		// TODO: these numbers need to be tweaked properly, the current values
@@ -160,13 +291,13 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 		
 		// we have a valid snapshot to delta from
 		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+		*lastframe = client->netchan.outgoingSequence - client->deltaMessage;
 
 		// the snapshot's entities may still have rolled off the buffer, though
 		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
 			Com_DPrintf ("%s: Delta request from out of date entities.\n", client->name);
 			oldframe = NULL;
-			lastframe = 0;
+			*lastframe = 0;
 		}
 	}
 	// start recording only once there's a non-delta frame to start with
@@ -175,6 +306,25 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 		Com_DPrintf("Got non-delta frame, recording %s now\n", client->name);
 	}
 
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+
+Doesn't print or touch anything shared, so the snapshot threads can call it
+==================
+*/
+static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg, 
+									  clientSnapshot_t *oldframe, int lastframe ) {
+	clientSnapshot_t	*frame;
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -262,6 +412,8 @@ Build a client snapshot structure
 typedef struct {
 	int		numSnapshotEntities;
 	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];	
+	byte	added[MAX_GENTITIES/8];		// prevents double adding from portal views
+	char	*error;						// reported by SV_StoreClientSnapshot
 } snapshotEntityNumbers_t;
 
 /*
@@ -292,105 +444,184 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddEntToSnapshot( sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+	int		e;
+
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	e = gEnt->s.number;
+	if ( eNums->added[e >> 3] & (1 << (e & 7)) ) {
 		return;
 	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[e >> 3] |= 1 << (e & 7);
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
 		return;
 	}
 
-	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = gEnt->s.number;
+	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = e;
 	eNums->numSnapshotEntities++;
 }
 
+// linked SVF_BROADCAST entities, collected once per frame since the game
+// can change svFlags without relinking
+static int		snapshotBroadcast[MAX_GENTITIES];
+static int		numSnapshotBroadcast;
+
 /*
 ===============
-SV_AddEntitiesVisibleFromPoint
+SV_PrepareSnapshotEntities
+
+Per frame work shared by all the snapshots.  The builders rely on s.number
+matching the entity slot, but they may run on several threads, so it is
+checked here up front.
 ===============
 */
-static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame, 
-									snapshotEntityNumbers_t *eNums, qboolean portal ) {
-	int		e, i;
+static void SV_PrepareSnapshotEntities( void ) {
+	int		e;
 	sharedEntity_t *ent;
-	svEntity_t	*svEnt;
-	int		l;
-	int		clientarea, clientcluster;
-	int		leafnum;
-	int		c_fullsend;
-	byte	*clientpvs;
-	byte	*bitvector;
 
-	// during an error shutdown message we may need to transmit
-	// the shutdown message after the server has shutdown, so
-	// specfically check for it
+	numSnapshotBroadcast = 0;
+	svs.snapshotStamp++;
+
 	if ( !sv.state ) {
 		return;
 	}
 
-	leafnum = CM_PointLeafnum (origin);
-	clientarea = CM_LeafArea (leafnum);
-	clientcluster = CM_LeafCluster (leafnum);
-
-	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
-
-	clientpvs = CM_ClusterPVS (clientcluster);
-
-	c_fullsend = 0;
-
 	for ( e = 0 ; e < sv.num_entities ; e++ ) {
 		ent = SV_GentityNum(e);
 
-		// never send entities that aren't linked in
 		if ( !ent->r.linked ) {
 			continue;
 		}
 
-		if (ent->s.number != e) {
+		if ( ent->s.number != e ) {
 			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
 			ent->s.number = e;
 		}
 
-		// entities can be flagged to explicitly not be sent to the client
-		if ( ent->r.svFlags & SVF_NOCLIENT ) {
-			continue;
+		if ( ent->r.svFlags & SVF_BROADCAST ) {
+			snapshotBroadcast[numSnapshotBroadcast++] = e;
 		}
+	}
+}
 
-		// entities can be flagged to be sent to only one client
-		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
-			if ( ent->r.singleClient != frame->ps.clientNum ) {
-				continue;
-			}
+/*
+===============
+SV_EntityForClient
+
+Checks everything but visibility
+===============
+*/
+static qboolean SV_EntityForClient( sharedEntity_t *ent, clientSnapshot_t *frame, 
+									snapshotEntityNumbers_t *eNums ) {
+	int		e;
+
+	// never send entities that aren't linked in
+	if ( !ent->r.linked ) {
+		return qfalse;
+	}
+
+	// entities can be flagged to explicitly not be sent to the client
+	if ( ent->r.svFlags & SVF_NOCLIENT ) {
+		return qfalse;
+	}
+
+	// entities can be flagged to be sent to only one client
+	if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
+		if ( ent->r.singleClient != frame->ps.clientNum ) {
+			return qfalse;
 		}
-		// entities can be flagged to be sent to everyone but one client
-		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
-			if ( ent->r.singleClient == frame->ps.clientNum ) {
-				continue;
-			}
+	}
+	// entities can be flagged to be sent to everyone but one client
+	if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
+		if ( ent->r.singleClient == frame->ps.clientNum ) {
+			return qfalse;
 		}
-		// entities can be flagged to be sent to a given mask of clients
-		if ( ent->r.svFlags & SVF_CLIENTMASK ) {
-			if (frame->ps.clientNum >= 32)
-				Com_Error( ERR_DROP, "SVF_CLIENTMASK: cientNum > 32\n" );
-			if (~ent->r.singleClient & (1 << frame->ps.clientNum))
-				continue;
+	}
+	// entities can be flagged to be sent to a given mask of clients
+	if ( ent->r.svFlags & SVF_CLIENTMASK ) {
+		if (frame->ps.clientNum >= 32) {
+			eNums->error = "SVF_CLIENTMASK: cientNum > 32\n";
+			return qfalse;
 		}
+		if (~ent->r.singleClient & (1 << frame->ps.clientNum))
+			return qfalse;
+	}
 
-		svEnt = SV_SvEntityForGentity( ent );
+	// don't double add an entity through portals
+	e = ent->s.number;
+	if ( eNums->added[e >> 3] & (1 << (e & 7)) ) {
+		return qfalse;
+	}
 
-		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
-			continue;
+	return qtrue;
+}
+
+/*
+===============
+SV_EntityInPVS
+
+Only needed for entities touching more clusters than fit in clusternums,
+the others are found through their cluster lists
+===============
+*/
+static qboolean SV_EntityInPVS( svEntity_t *svEnt, byte *bitvector ) {
+	int		i, l;
+
+	// check individual leafs
+	if ( !svEnt->numClusters ) {
+		return qfalse;
+	}
+	l = 0;
+	for ( i=0 ; i < svEnt->numClusters ; i++ ) {
+		l = svEnt->clusternums[i];
+		if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+			return qtrue;
 		}
+	}
 
-		// broadcast entities are always sent
-		if ( ent->r.svFlags & SVF_BROADCAST ) {
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
+	// if we haven't found it to be visible,
+	// check overflow clusters that coudln't be stored
+	if ( svEnt->lastCluster ) {
+		for ( ; l <= svEnt->lastCluster ; l++ ) {
+			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+				break;
+			}
+		}
+		if ( l != svEnt->lastCluster ) {
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
+static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame, 
+									snapshotEntityNumbers_t *eNums, qboolean portal );
+
+/*
+===============
+SV_AddClusterEntities
+
+Adds the entities of one cluster list that pass the area checks, the
+PVS still has to be checked for the overflow list
+===============
+*/
+static void SV_AddClusterEntities( clusterLink_t *head, vec3_t origin, clientSnapshot_t *frame, 
+									snapshotEntityNumbers_t *eNums, int clientarea, byte *clientpvs ) {
+	sharedEntity_t *ent;
+	svEntity_t	*svEnt;
+	clusterLink_t	*link;
+	qboolean	checkPVS;
+
+	checkPVS = ( head == &sv.clusterEntities[sv.numClusters] );
+
+	for ( link = head->next ; link != head ; link = link->next ) {
+		svEnt = link->ent;
+		ent = SV_GentityNum( svEnt - sv.svEntities );
+
+		if ( !SV_EntityForClient( ent, frame, eNums ) ) {
 			continue;
 		}
 
@@ -404,39 +635,12 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			}
 		}
 
-		bitvector = clientpvs;
-
-		// check individual leafs
-		if ( !svEnt->numClusters ) {
-			continue;
-		}
-		l = 0;
-		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
-			l = svEnt->clusternums[i];
-			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-				break;
-			}
-		}
-
-		// if we haven't found it to be visible,
-		// check overflow clusters that coudln't be stored
-		if ( i == svEnt->numClusters ) {
-			if ( svEnt->lastCluster ) {
-				for ( ; l <= svEnt->lastCluster ; l++ ) {
-					if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-						break;
-					}
-				}
-				if ( l == svEnt->lastCluster ) {
-					continue;	// not visible
-				}
-			} else {
-				continue;
-			}
+		if ( checkPVS && !SV_EntityInPVS( svEnt, clientpvs ) ) {
+			continue;	// not visible
 		}
 
 		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+		SV_AddEntToSnapshot( ent, eNums );
 
 		// if its a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL ) {
@@ -449,8 +653,58 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			}
 			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, qtrue );
 		}
+	}
+}
+
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
+*/
+static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame, 
+									snapshotEntityNumbers_t *eNums, qboolean portal ) {
+	int		i, c;
+	sharedEntity_t *ent;
+	int		clientarea, clientcluster;
+	int		leafnum;
+	byte	*clientpvs;
+
+	// during an error shutdown message we may need to transmit
+	// the shutdown message after the server has shutdown, so
+	// specfically check for it
+	if ( !sv.state ) {
+		return;
+	}
+
+	leafnum = CM_PointLeafnum (origin);
+	clientarea = CM_LeafArea (leafnum);
+	clientcluster = CM_LeafCluster (leafnum);
+
+	// calculate the visible areas
+	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+
+	clientpvs = CM_ClusterPVS (clientcluster);
+
+	// broadcast entities are always sent
+	for ( i = 0 ; i < numSnapshotBroadcast ; i++ ) {
+		ent = SV_GentityNum( snapshotBroadcast[i] );
+		if ( SV_EntityForClient( ent, frame, eNums ) ) {
+			SV_AddEntToSnapshot( ent, eNums );
+		}
+	}
 
+	// only the entities of the clusters in the PVS can be visible
+	for ( c = 0 ; c < sv.numClusters ; c++ ) {
+		if ( !clientpvs[c >> 3] ) {
+			c |= 7;		// skip the whole byte
+			continue;
+		}
+		if ( clientpvs[c >> 3] & (1 << (c&7)) ) {
+			SV_AddClusterEntities( &sv.clusterEntities[c], origin, frame, eNums, clientarea, clientpvs );
+		}
 	}
+
+	SV_AddClusterEntities( &sv.clusterEntities[sv.numClusters], origin, frame, eNums, clientarea, clientpvs );
 }
 
 /*
@@ -458,7 +712,8 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 SV_BuildClientSnapshot
 
 Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
+copies off the playerstate and areabits.  Only the client's own frame
+is written, so this can run for several clients at once.
 
 This properly handles multiple recursive portals, but the render
 currently doesn't.
@@ -466,26 +721,21 @@ currently doesn't.
 For viewing through other player's eyes, clent can be something other than client->gentity
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static void SV_BuildClientSnapshot( client_t *client, snapshotEntityNumbers_t *eNums ) {
 	vec3_t						org;
 	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
 	int							i;
-	sharedEntity_t				*ent;
-	entityState_t				*state;
-	svEntity_t					*svEnt;
 	sharedEntity_t				*clent;
 	int							clientNum;
 	playerState_t				*ps;
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
-
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
+	eNums->numSnapshotEntities = 0;
+	eNums->error = NULL;
+	Com_Memset( eNums->added, 0, sizeof( eNums->added ) );
 	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
 
   // https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=62
@@ -504,11 +754,10 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// be regenerated from the playerstate
 	clientNum = frame->ps.clientNum;
 	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
-		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
+		eNums->error = "SV_SvEntityForGentity: bad gEnt";
+		return;
 	}
-	svEnt = &sv.svEntities[ clientNum ];
-
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[clientNum >> 3] |= 1 << (clientNum & 7);
 
 	// find the client's viewpoint
 	VectorCopy( ps->origin, org );
@@ -516,26 +765,48 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
+	SV_AddEntitiesVisibleFromPoint( org, frame, eNums, qfalse );
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities, 
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
+	qsort( eNums->snapshotEntities, eNums->numSnapshotEntities, 
+		sizeof( eNums->snapshotEntities[0] ), SV_QsortEntityNumbers );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
 	for ( i = 0 ; i < MAX_MAP_AREA_BYTES/4 ; i++ ) {
 		((int *)frame->areabits)[i] = ((int *)frame->areabits)[i] ^ -1;
 	}
+}
+
+/*
+=============
+SV_StoreClientSnapshot
+
+Copies the entity states picked by SV_BuildClientSnapshot into the
+shared snapshot entity buffer
+=============
+*/
+static void SV_StoreClientSnapshot( client_t *client, snapshotEntityNumbers_t *eNums ) {
+	clientSnapshot_t			*frame;
+	int							i;
+	sharedEntity_t				*ent;
+	entityState_t				*state;
+
+	if ( eNums->error ) {
+		Com_Error( ERR_DROP, "%s", eNums->error );
+	}
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// copy the entity states out
+	frame->stamp = svs.snapshotStamp;
 	frame->num_entities = 0;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
+	for ( i = 0 ; i < eNums->numSnapshotEntities ; i++ ) {
+		ent = SV_GentityNum(eNums->snapshotEntities[i]);
 		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
 		*state = ent->s;
 		svs.nextSnapshotEntities++;
@@ -645,18 +916,64 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 /*
 =======================
-SV_SendClientSnapshot
+SV_WriteClientSnapshot
 
-Also called by SV_FinalMessage
+Everything in a snapshot message except download data, which is read from
+disk and gets added on the main thread
+=======================
+*/
+static void SV_WriteClientSnapshot( client_t *client, msg_t *msg, 
+									clientSnapshot_t *oldframe, int lastframe ) {
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
+
+	// send over all the relevant entityState_t
+	// and the playerState_t
+	SV_WriteSnapshotToClient( client, msg, oldframe, lastframe );
+}
 
+/*
+=======================
+SV_FinishClientSnapshot
 =======================
 */
-void SV_SendClientSnapshot( client_t *client ) {
+static void SV_FinishClientSnapshot( client_t *client, msg_t *msg ) {
+	// Add any download data if the client is downloading
+	SV_WriteDownloadToClient( client, msg );
+
+	// check for overflow
+	if ( msg->overflowed ) {
+		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
+		MSG_Clear (msg);
+	}
+
+	SV_SendMessageToClient( msg, client );
+}
+
+/*
+=======================
+SV_SendPreparedSnapshot
+
+SV_PrepareSnapshotEntities must have been run this frame
+=======================
+*/
+static void SV_SendPreparedSnapshot( client_t *client ) {
 	byte		msg_buf[MAX_MSGLEN];
 	msg_t		msg;
+	snapshotEntityNumbers_t	entityNumbers;
+	clientSnapshot_t	*oldframe;
+	int			lastframe;
+	unsigned int	start;
 
 	// build the snapshot
-	SV_BuildClientSnapshot( client );
+	start = SV_ProfileStart();
+	SV_BuildClientSnapshot( client, &entityNumbers );
+	SV_StoreClientSnapshot( client, &entityNumbers );
+	SV_ProfileAdd( PROF_SNAPSHOTBUILD, start );
 
 	// bots need to have their snapshots build, but
 	// the query them directly without needing to be sent
@@ -667,29 +984,309 @@ void SV_SendClientSnapshot( client_t *client ) {
 	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
 	msg.allowoverflow = qtrue;
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	start = SV_ProfileStart();
+	oldframe = SV_SnapshotDeltaFrame( client, &lastframe );
+	SV_WriteClientSnapshot( client, &msg, oldframe, lastframe );
+	SV_ProfileAdd( PROF_SNAPSHOTENCODE, start );
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	start = SV_ProfileStart();
+	SV_FinishClientSnapshot( client, &msg );
+	SV_ProfileAdd( PROF_SNAPSHOTTRANSMIT, start );
+}
 
-	// send over all the relevant entityState_t
-	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+/*
+=======================
+SV_SendClientSnapshot
 
-	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+Also called by SV_FinalMessage
 
-	// check for overflow
-	if ( msg.overflowed ) {
-		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		MSG_Clear (&msg);
+=======================
+*/
+void SV_SendClientSnapshot( client_t *client ) {
+	deltaCacheActive = qfalse;
+	SV_PrepareSnapshotEntities();
+	SV_SendPreparedSnapshot( client );
+}
+
+
+/*
+=============================================================================
+
+Parallel snapshot building
+
+With sv_snapshotThreads above 1, the entity culling and delta encoding for
+all the clients due a snapshot in a frame are spread over a pool of worker
+threads, with the main thread taking jobs too.  The main thread keeps the
+parts that touch the shared snapshot entity buffer, the demo files, the
+console and the network.
+
+=============================================================================
+*/
+
+#ifndef _WIN32
+
+#define	MAX_SNAPSHOT_THREADS	16
+
+typedef struct {
+	client_t				*client;
+	qboolean				bot;
+	snapshotEntityNumbers_t	entityNumbers;
+	clientSnapshot_t		*oldframe;
+	int						lastframe;
+	msg_t					msg;
+	byte					msgBuf[MAX_MSGLEN];
+} snapshotJob_t;
+
+static snapshotJob_t	snapshotJobs[MAX_CLIENTS];
+static int				numSnapshotJobs;
+
+static pthread_t		snapshotThreads[MAX_SNAPSHOT_THREADS];
+static int				numSnapshotThreads;		// workers, the main thread not included
+static int				snapshotThreadsWanted;	// sv_snapshotThreads the pool was started for
+static pthread_mutex_t	snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	snapshotWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	snapshotDone = PTHREAD_COND_INITIALIZER;
+static int				snapshotGeneration;		// bumped for every phase handed out
+static int				snapshotBusy;			// workers still in the current phase
+static qboolean			snapshotQuit;
+static void				(*snapshotPhase)( snapshotJob_t *job );
+static int				snapshotNextJob;
+
+/*
+=======================
+SV_DoSnapshotJobs
+=======================
+*/
+static void SV_DoSnapshotJobs( void ) {
+	int		i;
+
+	while ( ( i = __sync_fetch_and_add( &snapshotNextJob, 1 ) ) < numSnapshotJobs ) {
+		snapshotPhase( &snapshotJobs[i] );
 	}
+}
+
+/*
+=======================
+SV_SnapshotThread
+=======================
+*/
+static void *SV_SnapshotThread( void *arg ) {
+	int		generation;
+
+	pthread_mutex_lock( &snapshotLock );
+	generation = snapshotGeneration;
+	for ( ;; ) {
+		while ( !snapshotQuit && generation == snapshotGeneration ) {
+			pthread_cond_wait( &snapshotWake, &snapshotLock );
+		}
+		if ( snapshotQuit ) {
+			break;
+		}
+		generation = snapshotGeneration;
+		pthread_mutex_unlock( &snapshotLock );
+
+		SV_DoSnapshotJobs();
 
-	SV_SendMessageToClient( &msg, client );
+		pthread_mutex_lock( &snapshotLock );
+		if ( --snapshotBusy == 0 ) {
+			pthread_cond_signal( &snapshotDone );
+		}
+	}
+	pthread_mutex_unlock( &snapshotLock );
+
+	return NULL;
+}
+
+/*
+=======================
+SV_RunSnapshotPhase
+
+Runs phase on every queued job and returns once all of them are done
+=======================
+*/
+static void SV_RunSnapshotPhase( void (*phase)( snapshotJob_t *job ) ) {
+	pthread_mutex_lock( &snapshotLock );
+	snapshotPhase = phase;
+	snapshotNextJob = 0;
+	snapshotBusy = numSnapshotThreads;
+	snapshotGeneration++;
+	pthread_cond_broadcast( &snapshotWake );
+	pthread_mutex_unlock( &snapshotLock );
+
+	SV_DoSnapshotJobs();
+
+	pthread_mutex_lock( &snapshotLock );
+	while ( snapshotBusy > 0 ) {
+		pthread_cond_wait( &snapshotDone, &snapshotLock );
+	}
+	pthread_mutex_unlock( &snapshotLock );
+}
+
+/*
+=======================
+SV_ShutdownSnapshotThreads
+=======================
+*/
+void SV_ShutdownSnapshotThreads( void ) {
+	int		i;
+
+	snapshotThreadsWanted = 0;
+	if ( !numSnapshotThreads ) {
+		return;
+	}
+
+	pthread_mutex_lock( &snapshotLock );
+	snapshotQuit = qtrue;
+	pthread_cond_broadcast( &snapshotWake );
+	pthread_mutex_unlock( &snapshotLock );
+
+	for ( i = 0 ; i < numSnapshotThreads ; i++ ) {
+		pthread_join( snapshotThreads[i], NULL );
+	}
+	numSnapshotThreads = 0;
+	snapshotQuit = qfalse;
+}
+
+/*
+=======================
+SV_SnapshotThreadsActive
+
+(Re)starts the pool when sv_snapshotThreads has changed
+=======================
+*/
+static qboolean SV_SnapshotThreadsActive( void ) {
+	int		wanted;
+
+	// an error drop in the middle of a frame may have left jobs behind
+	numSnapshotJobs = 0;
+
+	wanted = sv_snapshotThreads->integer;
+	if ( wanted > MAX_SNAPSHOT_THREADS ) {
+		wanted = MAX_SNAPSHOT_THREADS;
+	}
+	if ( wanted < 2 ) {
+		wanted = 0;
+	}
+
+	if ( wanted != snapshotThreadsWanted ) {
+		SV_ShutdownSnapshotThreads();
+		snapshotThreadsWanted = wanted;
+
+		// the main thread makes up the last one
+		while ( numSnapshotThreads < wanted - 1 ) {
+			if ( pthread_create( &snapshotThreads[numSnapshotThreads], NULL, 
+				SV_SnapshotThread, NULL ) ) {
+				Com_Printf( "WARNING: couldn't start snapshot thread %i\n", numSnapshotThreads );
+				break;
+			}
+			numSnapshotThreads++;
+		}
+	}
+
+	return numSnapshotThreads > 0;
+}
+
+/*
+=======================
+SV_QueueClientSnapshot
+=======================
+*/
+static void SV_QueueClientSnapshot( client_t *client ) {
+	snapshotJob_t	*job;
+
+	job = &snapshotJobs[numSnapshotJobs++];
+	job->client = client;
+	job->bot = ( client->gentity && client->gentity->r.svFlags & SVF_BOT );
 }
 
+static void SV_BuildSnapshotJob( snapshotJob_t *job ) {
+	SV_BuildClientSnapshot( job->client, &job->entityNumbers );
+}
+
+static void SV_WriteSnapshotJob( snapshotJob_t *job ) {
+	if ( !job->bot ) {
+		SV_WriteClientSnapshot( job->client, &job->msg, job->oldframe, job->lastframe );
+	}
+}
+
+/*
+=======================
+SV_SendQueuedSnapshots
+
+Same as SV_SendClientSnapshot for every queued client.  All the entity
+states are stored before any delta frame is picked, so no delta is made
+from entities the other clients' states have just overwritten.
+=======================
+*/
+static void SV_SendQueuedSnapshots( void ) {
+	int				i;
+	snapshotJob_t	*job;
+	unsigned int	start;
+
+	if ( !numSnapshotJobs ) {
+		return;
+	}
+
+	start = SV_ProfileStart();
+	SV_RunSnapshotPhase( SV_BuildSnapshotJob );
+
+	for ( i = 0, job = snapshotJobs ; i < numSnapshotJobs ; i++, job++ ) {
+		SV_StoreClientSnapshot( job->client, &job->entityNumbers );
+	}
+	SV_ProfileAdd( PROF_SNAPSHOTBUILD, start );
+
+	start = SV_ProfileStart();
+
+	for ( i = 0, job = snapshotJobs ; i < numSnapshotJobs ; i++, job++ ) {
+		if ( job->bot ) {
+			continue;
+		}
+		// initializes the message huffman tree before any worker needs it
+		MSG_Init( &job->msg, job->msgBuf, sizeof( job->msgBuf ) );
+		job->msg.allowoverflow = qtrue;
+		job->msg.deferErrors = qtrue;
+		job->oldframe = SV_SnapshotDeltaFrame( job->client, &job->lastframe );
+	}
+
+	SV_RunSnapshotPhase( SV_WriteSnapshotJob );
+	SV_ProfileAdd( PROF_SNAPSHOTENCODE, start );
+
+	// the workers left any write errors in the messages
+	for ( i = 0, job = snapshotJobs ; i < numSnapshotJobs ; i++, job++ ) {
+		if ( !job->bot && job->msg.error ) {
+			numSnapshotJobs = 0;
+			Com_Error( job->msg.errorCode, job->msg.error, job->msg.errorValue );
+		}
+	}
+
+	start = SV_ProfileStart();
+	for ( i = 0, job = snapshotJobs ; i < numSnapshotJobs ; i++, job++ ) {
+		if ( !job->bot ) {
+			SV_FinishClientSnapshot( job->client, &job->msg );
+		}
+	}
+	SV_ProfileAdd( PROF_SNAPSHOTTRANSMIT, start );
+
+	numSnapshotJobs = 0;
+}
+
+#else
+
+void SV_ShutdownSnapshotThreads( void ) {
+}
+
+static qboolean SV_SnapshotThreadsActive( void ) {
+	return qfalse;
+}
+
+static void SV_QueueClientSnapshot( client_t *client ) {
+}
+
+static void SV_SendQueuedSnapshots( void ) {
+}
+
+#endif
+
 
 /*
 =======================
@@ -699,6 +1296,16 @@ SV_SendClientMessages
 void SV_SendClientMessages( void ) {
 	int			i;
 	client_t	*c;
+	qboolean	threaded;
+
+	threaded = SV_SnapshotThreadsActive();
+	SV_PrepareSnapshotEntities();
+
+	// the cache isn't shared between threads
+	deltaCacheActive = sv_deltaCache->integer && !threaded;
+	if ( deltaCacheActive ) {
+		SV_ResetDeltaCache();
+	}
 
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++) {
@@ -720,8 +1327,16 @@ void SV_SendClientMessages( void ) {
 		}
 
 		// generate and send a new message
-		SV_SendClientSnapshot( c );
+		if ( threaded ) {
+			SV_QueueClientSnapshot( c );
+		} else {
+			SV_SendPreparedSnapshot( c );
+		}
 	}
+
+	SV_SendQueuedSnapshots();
+
+	deltaCacheActive = qfalse;
 }
 
 
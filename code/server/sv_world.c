@@ -147,24 +147,110 @@ SV_ClearWorld
 void SV_ClearWorld( void ) {
 	clipHandle_t	h;
 	vec3_t			mins, maxs;
+	int				i;
 
 	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
 	sv_numworldSectors = 0;
+	SV_BroadphaseClear();
+	SV_TraceCacheInvalidate();
 
 	// get world map bounds
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
 	SV_CreateworldSector( 0, mins, maxs );
+
+	// empty cluster lists for the snapshot visibility checks
+	sv.numClusters = CM_NumClusters();
+	sv.clusterEntities = Hunk_Alloc( ( sv.numClusters + 1 ) * sizeof( clusterLink_t ), h_high );
+	for ( i = 0 ; i <= sv.numClusters ; i++ ) {
+		sv.clusterEntities[i].prev = sv.clusterEntities[i].next = &sv.clusterEntities[i];
+	}
 }
 
 
 /*
 ===============
-SV_UnlinkEntity
+SV_LinkEntityToClusters
 
+Adds the entity to the list of every cluster it touches so snapshots only
+need to look at the entities in the viewer's PVS.  Entities touching more
+clusters than fit in clusternums go in the last list, which is checked
+for every viewer.
 ===============
 */
-void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
+static void SV_LinkEntityToClusters( svEntity_t *ent ) {
+	int				i, j;
+	int				cluster;
+	clusterLink_t	*link, *head;
+
+	ent->numClusterLinks = 0;
+
+	if ( !sv.clusterEntities ) {
+		return;
+	}
+
+	for ( i = 0 ; i < ent->numClusters ; i++ ) {
+		if ( ent->lastCluster ) {
+			// the overflow clusters are only known as a range, so the
+			// whole check is done by the snapshot code
+			cluster = sv.numClusters;
+		} else {
+			cluster = ent->clusternums[i];
+			if ( cluster < 0 || cluster >= sv.numClusters ) {
+				continue;
+			}
+			// several leafs can be in the same cluster
+			for ( j = 0 ; j < i ; j++ ) {
+				if ( ent->clusternums[j] == cluster ) {
+					break;
+				}
+			}
+			if ( j != i ) {
+				continue;
+			}
+		}
+
+		head = &sv.clusterEntities[cluster];
+		link = &ent->clusterLinks[ent->numClusterLinks++];
+		link->ent = ent;
+		link->prev = head;
+		link->next = head->next;
+		head->next->prev = link;
+		head->next = link;
+
+		if ( cluster == sv.numClusters ) {
+			break;
+		}
+	}
+}
+
+
+/*
+===============
+SV_UnlinkEntityFromClusters
+===============
+*/
+static void SV_UnlinkEntityFromClusters( svEntity_t *ent ) {
+	int				i;
+	clusterLink_t	*link;
+
+	for ( i = 0 ; i < ent->numClusterLinks ; i++ ) {
+		link = &ent->clusterLinks[i];
+		link->prev->next = link->next;
+		link->next->prev = link->prev;
+	}
+	ent->numClusterLinks = 0;
+}
+
+
+/*
+===============
+SV_UnlinkEntityFromSector
+
+Leaves the entity in the AABB tree, SV_LinkEntity updates it there
+===============
+*/
+static void SV_UnlinkEntityFromSector( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
 	svEntity_t		*scan;
 	worldSector_t	*ws;
@@ -179,6 +265,8 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	}
 	ent->worldSector = NULL;
 
+	SV_UnlinkEntityFromClusters( ent );
+
 	if ( ws->entities == ent ) {
 		ws->entities = ent->nextEntityInWorldSector;
 		return;
@@ -195,6 +283,18 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 }
 
 
+/*
+===============
+SV_UnlinkEntity
+
+===============
+*/
+void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
+	SV_BroadphaseUnlink( SV_SvEntityForGentity( gEnt ) - sv.svEntities );
+	SV_UnlinkEntityFromSector( gEnt );
+}
+
+
 /*
 ===============
 SV_LinkEntity
@@ -216,7 +316,7 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	ent = SV_SvEntityForGentity( gEnt );
 
 	if ( ent->worldSector ) {
-		SV_UnlinkEntity( gEnt );	// unlink from old position
+		SV_UnlinkEntityFromSector( gEnt );	// unlink from old position
 	}
 
 	// encode the size into the entityState_t for client prediction
@@ -292,6 +392,7 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	// if none of the leafs were inside the map, the
 	// entity is outside the world and can be considered unlinked
 	if ( !num_leafs ) {
+		SV_BroadphaseUnlink( ent - sv.svEntities );
 		return;
 	}
 
@@ -352,6 +453,10 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	ent->nextEntityInWorldSector = node->entities;
 	node->entities = ent;
 
+	SV_BroadphaseLink( ent - sv.svEntities, gEnt->r.absmin, gEnt->r.absmax );
+
+	SV_LinkEntityToClusters( ent );
+
 	gEnt->r.linked = qtrue;
 }
 
@@ -372,6 +477,26 @@ typedef struct {
 	int			count, maxcount;
 } areaParms_t;
 
+static int		sv_forcedBroadphase = -1;	// tracebench replays with both
+static qboolean	sv_traceRecording;
+
+static void SV_RecordTrace( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end,
+						   int passEntityNum, int contentmask, int capsule );
+
+/*
+====================
+SV_UseBroadphase
+
+True to query the AABB tree instead of the sector tree
+====================
+*/
+static qboolean SV_UseBroadphase( void ) {
+	if ( sv_forcedBroadphase != -1 ) {
+		return sv_forcedBroadphase;
+	}
+	return sv_broadphase->integer;
+}
+
 
 /*
 ====================
@@ -422,6 +547,27 @@ void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
 	}
 }
 
+/*
+================
+SV_AreaEntitiesTouch
+
+Adds an entity found in the AABB tree
+================
+*/
+static qboolean SV_AreaEntitiesTouch( int entityNum, void *data ) {
+	areaParms_t	*ap;
+
+	ap = data;
+	if ( ap->count == ap->maxcount ) {
+		Com_Printf ("SV_AreaEntities: MAXCOUNT\n");
+		return qfalse;
+	}
+
+	ap->list[ap->count] = entityNum;
+	ap->count++;
+	return qtrue;
+}
+
 /*
 ================
 SV_AreaEntities
@@ -436,7 +582,11 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.count = 0;
 	ap.maxcount = maxcount;
 
-	SV_AreaEntities_r( sv_worldSectors, &ap );
+	if ( SV_UseBroadphase() ) {
+		SV_BroadphaseQuery( mins, maxs, SV_AreaEntitiesTouch, &ap );
+	} else {
+		SV_AreaEntities_r( sv_worldSectors, &ap );
+	}
 
 	return ap.count;
 }
@@ -454,6 +604,7 @@ typedef struct {
 	vec3_t		end;
 	trace_t		trace;
 	int			passEntityNum;
+	int			passOwnerNum;
 	int			contentmask;
 	int			capsule;
 } moveclip_t;
@@ -503,89 +654,353 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 
 /*
 ====================
-SV_ClipMoveToEntities
+SV_ClipMoveToEntity
 
+Returns qfalse once the move is all in solid
 ====================
 */
-void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	int			i, num;
-	int			touchlist[MAX_GENTITIES];
+static qboolean SV_ClipMoveToEntity( int entityNum, void *data ) {
+	moveclip_t	*clip;
 	sharedEntity_t *touch;
-	int			passOwnerNum;
 	trace_t		trace;
 	clipHandle_t	clipHandle;
 	float		*origin, *angles;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+	clip = data;
+	if ( clip->trace.allsolid ) {
+		return qfalse;
+	}
+	touch = SV_GentityNum( entityNum );
 
+	// see if we should ignore this entity
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
-		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
-		if ( passOwnerNum == ENTITYNUM_NONE ) {
-			passOwnerNum = -1;
+		if ( entityNum == clip->passEntityNum ) {
+			return qtrue;	// don't clip against the pass entity
 		}
-	} else {
-		passOwnerNum = -1;
+		if ( touch->r.ownerNum == clip->passEntityNum ) {
+			return qtrue;	// don't clip against own missiles
+		}
+		if ( touch->r.ownerNum == clip->passOwnerNum ) {
+			return qtrue;	// don't clip against other missiles from our owner
+		}
+	}
+
+	// if it doesn't have any brushes of a type we
+	// are looking for, ignore it
+	if ( ! ( clip->contentmask & touch->r.contents ) ) {
+		return qtrue;
+	}
+
+	// might intersect, so do an exact clip
+	clipHandle = SV_ClipHandleForEntity (touch);
+
+	origin = touch->r.currentOrigin;
+	angles = touch->r.currentAngles;
+
+
+	if ( !touch->r.bmodel ) {
+		angles = vec3_origin;	// boxes don't rotate
+	}
+
+	CM_TransformedBoxTrace ( &trace, (float *)clip->start, (float *)clip->end,
+		(float *)clip->mins, (float *)clip->maxs, clipHandle,  clip->contentmask,
+		origin, angles, clip->capsule);
+
+	if ( trace.allsolid ) {
+		clip->trace.allsolid = qtrue;
+		trace.entityNum = touch->s.number;
+	} else if ( trace.startsolid ) {
+		clip->trace.startsolid = qtrue;
+		trace.entityNum = touch->s.number;
+	}
+
+	if ( trace.fraction < clip->trace.fraction ) {
+		qboolean	oldStart;
+
+		// make sure we keep a startsolid from a previous trace
+		oldStart = clip->trace.startsolid;
+
+		trace.entityNum = touch->s.number;
+		clip->trace = trace;
+		clip->trace.startsolid |= oldStart;
+	}
+	return qtrue;
+}
+
+
+/*
+====================
+SV_ClipMoveToEntities
+
+====================
+*/
+void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	int			i, num;
+	int			touchlist[MAX_GENTITIES];
+
+	// the AABB tree clips as it finds them, without a list
+	if ( SV_UseBroadphase() ) {
+		SV_BroadphaseQuery( clip->boxmins, clip->boxmaxs, SV_ClipMoveToEntity, clip );
+		return;
 	}
 
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
 	for ( i=0 ; i<num ; i++ ) {
-		if ( clip->trace.allsolid ) {
+		if ( !SV_ClipMoveToEntity( touchlist[i], clip ) ) {
 			return;
 		}
-		touch = SV_GentityNum( touchlist[i] );
+	}
+}
 
-		// see if we should ignore this entity
-		if ( clip->passEntityNum != ENTITYNUM_NONE ) {
-			if ( touchlist[i] == clip->passEntityNum ) {
-				continue;	// don't clip against the pass entity
-			}
-			if ( touch->r.ownerNum == clip->passEntityNum ) {
-				continue;	// don't clip against own missiles
-			}
-			if ( touch->r.ownerNum == passOwnerNum ) {
-				continue;	// don't clip against other missiles from our owner
-			}
+
+/*
+==================
+SV_SetupMoveClip
+==================
+*/
+static void SV_SetupMoveClip( moveclip_t *clip, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
+	int			i;
+
+	Com_Memset ( clip, 0, sizeof ( moveclip_t ) );
+
+	clip->contentmask = contentmask;
+	clip->start = start;
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
+
+	if ( passEntityNum != ENTITYNUM_NONE ) {
+		clip->passOwnerNum = ( SV_GentityNum( passEntityNum ) )->r.ownerNum;
+		if ( clip->passOwnerNum == ENTITYNUM_NONE ) {
+			clip->passOwnerNum = -1;
 		}
+	} else {
+		clip->passOwnerNum = -1;
+	}
 
-		// if it doesn't have any brushes of a type we
-		// are looking for, ignore it
-		if ( ! ( clip->contentmask & touch->r.contents ) ) {
-			continue;
+	// create the bounding box of the entire move
+	// we can limit it to the part of the move not
+	// already clipped off by the world, which can be
+	// a significant savings for line of sight and shot traces
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			clip->boxmins[i] = clip->start[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->end[i] + clip->maxs[i] + 1;
+		} else {
+			clip->boxmins[i] = clip->end[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->start[i] + clip->maxs[i] + 1;
 		}
+	}
+}
 
-		// might intersect, so do an exact clip
-		clipHandle = SV_ClipHandleForEntity (touch);
 
-		origin = touch->r.currentOrigin;
-		angles = touch->r.currentAngles;
+/*
+============================================================================
 
+WORLD TRACE CACHE
 
-		if ( !touch->r.bmodel ) {
-			angles = vec3_origin;	// boxes don't rotate
-		}
+Player movement and the bots repeat the same world traces and point
+contents many times in a frame.  With sv_traceCache set, the world part of
+those is remembered until the next game frame, a map change or an area
+portal change.  Queries only match on the exact bits of their arguments,
+so a cached result is the one CM_BoxTrace would have returned.
+============================================================================
+*/
 
-		CM_TransformedBoxTrace ( &trace, (float *)clip->start, (float *)clip->end,
-			(float *)clip->mins, (float *)clip->maxs, clipHandle,  clip->contentmask,
-			origin, angles, clip->capsule);
+#define	TRACECACHE_SIZE		4096		// power of two
+#define	TRACECACHE_POINTS	1024		// power of two
+#define	TRACECACHE_PROBES	4
 
-		if ( trace.allsolid ) {
-			clip->trace.allsolid = qtrue;
-			trace.entityNum = touch->s.number;
-		} else if ( trace.startsolid ) {
-			clip->trace.startsolid = qtrue;
-			trace.entityNum = touch->s.number;
-		}
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int			contentmask;
+	int			capsule;
+} traceKey_t;
+
+typedef struct {
+	int			generation;
+	traceKey_t	key;
+	trace_t		trace;
+} cachedTrace_t;
+
+typedef struct {
+	int			generation;
+	vec3_t		point;
+	int			contents;
+} cachedContents_t;
+
+typedef struct {
+	int			traces, traceHits, traceEvictions;
+	int			points, pointHits;
+	int			invalidations;
+} traceCacheStats_t;
+
+static cachedTrace_t		*sv_cachedTraces;
+static cachedContents_t		*sv_cachedContents;
+static int					sv_traceCacheGeneration = 1;
+static traceCacheStats_t	sv_traceCacheStats;
 
-		if ( trace.fraction < clip->trace.fraction ) {
-			qboolean	oldStart;
+/*
+==================
+SV_TraceCacheInvalidate
 
-			// make sure we keep a startsolid from a previous trace
-			oldStart = clip->trace.startsolid;
+Forgets every cached result
+==================
+*/
+void SV_TraceCacheInvalidate( void ) {
+	sv_traceCacheGeneration++;
+	sv_traceCacheStats.invalidations++;
+}
 
-			trace.entityNum = touch->s.number;
-			clip->trace = trace;
-			clip->trace.startsolid |= oldStart;
+/*
+==================
+SV_TraceCacheHash
+==================
+*/
+static unsigned int SV_TraceCacheHash( const void *key, int size ) {
+	const unsigned int	*words;
+	unsigned int		hash;
+	int					i;
+
+	words = key;
+	hash = 2166136261u;
+	for ( i = 0 ; i < size / 4 ; i++ ) {
+		hash = ( hash ^ words[i] ) * 16777619u;
+	}
+	return hash ^ ( hash >> 15 );
+}
+
+/*
+==================
+SV_TraceCacheEnabled
+==================
+*/
+static qboolean SV_TraceCacheEnabled( void ) {
+	if ( !sv_traceCache->integer ) {
+		return qfalse;
+	}
+	if ( !sv_cachedTraces ) {
+		sv_cachedTraces = Z_Malloc( TRACECACHE_SIZE * sizeof( *sv_cachedTraces ) );
+		sv_cachedContents = Z_Malloc( TRACECACHE_POINTS * sizeof( *sv_cachedContents ) );
+	}
+	return qtrue;
+}
+
+/*
+==================
+SV_ClipMoveToWorld
+
+CM_BoxTrace against the world model, through the cache if it's on
+==================
+*/
+static void SV_ClipMoveToWorld( trace_t *trace, const vec3_t start, vec3_t mins, vec3_t maxs,
+							   const vec3_t end, int contentmask, int capsule ) {
+	traceKey_t		key;
+	cachedTrace_t	*entry, *slot;
+	unsigned int	hash;
+	int				i;
+
+	if ( !SV_TraceCacheEnabled() ) {
+		CM_BoxTrace( trace, start, end, mins, maxs, 0, contentmask, capsule );
+		return;
+	}
+
+	// one block to hash and compare
+	Com_Memset( &key, 0, sizeof( key ) );
+	VectorCopy( start, key.start );
+	VectorCopy( end, key.end );
+	VectorCopy( mins, key.mins );
+	VectorCopy( maxs, key.maxs );
+	key.contentmask = contentmask;
+	key.capsule = capsule;
+
+	sv_traceCacheStats.traces++;
+	hash = SV_TraceCacheHash( &key, sizeof( key ) );
+	slot = NULL;
+	for ( i = 0 ; i < TRACECACHE_PROBES ; i++ ) {
+		entry = &sv_cachedTraces[( hash + i ) & ( TRACECACHE_SIZE - 1 )];
+		if ( entry->generation != sv_traceCacheGeneration ) {
+			if ( !slot ) {
+				slot = entry;
+			}
+			continue;
 		}
+		if ( !memcmp( &entry->key, &key, sizeof( key ) ) ) {
+			sv_traceCacheStats.traceHits++;
+			*trace = entry->trace;
+			return;
+		}
+	}
+
+	CM_BoxTrace( trace, start, end, mins, maxs, 0, contentmask, capsule );
+
+	if ( !slot ) {
+		slot = &sv_cachedTraces[hash & ( TRACECACHE_SIZE - 1 )];
+		sv_traceCacheStats.traceEvictions++;
+	}
+	slot->generation = sv_traceCacheGeneration;
+	slot->key = key;
+	slot->trace = *trace;
+}
+
+/*
+==================
+SV_WorldPointContents
+
+CM_PointContents of the world model, through the cache if it's on
+==================
+*/
+static int SV_WorldPointContents( const vec3_t p ) {
+	cachedContents_t	*entry;
+	vec3_t				point;
+
+	if ( !SV_TraceCacheEnabled() ) {
+		return CM_PointContents( p, 0 );
+	}
+
+	VectorCopy( p, point );
+	sv_traceCacheStats.points++;
+	entry = &sv_cachedContents[SV_TraceCacheHash( point, sizeof( point ) ) & ( TRACECACHE_POINTS - 1 )];
+	if ( entry->generation == sv_traceCacheGeneration && !memcmp( entry->point, point, sizeof( point ) ) ) {
+		sv_traceCacheStats.pointHits++;
+		return entry->contents;
+	}
+
+	entry->generation = sv_traceCacheGeneration;
+	VectorCopy( point, entry->point );
+	entry->contents = CM_PointContents( p, 0 );
+	return entry->contents;
+}
+
+/*
+==================
+SV_TraceCache_f
+
+tracecache [reset]
+==================
+*/
+void SV_TraceCache_f( void ) {
+	traceCacheStats_t	*s;
+
+	s = &sv_traceCacheStats;
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		Com_Memset( s, 0, sizeof( *s ) );
+		return;
+	}
+
+	if ( !sv_traceCache->integer ) {
+		Com_Printf( "sv_traceCache is off\n" );
 	}
+	Com_Printf( "world traces    %9i, %9i hits (%.1f%%), %i evicted\n", s->traces, s->traceHits,
+		s->traces ? s->traceHits * 100.0 / s->traces : 0.0, s->traceEvictions );
+	Com_Printf( "point contents  %9i, %9i hits (%.1f%%)\n", s->points, s->pointHits,
+		s->points ? s->pointHits * 100.0 / s->points : 0.0 );
+	Com_Printf( "invalidations   %9i\n", s->invalidations );
 }
 
 
@@ -599,7 +1014,6 @@ passEntityNum and entities owned by passEntityNum are explicitly not checked.
 */
 void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
 	moveclip_t	clip;
-	int			i;
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -608,43 +1022,121 @@ void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, c
 		maxs = vec3_origin;
 	}
 
-	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
+	if ( sv_traceRecording ) {
+		SV_RecordTrace( start, mins, maxs, end, passEntityNum, contentmask, capsule );
+	}
+
+	SV_SetupMoveClip( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule );
 
 	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, capsule );
+	SV_ClipMoveToWorld( &clip.trace, start, mins, maxs, end, contentmask, capsule );
 	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
 	if ( clip.trace.fraction == 0 ) {
 		*results = clip.trace;
 		return;		// blocked immediately by the world
 	}
 
-	clip.contentmask = contentmask;
-	clip.start = start;
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+	// clip to other solid entities
+	SV_ClipMoveToEntities ( &clip );
 
-	// create the bounding box of the entire move
-	// we can limit it to the part of the move not
-	// already clipped off by the world, which can be
-	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
-		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+	*results = clip.trace;
+}
+
+
+/*
+==================
+SV_EntityTouchesBox
+
+The exact box test of whichever broadphase is in use
+==================
+*/
+static qboolean SV_EntityTouchesBox( int entityNum, const vec3_t mins, const vec3_t maxs ) {
+	const float		*absmin, *absmax;
+	sharedEntity_t	*gcheck;
+
+	if ( SV_UseBroadphase() ) {
+		absmin = SV_BroadphaseBounds( entityNum );
+		absmax = absmin + 3;
+	} else {
+		gcheck = SV_GentityNum( entityNum );
+		absmin = gcheck->r.absmin;
+		absmax = gcheck->r.absmax;
+	}
+
+	if ( absmin[0] > maxs[0] || absmin[1] > maxs[1] || absmin[2] > maxs[2]
+		|| absmax[0] < mins[0] || absmax[1] < mins[1] || absmax[2] < mins[2] ) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+
+/*
+==================
+SV_TraceBatch
+
+Runs count traces with the same results as count SV_Trace calls.  The
+entities along all the moves are looked up once, and every trace clips
+against the ones its own move box touches.  Both broadphases find those
+in the same order a query with just that box would.
+==================
+*/
+void SV_TraceBatch( gameTrace_t *traces, int count ) {
+	moveclip_t		clip;
+	gameTrace_t		*t;
+	vec3_t			mins, maxs;
+	int				candidates[MAX_GENTITIES];
+	int				i, j, k, num;
+	qboolean		pending;
+
+	// the world first, and the box around every move it lets through
+	pending = qfalse;
+	for ( i = 0, t = traces ; i < count ; i++, t++ ) {
+		if ( sv_traceRecording ) {
+			SV_RecordTrace( t->start, t->mins, t->maxs, t->end, t->passEntityNum, t->contentmask, t->capsule );
 		}
+
+		SV_ClipMoveToWorld( &t->results, t->start, t->mins, t->maxs, t->end, t->contentmask, t->capsule );
+		t->results.entityNum = t->results.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+		if ( t->results.fraction == 0 ) {
+			continue;		// blocked immediately by the world
+		}
+
+		SV_SetupMoveClip( &clip, t->start, t->mins, t->maxs, t->end, t->passEntityNum, t->contentmask, t->capsule );
+		for ( k = 0 ; k < 3 ; k++ ) {
+			if ( !pending || clip.boxmins[k] < mins[k] ) {
+				mins[k] = clip.boxmins[k];
+			}
+			if ( !pending || clip.boxmaxs[k] > maxs[k] ) {
+				maxs[k] = clip.boxmaxs[k];
+			}
+		}
+		pending = qtrue;
 	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+	if ( !pending ) {
+		return;
+	}
 
-	*results = clip.trace;
+	num = SV_AreaEntities( mins, maxs, candidates, MAX_GENTITIES );
+
+	for ( i = 0, t = traces ; i < count ; i++, t++ ) {
+		if ( t->results.fraction == 0 ) {
+			continue;
+		}
+
+		SV_SetupMoveClip( &clip, t->start, t->mins, t->maxs, t->end, t->passEntityNum, t->contentmask, t->capsule );
+		clip.trace = t->results;
+		for ( j = 0 ; j < num ; j++ ) {
+			if ( !SV_EntityTouchesBox( candidates[j], clip.boxmins, clip.boxmaxs ) ) {
+				continue;
+			}
+			if ( !SV_ClipMoveToEntity( candidates[j], &clip ) ) {
+				break;
+			}
+		}
+		t->results = clip.trace;
+	}
 }
 
 
@@ -663,7 +1155,7 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 	float		*angles;
 
 	// get base contents from world
-	contents = CM_PointContents( p, 0 );
+	contents = SV_WorldPointContents( p );
 
 	// or in contents from all the other entities
 	num = SV_AreaEntities( p, p, touch, MAX_GENTITIES );
@@ -689,3 +1181,191 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 }
 
 
+/*
+===============================================================================
+
+TRACE BENCHMARK
+
+"tracebench record <frames>" keeps the SV_Trace calls the game makes over
+the next frames.  "tracebench" then replays them against the entities as
+they are at that point, once with the sector tree and once with the AABB
+tree, and compares the times and the results.
+
+===============================================================================
+*/
+
+#define	TRACEBENCH_MAX		32768
+#define	TRACEBENCH_PASSES	4
+
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+} recordedTrace_t;
+
+static recordedTrace_t	*sv_recordedTraces;
+static int				sv_numRecordedTraces;
+static int				sv_recordFrames;		// frames left to record
+static int				sv_recordTime;			// sv.time of the frame being recorded
+
+/*
+===============
+SV_RecordTrace
+===============
+*/
+static void SV_RecordTrace( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end,
+						   int passEntityNum, int contentmask, int capsule ) {
+	recordedTrace_t	*rec;
+
+	if ( sv.time != sv_recordTime ) {
+		sv_recordTime = sv.time;
+		if ( !sv_recordFrames-- || sv_numRecordedTraces == TRACEBENCH_MAX ) {
+			sv_traceRecording = qfalse;
+			Com_Printf( "tracebench: recorded %i traces\n", sv_numRecordedTraces );
+			return;
+		}
+	}
+	if ( sv_numRecordedTraces == TRACEBENCH_MAX ) {
+		return;
+	}
+
+	rec = &sv_recordedTraces[sv_numRecordedTraces++];
+	VectorCopy( start, rec->start );
+	VectorCopy( end, rec->end );
+	VectorCopy( mins, rec->mins );
+	VectorCopy( maxs, rec->maxs );
+	rec->passEntityNum = passEntityNum;
+	rec->contentmask = contentmask;
+	rec->capsule = capsule;
+}
+
+/*
+===============
+SV_ReplayTraces
+
+Returns the microseconds for all the passes.  The first pass results are
+stored in results, or compared with them if compare is set.
+===============
+*/
+static unsigned int SV_ReplayTraces( trace_t *results, qboolean compare, int *mismatches ) {
+	recordedTrace_t	*rec;
+	trace_t			trace;
+	unsigned int	start;
+	int				i, pass;
+
+	start = Sys_Microseconds();
+	for ( pass = 0 ; pass < TRACEBENCH_PASSES ; pass++ ) {
+		// every pass is a new frame to the trace cache
+		SV_TraceCacheInvalidate();
+		for ( i = 0, rec = sv_recordedTraces ; i < sv_numRecordedTraces ; i++, rec++ ) {
+			SV_Trace( &trace, rec->start, rec->mins, rec->maxs, rec->end,
+				rec->passEntityNum, rec->contentmask, rec->capsule );
+			if ( pass ) {
+				continue;
+			}
+			if ( !compare ) {
+				results[i] = trace;
+			} else if ( trace.fraction != results[i].fraction || trace.entityNum != results[i].entityNum
+				|| trace.allsolid != results[i].allsolid ) {
+				( *mismatches )++;
+			}
+		}
+	}
+	return Sys_Microseconds() - start;
+}
+
+/*
+===============
+SV_ReplayAreaEntities
+
+Microseconds to look up the entities along every recorded move
+===============
+*/
+static unsigned int SV_ReplayAreaEntities( int *found ) {
+	recordedTrace_t	*rec;
+	vec3_t			mins, maxs;
+	int				touchlist[MAX_GENTITIES];
+	unsigned int	start;
+	int				i, j, pass;
+
+	*found = 0;
+	start = Sys_Microseconds();
+	for ( pass = 0 ; pass < TRACEBENCH_PASSES ; pass++ ) {
+		for ( i = 0, rec = sv_recordedTraces ; i < sv_numRecordedTraces ; i++, rec++ ) {
+			for ( j = 0 ; j < 3 ; j++ ) {
+				if ( rec->end[j] > rec->start[j] ) {
+					mins[j] = rec->start[j] + rec->mins[j] - 1;
+					maxs[j] = rec->end[j] + rec->maxs[j] + 1;
+				} else {
+					mins[j] = rec->end[j] + rec->mins[j] - 1;
+					maxs[j] = rec->start[j] + rec->maxs[j] + 1;
+				}
+			}
+			*found += SV_AreaEntities( mins, maxs, touchlist, MAX_GENTITIES );
+		}
+	}
+	return Sys_Microseconds() - start;
+}
+
+/*
+===============
+SV_TraceBench_f
+
+tracebench [record <frames>]
+===============
+*/
+void SV_TraceBench_f( void ) {
+	trace_t			*results;
+	unsigned int	usec[2], areaUsec[2];
+	int				found[2];
+	int				i, mismatches, count;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "record" ) ) {
+		if ( !sv_recordedTraces ) {
+			sv_recordedTraces = Z_Malloc( TRACEBENCH_MAX * sizeof( *sv_recordedTraces ) );
+		}
+		sv_numRecordedTraces = 0;
+		sv_recordFrames = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 20;
+		sv_recordTime = sv.time;
+		sv_traceRecording = qtrue;
+		Com_Printf( "tracebench: recording %i frames\n", sv_recordFrames );
+		return;
+	}
+
+	if ( sv_traceRecording ) {
+		Com_Printf( "tracebench: still recording, %i traces so far\n", sv_numRecordedTraces );
+		return;
+	}
+	if ( !sv_numRecordedTraces ) {
+		Com_Printf( "tracebench: nothing recorded, use tracebench record <frames>\n" );
+		return;
+	}
+
+	count = sv_numRecordedTraces * TRACEBENCH_PASSES;
+	results = Z_Malloc( sv_numRecordedTraces * sizeof( *results ) );
+	mismatches = 0;
+
+	for ( i = 0 ; i < 2 ; i++ ) {
+		sv_forcedBroadphase = i;
+		usec[i] = SV_ReplayTraces( results, i, &mismatches );
+		areaUsec[i] = SV_ReplayAreaEntities( &found[i] );
+	}
+	sv_forcedBroadphase = -1;
+
+	Z_Free( results );
+
+	Com_Printf( "%i traces, %i passes\n", sv_numRecordedTraces, TRACEBENCH_PASSES );
+	Com_Printf( "             trace ns  area ns  entities\n" );
+	Com_Printf( "sector tree  %8i %8i %9i\n", (int)( usec[0] * 1000.0 / count ),
+		(int)( areaUsec[0] * 1000.0 / count ), found[0] / TRACEBENCH_PASSES );
+	Com_Printf( "aabb tree    %8i %8i %9i\n", (int)( usec[1] * 1000.0 / count ),
+		(int)( areaUsec[1] * 1000.0 / count ), found[1] / TRACEBENCH_PASSES );
+	Com_Printf( "%i traces with different results\n", mismatches );
+}
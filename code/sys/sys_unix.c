@@ -20,6 +20,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
 
+#ifdef __linux__
+// REG_RIP and REG_EIP in ucontext.h are GNU extensions
+#define _GNU_SOURCE
+#endif
+
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
 #include "sys_local.h"
@@ -30,8 +35,12 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <stdio.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
+#include <signal.h>
+#include <ucontext.h>
 #include <pwd.h>
 #include <libgen.h>
 
@@ -104,6 +113,116 @@ int Sys_Milliseconds (void)
 	return curtime;
 }
 
+/*
+================
+Sys_Microseconds
+================
+*/
+unsigned int Sys_Microseconds( void )
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (unsigned int)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+#else
+	struct timeval tp;
+
+	gettimeofday( &tp, NULL );
+
+	return (unsigned int)tp.tv_sec * 1000000u + tp.tv_usec;
+#endif
+}
+
+/*
+=============================================================================
+
+Sampling profile timer
+
+SIGPROF fires every interval of process cpu time and hands the interrupted
+program counter to the sample callback, inside the signal handler, so the
+callback may only count things.
+
+=============================================================================
+*/
+
+static void	(*profileSample)( void *pc );
+
+/*
+================
+Sys_ProfileSignal
+================
+*/
+static void Sys_ProfileSignal( int signum, siginfo_t *info, void *context )
+{
+	void	*pc = NULL;
+
+#if defined( __linux__ ) && defined( __x86_64__ )
+	pc = (void *)( (ucontext_t *)context )->uc_mcontext.gregs[ REG_RIP ];
+#elif defined( __linux__ ) && defined( __i386__ )
+	pc = (void *)( (ucontext_t *)context )->uc_mcontext.gregs[ REG_EIP ];
+#endif
+
+	if( profileSample )
+		profileSample( pc );
+}
+
+/*
+================
+Sys_StartProfileTimer
+================
+*/
+qboolean Sys_StartProfileTimer( int hz, void (*sample)( void *pc ) )
+{
+	struct sigaction	sa;
+	struct itimerval	timer;
+
+	if( hz <= 0 || hz > 1000000 )
+		return qfalse;
+
+	profileSample = sample;
+
+	memset( &sa, 0, sizeof( sa ) );
+	sa.sa_sigaction = Sys_ProfileSignal;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset( &sa.sa_mask );
+	if( sigaction( SIGPROF, &sa, NULL ) == -1 )
+	{
+		profileSample = NULL;
+		return qfalse;
+	}
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	if( setitimer( ITIMER_PROF, &timer, NULL ) == -1 )
+	{
+		signal( SIGPROF, SIG_IGN );
+		profileSample = NULL;
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+================
+Sys_StopProfileTimer
+================
+*/
+void Sys_StopProfileTimer( void )
+{
+	struct itimerval	timer;
+
+	memset( &timer, 0, sizeof( timer ) );
+	setitimer( ITIMER_PROF, &timer, NULL );
+
+	// a signal already on its way is dropped instead of counted late
+	signal( SIGPROF, SIG_IGN );
+	profileSample = NULL;
+}
+
 #if !id386
 /*
 ==================
@@ -221,6 +340,68 @@ void Sys_Mkdir( const char *path )
 	mkdir( path, 0777 );
 }
 
+/*
+==================
+Sys_FileStat
+
+Size and modification time of a file, qfalse if it can't be found
+==================
+*/
+qboolean Sys_FileStat( const char *path, int *size, int *mtime )
+{
+	struct stat st;
+
+	if( stat( path, &st ) == -1 || !S_ISREG( st.st_mode ) )
+		return qfalse;
+
+	*size = (int)st.st_size;
+	*mtime = (int)st.st_mtime;
+	return qtrue;
+}
+
+/*
+==================
+Sys_MapFile
+
+Maps a whole file read only, NULL if it can't be mapped
+==================
+*/
+void *Sys_MapFile( const char *path, int *length )
+{
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open( path, O_RDONLY );
+	if( fd == -1 )
+		return NULL;
+
+	if( fstat( fd, &st ) == -1 || !S_ISREG( st.st_mode ) ||
+		st.st_size <= 0 || st.st_size > 0x7fffffff )
+	{
+		close( fd );
+		return NULL;
+	}
+
+	base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( base == MAP_FAILED )
+		return NULL;
+
+	*length = (int)st.st_size;
+	return base;
+}
+
+/*
+==================
+Sys_UnmapFile
+==================
+*/
+void Sys_UnmapFile( void *base, int length )
+{
+	munmap( base, length );
+}
+
 /*
 ==================
 Sys_Cwd
@@ -32,6 +32,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <fcntl.h>
 #include <stdio.h>
 #include <direct.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <io.h>
 #include <conio.h>
 #include <wincrypt.h>
@@ -70,6 +72,122 @@ int Sys_Milliseconds (void)
 	return sys_curtime;
 }
 
+/*
+================
+Sys_Microseconds
+================
+*/
+unsigned int Sys_Microseconds( void )
+{
+	static LARGE_INTEGER	frequency;
+	LARGE_INTEGER			count;
+
+	if ( !frequency.QuadPart ) {
+		QueryPerformanceFrequency( &frequency );
+	}
+	QueryPerformanceCounter( &count );
+
+	// split so the multiply can't overflow on long uptimes
+	return (unsigned int)( count.QuadPart / frequency.QuadPart * 1000000 +
+		count.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart );
+}
+
+/*
+=============================================================================
+
+Sampling profile timer
+
+Windows has no SIGPROF, so a thread wakes up every interval, suspends the
+thread that started the timer and hands its program counter to the sample
+callback.  The intervals are wall clock time, not cpu time.
+
+=============================================================================
+*/
+
+static void				(*profileSample)( void *pc );
+static HANDLE			profileThread;
+static HANDLE			profileTarget;
+static DWORD			profileInterval;
+static volatile LONG	profileRunning;
+
+/*
+================
+Sys_ProfileThread
+================
+*/
+static DWORD WINAPI Sys_ProfileThread( LPVOID param )
+{
+	CONTEXT	context;
+
+	while( profileRunning )
+	{
+		Sleep( profileInterval );
+
+		if( SuspendThread( profileTarget ) == (DWORD)-1 )
+			continue;
+
+		context.ContextFlags = CONTEXT_CONTROL;
+		if( GetThreadContext( profileTarget, &context ) )
+		{
+#ifdef _WIN64
+			profileSample( (void *)context.Rip );
+#else
+			profileSample( (void *)context.Eip );
+#endif
+		}
+
+		ResumeThread( profileTarget );
+	}
+
+	return 0;
+}
+
+/*
+================
+Sys_StartProfileTimer
+================
+*/
+qboolean Sys_StartProfileTimer( int hz, void (*sample)( void *pc ) )
+{
+	if( hz <= 0 || profileRunning )
+		return qfalse;
+
+	if( !DuplicateHandle( GetCurrentProcess( ), GetCurrentThread( ), GetCurrentProcess( ),
+		&profileTarget, THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, 0 ) )
+		return qfalse;
+
+	profileSample = sample;
+	profileInterval = hz < 1000 ? 1000 / hz : 1;
+	profileRunning = 1;
+
+	profileThread = CreateThread( NULL, 0, Sys_ProfileThread, NULL, 0, NULL );
+	if( !profileThread )
+	{
+		profileRunning = 0;
+		CloseHandle( profileTarget );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+================
+Sys_StopProfileTimer
+================
+*/
+void Sys_StopProfileTimer( void )
+{
+	if( !profileRunning )
+		return;
+
+	profileRunning = 0;
+	WaitForSingleObject( profileThread, INFINITE );
+	CloseHandle( profileThread );
+	CloseHandle( profileTarget );
+	profileSample = NULL;
+}
+
 #ifndef __GNUC__ //see snapvectora.s
 /*
 ================
@@ -244,6 +362,75 @@ void Sys_Mkdir( const char *path )
 	_mkdir (path);
 }
 
+/*
+==============
+Sys_FileStat
+
+Size and modification time of a file, qfalse if it can't be found
+==============
+*/
+qboolean Sys_FileStat( const char *path, int *size, int *mtime )
+{
+	struct _stat st;
+
+	if( _stat( path, &st ) == -1 || !( st.st_mode & _S_IFREG ) )
+		return qfalse;
+
+	*size = (int)st.st_size;
+	*mtime = (int)st.st_mtime;
+	return qtrue;
+}
+
+/*
+==============
+Sys_MapFile
+
+Maps a whole file read only, NULL if it can't be mapped
+==============
+*/
+void *Sys_MapFile( const char *path, int *length )
+{
+	HANDLE	file, mapping;
+	DWORD	size, sizeHigh;
+	void	*base;
+
+	file = CreateFile( path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	size = GetFileSize( file, &sizeHigh );
+	if( size == INVALID_FILE_SIZE || sizeHigh || size == 0 || size > 0x7fffffff )
+	{
+		CloseHandle( file );
+		return NULL;
+	}
+
+	// the view keeps the file open, the handles aren't needed after this
+	mapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	if( !mapping )
+		return NULL;
+
+	base = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	if( !base )
+		return NULL;
+
+	*length = (int)size;
+	return base;
+}
+
+/*
+==============
+Sys_UnmapFile
+==============
+*/
+void Sys_UnmapFile( void *base, int length )
+{
+	UnmapViewOfFile( base );
+}
+
 /*
 ==============
 Sys_Cwd